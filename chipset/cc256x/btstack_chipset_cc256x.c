@@ -79,10 +79,22 @@
 
 #include "btstack_control.h"
 
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+#if !defined(HAVE_POSIX_FILE_IO) || defined(_WIN32)
+#error "ENABLE_CC256X_INIT_SCRIPT_FILE requires HAVE_POSIX_FILE_IO and mmap"
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hci.h"    /* HCI_OUTGOING_PRE_BUFFER_SIZE */
+#endif
 
+#ifndef ENABLE_CC256X_INIT_SCRIPT_FILE
 // default init script provided by separate .c file
 extern const uint8_t  cc256x_init_script[];
 extern const uint32_t cc256x_init_script_size;
+#endif
 
 // custom init script set by btstack_chipset_cc256x_set_init_script
 // used to select init scripts before each power up
@@ -99,6 +111,32 @@ static int16_t    init_power_in_dB    = 13; // 13 dBm
 // upload position
 static uint32_t   init_script_offset  = 0;
 
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+
+// .bts file format: 32 byte header followed by actions with 16-bit type, 16-bit size, and data
+#define BTS_HEADER_SIZE 32
+#define BTS_ACTION_HEADER_SIZE 4
+#define BTS_ACTION_SEND_COMMAND 1
+#define BTS_ACTION_SERIAL_PORT_PARAMETERS 3
+
+#define BTS_MAX_FILES 2
+
+// .bts files set by btstack_chipset_cc256x_set_bts_files: main script and optional add-on, e.g. ble_add_on.bts
+static const char * bts_file_paths[BTS_MAX_FILES];
+
+// files are mapped during init script upload and commands are sent directly from the mapping
+static uint8_t  * bts_file_data[BTS_MAX_FILES];
+static uint32_t   bts_file_size[BTS_MAX_FILES];
+static uint32_t   bts_file_mtime[BTS_MAX_FILES];
+static int        bts_file_index;
+static int        bts_have_sleep_mode_configuration;
+
+// HCI_VS_Sleep_Mode_Configurations 0xFD0C template, used if not provided by .bts file
+static const uint8_t hci_vs_sleep_mode_configurations[] = {
+    0x0c, 0xfd, 9 , 1, 0, 0,  0xff, 0xff, 0xff, 0xff, 100, 0
+};
+#endif
+
 // support for SCO over HCI
 #ifdef ENABLE_SCO_OVER_HCI
 static int      init_send_route_sco_over_hci = 0;
@@ -159,11 +197,80 @@ static const uint8_t hci_route_sco_over_hci[] = {
 };
 #endif
 
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+static void chipset_bts_files_unmap(void){
+    int i;
+    for (i=0;i<BTS_MAX_FILES;i++){
+        if (bts_file_data[i] == NULL) continue;
+        munmap(bts_file_data[i], bts_file_size[i]);
+        bts_file_data[i] = NULL;
+        bts_file_size[i] = 0;
+        bts_file_mtime[i] = 0;
+    }
+}
+
+static int chipset_bts_file_map(int index){
+    const char * path = bts_file_paths[index];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        log_error("cc256x: can't open file %s", path);
+        return -1;
+    }
+    struct stat file_stat;
+    if ((fstat(fd, &file_stat) < 0) || (file_stat.st_size < BTS_HEADER_SIZE)){
+        log_error("cc256x: invalid file %s", path);
+        close(fd);
+        return -1;
+    }
+    // private writable mapping: power commands are updated in place and HCI transport stores packet type before command
+    void * data = mmap(NULL, (size_t) file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED){
+        log_error("cc256x: can't map file %s", path);
+        return -1;
+    }
+    if (memcmp(data, "BTSB", 4) != 0){
+        log_error("cc256x: %s is not a .bts file", path);
+        munmap(data, (size_t) file_stat.st_size);
+        return -1;
+    }
+    bts_file_data[index] = (uint8_t *) data;
+    bts_file_size[index] = (uint32_t) file_stat.st_size;
+    bts_file_mtime[index] = (uint32_t) file_stat.st_mtime;
+    log_info("cc256x: mapped %s, size %u", path, bts_file_size[index]);
+    return 0;
+}
+#endif
+
 static void chipset_init(const void * config){
     init_script_offset = 0;
 #if defined(__GNUC__) && defined(__MSP430X__) && (__MSP430X__ > 0)
     // On MSP430, custom init script is not supported
     init_script_size = cc256x_init_script_size;
+#elif defined(ENABLE_CC256X_INIT_SCRIPT_FILE)
+    // map files again on each power up to pick up updated files
+    chipset_bts_files_unmap();
+    bts_file_index = 0;
+    bts_have_sleep_mode_configuration = 0;
+    init_script      = custom_init_script;
+    init_script_size = custom_init_script_size;
+    if (bts_file_paths[0] != NULL){
+        int i;
+        for (i=0;i<BTS_MAX_FILES;i++){
+            if (bts_file_paths[i] == NULL) break;
+            if (chipset_bts_file_map(i) < 0){
+                chipset_bts_files_unmap();
+                break;
+            }
+        }
+        // bts files replace custom init script
+        if (bts_file_data[0] != NULL){
+            init_script_size = 0;
+        }
+    }
+    if ((bts_file_data[0] == NULL) && (init_script_size == 0)){
+        log_error("cc256x: no init script");
+    }
 #else
     if (custom_init_script){
         log_info("cc256x: using custom init script");
@@ -353,6 +460,110 @@ static btstack_chipset_result_t chipset_next_command(uint8_t * hci_cmd_buffer){
     return BTSTACK_CHIPSET_VALID_COMMAND; 
 }
 
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+
+// get next command from mapped .bts files, returns NULL if all files are done
+static uint8_t * chipset_bts_files_next_command(void){
+    while (bts_file_index < BTS_MAX_FILES){
+        uint8_t * data = bts_file_data[bts_file_index];
+        uint32_t  size = bts_file_size[bts_file_index];
+        if (data == NULL) break;
+        if (init_script_offset == 0){
+            init_script_offset = BTS_HEADER_SIZE;
+        }
+        if ((init_script_offset + BTS_ACTION_HEADER_SIZE) > size){
+            // next file
+            bts_file_index++;
+            init_script_offset = 0;
+            continue;
+        }
+        uint16_t action_type = little_endian_read_16(data, init_script_offset);
+        uint16_t action_size = little_endian_read_16(data, init_script_offset + 2);
+        uint8_t * action_data = &data[init_script_offset + BTS_ACTION_HEADER_SIZE];
+        init_script_offset += BTS_ACTION_HEADER_SIZE + action_size;
+        if (init_script_offset > size){
+            log_error("cc256x: %s truncated", bts_file_paths[bts_file_index]);
+            bts_file_index++;
+            init_script_offset = 0;
+            continue;
+        }
+
+        switch (action_type){
+            case BTS_ACTION_SEND_COMMAND:
+                // action data: packet type, opcode, parameter length, parameters
+                if ((action_size < 4) || ((4u + action_data[3]) > action_size)){
+                    log_error("cc256x: invalid command at offset %u", init_script_offset - action_size);
+                    break;
+                }
+                switch (little_endian_read_16(action_data, 1)){
+                    case 0xFF36:
+                        // baud rate is changed by HCI before the init script, see hci_transport_config_uart_t.baudrate_main
+                        log_info("cc256x: skip HCI_VS_Update_UART_HCI_Baudrate %u", little_endian_read_32(action_data, 4));
+                        continue;
+                    case 0xFD0C:
+                        bts_have_sleep_mode_configuration = 1;
+                        break;
+                    default:
+                        break;
+                }
+                return &action_data[1];
+            case BTS_ACTION_SERIAL_PORT_PARAMETERS:
+                // follows HCI_VS_Update_UART_HCI_Baudrate
+                log_info("cc256x: skip serial port parameters, baud rate %u", little_endian_read_32(action_data, 0));
+                break;
+            default:
+                // wait for event, delay, comments: each command is sent after the previous one has completed
+                break;
+        }
+    }
+    return NULL;
+}
+
+static btstack_chipset_result_t chipset_next_command_in_place(uint8_t * hci_cmd_buffer, uint8_t ** hci_cmd){
+    if (bts_file_data[0] != NULL){
+        uint8_t * command = chipset_bts_files_next_command();
+        if (command != NULL){
+#if HCI_OUTGOING_PRE_BUFFER_SIZE > 1
+            // bytes before command in mapping belong to action header, which would be overwritten
+            (void)memcpy(hci_cmd_buffer, command, 3 + command[2]);
+            command = hci_cmd_buffer;
+#endif
+            // control power commands and ehcill
+            update_init_script_command(command);
+            *hci_cmd = command;
+            return BTSTACK_CHIPSET_VALID_COMMAND;
+        }
+        // append sleep mode configuration template if missing
+        if (bts_have_sleep_mode_configuration == 0){
+            bts_have_sleep_mode_configuration = 1;
+            (void)memcpy(hci_cmd_buffer, hci_vs_sleep_mode_configurations, sizeof(hci_vs_sleep_mode_configurations));
+            update_init_script_command(hci_cmd_buffer);
+            *hci_cmd = hci_cmd_buffer;
+            return BTSTACK_CHIPSET_VALID_COMMAND;
+        }
+    }
+
+    *hci_cmd = hci_cmd_buffer;
+    btstack_chipset_result_t result = chipset_next_command(hci_cmd_buffer);
+    if (result == BTSTACK_CHIPSET_DONE){
+        chipset_bts_files_unmap();
+    }
+    return result;
+}
+#endif
+
+// init script changes the controller capabilities, e.g. the ACL buffers with the BLE add-on
+static uint32_t chipset_init_script_identity(void){
+    uint32_t identity = init_script_size;
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+    int i;
+    for (i=0;i<BTS_MAX_FILES;i++){
+        identity = (identity * 31u) + bts_file_size[i];
+        identity = (identity * 31u) + bts_file_mtime[i];
+    }
+#endif
+    return identity;
+}
 
 // MARK: public API
 void btstack_chipset_cc256x_set_power(int16_t power_in_dB){
@@ -364,12 +575,25 @@ void btstack_chipset_cc256x_set_init_script(uint8_t * data, uint32_t size){
     custom_init_script_size = size;
 }
 
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+void btstack_chipset_cc256x_set_bts_files(const char * main_path, const char * add_on_path){
+    bts_file_paths[0] = main_path;
+    bts_file_paths[1] = main_path ? add_on_path : NULL;
+}
+#endif
+
 static const btstack_chipset_t btstack_chipset_cc256x = {
     "CC256x",
     chipset_init,
     chipset_next_command,
     chipset_set_baudrate_command,
     chipset_set_bd_addr_command,
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+    chipset_next_command_in_place,
+#else
+    NULL,
+#endif
+    chipset_init_script_identity,
 };
 
 const btstack_chipset_t * btstack_chipset_cc256x_instance(void){
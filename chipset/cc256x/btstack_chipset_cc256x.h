@@ -76,6 +76,21 @@ uint16_t btstack_chipset_cc256x_lmp_subversion(void);
  */
 void btstack_chipset_cc256x_set_init_script(uint8_t * data, uint32_t size);
 
+/**
+ * Set .bts init script files to use for next power up, requires ENABLE_CC256X_INIT_SCRIPT_FILE
+ *
+ * The files are memory-mapped during init and commands are sent directly from the mapping.
+ * HCI_VS_Update_UART_HCI_Baudrate commands in the script are skipped, as the baud rate is
+ * changed before the init script, see hci_transport_config_uart_t.baudrate_main.
+ *
+ * Note: With ENABLE_CC256X_INIT_SCRIPT_FILE, no init script is compiled in and
+ *       btstack_chipset_cc256x_lmp_subversion is not available
+ *
+ * @param main_path of main .bts file, e.g. TIInit_6.12.26.bts, or NULL to use init script set by btstack_chipset_cc256x_set_init_script
+ * @param add_on_path of add-on .bts file, e.g. ble_add_on.bts, or NULL
+ */
+void btstack_chipset_cc256x_set_bts_files(const char * main_path, const char * add_on_path);
+
 #if defined __cplusplus
 }
 #endif
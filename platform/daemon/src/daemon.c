@@ -1431,6 +1431,9 @@ static void daemon_set_logging_enabled(int enabled){
             case HCI_DUMP_BLUEZ:
                 snprintf(string_buffer, sizeof(string_buffer), "%s/hci_dump.snoop", btstack_server_storage_path);
                 break;
+            case HCI_DUMP_BTSNOOP_SEGMENTS:
+                snprintf(string_buffer, sizeof(string_buffer), "%s/hci_dump.btsnoop", btstack_server_storage_path);
+                break;
             default:
                 break;
         }
@@ -59,6 +59,17 @@
 #include <unistd.h>   /* UNIX standard function definitions */
 #include <sys/types.h>
 
+#ifndef _WIN32
+#include <poll.h>
+#define HAVE_USB_POLLFDS
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/timerfd.h>
+#define HAVE_USB_TIMERFD
+#endif
+
 #include <libusb.h>
 
 #include "btstack_config.h"
@@ -73,18 +84,44 @@
 // since 1.0.22, libusb_set_option replaces libusb_set_debug
 #define libusb_set_debug(context,level) libusb_set_option(context, LIBUSB_OPTION_LOG_LEVEL, level)
 #endif
+#if LIBUSB_API_VERSION >= 0x01000104
+#define HAVE_LIBUSB_FREE_POLLFDS
+#endif
 #endif
 
 #if (USB_VENDOR_ID != 0) && (USB_PRODUCT_ID != 0)
 #define HAVE_USB_VENDOR_ID_AND_PRODUCT_ID
 #endif
 
+// default number of IN transfers, see hci_transport_usb_set_in_transfer_count
 #define ACL_IN_BUFFER_COUNT    3
 #define EVENT_IN_BUFFER_COUNT  3
+
+// max number of IN transfers, one buffer of HCI_ACL_BUFFER_SIZE each
+#ifndef HCI_TRANSPORT_USB_MAX_ACL_IN_TRANSFERS
+#define HCI_TRANSPORT_USB_MAX_ACL_IN_TRANSFERS 16
+#endif
+#ifndef HCI_TRANSPORT_USB_MAX_EVENT_IN_TRANSFERS
+#define HCI_TRANSPORT_USB_MAX_EVENT_IN_TRANSFERS 8
+#endif
 #define SCO_IN_BUFFER_COUNT   10
 
+// number of outstanding ACL OUT transfers
+#ifndef HCI_TRANSPORT_USB_ACL_OUT_BUFFER_COUNT
+#define HCI_TRANSPORT_USB_ACL_OUT_BUFFER_COUNT 4
+#endif
+#if HCI_TRANSPORT_USB_ACL_OUT_BUFFER_COUNT < 1
+#error "HCI_TRANSPORT_USB_ACL_OUT_BUFFER_COUNT must be at least 1"
+#endif
+#define ACL_OUT_BUFFER_COUNT HCI_TRANSPORT_USB_ACL_OUT_BUFFER_COUNT
+
 #define ASYNC_POLLING_INTERVAL_MS 1
 
+// max number of file descriptors provided by libusb, typically: event fd, timer fd, one per open device
+#ifndef HCI_TRANSPORT_USB_MAX_POLLFDS
+#define HCI_TRANSPORT_USB_MAX_POLLFDS 8
+#endif
+
 //
 // Bluetooth USB Transport Alternate Settings:
 //
@@ -161,9 +198,32 @@ static struct libusb_device_descriptor desc;
 static libusb_device_handle * handle;
 
 static struct libusb_transfer *command_out_transfer;
-static struct libusb_transfer *acl_out_transfer;
-static struct libusb_transfer *event_in_transfer[EVENT_IN_BUFFER_COUNT];
-static struct libusb_transfer *acl_in_transfer[ACL_IN_BUFFER_COUNT];
+static struct libusb_transfer *event_in_transfer[HCI_TRANSPORT_USB_MAX_EVENT_IN_TRANSFERS];
+static struct libusb_transfer *acl_in_transfer[HCI_TRANSPORT_USB_MAX_ACL_IN_TRANSFERS];
+
+// incoming HCI Events and ACL Packets
+static int      event_in_transfer_count = EVENT_IN_BUFFER_COUNT;
+static int      acl_in_transfer_count   = ACL_IN_BUFFER_COUNT;
+static int      event_in_transfers_posted;
+static int      acl_in_transfers_posted;
+// number of times, the last posted IN transfer completed
+static uint32_t event_in_stalls;
+static uint32_t acl_in_stalls;
+
+// outgoing ACL, transfers are submitted and completed in ring order
+static struct libusb_transfer *acl_out_transfers[ACL_OUT_BUFFER_COUNT];
+static int      acl_out_transfers_in_flight[ACL_OUT_BUFFER_COUNT];
+static int      acl_out_ring_write;  // transfer idx
+static int      acl_out_ring_read;   // transfer idx
+static int      acl_out_transfers_active;
+// packet buffer from hci.c was taken over, but HCI_EVENT_TRANSPORT_PACKET_SENT not emitted yet
+static int      acl_out_packet_sent_pending;
+static btstack_timer_source_t acl_out_packet_sent_timer;
+static int      acl_out_packet_sent_timer_active;
+#if ACL_OUT_BUFFER_COUNT > 1
+// with a single transfer, the packet buffer from hci.c is used directly
+static uint8_t  hci_acl_out_buffer[ACL_OUT_BUFFER_COUNT][HCI_ACL_BUFFER_SIZE];
+#endif
 
 #ifdef ENABLE_SCO_OVER_HCI
 
@@ -201,19 +261,28 @@ static int      sco_enabled;
 static uint8_t hci_cmd_buffer[3 + 256 + LIBUSB_CONTROL_SETUP_SIZE];
 
 // incoming buffer for HCI Events and ACL Packets
-static uint8_t hci_event_in_buffer[EVENT_IN_BUFFER_COUNT][HCI_ACL_BUFFER_SIZE]; // bigger than largest packet
-static uint8_t hci_acl_in_buffer[ACL_IN_BUFFER_COUNT][HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE]; 
+// transfers are passed to the packet handler in-place and resubmitted when it returns
+static uint8_t hci_event_in_buffer[HCI_TRANSPORT_USB_MAX_EVENT_IN_TRANSFERS][HCI_ACL_BUFFER_SIZE]; // bigger than largest packet
+static uint8_t hci_acl_in_buffer[HCI_TRANSPORT_USB_MAX_ACL_IN_TRANSFERS][HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE]; 
 
 // For (ab)use as a linked list of received packets
 static struct libusb_transfer *handle_packet;
+static struct libusb_transfer *handle_packet_tail;
 
 static int doing_pollfds;
-static int num_pollfds;
-static btstack_data_source_t * pollfd_data_sources;
 static btstack_timer_source_t usb_timer;
 static int usb_timer_active;
 
-static int usb_acl_out_active = 0;
+#ifdef HAVE_USB_POLLFDS
+static btstack_data_source_t pollfd_data_sources[HCI_TRANSPORT_USB_MAX_POLLFDS];
+static int pollfd_data_sources_in_use[HCI_TRANSPORT_USB_MAX_POLLFDS];
+// libusb timeouts need to be handled by us, as libusb doesn't provide a timer fd
+static int usb_handle_timeouts;
+#ifdef HAVE_USB_TIMERFD
+static btstack_data_source_t usb_timerfd_data_source;
+#endif
+#endif
+
 static int usb_command_active = 0;
 
 // endpoint addresses
@@ -241,6 +310,35 @@ static int sco_ring_have_space(void){
 }
 #endif
 
+static void acl_out_ring_init(void){
+    acl_out_ring_write = 0;
+    acl_out_ring_read  = 0;
+    acl_out_transfers_active = 0;
+    acl_out_packet_sent_pending = 0;
+}
+static int acl_out_ring_have_space(void){
+    return acl_out_transfers_active < ACL_OUT_BUFFER_COUNT;
+}
+
+void hci_transport_usb_set_in_transfer_count(int num_event_transfers, int num_acl_transfers){
+    if (usb_transport_open){
+        log_error("hci_transport_usb_set_in_transfer_count: transport already open");
+        return;
+    }
+    if ((num_event_transfers < 1) || (num_event_transfers > HCI_TRANSPORT_USB_MAX_EVENT_IN_TRANSFERS) ||
+        (num_acl_transfers   < 1) || (num_acl_transfers   > HCI_TRANSPORT_USB_MAX_ACL_IN_TRANSFERS)){
+        log_error("hci_transport_usb_set_in_transfer_count: invalid count %d/%d", num_event_transfers, num_acl_transfers);
+        return;
+    }
+    event_in_transfer_count = num_event_transfers;
+    acl_in_transfer_count   = num_acl_transfers;
+}
+
+void hci_transport_usb_get_in_transfer_stalls(uint32_t * num_event_in_stalls, uint32_t * num_acl_in_stalls){
+    *num_event_in_stalls = event_in_stalls;
+    *num_acl_in_stalls   = acl_in_stalls;
+}
+
 void hci_transport_usb_set_path(int len, uint8_t * port_numbers){
     if (len > USB_MAX_PATH_LEN || !port_numbers){
         log_error("hci_transport_usb_set_path: len or port numbers invalid");
@@ -260,15 +358,38 @@ static void queue_transfer(struct libusb_transfer *transfer){
     // insert first element
     if (handle_packet == NULL) {
         handle_packet = transfer;
-        return;
+    } else {
+        handle_packet_tail->user_data = transfer;
     }
+    handle_packet_tail = transfer;
+}
 
-    // Walk to end of list and add current packet there
-    struct libusb_transfer *temp = handle_packet;
-    while (temp->user_data) {
-        temp = (struct libusb_transfer*)temp->user_data;
+// track number of posted IN transfers, called for completed IN transfers
+static void usb_in_transfer_completed(struct libusb_transfer *transfer){
+    if (transfer->endpoint == event_in_addr){
+        event_in_transfers_posted--;
+        if (event_in_transfers_posted == 0){
+            event_in_stalls++;
+            log_debug("no event in transfer posted, stalls %u", event_in_stalls);
+        }
+    } else if (transfer->endpoint == acl_in_addr){
+        acl_in_transfers_posted--;
+        if (acl_in_transfers_posted == 0){
+            acl_in_stalls++;
+            log_debug("no acl in transfer posted, stalls %u", acl_in_stalls);
+        }
     }
-    temp->user_data = transfer;
+}
+
+static int usb_submit_in_transfer(struct libusb_transfer *transfer){
+    int r = libusb_submit_transfer(transfer);
+    if (r) return r;
+    if (transfer->endpoint == event_in_addr){
+        event_in_transfers_posted++;
+    } else if (transfer->endpoint == acl_in_addr){
+        acl_in_transfers_posted++;
+    }
+    return 0;
 }
 
 LIBUSB_CALL static void async_callback(struct libusb_transfer *transfer){
@@ -303,23 +424,38 @@ LIBUSB_CALL static void async_callback(struct libusb_transfer *transfer){
 #endif
 
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) {
-        for (c=0;c<EVENT_IN_BUFFER_COUNT;c++){
+        for (c=0;c<event_in_transfer_count;c++){
             if (transfer == event_in_transfer[c]){
                 libusb_free_transfer(transfer);
                 event_in_transfer[c] = 0;
                 return;
             }
         }
-        for (c=0;c<ACL_IN_BUFFER_COUNT;c++){
+        for (c=0;c<acl_in_transfer_count;c++){
             if (transfer == acl_in_transfer[c]){
                 libusb_free_transfer(transfer);
                 acl_in_transfer[c] = 0;
                 return;
             }
         }
+        for (c=0;c<ACL_OUT_BUFFER_COUNT;c++){
+            if (transfer == acl_out_transfers[c]){
+                acl_out_transfers_in_flight[c] = 0;
+                libusb_free_transfer(transfer);
+                acl_out_transfers[c] = 0;
+                return;
+            }
+        }
         return;
     }
 
+    // mark ACL OUT transfer as done
+    for (c=0;c<ACL_OUT_BUFFER_COUNT;c++){
+        if (transfer == acl_out_transfers[c]){
+            acl_out_transfers_in_flight[c] = 0;
+        }
+    }
+
 #ifdef ENABLE_SCO_OVER_HCI
     // mark SCO OUT transfer as done
     for (c=0;c<SCO_OUT_BUFFER_COUNT;c++){
@@ -333,6 +469,7 @@ LIBUSB_CALL static void async_callback(struct libusb_transfer *transfer){
     // log_info("begin async_callback endpoint %x, status %x, actual length %u", transfer->endpoint, transfer->status, transfer->actual_length );
 
     if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        usb_in_transfer_completed(transfer);
         queue_transfer(transfer);
     } else if (transfer->status == LIBUSB_TRANSFER_STALL){
         log_info("-> Transfer stalled, trying again");
@@ -439,6 +576,23 @@ static void handle_isochronous_data(uint8_t * buffer, uint16_t size){
 }
 #endif
 
+static void usb_acl_out_emit_packet_sent(void){
+    // hci.c can only provide the next packet if we have space for it
+    if (!acl_out_packet_sent_pending) return;
+    if (!acl_out_ring_have_space()) return;
+    acl_out_packet_sent_pending = 0;
+    // notify upper stack that provided buffer can be used again
+    uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
+    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+}
+
+static void usb_acl_out_packet_sent_timer_handler(btstack_timer_source_t *ts){
+    UNUSED(ts);
+    acl_out_packet_sent_timer_active = 0;
+    if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return;
+    usb_acl_out_emit_packet_sent();
+}
+
 static void handle_completed_transfer(struct libusb_transfer *transfer){
 
     int resubmit = 0;
@@ -457,8 +611,15 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
         signal_done = 1;
     } else if (transfer->endpoint == acl_out_addr){
         // log_info("acl out done, size %u", transfer->actual_length);
-        usb_acl_out_active = 0;
-        signal_done = 1;
+        if (transfer != acl_out_transfers[acl_out_ring_read]){
+            log_error("acl out transfer %p completed out of order", transfer);
+        }
+        acl_out_ring_read++;
+        if (acl_out_ring_read == ACL_OUT_BUFFER_COUNT){
+            acl_out_ring_read = 0;
+        }
+        acl_out_transfers_active--;
+        usb_acl_out_emit_packet_sent();
 #ifdef ENABLE_SCO_OVER_HCI
     } else if (transfer->endpoint == sco_in_addr) {
         // log_info("handle_completed_transfer for SCO IN! num packets %u", transfer->NUM_ISO_PACKETS);
@@ -513,13 +674,51 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
     if (resubmit){
         // Re-submit transfer 
         transfer->user_data = NULL;
-        int r = libusb_submit_transfer(transfer);
+        int r = usb_submit_in_transfer(transfer);
         if (r) {
             log_error("Error re-submitting transfer %d", r);
         }
     }   
 }
 
+#ifdef HAVE_USB_POLLFDS
+
+// arm timer for next libusb timeout, if libusb needs us to handle them
+static void usb_timeout_update(void){
+    if (!usb_handle_timeouts) return;
+
+    struct timeval tv;
+    int has_timeout = libusb_get_next_timeout(NULL, &tv) == 1;
+
+#ifdef HAVE_USB_TIMERFD
+    struct itimerspec timer_spec;
+    memset(&timer_spec, 0, sizeof(timer_spec));
+    if (has_timeout){
+        timer_spec.it_value.tv_sec  = tv.tv_sec;
+        timer_spec.it_value.tv_nsec = tv.tv_usec * 1000;
+        // an all-zero it_value would disarm the timer
+        if ((tv.tv_sec == 0) && (tv.tv_usec == 0)){
+            timer_spec.it_value.tv_nsec = 1;
+        }
+    }
+    if (timerfd_settime(usb_timerfd_data_source.source.fd, 0, &timer_spec, NULL) < 0){
+        log_error("usb_timeout_update: timerfd_settime failed, errno %u", errno);
+    }
+#else
+    if (usb_timer_active){
+        btstack_run_loop_remove_timer(&usb_timer);
+        usb_timer_active = 0;
+    }
+    if (has_timeout){
+        uint32_t msec = (uint32_t) (tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+        btstack_run_loop_set_timer(&usb_timer, msec);
+        btstack_run_loop_add_timer(&usb_timer);
+        usb_timer_active = 1;
+    }
+#endif
+}
+#endif
+
 static void usb_process_ds(btstack_data_source_t *ds, btstack_data_source_callback_type_t callback_type) {
 
     UNUSED(ds);
@@ -547,6 +746,12 @@ static void usb_process_ds(btstack_data_source_t *ds, btstack_data_source_callba
         // handle case where libusb_close might be called by hci packet handler        
         if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return;
     }
+
+#ifdef HAVE_USB_POLLFDS
+    if (doing_pollfds){
+        usb_timeout_update();
+    }
+#endif
     // log_info("end usb_process_ds");
 }
 
@@ -564,6 +769,9 @@ static void usb_process_ts(btstack_timer_source_t *timer) {
     // actually handled the packet in the pollfds function
     usb_process_ds((struct btstack_data_source *) NULL, DATA_SOURCE_CALLBACK_READ);
 
+    // libusb timeout handled, next one has been scheduled by usb_process_ds
+    if (doing_pollfds) return;
+
     // Get the amount of time until next event is due
     long msec = ASYNC_POLLING_INTERVAL_MS;
 
@@ -921,6 +1129,114 @@ static void usb_sco_stop(void){
 
 
 
+#endif
+
+#ifdef HAVE_USB_POLLFDS
+
+#ifdef HAVE_USB_TIMERFD
+static void usb_process_timerfd(btstack_data_source_t *ds, btstack_data_source_callback_type_t callback_type) {
+    // clear expiration count
+    uint64_t expirations;
+    ssize_t bytes_read = read(ds->source.fd, &expirations, sizeof(expirations));
+    UNUSED(bytes_read);
+    usb_process_ds(ds, callback_type);
+}
+#endif
+
+LIBUSB_CALL static void usb_pollfd_added(int fd, short events, void * user_data){
+    UNUSED(user_data);
+    int i;
+    for (i = 0; i < HCI_TRANSPORT_USB_MAX_POLLFDS; i++){
+        if (pollfd_data_sources_in_use[i]) continue;
+        btstack_data_source_t *ds = &pollfd_data_sources[i];
+        memset(ds, 0, sizeof(btstack_data_source_t));
+        btstack_run_loop_set_data_source_fd(ds, fd);
+        btstack_run_loop_set_data_source_handler(ds, &usb_process_ds);
+        // Linux usbfs signals completed transfers via POLLOUT
+        if (events & POLLIN){
+            btstack_run_loop_enable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_READ);
+        }
+        if (events & POLLOUT){
+            btstack_run_loop_enable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_WRITE);
+        }
+        btstack_run_loop_add_data_source(ds);
+        pollfd_data_sources_in_use[i] = 1;
+        log_info("pollfd %u added: fd %u, events %x", i, fd, events);
+        return;
+    }
+    log_error("usb_pollfd_added: no free data source for fd %u, increase HCI_TRANSPORT_USB_MAX_POLLFDS", fd);
+}
+
+LIBUSB_CALL static void usb_pollfd_removed(int fd, void * user_data){
+    UNUSED(user_data);
+    int i;
+    for (i = 0; i < HCI_TRANSPORT_USB_MAX_POLLFDS; i++){
+        if (!pollfd_data_sources_in_use[i]) continue;
+        if (pollfd_data_sources[i].source.fd != fd) continue;
+        btstack_run_loop_remove_data_source(&pollfd_data_sources[i]);
+        pollfd_data_sources_in_use[i] = 0;
+        log_info("pollfd %u removed: fd %u", i, fd);
+        return;
+    }
+}
+
+// register libusb file descriptors with run loop, returns 0 if not supported
+static int usb_pollfds_register(void){
+    const struct libusb_pollfd ** pollfd = libusb_get_pollfds(NULL);
+    if (!pollfd) return 0;
+
+    usb_handle_timeouts = libusb_pollfds_handle_timeouts(NULL) == 0;
+#ifdef HAVE_USB_TIMERFD
+    if (usb_handle_timeouts){
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0){
+            log_error("usb_pollfds_register: timerfd_create failed, errno %u", errno);
+#ifdef HAVE_LIBUSB_FREE_POLLFDS
+            libusb_free_pollfds(pollfd);
+#else
+            free(pollfd);
+#endif
+            return 0;
+        }
+        memset(&usb_timerfd_data_source, 0, sizeof(btstack_data_source_t));
+        btstack_run_loop_set_data_source_fd(&usb_timerfd_data_source, fd);
+        btstack_run_loop_set_data_source_handler(&usb_timerfd_data_source, &usb_process_timerfd);
+        btstack_run_loop_enable_data_source_callbacks(&usb_timerfd_data_source, DATA_SOURCE_CALLBACK_READ);
+        btstack_run_loop_add_data_source(&usb_timerfd_data_source);
+    }
+#endif
+    log_info("Async using pollfds, libusb timeouts handled by %s", usb_handle_timeouts ? "BTstack" : "libusb");
+
+    int i;
+    for (i = 0 ; pollfd[i] ; i++){
+        usb_pollfd_added(pollfd[i]->fd, pollfd[i]->events, NULL);
+    }
+#ifdef HAVE_LIBUSB_FREE_POLLFDS
+    libusb_free_pollfds(pollfd);
+#else
+    free(pollfd);
+#endif
+
+    libusb_set_pollfd_notifiers(NULL, &usb_pollfd_added, &usb_pollfd_removed, NULL);
+    return 1;
+}
+
+static void usb_pollfds_unregister(void){
+    libusb_set_pollfd_notifiers(NULL, NULL, NULL, NULL);
+    int i;
+    for (i = 0; i < HCI_TRANSPORT_USB_MAX_POLLFDS; i++){
+        if (!pollfd_data_sources_in_use[i]) continue;
+        btstack_run_loop_remove_data_source(&pollfd_data_sources[i]);
+        pollfd_data_sources_in_use[i] = 0;
+    }
+#ifdef HAVE_USB_TIMERFD
+    if (usb_handle_timeouts){
+        btstack_run_loop_remove_data_source(&usb_timerfd_data_source);
+        close(usb_timerfd_data_source.source.fd);
+    }
+#endif
+    usb_handle_timeouts = 0;
+}
 #endif
 
 static int usb_open(void){
@@ -929,6 +1245,11 @@ static int usb_open(void){
     if (usb_transport_open) return 0;
 
     handle_packet = NULL;
+    handle_packet_tail = NULL;
+    event_in_transfers_posted = 0;
+    acl_in_transfers_posted = 0;
+    event_in_stalls = 0;
+    acl_in_stalls = 0;
 
     // default endpoint addresses
     event_in_addr = 0x81; // EP1, IN interrupt
@@ -1061,14 +1382,15 @@ static int usb_open(void){
     
     // allocate transfer handlers
     int c;
-    for (c = 0 ; c < EVENT_IN_BUFFER_COUNT ; c++) {
+    log_info("Using %u event in and %u acl in transfers", event_in_transfer_count, acl_in_transfer_count);
+    for (c = 0 ; c < event_in_transfer_count ; c++) {
         event_in_transfer[c] = libusb_alloc_transfer(0); // 0 isochronous transfers Events
         if (!event_in_transfer[c]) {
             usb_close();
             return LIBUSB_ERROR_NO_MEM;
         }
     }
-    for (c = 0 ; c < ACL_IN_BUFFER_COUNT ; c++) {
+    for (c = 0 ; c < acl_in_transfer_count ; c++) {
         acl_in_transfer[c]  =  libusb_alloc_transfer(0); // 0 isochronous transfers ACL in
         if (!acl_in_transfer[c]) {
             usb_close();
@@ -1077,17 +1399,25 @@ static int usb_open(void){
     }
 
     command_out_transfer = libusb_alloc_transfer(0);
-    acl_out_transfer     = libusb_alloc_transfer(0);
+    for (c = 0 ; c < ACL_OUT_BUFFER_COUNT ; c++) {
+        acl_out_transfers[c] = libusb_alloc_transfer(0); // 0 isochronous transfers ACL out
+        acl_out_transfers_in_flight[c] = 0;
+        if (!acl_out_transfers[c]) {
+            usb_close();
+            return LIBUSB_ERROR_NO_MEM;
+        }
+    }
+    acl_out_ring_init();
 
     // TODO check for error
 
     libusb_state = LIB_USB_TRANSFERS_ALLOCATED;
 
-    for (c = 0 ; c < EVENT_IN_BUFFER_COUNT ; c++) {
+    for (c = 0 ; c < event_in_transfer_count ; c++) {
         // configure event_in handlers
         libusb_fill_interrupt_transfer(event_in_transfer[c], handle, event_in_addr, 
                 hci_event_in_buffer[c], HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
-        r = libusb_submit_transfer(event_in_transfer[c]);
+        r = usb_submit_in_transfer(event_in_transfer[c]);
         if (r) {
             log_error("Error submitting interrupt transfer %d", r);
             usb_close();
@@ -1095,11 +1425,11 @@ static int usb_open(void){
         }
     }
 
-    for (c = 0 ; c < ACL_IN_BUFFER_COUNT ; c++) {
+    for (c = 0 ; c < acl_in_transfer_count ; c++) {
         // configure acl_in handlers
         libusb_fill_bulk_transfer(acl_in_transfer[c], handle, acl_in_addr, 
                 hci_acl_in_buffer[c] + HCI_INCOMING_PRE_BUFFER_SIZE, HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
-        r = libusb_submit_transfer(acl_in_transfer[c]);
+        r = usb_submit_in_transfer(acl_in_transfer[c]);
         if (r) {
             log_error("Error submitting bulk in transfer %d", r);
             usb_close();
@@ -1108,35 +1438,19 @@ static int usb_open(void){
  
      }
 
- #if 0
-    // Check for pollfds functionality
-    doing_pollfds = libusb_pollfds_handle_timeouts(NULL);
+#ifdef HAVE_USB_POLLFDS
+    // use libusb file descriptors as data sources, if available (not on Windows)
+    doing_pollfds = usb_pollfds_register();
 #else
-    // NOTE: using pollfds doesn't work on Linux, so it is disable until further investigation
     doing_pollfds = 0;
 #endif
 
     if (doing_pollfds) {
-        log_info("Async using pollfds:");
-
-        const struct libusb_pollfd ** pollfd = libusb_get_pollfds(NULL);
-        for (num_pollfds = 0 ; pollfd[num_pollfds] ; num_pollfds++);
-        pollfd_data_sources = (btstack_data_source_t *)malloc(sizeof(btstack_data_source_t) * num_pollfds);
-        if (!pollfd_data_sources){
-            log_error("Cannot allocate data sources for pollfds");
-            usb_close();
-            return 1;            
-        }
-        memset(pollfd_data_sources, 0, sizeof(btstack_data_source_t) * num_pollfds);
-        for (r = 0 ; r < num_pollfds ; r++) {
-            btstack_data_source_t *ds = &pollfd_data_sources[r];
-            btstack_run_loop_set_data_source_fd(ds, pollfd[r]->fd);
-            btstack_run_loop_set_data_source_handler(ds, &usb_process_ds);
-            btstack_run_loop_enable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_READ);
-            btstack_run_loop_add_data_source(ds);
-            log_info("%u: %p fd: %u, events %x", r, pollfd[r], pollfd[r]->fd, pollfd[r]->events);
-        }
-        free(pollfd);
+#ifdef HAVE_USB_POLLFDS
+        // schedule first libusb timeout, if needed
+        usb_timer.process = usb_process_ts;
+        usb_timeout_update();
+#endif
     } else {
         log_info("Async using timers:");
 
@@ -1157,7 +1471,7 @@ static int usb_close(void){
 
     if (!usb_transport_open) return 0;
 
-    log_info("usb_close");
+    log_info("usb_close, in transfer stalls: event %u, acl %u", event_in_stalls, acl_in_stalls);
 
     switch (libusb_state){
         case LIB_USB_CLOSED:
@@ -1171,33 +1485,42 @@ static int usb_close(void){
                 usb_timer_active = 0;
             }
 
+            if (acl_out_packet_sent_timer_active){
+                btstack_run_loop_remove_timer(&acl_out_packet_sent_timer);
+                acl_out_packet_sent_timer_active = 0;
+            }
+
             if (doing_pollfds){
-                int r;
-                for (r = 0 ; r < num_pollfds ; r++) {
-                    btstack_data_source_t *ds = &pollfd_data_sources[r];
-                    btstack_run_loop_remove_data_source(ds);
-                }
-                free(pollfd_data_sources);
-                pollfd_data_sources = NULL;
-                num_pollfds = 0;
+#ifdef HAVE_USB_POLLFDS
+                usb_pollfds_unregister();
+#endif
                 doing_pollfds = 0;
             }
 
         case LIB_USB_INTERFACE_CLAIMED:
             // Cancel all transfers, ignore warnings for this
             libusb_set_debug(NULL, LIBUSB_LOG_LEVEL_ERROR);
-            for (c = 0 ; c < EVENT_IN_BUFFER_COUNT ; c++) {
+            for (c = 0 ; c < event_in_transfer_count ; c++) {
                 if (event_in_transfer[c]){
                     log_info("cancel event_in_transfer[%u] = %p", c, event_in_transfer[c]);
                     libusb_cancel_transfer(event_in_transfer[c]);
                 }
             }
-            for (c = 0 ; c < ACL_IN_BUFFER_COUNT ; c++) {
+            for (c = 0 ; c < acl_in_transfer_count ; c++) {
                 if (acl_in_transfer[c]){
                     log_info("cancel acl_in_transfer[%u] = %p", c, acl_in_transfer[c]);
                     libusb_cancel_transfer(acl_in_transfer[c]);
                 }
             }
+            for (c = 0 ; c < ACL_OUT_BUFFER_COUNT ; c++) {
+                if (acl_out_transfers_in_flight[c]) {
+                    log_info("cancel acl_out_transfers[%u] = %p", c, acl_out_transfers[c]);
+                    libusb_cancel_transfer(acl_out_transfers[c]);
+                } else if (acl_out_transfers[c]){
+                    libusb_free_transfer(acl_out_transfers[c]);
+                    acl_out_transfers[c] = 0;
+                }
+            }
 #ifdef ENABLE_SCO_OVER_HCI
             for (c = 0 ; c < SCO_IN_BUFFER_COUNT ; c++) {
                 if (sco_in_transfer[c]){
@@ -1231,7 +1554,7 @@ static int usb_close(void){
                 libusb_handle_events_timeout(NULL, &tv);
                 // check if all done
                 completed = 1;
-                for (c=0;c<EVENT_IN_BUFFER_COUNT;c++){
+                for (c=0;c<event_in_transfer_count;c++){
                     if (event_in_transfer[c]) {
                         log_info("event_in_transfer[%u] still active (%p)", c, event_in_transfer[c]);
                         completed = 0;
@@ -1241,7 +1564,7 @@ static int usb_close(void){
 
                 if (!completed) continue;
 
-                for (c=0;c<ACL_IN_BUFFER_COUNT;c++){
+                for (c=0;c<acl_in_transfer_count;c++){
                     if (acl_in_transfer[c]) {
                         log_info("acl_in_transfer[%u] still active (%p)", c, acl_in_transfer[c]);
                         completed = 0;
@@ -1249,6 +1572,16 @@ static int usb_close(void){
                     }
                 }
 
+                if (!completed) continue;
+
+                for (c=0;c<ACL_OUT_BUFFER_COUNT;c++){
+                    if (acl_out_transfers[c]) {
+                        log_info("acl_out_transfers[%u] still active (%p)", c, acl_out_transfers[c]);
+                        completed = 0;
+                        break;
+                    }
+                }
+
 #ifdef ENABLE_SCO_OVER_HCI
                 if (!completed) continue;
 
@@ -1330,23 +1663,55 @@ static int usb_send_acl_packet(uint8_t *packet, int size){
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return -1;
 
     // log_info("usb_send_acl_packet enter, size %u", size);
-    
-    // prepare transfer
-    int completed = 0;
-    libusb_fill_bulk_transfer(acl_out_transfer, handle, acl_out_addr, packet, size,
-        async_callback, &completed, 0);
-    acl_out_transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
 
-    // update stata before submitting transfer
-    usb_acl_out_active = 1;
+    if (!acl_out_ring_have_space()){
+        log_error("usb_send_acl_packet: no free ACL OUT transfer");
+        return -1;
+    }
 
-    r = libusb_submit_transfer(acl_out_transfer);
+    // store packet in free slot
+    int transfer_index = acl_out_ring_write;
+#if ACL_OUT_BUFFER_COUNT > 1
+    if (size > HCI_ACL_BUFFER_SIZE){
+        log_error("usb_send_acl_packet: packet too large, size %u", size);
+        return -1;
+    }
+    uint8_t * data = hci_acl_out_buffer[transfer_index];
+    memcpy(data, packet, size);
+#else
+    uint8_t * data = packet;
+#endif
+
+    // prepare transfer
+    struct libusb_transfer * acl_transfer = acl_out_transfers[transfer_index];
+    libusb_fill_bulk_transfer(acl_transfer, handle, acl_out_addr, data, size,
+        async_callback, NULL, 0);
+    acl_transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+
+    r = libusb_submit_transfer(acl_transfer);
     if (r < 0) {
-        usb_acl_out_active = 0;
         log_error("Error submitting acl transfer, %d", r);
         return -1;
     }
 
+    // mark slot as full
+    acl_out_ring_write++;
+    if (acl_out_ring_write == ACL_OUT_BUFFER_COUNT){
+        acl_out_ring_write = 0;
+    }
+    acl_out_transfers_active++;
+    acl_out_transfers_in_flight[transfer_index] = 1;
+    acl_out_packet_sent_pending = 1;
+
+    // if there's space for another packet, report packet sent from the run loop. Emitting it directly would
+    // re-enter hci_send_acl_packet_fragments. Otherwise, it's reported when the oldest transfer completes.
+    if (acl_out_ring_have_space() && !acl_out_packet_sent_timer_active){
+        btstack_run_loop_set_timer_handler(&acl_out_packet_sent_timer, &usb_acl_out_packet_sent_timer_handler);
+        btstack_run_loop_set_timer(&acl_out_packet_sent_timer, 0);
+        btstack_run_loop_add_timer(&acl_out_packet_sent_timer);
+        acl_out_packet_sent_timer_active = 1;
+    }
+
     return 0;
 }
 
@@ -1355,7 +1720,8 @@ static int usb_can_send_packet_now(uint8_t packet_type){
         case HCI_COMMAND_DATA_PACKET:
             return !usb_command_active;
         case HCI_ACL_DATA_PACKET:
-            return !usb_acl_out_active;
+            if (acl_out_packet_sent_pending) return 0;
+            return acl_out_ring_have_space();
 #ifdef ENABLE_SCO_OVER_HCI
         case HCI_SCO_DATA_PACKET:
             if (!sco_enabled) return 0;
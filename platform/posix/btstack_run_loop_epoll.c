@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "btstack_run_loop_epoll.c"
+
+/*
+ *  btstack_run_loop_epoll.c
+ *
+ *  Run loop for Linux based on epoll. In contrast to the select based POSIX run loop,
+ *  file descriptors stay registered with the kernel and only ready data sources are visited.
+ */
+
+// enable POSIX functions (needed for -std=c99)
+#define _POSIX_C_SOURCE 200809
+
+#include "btstack_run_loop_epoll.h"
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_base.h"
+#include "btstack_run_loop_profiler.h"
+#include "btstack_util.h"
+#include "btstack_linked_list.h"
+#include "btstack_debug.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// max number of ready events processed per epoll_wait call
+#define EPOLL_MAX_EVENTS 64
+
+static int epoll_fd = -1;
+
+// events returned by last epoll_wait, entries are set to NULL if data source gets removed during processing
+static struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+static int epoll_events_count;
+static int epoll_events_index;
+
+// start time. tv_nsec = 0
+static struct timespec init_ts;
+
+// callbacks posted from other threads, lock-free stack in reverse order, drained by run loop
+static btstack_context_callback_registration_t * main_thread_callbacks;
+static btstack_data_source_t main_thread_wakeup_data_source;
+
+static uint32_t btstack_run_loop_epoll_events_for_flags(uint16_t flags){
+    uint32_t events = 0;
+    if (flags & DATA_SOURCE_CALLBACK_READ){
+        events |= EPOLLIN;
+    }
+    if (flags & DATA_SOURCE_CALLBACK_WRITE){
+        events |= EPOLLOUT;
+    }
+    return events;
+}
+
+static int btstack_run_loop_epoll_ctl(int op, btstack_data_source_t * ds){
+    struct epoll_event event;
+    event.events   = btstack_run_loop_epoll_events_for_flags(ds->flags);
+    event.data.ptr = ds;
+    return epoll_ctl(epoll_fd, op, ds->source.fd, &event);
+}
+
+/**
+ * Add data_source to run_loop and register its fd with epoll
+ */
+static void btstack_run_loop_epoll_add_data_source(btstack_data_source_t *ds){
+    btstack_run_loop_base_add_data_source(ds);
+    if (ds->source.fd < 0) return;
+    int err = btstack_run_loop_epoll_ctl(EPOLL_CTL_ADD, ds);
+    if (err < 0){
+        log_error("btstack_run_loop_epoll_add_data_source: epoll_ctl add fd %u failed, errno %u", ds->source.fd, errno);
+    }
+}
+
+/**
+ * Remove data_source from run loop and unregister its fd
+ */
+static bool btstack_run_loop_epoll_remove_data_source(btstack_data_source_t *ds){
+    log_debug("btstack_run_loop_epoll_remove_data_source %p\n", ds);
+    // invalidate pending events for this data source
+    int i;
+    for (i = epoll_events_index; i < epoll_events_count; i++){
+        if (epoll_events[i].data.ptr == ds){
+            epoll_events[i].data.ptr = NULL;
+        }
+    }
+    if (ds->source.fd >= 0){
+        // fd might already be closed, which removes it from the epoll set implicitly
+        (void) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ds->source.fd, NULL);
+    }
+    return btstack_run_loop_base_remove_data_source(ds);
+}
+
+static bool btstack_run_loop_epoll_data_source_added(btstack_data_source_t * ds){
+    btstack_linked_item_t *it;
+    for (it = (btstack_linked_item_t *) btstack_run_loop_base_data_sources; it ; it = it->next){
+        if (it == (btstack_linked_item_t *) ds) return true;
+    }
+    return false;
+}
+
+static void btstack_run_loop_epoll_update_data_source(btstack_data_source_t * ds){
+    if (ds->source.fd < 0) return;
+    int err = btstack_run_loop_epoll_ctl(EPOLL_CTL_MOD, ds);
+    if (err == 0) return;
+    if (errno == ENOENT){
+        // not added yet, events will be set by add_data_source - or parked after hangup, see process_event
+        if (btstack_run_loop_epoll_data_source_added(ds) == false) return;
+        err = btstack_run_loop_epoll_ctl(EPOLL_CTL_ADD, ds);
+        if (err == 0) return;
+    }
+    log_error("btstack_run_loop_epoll_update_data_source: epoll_ctl fd %u failed, errno %u", ds->source.fd, errno);
+}
+
+static void btstack_run_loop_epoll_enable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callback_types){
+    uint16_t old_flags = ds->flags;
+    ds->flags |= callback_types;
+    if (ds->flags == old_flags) return;
+    btstack_run_loop_epoll_update_data_source(ds);
+}
+
+static void btstack_run_loop_epoll_disable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callback_types){
+    uint16_t old_flags = ds->flags;
+    ds->flags &= ~callback_types;
+    if (ds->flags == old_flags) return;
+    btstack_run_loop_epoll_update_data_source(ds);
+}
+
+/**
+ * @brief Queries the current time in us since start
+ */
+static uint64_t btstack_run_loop_epoll_get_time_us(void){
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC, &now_ts);
+    uint64_t sec_val  = (uint64_t) (now_ts.tv_sec - init_ts.tv_sec);
+    uint64_t nsec_val = (uint64_t) now_ts.tv_nsec;
+    return (sec_val * 1000000) + (nsec_val / 1000);
+}
+
+/**
+ * @brief Queries the current time in ms since start
+ */
+static uint32_t btstack_run_loop_epoll_get_time_ms(void){
+    return (uint32_t) (btstack_run_loop_epoll_get_time_us() / 1000);
+}
+
+static void btstack_run_loop_epoll_process_data_source(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+#ifdef ENABLE_RUN_LOOP_PROFILER
+    // ds might be removed and freed by callback
+    btstack_run_loop_profiler_callback_t callback = (btstack_run_loop_profiler_callback_t) ds->process;
+    uint32_t start_us = btstack_run_loop_profiler_get_time_us();
+    ds->process(ds, callback_type);
+    btstack_run_loop_profiler_record(BTSTACK_RUN_LOOP_PROFILER_DATA_SOURCE, callback, btstack_run_loop_profiler_get_time_us() - start_us);
+#else
+    ds->process(ds, callback_type);
+#endif
+}
+
+static void btstack_run_loop_epoll_process_event(struct epoll_event * event){
+    btstack_data_source_t * ds = (btstack_data_source_t *) event->data.ptr;
+    // data source removed by previous callback
+    if (ds == NULL) return;
+    // errors and hangups are always reported by epoll, park fd until read callback gets enabled again
+    if (((event->events & (EPOLLERR | EPOLLHUP)) != 0) && ((ds->flags & DATA_SOURCE_CALLBACK_READ) == 0)){
+        log_info("btstack_run_loop_epoll_execute: fd %u hangup/error without read callback, unregister", ds->source.fd);
+        (void) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ds->source.fd, NULL);
+    }
+    // errors and hangups are reported as read to let the data source handle them
+    if (event->events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+        if (ds->flags & DATA_SOURCE_CALLBACK_READ){
+            log_debug("btstack_run_loop_epoll_execute: process read ds %p with fd %u\n", ds, ds->source.fd);
+            btstack_run_loop_epoll_process_data_source(ds, DATA_SOURCE_CALLBACK_READ);
+        }
+    }
+    // data source removed by read callback
+    if (event->data.ptr == NULL) return;
+    if (event->events & EPOLLOUT){
+        if (ds->flags & DATA_SOURCE_CALLBACK_WRITE){
+            log_debug("btstack_run_loop_epoll_execute: process write ds %p with fd %u\n", ds, ds->source.fd);
+            btstack_run_loop_epoll_process_data_source(ds, DATA_SOURCE_CALLBACK_WRITE);
+        }
+    }
+}
+
+static void btstack_run_loop_epoll_execute_on_main_thread(btstack_context_callback_registration_t * callback_registration){
+    // push onto lock-free stack
+    btstack_context_callback_registration_t * head = __atomic_load_n(&main_thread_callbacks, __ATOMIC_RELAXED);
+    do {
+        callback_registration->item = (btstack_linked_item_t *) head;
+    } while (!__atomic_compare_exchange_n(&main_thread_callbacks, &head, callback_registration, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    // only wake up run loop for first callback of a batch
+    if (head == NULL){
+        uint64_t value = 1;
+        ssize_t res = write(main_thread_wakeup_data_source.source.fd, &value, sizeof(value));
+        if (res < 0){
+            log_error("btstack_run_loop_epoll_execute_on_main_thread: eventfd write failed, errno %u", errno);
+        }
+    }
+}
+
+static void btstack_run_loop_epoll_process_main_thread_callbacks(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    UNUSED(callback_type);
+
+    // clear wakeup before taking callbacks, so callbacks posted later trigger a new wakeup
+    uint64_t value;
+    ssize_t res = read(ds->source.fd, &value, sizeof(value));
+    UNUSED(res);
+
+    // take all callbacks and restore order in which they have been posted
+    btstack_context_callback_registration_t * stack = __atomic_exchange_n(&main_thread_callbacks, NULL, __ATOMIC_ACQUIRE);
+    btstack_context_callback_registration_t * queue = NULL;
+    while (stack != NULL){
+        btstack_context_callback_registration_t * next = (btstack_context_callback_registration_t *) stack->item;
+        stack->item = (btstack_linked_item_t *) queue;
+        queue = stack;
+        stack = next;
+    }
+
+    // execute batch. registration can be re-used by callback
+    while (queue != NULL){
+        btstack_context_callback_registration_t * callback_registration = queue;
+        queue = (btstack_context_callback_registration_t *) queue->item;
+        (*callback_registration->callback)(callback_registration->context);
+    }
+}
+
+/**
+ * Execute run_loop
+ */
+static void btstack_run_loop_epoll_execute(void) {
+
+    log_info("Linux epoll run loop");
+
+    while (true) {
+
+        // get next timeout, epoll_wait has ms resolution
+        int timeout_ms = -1;
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+        int32_t delta_us = btstack_run_loop_base_get_time_until_timeout_us(btstack_run_loop_epoll_get_time_us());
+        if (delta_us >= 0){
+            timeout_ms = (delta_us + 999) / 1000;
+            log_debug("btstack_run_loop_epoll_execute next timeout in %u us", delta_us);
+        }
+#else
+        int32_t delta = btstack_run_loop_base_get_time_until_timeout(btstack_run_loop_epoll_get_time_ms());
+        if (delta >= 0){
+            timeout_ms = delta;
+            log_debug("btstack_run_loop_epoll_execute next timeout in %u ms", delta);
+        }
+#endif
+
+        // wait for ready FDs
+#ifdef ENABLE_RUN_LOOP_PROFILER
+        uint32_t wait_start_us = btstack_run_loop_profiler_get_time_us();
+#endif
+        int num_events = epoll_wait(epoll_fd, epoll_events, EPOLL_MAX_EVENTS, timeout_ms);
+#ifdef ENABLE_RUN_LOOP_PROFILER
+        btstack_run_loop_profiler_record(BTSTACK_RUN_LOOP_PROFILER_WAIT, NULL, btstack_run_loop_profiler_get_time_us() - wait_start_us);
+#endif
+        if (num_events < 0){
+            if (errno != EINTR){
+                log_error("btstack_run_loop_epoll_execute: epoll_wait failed, errno %u", errno);
+            }
+            num_events = 0;
+        }
+
+        // process ready data sources
+        epoll_events_count = num_events;
+        for (epoll_events_index = 0; epoll_events_index < epoll_events_count; epoll_events_index++){
+            btstack_run_loop_epoll_process_event(&epoll_events[epoll_events_index]);
+        }
+        epoll_events_count = 0;
+        epoll_events_index = 0;
+
+        // process timers
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+        btstack_run_loop_base_process_timers_us(btstack_run_loop_epoll_get_time_us());
+#else
+        btstack_run_loop_base_process_timers(btstack_run_loop_epoll_get_time_ms());
+#endif
+    }
+}
+
+// set timer
+static void btstack_run_loop_epoll_set_timer(btstack_timer_source_t *a, uint32_t timeout_in_ms){
+    uint32_t time_ms = btstack_run_loop_epoll_get_time_ms();
+    a->timeout = time_ms + timeout_in_ms;
+    log_debug("btstack_run_loop_epoll_set_timer to %u ms (now %u, timeout %u)", a->timeout, time_ms, timeout_in_ms);
+}
+
+static void btstack_run_loop_epoll_init(void){
+    btstack_run_loop_base_init();
+    if (epoll_fd >= 0){
+        close(epoll_fd);
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0){
+        log_error("btstack_run_loop_epoll_init: epoll_create1 failed, errno %u", errno);
+    }
+    epoll_events_count = 0;
+    epoll_events_index = 0;
+    main_thread_callbacks = NULL;
+    int wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd < 0){
+        log_error("btstack_run_loop_epoll_init: eventfd failed, errno %u", errno);
+    } else {
+        btstack_run_loop_set_data_source_fd(&main_thread_wakeup_data_source, wakeup_fd);
+        btstack_run_loop_set_data_source_handler(&main_thread_wakeup_data_source, &btstack_run_loop_epoll_process_main_thread_callbacks);
+        main_thread_wakeup_data_source.flags = DATA_SOURCE_CALLBACK_READ;
+        btstack_run_loop_epoll_add_data_source(&main_thread_wakeup_data_source);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &init_ts);
+    init_ts.tv_nsec = 0;
+#ifdef ENABLE_RUN_LOOP_PROFILER
+    btstack_run_loop_profiler_init();
+#endif
+}
+
+static const btstack_run_loop_t btstack_run_loop_epoll = {
+    &btstack_run_loop_epoll_init,
+    &btstack_run_loop_epoll_add_data_source,
+    &btstack_run_loop_epoll_remove_data_source,
+    &btstack_run_loop_epoll_enable_data_source_callbacks,
+    &btstack_run_loop_epoll_disable_data_source_callbacks,
+    &btstack_run_loop_epoll_set_timer,
+    &btstack_run_loop_base_add_timer,
+    &btstack_run_loop_base_remove_timer,
+    &btstack_run_loop_epoll_execute,
+    &btstack_run_loop_base_dump_timer,
+    &btstack_run_loop_epoll_get_time_ms,
+    &btstack_run_loop_epoll_execute_on_main_thread,
+    &btstack_run_loop_epoll_get_time_us,
+};
+
+/**
+ * Provide btstack_run_loop_epoll instance
+ */
+const btstack_run_loop_t * btstack_run_loop_epoll_get_instance(void){
+    return &btstack_run_loop_epoll;
+}
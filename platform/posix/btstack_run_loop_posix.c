@@ -49,10 +49,14 @@
 #include "btstack_run_loop_posix.h"
 
 #include "btstack_run_loop.h"
+#include "btstack_run_loop_base.h"
+#include "btstack_run_loop_profiler.h"
 #include "btstack_util.h"
 #include "btstack_linked_list.h"
 #include "btstack_debug.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/select.h>
@@ -60,12 +64,13 @@
 #include <time.h>
 #include <unistd.h>
 
-static void btstack_run_loop_posix_dump_timer(void);
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 // the run loop
 static btstack_linked_list_t data_sources;
 static int data_sources_modified;
-static btstack_linked_list_t timers;
 
 // start time. tv_usec/tv_nsec = 0
 #ifdef _POSIX_MONOTONIC_CLOCK
@@ -76,6 +81,12 @@ static struct timespec init_ts;
 static struct timeval init_tv;
 #endif
 
+// callbacks posted from other threads, lock-free stack in reverse order, drained by run loop
+static btstack_context_callback_registration_t * main_thread_callbacks;
+// wakeup for run loop: eventfd on Linux, pipe otherwise
+static btstack_data_source_t main_thread_wakeup_data_source;
+static int main_thread_wakeup_write_fd = -1;
+
 /**
  * Add data_source to run_loop
  */
@@ -94,42 +105,6 @@ static bool btstack_run_loop_posix_remove_data_source(btstack_data_source_t *ds)
     return btstack_linked_list_remove(&data_sources, (btstack_linked_item_t *) ds);
 }
 
-/**
- * Add timer to run_loop (keep list sorted)
- */
-static void btstack_run_loop_posix_add_timer(btstack_timer_source_t *ts){
-    btstack_linked_item_t *it;
-    for (it = (btstack_linked_item_t *) &timers; it->next ; it = it->next){
-        btstack_timer_source_t * next = (btstack_timer_source_t *) it->next;
-        btstack_assert(next != ts);
-        // exit if new timeout before list timeout
-        int32_t delta = btstack_time_delta(ts->timeout, next->timeout);
-        if (delta < 0) break;
-    }
-    ts->item.next = it->next;
-    it->next = (btstack_linked_item_t *) ts;
-    log_debug("Added timer %p at %u\n", ts, ts->timeout);
-    // btstack_run_loop_posix_dump_timer();
-}
-
-/**
- * Remove timer from run loop
- */
-static bool btstack_run_loop_posix_remove_timer(btstack_timer_source_t *ts){
-    // log_info("Removed timer %x at %u\n", (int) ts, (unsigned int) ts->timeout.tv_sec);
-    // btstack_run_loop_posix_dump_timer();
-    return btstack_linked_list_remove(&timers, (btstack_linked_item_t *) ts);
-}
-
-static void btstack_run_loop_posix_dump_timer(void){
-    btstack_linked_item_t *it;
-    int i = 0;
-    for (it = (btstack_linked_item_t *) timers; it ; it = it->next){
-        btstack_timer_source_t *ts = (btstack_timer_source_t*) it;
-        log_info("timer %u (%p): timeout %u\n", i, ts, ts->timeout);
-    }
-}
-
 static void btstack_run_loop_posix_enable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callback_types){
     ds->flags |= callback_types;
 }
@@ -164,6 +139,15 @@ static uint64_t timespec_to_milliseconds(struct timespec *a){
     return ret;
 }
 
+/**
+ * @brief Convert timespec to microseconds
+ */
+static uint64_t timespec_to_microseconds(struct timespec *a){
+    uint64_t sec_val = (uint64_t)(a->tv_sec);
+    uint64_t nsec_val = (uint64_t)(a->tv_nsec);
+    return (sec_val*1000000) + (nsec_val/1000);
+}
+
 /**
  * @brief Returns the milisecond value of (stop - start). Might overflow
  */
@@ -172,6 +156,15 @@ static uint64_t timespec_diff_milis(struct timespec* start, struct timespec* sto
     timespec_diff(start, stop, &diff_ts);
     return timespec_to_milliseconds(&diff_ts);
 }
+
+/**
+ * @brief Returns the microsecond value of (stop - start)
+ */
+static uint64_t timespec_diff_micros(struct timespec* start, struct timespec* stop){
+    struct timespec diff_ts;
+    timespec_diff(start, stop, &diff_ts);
+    return timespec_to_microseconds(&diff_ts);
+}
 #endif
 
 /**
@@ -191,6 +184,120 @@ static uint32_t btstack_run_loop_posix_get_time_ms(void){
     return time_ms;
 }
 
+/**
+ * @brief Queries the current time in us since start
+ */
+static uint64_t btstack_run_loop_posix_get_time_us(void){
+    uint64_t time_us;
+#ifdef _POSIX_MONOTONIC_CLOCK
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC, &now_ts);
+    time_us = timespec_diff_micros(&init_ts, &now_ts);
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    time_us = ((uint64_t) (tv.tv_sec  - init_tv.tv_sec) * 1000000) + tv.tv_usec;
+#endif
+    return time_us;
+}
+
+static void btstack_run_loop_posix_process_data_source(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+#ifdef ENABLE_RUN_LOOP_PROFILER
+    // ds might be removed and freed by callback
+    btstack_run_loop_profiler_callback_t callback = (btstack_run_loop_profiler_callback_t) ds->process;
+    uint32_t start_us = btstack_run_loop_profiler_get_time_us();
+    ds->process(ds, callback_type);
+    btstack_run_loop_profiler_record(BTSTACK_RUN_LOOP_PROFILER_DATA_SOURCE, callback, btstack_run_loop_profiler_get_time_us() - start_us);
+#else
+    ds->process(ds, callback_type);
+#endif
+}
+
+static void btstack_run_loop_posix_main_thread_wakeup(void){
+#ifdef __linux__
+    uint64_t value = 1;
+#else
+    uint8_t value = 1;
+#endif
+    ssize_t res = write(main_thread_wakeup_write_fd, &value, sizeof(value));
+    // EAGAIN: run loop already woken up
+    if ((res < 0) && (errno != EAGAIN)){
+        log_error("btstack_run_loop_posix_main_thread_wakeup: write failed, errno %u", errno);
+    }
+}
+
+static void btstack_run_loop_posix_execute_on_main_thread(btstack_context_callback_registration_t * callback_registration){
+    // push onto lock-free stack
+    btstack_context_callback_registration_t * head = __atomic_load_n(&main_thread_callbacks, __ATOMIC_RELAXED);
+    do {
+        callback_registration->item = (btstack_linked_item_t *) head;
+    } while (!__atomic_compare_exchange_n(&main_thread_callbacks, &head, callback_registration, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    // only wake up run loop for first callback of a batch
+    if (head == NULL){
+        btstack_run_loop_posix_main_thread_wakeup();
+    }
+}
+
+static void btstack_run_loop_posix_process_main_thread_callbacks(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    UNUSED(callback_type);
+
+    // clear wakeup before taking callbacks, so callbacks posted later trigger a new wakeup
+#ifdef __linux__
+    uint64_t value;
+    ssize_t res = read(ds->source.fd, &value, sizeof(value));
+    UNUSED(res);
+#else
+    uint8_t buffer[16];
+    while (read(ds->source.fd, buffer, sizeof(buffer)) > 0){
+    }
+#endif
+
+    // take all callbacks and restore order in which they have been posted
+    btstack_context_callback_registration_t * stack = __atomic_exchange_n(&main_thread_callbacks, NULL, __ATOMIC_ACQUIRE);
+    btstack_context_callback_registration_t * queue = NULL;
+    while (stack != NULL){
+        btstack_context_callback_registration_t * next = (btstack_context_callback_registration_t *) stack->item;
+        stack->item = (btstack_linked_item_t *) queue;
+        queue = stack;
+        stack = next;
+    }
+
+    // execute batch. registration can be re-used by callback
+    while (queue != NULL){
+        btstack_context_callback_registration_t * callback_registration = queue;
+        queue = (btstack_context_callback_registration_t *) queue->item;
+        (*callback_registration->callback)(callback_registration->context);
+    }
+}
+
+static void btstack_run_loop_posix_main_thread_init(void){
+    int read_fd;
+    main_thread_callbacks = NULL;
+#ifdef __linux__
+    read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    main_thread_wakeup_write_fd = read_fd;
+#else
+    int fds[2];
+    if (pipe(fds) == 0){
+        read_fd = fds[0];
+        main_thread_wakeup_write_fd = fds[1];
+        fcntl(read_fd, F_SETFL, O_NONBLOCK);
+        fcntl(main_thread_wakeup_write_fd, F_SETFL, O_NONBLOCK);
+    } else {
+        read_fd = -1;
+        main_thread_wakeup_write_fd = -1;
+    }
+#endif
+    if (read_fd < 0){
+        log_error("btstack_run_loop_posix_main_thread_init: cannot create wakeup fd, errno %u", errno);
+        return;
+    }
+    btstack_run_loop_set_data_source_fd(&main_thread_wakeup_data_source, read_fd);
+    btstack_run_loop_set_data_source_handler(&main_thread_wakeup_data_source, &btstack_run_loop_posix_process_main_thread_callbacks);
+    main_thread_wakeup_data_source.flags = DATA_SOURCE_CALLBACK_READ;
+    btstack_run_loop_posix_add_data_source(&main_thread_wakeup_data_source);
+}
+
 /**
  * Execute run_loop
  */
@@ -198,11 +305,9 @@ static void btstack_run_loop_posix_execute(void) {
     fd_set descriptors_read;
     fd_set descriptors_write;
     
-    btstack_timer_source_t       *ts;
     btstack_linked_list_iterator_t it;
     struct timeval * timeout;
     struct timeval tv;
-    uint32_t now_ms;
 
 #ifdef _POSIX_MONOTONIC_CLOCK
     log_info("POSIX run loop with monotonic clock");
@@ -237,22 +342,32 @@ static void btstack_run_loop_posix_execute(void) {
         
         // get next timeout
         timeout = NULL;
-        if (timers) {
-            ts = (btstack_timer_source_t *) timers;
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+        int32_t delta_us = btstack_run_loop_base_get_time_until_timeout_us(btstack_run_loop_posix_get_time_us());
+        if (delta_us >= 0) {
+            timeout = &tv;
+            tv.tv_sec  = delta_us / 1000000;
+            tv.tv_usec = delta_us - (tv.tv_sec * 1000000);
+            log_debug("btstack_run_loop_execute next timeout in %u us", delta_us);
+        }
+#else
+        int32_t delta = btstack_run_loop_base_get_time_until_timeout(btstack_run_loop_posix_get_time_ms());
+        if (delta >= 0) {
             timeout = &tv;
-            uint32_t list_timeout  = ts->timeout;
-            now_ms = btstack_run_loop_posix_get_time_ms();
-            int32_t delta = btstack_time_delta(list_timeout, now_ms);
-            if (delta < 0){
-                delta = 0;
-            }
             tv.tv_sec  = delta / 1000;
             tv.tv_usec = (int) (delta - (tv.tv_sec * 1000)) * 1000;
             log_debug("btstack_run_loop_execute next timeout in %u ms", delta);
         }
+#endif
                 
         // wait for ready FDs
+#ifdef ENABLE_RUN_LOOP_PROFILER
+        uint32_t wait_start_us = btstack_run_loop_profiler_get_time_us();
+#endif
         select( highest_fd+1 , &descriptors_read, &descriptors_write, NULL, timeout);
+#ifdef ENABLE_RUN_LOOP_PROFILER
+        btstack_run_loop_profiler_record(BTSTACK_RUN_LOOP_PROFILER_WAIT, NULL, btstack_run_loop_profiler_get_time_us() - wait_start_us);
+#endif
                 
 
         data_sources_modified = 0;
@@ -262,28 +377,22 @@ static void btstack_run_loop_posix_execute(void) {
             log_debug("btstack_run_loop_posix_execute: check ds %p with fd %u\n", ds, ds->source.fd);
             if (FD_ISSET(ds->source.fd, &descriptors_read)) {
                 log_debug("btstack_run_loop_posix_execute: process read ds %p with fd %u\n", ds, ds->source.fd);
-                ds->process(ds, DATA_SOURCE_CALLBACK_READ);
+                btstack_run_loop_posix_process_data_source(ds, DATA_SOURCE_CALLBACK_READ);
             }
             if (data_sources_modified) break;
             if (FD_ISSET(ds->source.fd, &descriptors_write)) {
                 log_debug("btstack_run_loop_posix_execute: process write ds %p with fd %u\n", ds, ds->source.fd);
-                ds->process(ds, DATA_SOURCE_CALLBACK_WRITE);
+                btstack_run_loop_posix_process_data_source(ds, DATA_SOURCE_CALLBACK_WRITE);
             }
         }
         log_debug("btstack_run_loop_posix_execute: after ds check\n");
         
         // process timers
-        now_ms = btstack_run_loop_posix_get_time_ms();
-        while (timers) {
-            ts = (btstack_timer_source_t *) timers;
-            int32_t delta = btstack_time_delta(ts->timeout, now_ms);
-            if (delta > 0) break;
-            log_debug("btstack_run_loop_posix_execute: process timer %p\n", ts);
-            
-            // remove timer before processing it to allow handler to re-register with run loop
-            btstack_run_loop_posix_remove_timer(ts);
-            ts->process(ts);
-        }
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+        btstack_run_loop_base_process_timers_us(btstack_run_loop_posix_get_time_us());
+#else
+        btstack_run_loop_base_process_timers(btstack_run_loop_posix_get_time_ms());
+#endif
     }
 }
 
@@ -295,8 +404,9 @@ static void btstack_run_loop_posix_set_timer(btstack_timer_source_t *a, uint32_t
 }
 
 static void btstack_run_loop_posix_init(void){
+    btstack_run_loop_base_init();
     data_sources = NULL;
-    timers = NULL;
+    btstack_run_loop_posix_main_thread_init();
 #ifdef _POSIX_MONOTONIC_CLOCK
     clock_gettime(CLOCK_MONOTONIC, &init_ts);
     init_ts.tv_nsec = 0;
@@ -305,6 +415,9 @@ static void btstack_run_loop_posix_init(void){
     gettimeofday(&init_tv, NULL);
     init_tv.tv_usec = 0;
 #endif
+#ifdef ENABLE_RUN_LOOP_PROFILER
+    btstack_run_loop_profiler_init();
+#endif
 }
 
 
@@ -315,11 +428,13 @@ static const btstack_run_loop_t btstack_run_loop_posix = {
     &btstack_run_loop_posix_enable_data_source_callbacks,
     &btstack_run_loop_posix_disable_data_source_callbacks,
     &btstack_run_loop_posix_set_timer,
-    &btstack_run_loop_posix_add_timer,
-    &btstack_run_loop_posix_remove_timer,
+    &btstack_run_loop_base_add_timer,
+    &btstack_run_loop_base_remove_timer,
     &btstack_run_loop_posix_execute,
-    &btstack_run_loop_posix_dump_timer,
+    &btstack_run_loop_base_dump_timer,
     &btstack_run_loop_posix_get_time_ms,
+    &btstack_run_loop_posix_execute_on_main_thread,
+    &btstack_run_loop_posix_get_time_us,
 };
 
 /**
@@ -0,0 +1,695 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "btstack_uart_block_io_uring.c"
+
+/*
+ *  btstack_uart_block_io_uring.c
+ *
+ *  Serial port access via io_uring (Linux)
+ *
+ *  A read is kept submitted at all times into a receive ring buffer and receive_block requests are served from it.
+ *  In streaming mode, all received data is passed to the data_received handler instead.
+ *  Completions are signalled via an eventfd that is registered with the run loop. Requests queued while processing
+ *  completions, e.g. the next send_block from the block_sent handler, are submitted together with the re-armed read.
+ */
+
+#include "btstack_uart_block.h"
+#include "btstack_run_loop.h"
+#include "btstack_debug.h"
+#include "btstack_util.h"
+
+#include <termios.h>  /* POSIX terminal control definitions */
+#include <fcntl.h>    /* File control definitions */
+#include <unistd.h>   /* UNIX standard function definitions */
+#include <string.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// size of receive ring buffer
+#ifndef BTSTACK_UART_IO_URING_RX_BUFFER_SIZE
+#define BTSTACK_UART_IO_URING_RX_BUFFER_SIZE 4096
+#endif
+
+// at most one read and one write are in flight
+#define IO_URING_ENTRIES 4
+
+#define IO_URING_USER_DATA_READ  1
+#define IO_URING_USER_DATA_WRITE 2
+
+// uart config
+static const btstack_uart_config_t * uart_config;
+static int uart_fd = -1;
+
+// io_uring
+static int                    ring_fd = -1;
+static void *                 sq_ring_ptr;
+static size_t                 sq_ring_size;
+static void *                 cq_ring_ptr;
+static size_t                 cq_ring_size;
+static struct io_uring_sqe *  sqes;
+static size_t                 sqes_size;
+static uint32_t *             sq_head;
+static uint32_t *             sq_tail;
+static uint32_t               sq_mask;
+static uint32_t *             sq_array;
+static uint32_t *             cq_head;
+static uint32_t *             cq_tail;
+static uint32_t               cq_mask;
+static struct io_uring_cqe *  cqes;
+static uint32_t               sq_pending;
+
+// data source for completion eventfd
+static btstack_data_source_t transport_data_source;
+
+// set while completions are processed, submission is deferred until done
+static int in_process;
+
+// receive ring buffer
+static uint8_t      rx_buffer[BTSTACK_UART_IO_URING_RX_BUFFER_SIZE];
+static uint32_t     rx_read_pos;
+static uint32_t     rx_level;
+static int          rx_submitted;
+static int          rx_stopped;
+static struct iovec rx_iovec[2];
+
+// block read
+static uint16_t  read_bytes_len;
+static uint8_t * read_bytes_data;
+
+// block write, remaining blocks starting at write_iovec_pos
+static struct iovec    write_iovec[BTSTACK_UART_MAX_SEND_BLOCKS];
+static int             write_iovec_pos;
+static int             write_iovec_count;
+
+// callbacks
+static void (*block_sent)(void);
+static void (*block_received)(void);
+static void (*data_received)(const uint8_t * data, uint16_t size);
+
+
+static int btstack_uart_io_uring_init(const btstack_uart_config_t * config){
+    uart_config = config;
+    return 0;
+}
+
+static void btstack_uart_io_uring_ring_free(void){
+    if (sqes != NULL){
+        munmap(sqes, sqes_size);
+        sqes = NULL;
+    }
+    if (cq_ring_ptr != NULL){
+        munmap(cq_ring_ptr, cq_ring_size);
+        cq_ring_ptr = NULL;
+    }
+    if (sq_ring_ptr != NULL){
+        munmap(sq_ring_ptr, sq_ring_size);
+        sq_ring_ptr = NULL;
+    }
+    if (ring_fd >= 0){
+        // closing the ring cancels outstanding requests
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    sq_pending = 0;
+}
+
+static void * btstack_uart_io_uring_mmap(size_t size, off_t offset){
+    void * ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+    if (ptr == MAP_FAILED) {
+        log_error("mmap io_uring failed, %s", strerror(errno));
+        return NULL;
+    }
+    return ptr;
+}
+
+static int btstack_uart_io_uring_ring_setup(void){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = (int) syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params);
+    if (ring_fd < 0){
+        log_error("io_uring_setup failed, %s", strerror(errno));
+        return -1;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqes_size    = params.sq_entries * sizeof(struct io_uring_sqe);
+    sq_ring_ptr  = btstack_uart_io_uring_mmap(sq_ring_size, IORING_OFF_SQ_RING);
+    cq_ring_ptr  = btstack_uart_io_uring_mmap(cq_ring_size, IORING_OFF_CQ_RING);
+    sqes         = (struct io_uring_sqe *) btstack_uart_io_uring_mmap(sqes_size, IORING_OFF_SQES);
+    if ((sq_ring_ptr == NULL) || (cq_ring_ptr == NULL) || (sqes == NULL)){
+        btstack_uart_io_uring_ring_free();
+        return -1;
+    }
+
+    uint8_t * sq_ring = (uint8_t *) sq_ring_ptr;
+    sq_head  = (uint32_t *) &sq_ring[params.sq_off.head];
+    sq_tail  = (uint32_t *) &sq_ring[params.sq_off.tail];
+    sq_mask  = *(uint32_t *) &sq_ring[params.sq_off.ring_mask];
+    sq_array = (uint32_t *) &sq_ring[params.sq_off.array];
+
+    uint8_t * cq_ring = (uint8_t *) cq_ring_ptr;
+    cq_head  = (uint32_t *) &cq_ring[params.cq_off.head];
+    cq_tail  = (uint32_t *) &cq_ring[params.cq_off.tail];
+    cq_mask  = *(uint32_t *) &cq_ring[params.cq_off.ring_mask];
+    cqes     = (struct io_uring_cqe *) &cq_ring[params.cq_off.cqes];
+
+    sq_pending = 0;
+    return 0;
+}
+
+static void btstack_uart_io_uring_queue(uint8_t opcode, const struct iovec * iov, uint32_t iov_count, uint64_t user_data){
+    uint32_t tail = *sq_tail;
+    uint32_t head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if ((tail - head) > sq_mask){
+        log_error("io_uring submission queue full");
+        return;
+    }
+    uint32_t index = tail & sq_mask;
+    struct io_uring_sqe * sqe = &sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode    = opcode;
+    sqe->fd        = uart_fd;
+    sqe->addr      = (uint64_t) (uintptr_t) iov;
+    sqe->len       = iov_count;
+    sqe->user_data = user_data;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    sq_pending++;
+}
+
+static void btstack_uart_io_uring_submit(void){
+    while (sq_pending > 0){
+        int res = (int) syscall(__NR_io_uring_enter, ring_fd, sq_pending, 0, 0, NULL, 0);
+        if (res > 0){
+            sq_pending -= (uint32_t) res;
+            continue;
+        }
+        if ((res < 0) && (errno == EINTR)) continue;
+        log_error("io_uring_enter failed, %s", strerror(errno));
+        break;
+    }
+}
+
+static void btstack_uart_io_uring_queue_read(void){
+    if (rx_submitted) return;
+    if (rx_stopped)   return;
+
+    uint32_t bytes_free = BTSTACK_UART_IO_URING_RX_BUFFER_SIZE - rx_level;
+    if (bytes_free == 0) return;
+
+    // read into free space, wrapping around end of buffer
+    uint32_t write_pos = (rx_read_pos + rx_level) % BTSTACK_UART_IO_URING_RX_BUFFER_SIZE;
+    uint32_t bytes_till_end = btstack_min(bytes_free, BTSTACK_UART_IO_URING_RX_BUFFER_SIZE - write_pos);
+    uint32_t iov_count = 1;
+    rx_iovec[0].iov_base = &rx_buffer[write_pos];
+    rx_iovec[0].iov_len  = bytes_till_end;
+    if (bytes_till_end < bytes_free){
+        rx_iovec[1].iov_base = &rx_buffer[0];
+        rx_iovec[1].iov_len  = bytes_free - bytes_till_end;
+        iov_count = 2;
+    }
+    btstack_uart_io_uring_queue(IORING_OP_READV, rx_iovec, iov_count, IO_URING_USER_DATA_READ);
+    rx_submitted = 1;
+}
+
+static void btstack_uart_io_uring_queue_write(void){
+    btstack_uart_io_uring_queue(IORING_OP_WRITEV, &write_iovec[write_iovec_pos], write_iovec_count - write_iovec_pos, IO_URING_USER_DATA_WRITE);
+}
+
+static void btstack_uart_io_uring_handle_read(int32_t res){
+    rx_submitted = 0;
+    if (res < 0){
+        if ((res == -EINTR) || (res == -EAGAIN)) return;
+        log_error("read returned error %d", (int) res);
+        rx_stopped = 1;
+        return;
+    }
+    if (res == 0){
+        log_error("read zero bytes");
+        rx_stopped = 1;
+        return;
+    }
+    rx_level += (uint32_t) res;
+}
+
+static void btstack_uart_io_uring_handle_write(int32_t res){
+    if (res < 0){
+        log_error("write returned error %d", (int) res);
+        if ((res == -EINTR) || (res == -EAGAIN)){
+            btstack_uart_io_uring_queue_write();
+        }
+        return;
+    }
+    if (res == 0){
+        log_error("wrote zero bytes");
+        return;
+    }
+
+    // skip written blocks
+    while ((write_iovec_pos < write_iovec_count) && ((size_t) res >= write_iovec[write_iovec_pos].iov_len)){
+        res -= (int32_t) write_iovec[write_iovec_pos].iov_len;
+        write_iovec_pos++;
+    }
+    if (write_iovec_pos < write_iovec_count){
+        write_iovec[write_iovec_pos].iov_base = ((uint8_t *) write_iovec[write_iovec_pos].iov_base) + res;
+        write_iovec[write_iovec_pos].iov_len -= res;
+        btstack_uart_io_uring_queue_write();
+        return;
+    }
+
+    // notify done
+    if (block_sent){
+        block_sent();
+    }
+}
+
+// serve pending receive_block request from receive buffer, returns 1 if block was delivered
+static int btstack_uart_io_uring_deliver_block(void){
+    uint16_t len = read_bytes_len;
+    if (len == 0) return 0;
+    if (rx_level < len) return 0;
+
+    uint32_t bytes_till_end = btstack_min(len, BTSTACK_UART_IO_URING_RX_BUFFER_SIZE - rx_read_pos);
+    (void)memcpy(read_bytes_data, &rx_buffer[rx_read_pos], bytes_till_end);
+    if (bytes_till_end < len){
+        (void)memcpy(&read_bytes_data[bytes_till_end], &rx_buffer[0], len - bytes_till_end);
+    }
+    rx_read_pos = (rx_read_pos + len) % BTSTACK_UART_IO_URING_RX_BUFFER_SIZE;
+    rx_level   -= len;
+    read_bytes_len = 0;
+
+    if (block_received){
+        block_received();
+    }
+    return 1;
+}
+
+// streaming mode: pass all buffered data to handler, returns 1 if data was delivered
+static int btstack_uart_io_uring_deliver_data(void){
+    if (rx_level == 0) return 0;
+
+    // contiguous data up to end of buffer
+    uint32_t bytes_till_end = btstack_min(rx_level, BTSTACK_UART_IO_URING_RX_BUFFER_SIZE - rx_read_pos);
+    uint16_t len = (uint16_t) btstack_min(bytes_till_end, 0xffff);
+    const uint8_t * data = &rx_buffer[rx_read_pos];
+    rx_read_pos = (rx_read_pos + len) % BTSTACK_UART_IO_URING_RX_BUFFER_SIZE;
+    rx_level   -= len;
+
+    // buffer is not refilled before processing is complete
+    (*data_received)(data, len);
+    return 1;
+}
+
+static int btstack_uart_io_uring_deliver(void){
+    if (data_received){
+        return btstack_uart_io_uring_deliver_data();
+    } else {
+        return btstack_uart_io_uring_deliver_block();
+    }
+}
+
+static void btstack_uart_io_uring_process(btstack_data_source_t *ds, btstack_data_source_callback_type_t callback_type) {
+    if (callback_type != DATA_SOURCE_CALLBACK_READ) return;
+    if (ring_fd < 0) return;
+
+    // reset eventfd
+    uint64_t counter;
+    ssize_t bytes_read = read(ds->source.fd, &counter, sizeof(counter));
+    UNUSED(bytes_read);
+
+    in_process = 1;
+
+    uint32_t head = *cq_head;
+    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+        const struct io_uring_cqe * cqe = &cqes[head & cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int32_t  res       = cqe->res;
+        head++;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        switch (user_data){
+            case IO_URING_USER_DATA_READ:
+                btstack_uart_io_uring_handle_read(res);
+                break;
+            case IO_URING_USER_DATA_WRITE:
+                btstack_uart_io_uring_handle_write(res);
+                // block_sent handler might have closed the uart
+                if (ring_fd < 0) {
+                    in_process = 0;
+                    return;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    while (btstack_uart_io_uring_deliver()){
+        // block_received or data_received handler might have closed the uart
+        if (ring_fd < 0) break;
+    }
+
+    in_process = 0;
+
+    if (ring_fd < 0) return;
+
+    // re-arm read and submit everything queued by the callbacks with a single syscall
+    btstack_uart_io_uring_queue_read();
+    btstack_uart_io_uring_submit();
+}
+
+static int btstack_uart_io_uring_set_baudrate(uint32_t baudrate){
+
+    int fd = uart_fd;
+
+    log_info("h4_set_baudrate %u", baudrate);
+
+    struct termios toptions;
+
+    if (tcgetattr(fd, &toptions) < 0) {
+        log_error("btstack_uart_io_uring_set_baudrate: Couldn't get term attributes");
+        return -1;
+    }
+
+    speed_t brate = baudrate; // let you override switch below if needed
+    switch(baudrate) {
+        case    9600: brate=B9600;    break;
+        case   19200: brate=B19200;   break;
+        case   38400: brate=B38400;   break;
+        case   57600: brate=B57600;   break;
+        case  115200: brate=B115200;  break;
+        case  230400: brate=B230400;  break;
+        case  460800: brate=B460800;  break;
+        case  500000: brate=B500000;  break;
+        case  576000: brate=B576000;  break;
+        case  921600: brate=B921600;  break;
+        case 1000000: brate=B1000000; break;
+        case 1152000: brate=B1152000; break;
+        case 1500000: brate=B1500000; break;
+        case 2000000: brate=B2000000; break;
+        case 2500000: brate=B2500000; break;
+        case 3000000: brate=B3000000; break;
+        case 3500000: brate=B3500000; break;
+        case 4000000: brate=B4000000; break;
+        default:
+            log_error("can't set baudrate %dn", baudrate );
+            return -1;
+    }
+    cfsetospeed(&toptions, brate);
+    cfsetispeed(&toptions, brate);
+
+    if( tcsetattr(fd, TCSANOW, &toptions) < 0) {
+        log_error("Couldn't set term attributes");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void btstack_uart_io_uring_set_parity_option(struct termios * toptions, int parity){
+    if (parity){
+        // enable even parity
+        toptions->c_cflag |= PARENB;
+    } else {
+        // disable even parity
+        toptions->c_cflag &= ~PARENB;
+    }
+}
+
+static void btstack_uart_io_uring_set_flowcontrol_option(struct termios * toptions, int flowcontrol){
+    if (flowcontrol) {
+        // with flow control
+        toptions->c_cflag |= CRTSCTS;
+    } else {
+        // no flow control
+        toptions->c_cflag &= ~CRTSCTS;
+    }
+}
+
+static int btstack_uart_io_uring_set_parity(int parity){
+    struct termios toptions;
+    if (tcgetattr(uart_fd, &toptions) < 0) {
+        log_error("Couldn't get term attributes");
+        return -1;
+    }
+    btstack_uart_io_uring_set_parity_option(&toptions, parity);
+    if(tcsetattr(uart_fd, TCSANOW, &toptions) < 0) {
+        log_error("Couldn't set term attributes");
+        return -1;
+    }
+    return 0;
+}
+
+static int btstack_uart_io_uring_set_flowcontrol(int flowcontrol){
+    struct termios toptions;
+    if (tcgetattr(uart_fd, &toptions) < 0) {
+        log_error("Couldn't get term attributes");
+        return -1;
+    }
+    btstack_uart_io_uring_set_flowcontrol_option(&toptions, flowcontrol);
+    if(tcsetattr(uart_fd, TCSANOW, &toptions) < 0) {
+        log_error("Couldn't set term attributes");
+        return -1;
+    }
+    return 0;
+}
+
+static int btstack_uart_io_uring_close(void);
+
+static int btstack_uart_io_uring_open(void){
+
+    const char * device_name = uart_config->device_name;
+    const int flowcontrol    = uart_config->flowcontrol;
+    const uint32_t baudrate  = uart_config->baudrate;
+
+    transport_data_source.source.fd = -1;
+
+    struct termios toptions;
+    int flags = O_RDWR | O_NOCTTY | O_NONBLOCK;
+    int fd = open(device_name, flags);
+    if (fd == -1)  {
+        log_error("Unable to open port %s", device_name);
+        return -1;
+    }
+    uart_fd = fd;
+
+    // io_uring completes reads on non-blocking files with -EAGAIN instead of waiting for data
+    flags = fcntl(fd, F_GETFL);
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0)){
+        log_error("Couldn't clear O_NONBLOCK");
+        btstack_uart_io_uring_close();
+        return -1;
+    }
+
+    if (tcgetattr(fd, &toptions) < 0) {
+        log_error("Couldn't get term attributes");
+        btstack_uart_io_uring_close();
+        return -1;
+    }
+
+    cfmakeraw(&toptions);   // make raw
+
+    // 8N1
+    toptions.c_cflag &= ~CSTOPB;
+    toptions.c_cflag |= CS8;
+
+    toptions.c_cflag |= CREAD | CLOCAL;  // turn on READ & ignore ctrl lines
+    toptions.c_iflag &= ~(IXON | IXOFF | IXANY); // turn off s/w flow ctrl
+
+    // see: http://unixwiz.net/techtips/termios-vmin-vtime.html
+    toptions.c_cc[VMIN]  = 1;
+    toptions.c_cc[VTIME] = 0;
+
+    // no parity
+    btstack_uart_io_uring_set_parity_option(&toptions, 0);
+
+    // flowcontrol
+    btstack_uart_io_uring_set_flowcontrol_option(&toptions, flowcontrol);
+
+    if(tcsetattr(fd, TCSANOW, &toptions) < 0) {
+        log_error("Couldn't set term attributes");
+        btstack_uart_io_uring_close();
+        return -1;
+    }
+
+    // also set baudrate
+    if (btstack_uart_io_uring_set_baudrate(baudrate) < 0){
+        btstack_uart_io_uring_close();
+        return -1;
+    }
+
+    // setup io_uring with eventfd for completion notification
+    if (btstack_uart_io_uring_ring_setup() < 0){
+        btstack_uart_io_uring_close();
+        return -1;
+    }
+    int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0){
+        log_error("eventfd failed, %s", strerror(errno));
+        btstack_uart_io_uring_close();
+        return -1;
+    }
+    btstack_run_loop_set_data_source_fd(&transport_data_source, event_fd);
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0){
+        log_error("io_uring_register eventfd failed, %s", strerror(errno));
+        btstack_uart_io_uring_close();
+        return -1;
+    }
+
+    // set up data_source
+    btstack_run_loop_set_data_source_handler(&transport_data_source, &btstack_uart_io_uring_process);
+    btstack_run_loop_enable_data_source_callbacks(&transport_data_source, DATA_SOURCE_CALLBACK_READ);
+    btstack_run_loop_add_data_source(&transport_data_source);
+
+    // start receiving
+    rx_read_pos    = 0;
+    rx_level       = 0;
+    rx_submitted   = 0;
+    rx_stopped     = 0;
+    read_bytes_len = 0;
+    write_iovec_pos = 0;
+    write_iovec_count = 0;
+    btstack_uart_io_uring_queue_read();
+    btstack_uart_io_uring_submit();
+
+    // wait a bit - at least cheap FTDI232 clones might send the first byte out incorrectly
+    usleep(100000);
+
+    return 0;
+}
+
+static int btstack_uart_io_uring_close(void){
+
+    // first remove run loop handler
+    btstack_run_loop_remove_data_source(&transport_data_source);
+
+    // then tear down ring and close device
+    btstack_uart_io_uring_ring_free();
+    if (transport_data_source.source.fd >= 0){
+        close(transport_data_source.source.fd);
+    }
+    transport_data_source.source.fd = -1;
+    if (uart_fd >= 0){
+        close(uart_fd);
+        uart_fd = -1;
+    }
+    rx_submitted = 0;
+    return 0;
+}
+
+static void btstack_uart_io_uring_set_block_received( void (*block_handler)(void)){
+    block_received = block_handler;
+}
+
+static void btstack_uart_io_uring_set_block_sent( void (*block_handler)(void)){
+    block_sent = block_handler;
+}
+
+static void btstack_uart_io_uring_set_data_received( void (*data_handler)(const uint8_t * data, uint16_t size)){
+    data_received = data_handler;
+}
+
+static void btstack_uart_io_uring_send_blocks(const btstack_uart_block_segment_t * blocks, uint16_t num_blocks){
+    if (num_blocks > BTSTACK_UART_MAX_SEND_BLOCKS){
+        log_error("send_blocks: %u blocks > BTSTACK_UART_MAX_SEND_BLOCKS", num_blocks);
+        return;
+    }
+    uint16_t i;
+    for (i = 0; i < num_blocks; i++){
+        write_iovec[i].iov_base = (void *) blocks[i].data;
+        write_iovec[i].iov_len  = blocks[i].len;
+    }
+    write_iovec_pos   = 0;
+    write_iovec_count = num_blocks;
+    btstack_uart_io_uring_queue_write();
+
+    // submitted together with re-armed read after completions have been processed
+    if (in_process) return;
+    btstack_uart_io_uring_submit();
+}
+
+static void btstack_uart_io_uring_send_block(const uint8_t *data, uint16_t size){
+    btstack_uart_block_segment_t block = { data, size };
+    btstack_uart_io_uring_send_blocks(&block, 1);
+}
+
+static void btstack_uart_io_uring_receive_block(uint8_t *buffer, uint16_t len){
+    // block has to fit into receive buffer, request would never complete otherwise
+    if (len > BTSTACK_UART_IO_URING_RX_BUFFER_SIZE){
+        log_error("receive_block: %u bytes > BTSTACK_UART_IO_URING_RX_BUFFER_SIZE", len);
+        return;
+    }
+    read_bytes_data = buffer;
+    read_bytes_len  = len;
+
+    // served from receive buffer after completions have been processed
+    if (in_process) return;
+
+    // data already available, trigger processing via eventfd to avoid recursion into block_received handler
+    if (rx_level >= len){
+        uint64_t counter = 1;
+        ssize_t bytes_written = write(transport_data_source.source.fd, &counter, sizeof(counter));
+        UNUSED(bytes_written);
+    }
+}
+
+static const btstack_uart_block_t btstack_uart_io_uring = {
+    /* int  (*init)(hci_transport_config_uart_t * config); */         &btstack_uart_io_uring_init,
+    /* int  (*open)(void); */                                         &btstack_uart_io_uring_open,
+    /* int  (*close)(void); */                                        &btstack_uart_io_uring_close,
+    /* void (*set_block_received)(void (*handler)(void)); */          &btstack_uart_io_uring_set_block_received,
+    /* void (*set_block_sent)(void (*handler)(void)); */              &btstack_uart_io_uring_set_block_sent,
+    /* int  (*set_baudrate)(uint32_t baudrate); */                    &btstack_uart_io_uring_set_baudrate,
+    /* int  (*set_parity)(int parity); */                             &btstack_uart_io_uring_set_parity,
+    /* int  (*set_flowcontrol)(int flowcontrol); */                   &btstack_uart_io_uring_set_flowcontrol,
+    /* void (*receive_block)(uint8_t *buffer, uint16_t len); */       &btstack_uart_io_uring_receive_block,
+    /* void (*send_block)(const uint8_t *buffer, uint16_t length); */ &btstack_uart_io_uring_send_block,
+    /* int (*get_supported_sleep_modes); */                           NULL,
+    /* void (*set_sleep)(btstack_uart_sleep_mode_t sleep_mode); */    NULL,
+    /* void (*set_wakeup_handler)(void (*handler)(void)); */          NULL,
+    /* void (*set_data_received)(void (*handler)(const uint8_t * data, uint16_t size)); */ &btstack_uart_io_uring_set_data_received,
+    /* void (*send_blocks)(const btstack_uart_block_segment_t * blocks, uint16_t num_blocks); */ &btstack_uart_io_uring_send_blocks,
+};
+
+const btstack_uart_block_t * btstack_uart_block_io_uring_instance(void){
+    return &btstack_uart_io_uring;
+}
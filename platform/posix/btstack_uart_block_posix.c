@@ -53,6 +53,7 @@
 #include <unistd.h>   /* UNIX standard function definitions */
 #include <string.h>
 #include <errno.h>
+#include <sys/uio.h>
 #ifdef __APPLE__
 #include <sys/ioctl.h>
 #include <IOKit/serial/ioss.h>
@@ -64,17 +65,23 @@ static const btstack_uart_config_t * uart_config;
 // data source for integration with BTstack Runloop
 static btstack_data_source_t transport_data_source;
 
-// block write
-static int             write_bytes_len;
-static const uint8_t * write_bytes_data;
+// block write, remaining blocks starting at write_iovec_pos
+static struct iovec    write_iovec[BTSTACK_UART_MAX_SEND_BLOCKS];
+static int             write_iovec_pos;
+static int             write_iovec_count;
 
 // block read
 static uint16_t  read_bytes_len;
 static uint8_t * read_bytes_data;
 
+// streaming mode
+#define UART_POSIX_STREAM_BUFFER_SIZE 1024
+static uint8_t stream_buffer[UART_POSIX_STREAM_BUFFER_SIZE];
+
 // callbacks
 static void (*block_sent)(void);
 static void (*block_received)(void);
+static void (*data_received)(const uint8_t * data, uint16_t size);
 
 
 static int btstack_uart_posix_init(const btstack_uart_config_t * config){
@@ -84,12 +91,12 @@ static int btstack_uart_posix_init(const btstack_uart_config_t * config){
 
 static void btstack_uart_posix_process_write(btstack_data_source_t *ds) {
     
-    if (write_bytes_len == 0) return;
+    if (write_iovec_pos == write_iovec_count) return;
 
     uint32_t start = btstack_run_loop_get_time_ms();
 
-    // write up to write_bytes_len to fd
-    int bytes_written = (int) write(ds->source.fd, write_bytes_data, write_bytes_len);
+    // write remaining blocks to fd
+    int bytes_written = (int) writev(ds->source.fd, &write_iovec[write_iovec_pos], write_iovec_count - write_iovec_pos);
     uint32_t end = btstack_run_loop_get_time_ms();
     if (end - start > 10){
         log_info("write took %u ms", end - start);
@@ -104,10 +111,14 @@ static void btstack_uart_posix_process_write(btstack_data_source_t *ds) {
         return;
     }
 
-    write_bytes_data += bytes_written;
-    write_bytes_len  -= bytes_written;
-
-    if (write_bytes_len){
+    // skip written blocks
+    while ((write_iovec_pos < write_iovec_count) && ((size_t) bytes_written >= write_iovec[write_iovec_pos].iov_len)){
+        bytes_written -= (int) write_iovec[write_iovec_pos].iov_len;
+        write_iovec_pos++;
+    }
+    if (write_iovec_pos < write_iovec_count){
+        write_iovec[write_iovec_pos].iov_base = ((uint8_t *) write_iovec[write_iovec_pos].iov_base) + bytes_written;
+        write_iovec[write_iovec_pos].iov_len -= bytes_written;
         btstack_run_loop_enable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_WRITE);
         return;
     }
@@ -120,8 +131,29 @@ static void btstack_uart_posix_process_write(btstack_data_source_t *ds) {
     }
 }
 
+static void btstack_uart_posix_process_stream(btstack_data_source_t *ds) {
+
+    // read whatever is available and pass it on
+    ssize_t bytes_read = read(ds->source.fd, stream_buffer, sizeof(stream_buffer));
+    if (bytes_read == 0){
+        log_error("read zero bytes\n");
+        return;
+    }
+    if (bytes_read < 0) {
+        log_error("read returned error\n");
+        return;
+    }
+
+    (*data_received)(stream_buffer, (uint16_t) bytes_read);
+}
+
 static void btstack_uart_posix_process_read(btstack_data_source_t *ds) {
 
+    if (data_received){
+        btstack_uart_posix_process_stream(ds);
+        return;
+    }
+
     if (read_bytes_len == 0) {
         log_info("called but no read pending");
         btstack_run_loop_disable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_READ);
@@ -368,6 +400,11 @@ static int btstack_uart_posix_open(void){
     btstack_run_loop_set_data_source_handler(&transport_data_source, &hci_uart_posix_process);
     btstack_run_loop_add_data_source(&transport_data_source);
 
+    // streaming mode: always read
+    if (data_received){
+        btstack_run_loop_enable_data_source_callbacks(&transport_data_source, DATA_SOURCE_CALLBACK_READ);
+    }
+
     // wait a bit - at least cheap FTDI232 clones might send the first byte out incorrectly
     usleep(100000);
 
@@ -393,16 +430,39 @@ static void btstack_uart_posix_set_block_sent( void (*block_handler)(void)){
     block_sent = block_handler;
 }
 
+static void btstack_uart_posix_set_data_received( void (*data_handler)(const uint8_t * data, uint16_t size)){
+    data_received = data_handler;
+}
+
 static void btstack_uart_posix_send_block(const uint8_t *data, uint16_t size){
     // setup async write
-    write_bytes_data = data;
-    write_bytes_len  = size;
+    write_iovec[0].iov_base = (void *) data;
+    write_iovec[0].iov_len  = size;
+    write_iovec_pos   = 0;
+    write_iovec_count = 1;
 
     // go
     // btstack_uart_posix_process_write(&transport_data_source);
     btstack_run_loop_enable_data_source_callbacks(&transport_data_source, DATA_SOURCE_CALLBACK_WRITE);
 }
 
+static void btstack_uart_posix_send_blocks(const btstack_uart_block_segment_t * blocks, uint16_t num_blocks){
+    if (num_blocks > BTSTACK_UART_MAX_SEND_BLOCKS){
+        log_error("send_blocks: %u blocks > BTSTACK_UART_MAX_SEND_BLOCKS", num_blocks);
+        return;
+    }
+    // setup async write of all blocks with writev
+    uint16_t i;
+    for (i = 0; i < num_blocks; i++){
+        write_iovec[i].iov_base = (void *) blocks[i].data;
+        write_iovec[i].iov_len  = blocks[i].len;
+    }
+    write_iovec_pos   = 0;
+    write_iovec_count = num_blocks;
+
+    btstack_run_loop_enable_data_source_callbacks(&transport_data_source, DATA_SOURCE_CALLBACK_WRITE);
+}
+
 static void btstack_uart_posix_receive_block(uint8_t *buffer, uint16_t len){
     read_bytes_data = buffer;
     read_bytes_len = len;
@@ -431,6 +491,8 @@ static const btstack_uart_block_t btstack_uart_posix = {
     /* int (*get_supported_sleep_modes); */                           NULL,
     /* void (*set_sleep)(btstack_uart_sleep_mode_t sleep_mode); */    NULL,
     /* void (*set_wakeup_handler)(void (*handler)(void)); */          NULL,
+    /* void (*set_data_received)(void (*handler)(const uint8_t * data, uint16_t size)); */ &btstack_uart_posix_set_data_received,
+    /* void (*send_blocks)(const btstack_uart_block_segment_t * blocks, uint16_t num_blocks); */ &btstack_uart_posix_send_blocks,
 };
 
 const btstack_uart_block_t * btstack_uart_block_posix_instance(void){
@@ -0,0 +1,1974 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "hci_transport_virtual.c"
+
+/*
+ *  hci_transport_virtual.c
+ *
+ *  Software Bluetooth Controller for testing and benchmarking without hardware.
+ *
+ *  Two virtual controllers exchange link messages over a SOCK_SEQPACKET socket. Each link message carries
+ *  the absolute CLOCK_MONOTONIC time when it arrives at the peer. ACL packets occupy the radio link according
+ *  to the configured bit rate, lost transmissions are repeated, and the Number Of Completed Packets event is
+ *  sent when the acknowledgement would have been received.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hci_transport_virtual.h"
+
+#include "btstack_config.h"
+#include "btstack_debug.h"
+#include "btstack_run_loop.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "rijndael.h"
+
+#define VIRTUAL_OPCODE(ogf, ocf) ((ocf) | ((ogf) << 10))
+
+#define VIRTUAL_MAX_CONNECTIONS 4
+
+// LE Extended Advertising
+#define VIRTUAL_MAX_ADVERTISING_SETS     HCI_TRANSPORT_VIRTUAL_MAX_ADVERTISING_SETS
+#define VIRTUAL_MAX_ADVERTISING_DATA_LEN HCI_TRANSPORT_VIRTUAL_MAX_ADVERTISING_DATA_LEN
+#define VIRTUAL_EXTENDED_ADVERTISING_REPORT_DATA_LEN HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORT_DATA_LEN
+
+// radio link, largest message is advertising set with advertising and scan response data
+#define VIRTUAL_RETRANSMISSION_DELAY_US 1250
+#define VIRTUAL_LINK_MESSAGE_MAX_SIZE (1 + 8 + 20 + (2 * VIRTUAL_MAX_ADVERTISING_DATA_LEN))
+
+// default ACL buffers
+#define VIRTUAL_ACL_BUFFER_SIZE  1021
+#define VIRTUAL_ACL_BUFFER_COUNT 8
+
+// size of host packet buffer for events, allows hci.c to terminate local name
+#define VIRTUAL_EVENT_BUFFER_SIZE (2 + 255 + 1)
+
+typedef enum {
+    LINK_MESSAGE_CLOSED = 0,     // local: peer controller closed the link
+    LINK_MESSAGE_INFO,       // scan enable, class of device, local name
+    LINK_MESSAGE_ADVERTISING,    // advertising enable, type, address, data
+    LINK_MESSAGE_CONNECT_REQUEST,
+    LINK_MESSAGE_CONNECT_RESPONSE,
+    LINK_MESSAGE_ACL,
+    LINK_MESSAGE_DISCONNECT,
+    LINK_MESSAGE_LE_ENCRYPTION_REQUEST,
+    LINK_MESSAGE_LE_ENCRYPTION_RESPONSE,
+    LINK_MESSAGE_LE_CONNECTION_UPDATE,
+    LINK_MESSAGE_EXTENDED_ADVERTISING,  // advertising set enable, properties, address, data
+} virtual_link_message_t;
+
+typedef enum {
+    VIRTUAL_CONNECTION_FREE = 0,
+    VIRTUAL_CONNECTION_PAGING,
+    VIRTUAL_CONNECTION_W4_CONNECT_RESPONSE,
+    VIRTUAL_CONNECTION_W4_ACCEPT,
+    VIRTUAL_CONNECTION_OPEN,
+} virtual_connection_state_t;
+
+typedef struct {
+    virtual_connection_state_t state;
+    hci_con_handle_t con_handle;
+    hci_con_handle_t peer_con_handle;
+    uint8_t  le;
+    uint8_t  cancelled;
+    uint64_t page_timeout_us;
+    bd_addr_type_t peer_addr_type;
+    bd_addr_t peer_addr;
+    // LE encryption
+    uint8_t  encrypted;
+    uint8_t  ltk_request_pending;
+    uint8_t  requested_ltk[16];
+} virtual_connection_t;
+
+// local advertising set or advertising set of peer
+typedef struct {
+    uint8_t  in_use;
+    uint8_t  handle;
+    uint8_t  enabled;
+    uint16_t properties;
+    uint8_t  address_type;
+    uint8_t  address[6];        // little endian, local: random address for advertising set
+    uint8_t  sid;
+    uint8_t  primary_phy;       // 1: LE 1M, 3: LE Coded
+    uint8_t  secondary_phy;
+    uint16_t interval;
+    uint16_t data_len;
+    uint8_t  data[VIRTUAL_MAX_ADVERTISING_DATA_LEN];
+    uint16_t scan_response_data_len;
+    uint8_t  scan_response_data[VIRTUAL_MAX_ADVERTISING_DATA_LEN];
+} virtual_advertising_set_t;
+
+// packets for host, received link messages, and pending completions
+typedef struct virtual_packet {
+    struct virtual_packet * next;
+    uint64_t due_us;
+    uint8_t  packet_type;
+    uint16_t size;
+    uint8_t  data[1];
+} virtual_packet_t;
+
+typedef struct {
+    virtual_packet_t * head;
+    virtual_packet_t * tail;
+} virtual_queue_t;
+
+static hci_transport_config_virtual_t virtual_config;
+static void (*virtual_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+
+static btstack_data_source_t virtual_link_data_source;
+static btstack_timer_source_t virtual_timer;
+static int      virtual_timer_active;
+static btstack_timer_source_t virtual_advertising_timer;
+static int      virtual_advertising_timer_active;
+
+static virtual_queue_t virtual_host_queue;
+static virtual_queue_t virtual_link_queue;
+static virtual_queue_t virtual_completed_queue;
+
+static uint64_t virtual_link_tx_busy_until_us;
+static uint64_t virtual_link_last_arrival_us;
+static uint32_t virtual_random_state;
+static uint16_t virtual_acl_buffers_used;
+
+static virtual_connection_t virtual_connections[VIRTUAL_MAX_CONNECTIONS];
+
+// local state
+static uint8_t  virtual_local_name[248];
+static uint8_t  virtual_scan_enable;
+static uint32_t virtual_class_of_device;
+static uint32_t virtual_page_timeout_us;
+static bd_addr_t virtual_le_random_address;
+static uint8_t  virtual_le_advertising_enabled;
+static uint8_t  virtual_le_advertising_type;
+static uint8_t  virtual_le_advertising_own_address_type;
+static uint16_t virtual_le_advertising_interval;
+static uint8_t  virtual_le_advertising_data_len;
+static uint8_t  virtual_le_advertising_data[31];
+static uint8_t  virtual_le_scan_response_data_len;
+static uint8_t  virtual_le_scan_response_data[31];
+static uint8_t  virtual_le_scan_enable;
+static uint8_t  virtual_le_scan_extended;
+static uint8_t  virtual_le_scan_type;
+static uint8_t  virtual_le_scan_phys;
+static uint8_t  virtual_le_connecting;
+static uint8_t  virtual_le_initiating_phys;
+static uint8_t  virtual_le_create_connection[25];
+static virtual_advertising_set_t virtual_le_advertising_sets[VIRTUAL_MAX_ADVERTISING_SETS];
+
+// peer state
+static bd_addr_t virtual_peer_addr;
+static uint8_t  virtual_peer_name[248];
+static uint8_t  virtual_peer_scan_enable;
+static uint32_t virtual_peer_class_of_device;
+static uint8_t  virtual_peer_advertising[1 + 1 + 1 + 6 + 2 + 1 + 31 + 1 + 31];
+static virtual_advertising_set_t virtual_peer_advertising_sets[VIRTUAL_MAX_ADVERTISING_SETS];
+
+// Classic: 3/5 slot, EDR 2/3 Mbps, 3/5 slot EDR. LE supported. No Secure Simple Pairing as pairing is not emulated
+static const uint8_t virtual_local_supported_features[8] = { 0x03, 0x00, 0x00, 0x06, 0xC0, 0x01, 0x00, 0x00 };
+
+static uint64_t virtual_get_time_us(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000u) + ((uint64_t) now.tv_nsec / 1000u);
+}
+
+// xorshift32
+static uint32_t virtual_random(void){
+    uint32_t x = virtual_random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    virtual_random_state = x;
+    return x;
+}
+
+// queue
+
+static virtual_packet_t * virtual_packet_create(uint8_t packet_type, uint16_t size, uint16_t buffer_size){
+    virtual_packet_t * packet = (virtual_packet_t *) malloc(sizeof(virtual_packet_t) + buffer_size);
+    if (packet == NULL){
+        log_error("virtual: out of memory");
+        return NULL;
+    }
+    packet->next = NULL;
+    packet->due_us = 0;
+    packet->packet_type = packet_type;
+    packet->size = size;
+    return packet;
+}
+
+static void virtual_queue_add(virtual_queue_t * queue, virtual_packet_t * packet){
+    if (queue->tail == NULL){
+        queue->head = packet;
+    } else {
+        queue->tail->next = packet;
+    }
+    queue->tail = packet;
+}
+
+static virtual_packet_t * virtual_queue_pop(virtual_queue_t * queue){
+    virtual_packet_t * packet = queue->head;
+    if (packet == NULL) return NULL;
+    queue->head = packet->next;
+    if (queue->head == NULL){
+        queue->tail = NULL;
+    }
+    return packet;
+}
+
+static void virtual_queue_free(virtual_queue_t * queue){
+    virtual_packet_t * packet;
+    while ((packet = virtual_queue_pop(queue)) != NULL){
+        free(packet);
+    }
+}
+
+// timer for all queues
+
+static void virtual_timer_handler(btstack_timer_source_t * ts);
+
+static void virtual_schedule(void){
+    uint64_t next_us = UINT64_MAX;
+    if (virtual_host_queue.head != NULL){
+        next_us = virtual_host_queue.head->due_us;
+    }
+    if ((virtual_link_queue.head != NULL) && (virtual_link_queue.head->due_us < next_us)){
+        next_us = virtual_link_queue.head->due_us;
+    }
+    if ((virtual_completed_queue.head != NULL) && (virtual_completed_queue.head->due_us < next_us)){
+        next_us = virtual_completed_queue.head->due_us;
+    }
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_CONNECTIONS; i++){
+        if (virtual_connections[i].state != VIRTUAL_CONNECTION_PAGING) continue;
+        if (virtual_connections[i].page_timeout_us >= next_us) continue;
+        next_us = virtual_connections[i].page_timeout_us;
+    }
+
+    if (virtual_timer_active){
+        btstack_run_loop_remove_timer(&virtual_timer);
+        virtual_timer_active = 0;
+    }
+    if (next_us == UINT64_MAX) return;
+
+    uint64_t now_us = virtual_get_time_us();
+    uint32_t timeout_us = (next_us > now_us) ? (uint32_t) (next_us - now_us) : 0;
+    btstack_run_loop_set_timer_handler(&virtual_timer, &virtual_timer_handler);
+    btstack_run_loop_set_timer_us(&virtual_timer, timeout_us);
+    btstack_run_loop_add_timer(&virtual_timer);
+    virtual_timer_active = 1;
+}
+
+// packets to host
+
+static uint8_t * virtual_host_packet_reserve(uint8_t packet_type, uint16_t size){
+    uint16_t buffer_size = HCI_INCOMING_PRE_BUFFER_SIZE + btstack_max(size, VIRTUAL_EVENT_BUFFER_SIZE);
+    virtual_packet_t * packet = virtual_packet_create(packet_type, size, buffer_size);
+    if (packet == NULL) return NULL;
+    memset(packet->data, 0, buffer_size);
+    if (virtual_config.hci_latency_us > 0){
+        packet->due_us = virtual_get_time_us() + virtual_config.hci_latency_us;
+    }
+    virtual_queue_add(&virtual_host_queue, packet);
+    return &packet->data[HCI_INCOMING_PRE_BUFFER_SIZE];
+}
+
+static uint8_t * virtual_event_reserve(uint8_t event_type, uint8_t param_len){
+    uint8_t * event = virtual_host_packet_reserve(HCI_EVENT_PACKET, 2 + param_len);
+    if (event == NULL) return NULL;
+    event[0] = event_type;
+    event[1] = param_len;
+    return event;
+}
+
+static uint8_t * virtual_le_event_reserve(uint8_t subevent_type, uint8_t param_len){
+    uint8_t * event = virtual_event_reserve(HCI_EVENT_LE_META, 1 + param_len);
+    if (event == NULL) return NULL;
+    event[2] = subevent_type;
+    return event;
+}
+
+static void virtual_emit_command_complete(uint16_t opcode, const uint8_t * return_params, uint8_t return_params_len){
+    uint8_t * event = virtual_event_reserve(HCI_EVENT_COMMAND_COMPLETE, 3 + return_params_len);
+    if (event == NULL) return;
+    event[2] = virtual_config.num_command_packets;
+    little_endian_store_16(event, 3, opcode);
+    (void)memcpy(&event[5], return_params, return_params_len);
+}
+
+static void virtual_emit_command_complete_status(uint16_t opcode, uint8_t status){
+    virtual_emit_command_complete(opcode, &status, 1);
+}
+
+static void virtual_emit_command_complete_status_handle(uint16_t opcode, uint8_t status, hci_con_handle_t con_handle){
+    uint8_t return_params[3];
+    return_params[0] = status;
+    little_endian_store_16(return_params, 1, con_handle);
+    virtual_emit_command_complete(opcode, return_params, sizeof(return_params));
+}
+
+static void virtual_emit_command_status(uint16_t opcode, uint8_t status){
+    uint8_t * event = virtual_event_reserve(HCI_EVENT_COMMAND_STATUS, 4);
+    if (event == NULL) return;
+    event[2] = status;
+    event[3] = virtual_config.num_command_packets;
+    little_endian_store_16(event, 4, opcode);
+}
+
+static void virtual_emit_disconnection_complete(hci_con_handle_t con_handle, uint8_t reason){
+    uint8_t * event = virtual_event_reserve(HCI_EVENT_DISCONNECTION_COMPLETE, 4);
+    if (event == NULL) return;
+    event[2] = ERROR_CODE_SUCCESS;
+    little_endian_store_16(event, 3, con_handle);
+    event[5] = reason;
+}
+
+static void virtual_emit_encryption_change(hci_con_handle_t con_handle, uint8_t status, uint8_t refresh){
+    uint8_t * event;
+    if (refresh){
+        event = virtual_event_reserve(HCI_EVENT_ENCRYPTION_KEY_REFRESH_COMPLETE, 3);
+    } else {
+        event = virtual_event_reserve(HCI_EVENT_ENCRYPTION_CHANGE, 4);
+    }
+    if (event == NULL) return;
+    event[2] = status;
+    little_endian_store_16(event, 3, con_handle);
+    if (refresh == 0){
+        event[5] = (status == ERROR_CODE_SUCCESS) ? 1 : 0;
+    }
+}
+
+static void virtual_emit_le_connection_complete(virtual_connection_t * connection, uint8_t status, uint8_t role, uint16_t conn_interval){
+    uint8_t * event = virtual_le_event_reserve(HCI_SUBEVENT_LE_CONNECTION_COMPLETE, 18);
+    if (event == NULL) return;
+    event[3] = status;
+    little_endian_store_16(event, 4, (connection != NULL) ? connection->con_handle : 0);
+    event[6] = role;
+    if (connection != NULL){
+        event[7] = (uint8_t) connection->peer_addr_type;
+        reverse_bd_addr(connection->peer_addr, &event[8]);
+    }
+    little_endian_store_16(event, 14, conn_interval);
+    little_endian_store_16(event, 16, 0);       // latency
+    little_endian_store_16(event, 18, 500);     // supervision timeout: 5 s
+    event[20] = 0;                              // master clock accuracy
+}
+
+static void virtual_emit_connection_complete(const bd_addr_t addr, uint8_t status, hci_con_handle_t con_handle){
+    uint8_t * event = virtual_event_reserve(HCI_EVENT_CONNECTION_COMPLETE, 11);
+    if (event == NULL) return;
+    event[2] = status;
+    little_endian_store_16(event, 3, con_handle);
+    reverse_bd_addr(addr, &event[5]);
+    event[11] = 1;  // ACL
+    event[12] = 0;  // encryption disabled
+}
+
+// connections
+
+static virtual_connection_t * virtual_connection_for_handle(hci_con_handle_t con_handle){
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_CONNECTIONS; i++){
+        if (virtual_connections[i].state == VIRTUAL_CONNECTION_FREE) continue;
+        if (virtual_connections[i].con_handle != con_handle) continue;
+        return &virtual_connections[i];
+    }
+    return NULL;
+}
+
+static virtual_connection_t * virtual_connection_create(uint8_t le){
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_CONNECTIONS; i++){
+        virtual_connection_t * connection = &virtual_connections[i];
+        if (connection->state != VIRTUAL_CONNECTION_FREE) continue;
+        memset(connection, 0, sizeof(virtual_connection_t));
+        connection->le = le;
+        connection->con_handle = (hci_con_handle_t) (i + 1);
+        return connection;
+    }
+    return NULL;
+}
+
+static virtual_connection_t * virtual_connection_for_state(virtual_connection_state_t state, uint8_t le){
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_CONNECTIONS; i++){
+        if (virtual_connections[i].state != state) continue;
+        if (virtual_connections[i].le != le) continue;
+        return &virtual_connections[i];
+    }
+    return NULL;
+}
+
+static void virtual_connection_free(virtual_connection_t * connection){
+    // drop pending completions, the host considers them flushed
+    virtual_queue_t remaining = { NULL, NULL };
+    virtual_packet_t * packet;
+    while ((packet = virtual_queue_pop(&virtual_completed_queue)) != NULL){
+        if (little_endian_read_16(packet->data, 0) == connection->con_handle){
+            virtual_acl_buffers_used--;
+            free(packet);
+        } else {
+            packet->next = NULL;
+            virtual_queue_add(&remaining, packet);
+        }
+    }
+    virtual_completed_queue = remaining;
+    connection->state = VIRTUAL_CONNECTION_FREE;
+}
+
+// link
+
+// returns arrival time at the peer for a message of given size sent now
+static uint64_t virtual_link_arrival_time(uint16_t size, int acl){
+    uint64_t now_us = virtual_get_time_us();
+    uint64_t arrival_us = now_us + virtual_config.latency_us;
+    if (acl){
+        uint64_t air_time_us = 0;
+        if (virtual_config.bit_rate > 0){
+            air_time_us = ((uint64_t) size * 8u * 1000000u) / virtual_config.bit_rate;
+        }
+        uint64_t tx_us = btstack_max(now_us, virtual_link_tx_busy_until_us) + air_time_us;
+        // lost transmission attempts are repeated after the missing acknowledgement
+        while ((virtual_config.loss_per_mille > 0) && ((virtual_random() % 1000u) < virtual_config.loss_per_mille)){
+            tx_us += air_time_us + (2u * virtual_config.latency_us) + VIRTUAL_RETRANSMISSION_DELAY_US;
+        }
+        virtual_link_tx_busy_until_us = tx_us;
+        arrival_us = tx_us + virtual_config.latency_us;
+    }
+    // messages arrive in order
+    if (arrival_us < virtual_link_last_arrival_us){
+        arrival_us = virtual_link_last_arrival_us;
+    }
+    virtual_link_last_arrival_us = arrival_us;
+    return arrival_us;
+}
+
+static uint64_t virtual_link_send(uint8_t * message, uint16_t size, int acl){
+    uint64_t arrival_us = virtual_link_arrival_time(size, acl);
+    // message starts with type and arrival time
+    little_endian_store_32(message, 1, (uint32_t) arrival_us);
+    little_endian_store_32(message, 5, (uint32_t) (arrival_us >> 32));
+    ssize_t res = send(virtual_config.link_fd, message, size, 0);
+    if (res != (ssize_t) size){
+        log_error("virtual: link send failed, errno %u", errno);
+    }
+    return arrival_us;
+}
+
+static void virtual_link_send_info(void){
+    uint8_t message[9 + 6 + 1 + 3 + 248];
+    message[0] = LINK_MESSAGE_INFO;
+    reverse_bd_addr(virtual_config.bd_addr, &message[9]);
+    message[15] = virtual_scan_enable;
+    little_endian_store_24(message, 16, virtual_class_of_device);
+    (void)memcpy(&message[19], virtual_local_name, 248);
+    virtual_link_send(message, sizeof(message), 0);
+}
+
+static void virtual_link_send_advertising(void){
+    uint8_t message[9 + sizeof(virtual_peer_advertising)];
+    uint8_t * advertising = &message[9];
+    message[0] = LINK_MESSAGE_ADVERTISING;
+    advertising[0] = virtual_le_advertising_enabled;
+    advertising[1] = virtual_le_advertising_type;
+    advertising[2] = virtual_le_advertising_own_address_type;
+    if (virtual_le_advertising_own_address_type == BD_ADDR_TYPE_LE_RANDOM){
+        reverse_bd_addr(virtual_le_random_address, &advertising[3]);
+    } else {
+        reverse_bd_addr(virtual_config.bd_addr, &advertising[3]);
+    }
+    little_endian_store_16(advertising, 9, virtual_le_advertising_interval);
+    advertising[11] = virtual_le_advertising_data_len;
+    (void)memcpy(&advertising[12], virtual_le_advertising_data, 31);
+    advertising[43] = virtual_le_scan_response_data_len;
+    (void)memcpy(&advertising[44], virtual_le_scan_response_data, 31);
+    virtual_link_send(message, sizeof(message), 0);
+}
+
+static void virtual_link_send_extended_advertising(const virtual_advertising_set_t * advertising_set){
+    uint8_t message[VIRTUAL_LINK_MESSAGE_MAX_SIZE];
+    message[0] = LINK_MESSAGE_EXTENDED_ADVERTISING;
+    message[9] = advertising_set->handle;
+    message[10] = advertising_set->enabled;
+    little_endian_store_16(message, 11, advertising_set->properties);
+    message[13] = advertising_set->address_type;
+    if (advertising_set->address_type == BD_ADDR_TYPE_LE_RANDOM){
+        (void)memcpy(&message[14], advertising_set->address, 6);
+    } else {
+        reverse_bd_addr(virtual_config.bd_addr, &message[14]);
+    }
+    message[20] = advertising_set->sid;
+    little_endian_store_16(message, 21, advertising_set->interval);
+    little_endian_store_16(message, 23, advertising_set->data_len);
+    little_endian_store_16(message, 25, advertising_set->scan_response_data_len);
+    message[27] = advertising_set->primary_phy;
+    message[28] = advertising_set->secondary_phy;
+    (void)memcpy(&message[29], advertising_set->data, advertising_set->data_len);
+    (void)memcpy(&message[29 + advertising_set->data_len], advertising_set->scan_response_data, advertising_set->scan_response_data_len);
+    virtual_link_send(message, 29 + advertising_set->data_len + advertising_set->scan_response_data_len, 0);
+}
+
+static void virtual_link_send_disconnect(hci_con_handle_t peer_con_handle, uint8_t reason){
+    uint8_t message[9 + 3];
+    message[0] = LINK_MESSAGE_DISCONNECT;
+    little_endian_store_16(message, 9, peer_con_handle);
+    message[11] = reason;
+    virtual_link_send(message, sizeof(message), 0);
+}
+
+// advertising handle of connectable advertising set or 0xff for legacy advertising
+static void virtual_link_send_connect_request(virtual_connection_t * connection, uint8_t own_address_type, uint16_t conn_interval, uint8_t advertising_handle){
+    uint8_t message[9 + 15];
+    message[0] = LINK_MESSAGE_CONNECT_REQUEST;
+    message[9] = connection->le;
+    little_endian_store_16(message, 10, connection->con_handle);
+    message[12] = own_address_type;
+    if (own_address_type == BD_ADDR_TYPE_LE_RANDOM){
+        reverse_bd_addr(virtual_le_random_address, &message[13]);
+    } else {
+        reverse_bd_addr(virtual_config.bd_addr, &message[13]);
+    }
+    little_endian_store_24(message, 19, virtual_class_of_device);
+    little_endian_store_16(message, 21, conn_interval);
+    message[23] = advertising_handle;
+    virtual_link_send(message, sizeof(message), 0);
+}
+
+static void virtual_link_send_connect_response(hci_con_handle_t peer_con_handle, uint8_t status, hci_con_handle_t con_handle){
+    uint8_t message[9 + 5];
+    message[0] = LINK_MESSAGE_CONNECT_RESPONSE;
+    little_endian_store_16(message, 9, peer_con_handle);
+    message[11] = status;
+    little_endian_store_16(message, 12, con_handle);
+    virtual_link_send(message, sizeof(message), 0);
+}
+
+// Classic
+
+static void virtual_classic_page_if_ready(void){
+    if ((virtual_peer_scan_enable & 0x02) == 0) return;
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_CONNECTIONS; i++){
+        virtual_connection_t * connection = &virtual_connections[i];
+        if (connection->state != VIRTUAL_CONNECTION_PAGING) continue;
+        if (bd_addr_cmp(connection->peer_addr, virtual_peer_addr) != 0) continue;
+        connection->state = VIRTUAL_CONNECTION_W4_CONNECT_RESPONSE;
+        virtual_link_send_connect_request(connection, BD_ADDR_TYPE_LE_PUBLIC, 0, 0xff);
+    }
+}
+
+static void virtual_classic_handle_page_timeout(uint64_t now_us){
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_CONNECTIONS; i++){
+        virtual_connection_t * connection = &virtual_connections[i];
+        if (connection->state != VIRTUAL_CONNECTION_PAGING) continue;
+        if (connection->page_timeout_us > now_us) continue;
+        virtual_emit_connection_complete(connection->peer_addr, ERROR_CODE_PAGE_TIMEOUT, 0);
+        virtual_connection_free(connection);
+    }
+}
+
+// LE
+
+// advertising sets
+
+static virtual_advertising_set_t * virtual_advertising_set_for_handle(virtual_advertising_set_t * advertising_sets, uint8_t handle){
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+        if (advertising_sets[i].in_use == 0) continue;
+        if (advertising_sets[i].handle != handle) continue;
+        return &advertising_sets[i];
+    }
+    return NULL;
+}
+
+static virtual_advertising_set_t * virtual_advertising_set_create(virtual_advertising_set_t * advertising_sets, uint8_t handle){
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+        virtual_advertising_set_t * advertising_set = &advertising_sets[i];
+        if (advertising_set->in_use) continue;
+        memset(advertising_set, 0, sizeof(virtual_advertising_set_t));
+        advertising_set->in_use = 1;
+        advertising_set->handle = handle;
+        advertising_set->sid = 0xff;
+        advertising_set->interval = 0x0800;
+        return advertising_set;
+    }
+    return NULL;
+}
+
+// store advertising set of peer, only enabled sets are kept
+static void virtual_peer_advertising_set_update(const uint8_t * message){
+    uint8_t handle = message[9];
+    virtual_advertising_set_t * advertising_set = virtual_advertising_set_for_handle(virtual_peer_advertising_sets, handle);
+    if (message[10] == 0){
+        if (advertising_set != NULL){
+            advertising_set->in_use = 0;
+        }
+        return;
+    }
+    if (advertising_set == NULL){
+        advertising_set = virtual_advertising_set_create(virtual_peer_advertising_sets, handle);
+        if (advertising_set == NULL) return;
+    }
+    advertising_set->enabled = 1;
+    advertising_set->properties = little_endian_read_16(message, 11);
+    advertising_set->address_type = message[13];
+    (void)memcpy(advertising_set->address, &message[14], 6);
+    advertising_set->sid = message[20];
+    advertising_set->interval = little_endian_read_16(message, 21);
+    advertising_set->data_len = little_endian_read_16(message, 23);
+    advertising_set->scan_response_data_len = little_endian_read_16(message, 25);
+    advertising_set->primary_phy = message[27];
+    advertising_set->secondary_phy = message[28];
+    (void)memcpy(advertising_set->data, &message[29], advertising_set->data_len);
+    (void)memcpy(advertising_set->scan_response_data, &message[29 + advertising_set->data_len], advertising_set->scan_response_data_len);
+}
+
+// LE
+
+static uint8_t virtual_count_bits_set(uint8_t value){
+    uint8_t num_bits = 0;
+    while (value != 0){
+        num_bits += value & 1;
+        value >>= 1;
+    }
+    return num_bits;
+}
+
+// bit in scanning or initiating PHYs for primary advertising PHY 1: LE 1M or 3: LE Coded
+static uint8_t virtual_le_phy_bit(uint8_t primary_phy){
+    return (primary_phy == 3) ? 0x04 : 0x01;
+}
+
+// legacy advertising uses LE 1M PHY
+static int virtual_le_peer_legacy_advertising_connectable(void){
+    if (virtual_peer_advertising[0] == 0) return 0;
+    if ((virtual_le_initiating_phys & 0x01) == 0) return 0;
+    // ADV_IND or ADV_DIRECT_IND
+    return (virtual_peer_advertising[1] == 0x00) || (virtual_peer_advertising[1] == 0x01) || (virtual_peer_advertising[1] == 0x04);
+}
+
+// returns advertising set of peer with connectable advertising
+static virtual_advertising_set_t * virtual_le_peer_advertising_set_connectable(void){
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+        if (virtual_peer_advertising_sets[i].in_use == 0) continue;
+        if ((virtual_peer_advertising_sets[i].properties & 0x01) == 0) continue;
+        if ((virtual_le_initiating_phys & virtual_le_phy_bit(virtual_peer_advertising_sets[i].primary_phy)) == 0) continue;
+        return &virtual_peer_advertising_sets[i];
+    }
+    return NULL;
+}
+
+static void virtual_le_connect_if_ready(void){
+    if (virtual_le_connecting == 0) return;
+    virtual_advertising_set_t * advertising_set = NULL;
+    if (virtual_le_peer_legacy_advertising_connectable() == 0){
+        advertising_set = virtual_le_peer_advertising_set_connectable();
+        if (advertising_set == NULL) return;
+    }
+    virtual_connection_t * connection = virtual_connection_create(1);
+    if (connection == NULL){
+        virtual_le_connecting = 0;
+        virtual_emit_le_connection_complete(NULL, ERROR_CODE_CONNECTION_LIMIT_EXCEEDED, 0, 0);
+        return;
+    }
+    virtual_le_connecting = 0;
+    connection->state = VIRTUAL_CONNECTION_W4_CONNECT_RESPONSE;
+    uint8_t advertising_handle = 0xff;
+    if (advertising_set == NULL){
+        connection->peer_addr_type = (bd_addr_type_t) virtual_peer_advertising[2];
+        reverse_bd_addr(&virtual_peer_advertising[3], connection->peer_addr);
+    } else {
+        advertising_handle = advertising_set->handle;
+        connection->peer_addr_type = (bd_addr_type_t) advertising_set->address_type;
+        reverse_bd_addr(advertising_set->address, connection->peer_addr);
+    }
+    uint8_t  own_address_type = virtual_le_create_connection[12];
+    uint16_t conn_interval = little_endian_read_16(virtual_le_create_connection, 13);
+    virtual_link_send_connect_request(connection, own_address_type, conn_interval, advertising_handle);
+}
+
+static void virtual_le_emit_legacy_advertising_report(uint8_t adv_type, uint8_t address_type, const uint8_t * address,
+                                                      const uint8_t * data, uint8_t data_len,
+                                                      const uint8_t * scan_response_data, uint8_t scan_response_len){
+    // event types: ADV_IND, ADV_DIRECT_IND, ADV_SCAN_IND, ADV_NONCONN_IND, SCAN_RSP
+    static const uint8_t event_types[] = { 0x00, 0x01, 0x02, 0x03, 0x01 };
+    uint8_t * event = virtual_le_event_reserve(HCI_SUBEVENT_LE_ADVERTISING_REPORT, 11 + data_len);
+    if (event == NULL) return;
+    event[3] = 1;
+    event[4] = event_types[adv_type < sizeof(event_types) ? adv_type : 0];
+    event[5] = address_type;
+    (void)memcpy(&event[6], address, 6);
+    event[12] = data_len;
+    (void)memcpy(&event[13], data, data_len);
+    event[13 + data_len] = (uint8_t) -40;
+
+    // active scanning of scannable advertisement
+    if ((virtual_le_scan_type == 0) || ((adv_type != 0x00) && (adv_type != 0x02))) return;
+    event = virtual_le_event_reserve(HCI_SUBEVENT_LE_ADVERTISING_REPORT, 11 + scan_response_len);
+    if (event == NULL) return;
+    event[3] = 1;
+    event[4] = 0x04;
+    event[5] = address_type;
+    (void)memcpy(&event[6], address, 6);
+    event[12] = scan_response_len;
+    (void)memcpy(&event[13], scan_response_data, scan_response_len);
+    event[13 + scan_response_len] = (uint8_t) -40;
+}
+
+// data longer than one report is split into reports with data status 'incomplete, more data to come'. Emits report for
+// data at pos and returns pos of next report, data_len after last report. In truncated mode, the last of several reports
+// has data status 'truncated' and no data, as if the last AUX_CHAIN_IND was not received
+static uint16_t virtual_le_emit_extended_advertising_report_fragment(uint16_t event_type, uint8_t address_type, const uint8_t * address, uint8_t sid,
+                                                                     uint8_t primary_phy, uint8_t secondary_phy, const uint8_t * data, uint16_t data_len,
+                                                                     uint16_t pos){
+    uint8_t  fragment_len = (uint8_t) btstack_min(data_len - pos, VIRTUAL_EXTENDED_ADVERTISING_REPORT_DATA_LEN);
+    uint16_t data_status  = ((pos + fragment_len) < data_len) ? 0x20 : 0x00;
+    if ((virtual_config.extended_advertising_report_mode == HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORTS_TRUNCATED) &&
+        (pos > 0) && (data_status == 0x00)){
+        fragment_len = 0;
+        data_status = 0x40;
+    }
+    uint8_t * event = virtual_le_event_reserve(HCI_SUBEVENT_LE_EXTENDED_ADVERTISING_REPORT, 1 + 24 + fragment_len);
+    if (event == NULL) return data_len;
+    event[3] = 1;
+    little_endian_store_16(event, 4, event_type | data_status);
+    event[6] = address_type;
+    (void)memcpy(&event[7], address, 6);
+    event[13] = primary_phy;
+    event[14] = (event_type & 0x10) ? 0 : secondary_phy;    // secondary PHY: none for legacy PDUs
+    event[15] = sid;
+    event[16] = 127;                                // TX power: not available
+    event[17] = (uint8_t) -40;
+    little_endian_store_16(event, 18, 0);           // no periodic advertising
+    event[27] = fragment_len;
+    (void)memcpy(&event[28], &data[pos], fragment_len);
+    return (data_status == 0x20) ? (pos + fragment_len) : data_len;
+}
+
+static void virtual_le_emit_extended_advertising_report(uint16_t event_type, uint8_t address_type, const uint8_t * address, uint8_t sid,
+                                                        uint8_t primary_phy, uint8_t secondary_phy, const uint8_t * data, uint16_t data_len){
+    uint16_t pos = 0;
+    do {
+        pos = virtual_le_emit_extended_advertising_report_fragment(event_type, address_type, address, sid, primary_phy, secondary_phy,
+                                                                   data, data_len, pos);
+    } while (pos < data_len);
+}
+
+// in interleaved mode, reports of advertising data of all advertising sets with extended PDUs are emitted in turn
+static int virtual_le_extended_advertising_reports_interleaved(void){
+    return virtual_le_scan_extended &&
+           (virtual_config.extended_advertising_report_mode == HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORTS_INTERLEAVED);
+}
+
+static int virtual_le_advertising_set_reported(const virtual_advertising_set_t * advertising_set){
+    return (virtual_le_scan_phys & virtual_le_phy_bit(advertising_set->primary_phy)) != 0;
+}
+
+static void virtual_le_emit_advertising_set_reports_interleaved(void){
+    uint16_t pos[VIRTUAL_MAX_ADVERTISING_SETS];
+    uint8_t  pending[VIRTUAL_MAX_ADVERTISING_SETS];
+    int num_pending = 0;
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+        const virtual_advertising_set_t * advertising_set = &virtual_peer_advertising_sets[i];
+        pos[i] = 0;
+        pending[i] = advertising_set->in_use && virtual_le_advertising_set_reported(advertising_set) && ((advertising_set->properties & 0x10) == 0);
+        if (pending[i]){
+            num_pending++;
+        }
+    }
+    while (num_pending > 0){
+        for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+            if (pending[i] == 0) continue;
+            const virtual_advertising_set_t * advertising_set = &virtual_peer_advertising_sets[i];
+            pos[i] = virtual_le_emit_extended_advertising_report_fragment(advertising_set->properties & 0x17, advertising_set->address_type,
+                                                                          advertising_set->address, advertising_set->sid,
+                                                                          advertising_set->primary_phy, advertising_set->secondary_phy,
+                                                                          advertising_set->data, advertising_set->data_len, pos[i]);
+            if (pos[i] >= advertising_set->data_len){
+                pending[i] = 0;
+                num_pending--;
+            }
+        }
+    }
+}
+
+// extended advertising report event type for legacy advertising type: ADV_IND, ADV_DIRECT_IND, ADV_SCAN_IND, ADV_NONCONN_IND, ADV_DIRECT_IND
+static uint16_t virtual_le_legacy_event_type(uint8_t adv_type){
+    static const uint8_t event_types[] = { 0x13, 0x15, 0x12, 0x10, 0x15 };
+    return event_types[adv_type < sizeof(event_types) ? adv_type : 0];
+}
+
+static void virtual_le_emit_advertising_set_report(const virtual_advertising_set_t * advertising_set){
+    // connectable, scannable, directed, legacy
+    uint16_t event_type = advertising_set->properties & 0x17;
+    if (virtual_le_advertising_set_reported(advertising_set) == 0) return;
+    if (virtual_le_scan_extended == 0){
+        // only legacy PDUs are reported to legacy scanning
+        if ((event_type & 0x10) == 0) return;
+        uint8_t adv_type = 0x03;
+        if (event_type & 0x04){
+            adv_type = 0x01;
+        } else if (event_type & 0x01){
+            adv_type = 0x00;
+        } else if (event_type & 0x02){
+            adv_type = 0x02;
+        }
+        virtual_le_emit_legacy_advertising_report(adv_type, advertising_set->address_type, advertising_set->address,
+                                                  advertising_set->data, (uint8_t) btstack_min(advertising_set->data_len, 31),
+                                                  advertising_set->scan_response_data, (uint8_t) btstack_min(advertising_set->scan_response_data_len, 31));
+        return;
+    }
+    // advertising data of extended PDUs already reported if interleaved
+    if (((event_type & 0x10) != 0) || (virtual_le_extended_advertising_reports_interleaved() == 0)){
+        virtual_le_emit_extended_advertising_report(event_type, advertising_set->address_type, advertising_set->address, advertising_set->sid,
+                                                    advertising_set->primary_phy, advertising_set->secondary_phy,
+                                                    advertising_set->data, advertising_set->data_len);
+    }
+    // active scanning of scannable advertisement
+    if ((virtual_le_scan_type == 0) || ((event_type & 0x02) == 0)) return;
+    virtual_le_emit_extended_advertising_report(event_type | 0x08, advertising_set->address_type, advertising_set->address, advertising_set->sid,
+                                                advertising_set->primary_phy, advertising_set->secondary_phy,
+                                                advertising_set->scan_response_data, advertising_set->scan_response_data_len);
+}
+
+static void virtual_le_emit_advertising_report(void){
+    if (virtual_le_scan_enable == 0) return;
+    // legacy advertising uses LE 1M PHY
+    if ((virtual_peer_advertising[0] != 0) && (virtual_le_scan_phys & 0x01)){
+        uint8_t adv_type = virtual_peer_advertising[1];
+        uint8_t address_type = virtual_peer_advertising[2];
+        const uint8_t * address = &virtual_peer_advertising[3];
+        if (virtual_le_scan_extended){
+            uint16_t event_type = virtual_le_legacy_event_type(adv_type);
+            virtual_le_emit_extended_advertising_report(event_type, address_type, address, 0xff, 1, 0, &virtual_peer_advertising[12], virtual_peer_advertising[11]);
+            if ((virtual_le_scan_type != 0) && ((adv_type == 0x00) || (adv_type == 0x02))){
+                virtual_le_emit_extended_advertising_report(event_type | 0x08, address_type, address, 0xff, 1, 0, &virtual_peer_advertising[44], virtual_peer_advertising[43]);
+            }
+        } else {
+            virtual_le_emit_legacy_advertising_report(adv_type, address_type, address, &virtual_peer_advertising[12], virtual_peer_advertising[11],
+                                                      &virtual_peer_advertising[44], virtual_peer_advertising[43]);
+        }
+    }
+    if (virtual_le_extended_advertising_reports_interleaved()){
+        virtual_le_emit_advertising_set_reports_interleaved();
+    }
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+        if (virtual_peer_advertising_sets[i].in_use == 0) continue;
+        virtual_le_emit_advertising_set_report(&virtual_peer_advertising_sets[i]);
+    }
+}
+
+// shortest advertising interval of peer, 0 if peer does not advertise
+static uint16_t virtual_le_peer_advertising_interval(void){
+    uint16_t interval = 0;
+    if (virtual_peer_advertising[0] != 0){
+        interval = btstack_max(1, little_endian_read_16(virtual_peer_advertising, 9));
+    }
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+        if (virtual_peer_advertising_sets[i].in_use == 0) continue;
+        if ((interval != 0) && (virtual_peer_advertising_sets[i].interval >= interval)) continue;
+        interval = btstack_max(1, virtual_peer_advertising_sets[i].interval);
+    }
+    return interval;
+}
+
+static void virtual_le_advertising_timer_handler(btstack_timer_source_t * ts){
+    virtual_le_emit_advertising_report();
+    virtual_schedule();
+    // report again after peer advertising interval
+    uint32_t interval_ms = btstack_max(20, (virtual_le_peer_advertising_interval() * 5u) / 8u);
+    btstack_run_loop_set_timer(ts, interval_ms);
+    btstack_run_loop_add_timer(ts);
+}
+
+static void virtual_le_advertising_timer_update(void){
+    int active = virtual_le_scan_enable && (virtual_le_peer_advertising_interval() != 0);
+    if (active == virtual_advertising_timer_active) return;
+    if (active){
+        btstack_run_loop_set_timer_handler(&virtual_advertising_timer, &virtual_le_advertising_timer_handler);
+        btstack_run_loop_set_timer(&virtual_advertising_timer, 0);
+        btstack_run_loop_add_timer(&virtual_advertising_timer);
+    } else {
+        btstack_run_loop_remove_timer(&virtual_advertising_timer);
+    }
+    virtual_advertising_timer_active = active;
+}
+
+static void virtual_le_encrypt(const uint8_t * key_le, const uint8_t * plaintext_le, uint8_t * ciphertext_le){
+    // HCI uses little endian, AES big endian
+    uint8_t key[16];
+    uint8_t plaintext[16];
+    uint8_t ciphertext[16];
+    reverse_128(key_le, key);
+    reverse_128(plaintext_le, plaintext);
+    uint32_t rk[RKLENGTH(KEYBITS)];
+    int nrounds = rijndaelSetupEncrypt(rk, key, KEYBITS);
+    rijndaelEncrypt(rk, nrounds, plaintext, ciphertext);
+    reverse_128(ciphertext, ciphertext_le);
+}
+
+// received link messages
+
+static void virtual_link_closed(void){
+    log_info("virtual: peer controller gone");
+    memset(virtual_peer_advertising, 0, sizeof(virtual_peer_advertising));
+    memset(virtual_peer_advertising_sets, 0, sizeof(virtual_peer_advertising_sets));
+    virtual_le_advertising_timer_update();
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_CONNECTIONS; i++){
+        virtual_connection_t * connection = &virtual_connections[i];
+        if (connection->state == VIRTUAL_CONNECTION_FREE) continue;
+        if (connection->state == VIRTUAL_CONNECTION_OPEN){
+            virtual_emit_disconnection_complete(connection->con_handle, ERROR_CODE_CONNECTION_TIMEOUT);
+        }
+        virtual_connection_free(connection);
+    }
+}
+
+static void virtual_handle_link_message(uint8_t * message, uint16_t size){
+    virtual_connection_t * connection;
+    hci_con_handle_t con_handle;
+    uint8_t status;
+    uint8_t * event;
+
+    switch ((virtual_link_message_t) message[0]){
+        case LINK_MESSAGE_INFO:
+            reverse_bd_addr(&message[9], virtual_peer_addr);
+            virtual_peer_scan_enable = message[15];
+            virtual_peer_class_of_device = little_endian_read_24(message, 16);
+            (void)memcpy(virtual_peer_name, &message[19], 248);
+            virtual_classic_page_if_ready();
+            break;
+
+        case LINK_MESSAGE_ADVERTISING:
+            (void)memcpy(virtual_peer_advertising, &message[9], sizeof(virtual_peer_advertising));
+            virtual_le_advertising_timer_update();
+            virtual_le_connect_if_ready();
+            break;
+
+        case LINK_MESSAGE_EXTENDED_ADVERTISING:
+            virtual_peer_advertising_set_update(message);
+            virtual_le_advertising_timer_update();
+            virtual_le_connect_if_ready();
+            break;
+
+        case LINK_MESSAGE_CONNECT_REQUEST: {
+            uint8_t le = message[9];
+            hci_con_handle_t peer_con_handle = little_endian_read_16(message, 10);
+            virtual_advertising_set_t * advertising_set = NULL;
+            int accept;
+            if (le == 0){
+                accept = virtual_scan_enable & 0x02;
+            } else if (message[23] == 0xff){
+                accept = virtual_le_advertising_enabled;
+            } else {
+                // connectable advertising set
+                advertising_set = virtual_advertising_set_for_handle(virtual_le_advertising_sets, message[23]);
+                accept = (advertising_set != NULL) && advertising_set->enabled && (advertising_set->properties & 0x01);
+            }
+            connection = accept ? virtual_connection_create(le) : NULL;
+            if (connection == NULL){
+                virtual_link_send_connect_response(peer_con_handle, le ? ERROR_CODE_CONNECTION_TIMEOUT : ERROR_CODE_PAGE_TIMEOUT, 0);
+                break;
+            }
+            connection->peer_con_handle = peer_con_handle;
+            connection->peer_addr_type = (bd_addr_type_t) message[12];
+            reverse_bd_addr(&message[13], connection->peer_addr);
+            if (le && (advertising_set != NULL)){
+                // peripheral: advertising set is terminated by connection
+                connection->state = VIRTUAL_CONNECTION_OPEN;
+                advertising_set->enabled = 0;
+                virtual_link_send_extended_advertising(advertising_set);
+                virtual_link_send_connect_response(peer_con_handle, ERROR_CODE_SUCCESS, connection->con_handle);
+                virtual_emit_le_connection_complete(connection, ERROR_CODE_SUCCESS, 1, little_endian_read_16(message, 21));
+                event = virtual_le_event_reserve(HCI_SUBEVENT_LE_ADVERTISING_SET_TERMINATED, 5);
+                if (event == NULL) break;
+                event[3] = ERROR_CODE_SUCCESS;
+                event[4] = advertising_set->handle;
+                little_endian_store_16(event, 5, connection->con_handle);
+                event[7] = 0;   // number of completed extended advertising events: not counted
+            } else if (le){
+                // peripheral: advertising stops on connection
+                connection->state = VIRTUAL_CONNECTION_OPEN;
+                virtual_le_advertising_enabled = 0;
+                virtual_link_send_advertising();
+                virtual_link_send_connect_response(peer_con_handle, ERROR_CODE_SUCCESS, connection->con_handle);
+                virtual_emit_le_connection_complete(connection, ERROR_CODE_SUCCESS, 1, little_endian_read_16(message, 21));
+            } else {
+                // let host decide
+                connection->state = VIRTUAL_CONNECTION_W4_ACCEPT;
+                event = virtual_event_reserve(HCI_EVENT_CONNECTION_REQUEST, 10);
+                if (event == NULL) break;
+                (void)memcpy(&event[2], &message[13], 6);
+                little_endian_store_24(event, 8, little_endian_read_24(message, 19));
+                event[11] = 1;  // ACL
+            }
+            break;
+        }
+
+        case LINK_MESSAGE_CONNECT_RESPONSE:
+            connection = virtual_connection_for_handle(little_endian_read_16(message, 9));
+            if ((connection == NULL) || (connection->state != VIRTUAL_CONNECTION_W4_CONNECT_RESPONSE)) break;
+            status = message[11];
+            if ((status == ERROR_CODE_SUCCESS) && connection->cancelled){
+                // LE Create Connection Cancel was faster
+                virtual_link_send_disconnect(little_endian_read_16(message, 12), ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST);
+                virtual_connection_free(connection);
+                break;
+            }
+            if (status != ERROR_CODE_SUCCESS){
+                if (connection->cancelled){
+                    // LE Connection Complete already emitted for LE Create Connection Cancel
+                } else if (connection->le){
+                    // peer stopped advertising before connect request arrived, keep initiating like a real controller
+                    virtual_le_connecting = 1;
+                } else {
+                    virtual_emit_connection_complete(connection->peer_addr, status, 0);
+                }
+                virtual_connection_free(connection);
+                virtual_le_connect_if_ready();
+                break;
+            }
+            connection->state = VIRTUAL_CONNECTION_OPEN;
+            connection->peer_con_handle = little_endian_read_16(message, 12);
+            if (connection->le){
+                virtual_emit_le_connection_complete(connection, ERROR_CODE_SUCCESS, 0, little_endian_read_16(virtual_le_create_connection, 13));
+            } else {
+                virtual_emit_connection_complete(connection->peer_addr, ERROR_CODE_SUCCESS, connection->con_handle);
+            }
+            break;
+
+        case LINK_MESSAGE_ACL:
+            con_handle = little_endian_read_16(message, 9) & 0x0fff;
+            connection = virtual_connection_for_handle(con_handle);
+            if ((connection == NULL) || (connection->state != VIRTUAL_CONNECTION_OPEN)) break;
+            event = virtual_host_packet_reserve(HCI_ACL_DATA_PACKET, size - 9);
+            if (event == NULL) break;
+            (void)memcpy(event, &message[9], size - 9);
+            break;
+
+        case LINK_MESSAGE_DISCONNECT:
+            con_handle = little_endian_read_16(message, 9);
+            connection = virtual_connection_for_handle(con_handle);
+            if (connection == NULL) break;
+            if (connection->state == VIRTUAL_CONNECTION_OPEN){
+                virtual_emit_disconnection_complete(con_handle, message[11]);
+            }
+            virtual_connection_free(connection);
+            break;
+
+        case LINK_MESSAGE_LE_ENCRYPTION_REQUEST:
+            con_handle = little_endian_read_16(message, 9);
+            connection = virtual_connection_for_handle(con_handle);
+            if (connection == NULL) break;
+            connection->ltk_request_pending = 1;
+            (void)memcpy(connection->requested_ltk, &message[21], 16);
+            event = virtual_le_event_reserve(HCI_SUBEVENT_LE_LONG_TERM_KEY_REQUEST, 12);
+            if (event == NULL) break;
+            little_endian_store_16(event, 3, con_handle);
+            (void)memcpy(&event[5], &message[11], 10);   // rand, ediv
+            break;
+
+        case LINK_MESSAGE_LE_ENCRYPTION_RESPONSE: {
+            con_handle = little_endian_read_16(message, 9);
+            connection = virtual_connection_for_handle(con_handle);
+            if (connection == NULL) break;
+            status = message[11];
+            uint8_t refresh = connection->encrypted;
+            if (status == ERROR_CODE_SUCCESS){
+                connection->encrypted = 1;
+            }
+            virtual_emit_encryption_change(con_handle, status, refresh && (status == ERROR_CODE_SUCCESS));
+            break;
+        }
+
+        case LINK_MESSAGE_LE_CONNECTION_UPDATE:
+            con_handle = little_endian_read_16(message, 9);
+            connection = virtual_connection_for_handle(con_handle);
+            if (connection == NULL) break;
+            event = virtual_le_event_reserve(HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE, 9);
+            if (event == NULL) break;
+            event[3] = ERROR_CODE_SUCCESS;
+            little_endian_store_16(event, 4, con_handle);
+            (void)memcpy(&event[6], &message[11], 6);
+            break;
+
+        case LINK_MESSAGE_CLOSED:
+            virtual_link_closed();
+            break;
+
+        default:
+            log_error("virtual: unknown link message %u", message[0]);
+            break;
+    }
+}
+
+static void virtual_link_process(btstack_data_source_t *ds, btstack_data_source_callback_type_t callback_type){
+    UNUSED(callback_type);
+    uint8_t message[VIRTUAL_LINK_MESSAGE_MAX_SIZE];
+    while (true){
+        ssize_t size = recv(ds->source.fd, message, sizeof(message), MSG_DONTWAIT);
+        if ((size < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) break;
+        if (size <= 0){
+            // process messages already received first
+            btstack_run_loop_remove_data_source(ds);
+            uint64_t closed_us = (virtual_link_queue.tail != NULL) ? virtual_link_queue.tail->due_us : 0;
+            message[0] = LINK_MESSAGE_CLOSED;
+            size = 9;
+            little_endian_store_32(message, 1, (uint32_t) closed_us);
+            little_endian_store_32(message, 5, (uint32_t) (closed_us >> 32));
+        }
+        if (size < 9) continue;
+        // queue until arrival time
+        virtual_packet_t * packet = virtual_packet_create(0, (uint16_t) size, (uint16_t) size);
+        if (packet == NULL) break;
+        (void)memcpy(packet->data, message, size);
+        packet->due_us = little_endian_read_32(message, 1) | ((uint64_t) little_endian_read_32(message, 5) << 32);
+        virtual_queue_add(&virtual_link_queue, packet);
+        if (message[0] == LINK_MESSAGE_CLOSED) break;
+    }
+    virtual_schedule();
+}
+
+// completed packets
+
+static void virtual_emit_number_of_completed_packets(uint64_t now_us){
+    // collect completed packets per connection handle
+    hci_con_handle_t handles[VIRTUAL_MAX_CONNECTIONS];
+    uint16_t counts[VIRTUAL_MAX_CONNECTIONS];
+    int num_handles = 0;
+    while ((virtual_completed_queue.head != NULL) && (virtual_completed_queue.head->due_us <= now_us)){
+        hci_con_handle_t con_handle = little_endian_read_16(virtual_completed_queue.head->data, 0);
+        int i;
+        for (i = 0; i < num_handles; i++){
+            if (handles[i] == con_handle) break;
+        }
+        if (i == num_handles){
+            // no room for another handle, report remaining completions in next event
+            if (num_handles == VIRTUAL_MAX_CONNECTIONS) break;
+            handles[i] = con_handle;
+            counts[i] = 0;
+            num_handles++;
+        }
+        counts[i]++;
+        free(virtual_queue_pop(&virtual_completed_queue));
+        virtual_acl_buffers_used--;
+    }
+    if (num_handles == 0) return;
+    uint8_t * event = virtual_event_reserve(HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS, 1 + (num_handles * 4));
+    if (event == NULL) return;
+    event[2] = (uint8_t) num_handles;
+    int i;
+    for (i = 0; i < num_handles; i++){
+        little_endian_store_16(event, 3 + (i * 4), handles[i]);
+        little_endian_store_16(event, 5 + (i * 4), counts[i]);
+    }
+}
+
+static void virtual_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    virtual_timer_active = 0;
+
+    uint64_t now_us = virtual_get_time_us();
+
+    // process link messages that have arrived
+    while ((virtual_link_queue.head != NULL) && (virtual_link_queue.head->due_us <= now_us)){
+        virtual_packet_t * packet = virtual_queue_pop(&virtual_link_queue);
+        virtual_handle_link_message(packet->data, packet->size);
+        free(packet);
+    }
+
+    virtual_emit_number_of_completed_packets(now_us);
+
+    virtual_classic_handle_page_timeout(now_us);
+
+    // deliver to host, packet handler might send further commands
+    while ((virtual_host_queue.head != NULL) && (virtual_host_queue.head->due_us <= now_us)){
+        virtual_packet_t * packet = virtual_queue_pop(&virtual_host_queue);
+        (*virtual_packet_handler)(packet->packet_type, &packet->data[HCI_INCOMING_PRE_BUFFER_SIZE], packet->size);
+        free(packet);
+    }
+
+    virtual_schedule();
+}
+
+// commands
+
+static void virtual_reset(void){
+    int i;
+    for (i = 0; i < VIRTUAL_MAX_CONNECTIONS; i++){
+        virtual_connection_t * connection = &virtual_connections[i];
+        if (connection->state == VIRTUAL_CONNECTION_FREE) continue;
+        if ((connection->state == VIRTUAL_CONNECTION_OPEN) || (connection->state == VIRTUAL_CONNECTION_W4_ACCEPT)){
+            virtual_link_send_disconnect(connection->peer_con_handle, ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST);
+        }
+        virtual_connection_free(connection);
+    }
+    virtual_queue_free(&virtual_completed_queue);
+    virtual_acl_buffers_used = 0;
+    memset(virtual_local_name, 0, sizeof(virtual_local_name));
+    virtual_scan_enable = 0;
+    virtual_class_of_device = 0;
+    virtual_page_timeout_us = 0x2000 * 625u;
+    virtual_le_advertising_enabled = 0;
+    virtual_le_advertising_type = 0;
+    virtual_le_advertising_own_address_type = 0;
+    virtual_le_advertising_interval = 0x0800;
+    virtual_le_advertising_data_len = 0;
+    virtual_le_scan_response_data_len = 0;
+    virtual_le_scan_enable = 0;
+    virtual_le_scan_extended = 0;
+    virtual_le_scan_phys = 0x01;
+    virtual_le_connecting = 0;
+    virtual_le_initiating_phys = 0x01;
+    for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+        virtual_advertising_set_t * advertising_set = &virtual_le_advertising_sets[i];
+        if (advertising_set->in_use && advertising_set->enabled){
+            advertising_set->enabled = 0;
+            virtual_link_send_extended_advertising(advertising_set);
+        }
+    }
+    memset(virtual_le_advertising_sets, 0, sizeof(virtual_le_advertising_sets));
+    virtual_le_advertising_timer_update();
+    virtual_link_send_info();
+    virtual_link_send_advertising();
+}
+
+// LE Set Extended Advertising Data / LE Set Extended Scan Response Data
+static uint8_t virtual_le_set_extended_advertising_data(const uint8_t * params, uint8_t scan_response){
+    virtual_advertising_set_t * advertising_set = virtual_advertising_set_for_handle(virtual_le_advertising_sets, params[0]);
+    if (advertising_set == NULL) return ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER;
+    uint8_t  operation = params[1];
+    uint8_t  fragment_len = params[3];
+    uint8_t * data = scan_response ? advertising_set->scan_response_data : advertising_set->data;
+    uint16_t * data_len = scan_response ? &advertising_set->scan_response_data_len : &advertising_set->data_len;
+    switch (operation){
+        case 0x01:  // first fragment
+        case 0x03:  // complete data
+            *data_len = 0;
+            break;
+        case 0x00:  // intermediate fragment
+        case 0x02:  // last fragment
+            break;
+        case 0x04:  // unchanged data
+            return ERROR_CODE_SUCCESS;
+        default:
+            return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+    }
+    if ((*data_len + fragment_len) > VIRTUAL_MAX_ADVERTISING_DATA_LEN){
+        return ERROR_CODE_MEMORY_CAPACITY_EXCEEDED;
+    }
+    (void)memcpy(&data[*data_len], &params[4], fragment_len);
+    *data_len += fragment_len;
+    // peer sees complete data only
+    if (advertising_set->enabled && ((operation == 0x02) || (operation == 0x03))){
+        virtual_link_send_extended_advertising(advertising_set);
+    }
+    return ERROR_CODE_SUCCESS;
+}
+
+// LE Set Extended Advertising Enable
+static uint8_t virtual_le_set_extended_advertising_enable(const uint8_t * params){
+    uint8_t enable = params[0];
+    uint8_t num_sets = params[1];
+    virtual_advertising_set_t * advertising_set;
+    int i;
+    if (num_sets == 0){
+        // disable all advertising sets
+        if (enable) return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+        for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+            advertising_set = &virtual_le_advertising_sets[i];
+            if ((advertising_set->in_use == 0) || (advertising_set->enabled == 0)) continue;
+            advertising_set->enabled = 0;
+            virtual_link_send_extended_advertising(advertising_set);
+        }
+        return ERROR_CODE_SUCCESS;
+    }
+    for (i = 0; i < num_sets; i++){
+        if (virtual_advertising_set_for_handle(virtual_le_advertising_sets, params[2 + (i * 4)]) == NULL){
+            return ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER;
+        }
+    }
+    // duration and max extended advertising events are ignored
+    for (i = 0; i < num_sets; i++){
+        advertising_set = virtual_advertising_set_for_handle(virtual_le_advertising_sets, params[2 + (i * 4)]);
+        advertising_set->enabled = enable;
+        virtual_link_send_extended_advertising(advertising_set);
+    }
+    return ERROR_CODE_SUCCESS;
+}
+
+static void virtual_handle_command(uint8_t * packet, int size){
+    uint16_t opcode = little_endian_read_16(packet, 0);
+    uint8_t * params = &packet[3];
+    uint8_t return_params[65];
+    virtual_connection_t * connection;
+    virtual_advertising_set_t * advertising_set;
+    hci_con_handle_t con_handle;
+    bd_addr_t addr;
+    uint8_t * event;
+    UNUSED(size);
+
+    memset(return_params, 0, sizeof(return_params));
+
+    switch (opcode){
+
+        // Controller & Baseband, Informational Parameters
+
+        case VIRTUAL_OPCODE(OGF_CONTROLLER_BASEBAND, 0x03): // Reset
+            virtual_reset();
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_CONTROLLER_BASEBAND, 0x13): // Write Local Name
+            (void)memcpy(virtual_local_name, params, 248);
+            virtual_link_send_info();
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_CONTROLLER_BASEBAND, 0x14): // Read Local Name
+            event = virtual_event_reserve(HCI_EVENT_COMMAND_COMPLETE, 3 + 1 + 248);
+            if (event == NULL) break;
+            event[2] = 1;
+            little_endian_store_16(event, 3, opcode);
+            event[5] = ERROR_CODE_SUCCESS;
+            (void)memcpy(&event[6], virtual_local_name, 248);
+            break;
+        case VIRTUAL_OPCODE(OGF_CONTROLLER_BASEBAND, 0x18): // Write Page Timeout
+            virtual_page_timeout_us = little_endian_read_16(params, 0) * 625u;
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_CONTROLLER_BASEBAND, 0x1a): // Write Scan Enable
+            virtual_scan_enable = params[0];
+            virtual_link_send_info();
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_CONTROLLER_BASEBAND, 0x24): // Write Class of Device
+            virtual_class_of_device = little_endian_read_24(params, 0);
+            virtual_link_send_info();
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_CONTROLLER_BASEBAND, 0x37): // Write Link Supervision Timeout
+            virtual_emit_command_complete_status_handle(opcode, ERROR_CODE_SUCCESS, little_endian_read_16(params, 0));
+            break;
+        case VIRTUAL_OPCODE(OGF_INFORMATIONAL_PARAMETERS, 0x01): // Read Local Version Information
+            return_params[1] = 0x09;                            // HCI version 5.0
+            little_endian_store_16(return_params, 2, 0);        // HCI revision
+            return_params[4] = 0x09;                            // LMP version 5.0
+            little_endian_store_16(return_params, 5, 0xffff);   // manufacturer: none
+            little_endian_store_16(return_params, 7, 0);        // LMP subversion
+            virtual_emit_command_complete(opcode, return_params, 9);
+            break;
+        case VIRTUAL_OPCODE(OGF_INFORMATIONAL_PARAMETERS, 0x02): // Read Local Supported Commands
+            return_params[1 + 14] = 0x80;   // Read Buffer Size
+            return_params[1 + 24] = 0x40;   // Write LE Host Supported
+            return_params[1 + 34] = 0x01;   // LE Write Suggested Default Data Length
+            return_params[1 + 35] = 0x08;   // LE Read Maximum Data Length
+            return_params[1 + 36] = 0xFE;   // LE Set Advertising Set Random Address .. LE Read Number of Supported Advertising Sets
+            return_params[1 + 37] = 0xE3;   // LE Remove/Clear Advertising Sets, LE Set Extended Scan Parameters/Enable, LE Extended Create Connection
+            virtual_emit_command_complete(opcode, return_params, 65);
+            break;
+        case VIRTUAL_OPCODE(OGF_INFORMATIONAL_PARAMETERS, 0x03): // Read Local Supported Features
+            (void)memcpy(&return_params[1], virtual_local_supported_features, 8);
+            virtual_emit_command_complete(opcode, return_params, 9);
+            break;
+        case VIRTUAL_OPCODE(OGF_INFORMATIONAL_PARAMETERS, 0x05): // Read Buffer Size
+            little_endian_store_16(return_params, 1, virtual_config.acl_buffer_size);
+            return_params[3] = 0;   // no SCO
+            little_endian_store_16(return_params, 4, virtual_config.acl_buffer_count);
+            little_endian_store_16(return_params, 6, 0);
+            virtual_emit_command_complete(opcode, return_params, 8);
+            break;
+        case VIRTUAL_OPCODE(OGF_INFORMATIONAL_PARAMETERS, 0x09): // Read BD_ADDR
+            reverse_bd_addr(virtual_config.bd_addr, &return_params[1]);
+            virtual_emit_command_complete(opcode, return_params, 7);
+            break;
+        case VIRTUAL_OPCODE(OGF_STATUS_PARAMETERS, 0x05): // Read RSSI
+            little_endian_store_16(return_params, 1, little_endian_read_16(params, 0));
+            return_params[3] = (uint8_t) -40;
+            virtual_emit_command_complete(opcode, return_params, 4);
+            break;
+        case VIRTUAL_OPCODE(OGF_STATUS_PARAMETERS, 0x08): // Read Encryption Key Size
+            little_endian_store_16(return_params, 1, little_endian_read_16(params, 0));
+            return_params[3] = 16;
+            virtual_emit_command_complete(opcode, return_params, 4);
+            break;
+
+        // Link Control
+
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x01): // Inquiry
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            if (virtual_peer_scan_enable & 0x01){
+                event = virtual_event_reserve(HCI_EVENT_INQUIRY_RESULT, 15);
+                if (event == NULL) break;
+                event[2] = 1;
+                reverse_bd_addr(virtual_peer_addr, &event[3]);
+                little_endian_store_24(event, 12, virtual_peer_class_of_device);
+            }
+            event = virtual_event_reserve(HCI_EVENT_INQUIRY_COMPLETE, 1);
+            if (event == NULL) break;
+            event[2] = ERROR_CODE_SUCCESS;
+            break;
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x05): // Create Connection
+            connection = virtual_connection_create(0);
+            if (connection == NULL){
+                virtual_emit_command_status(opcode, ERROR_CODE_CONNECTION_LIMIT_EXCEEDED);
+                break;
+            }
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            // page until peer enables page scan or page timeout
+            connection->state = VIRTUAL_CONNECTION_PAGING;
+            connection->peer_addr_type = BD_ADDR_TYPE_ACL;
+            connection->page_timeout_us = virtual_get_time_us() + virtual_page_timeout_us;
+            reverse_bd_addr(params, connection->peer_addr);
+            virtual_classic_page_if_ready();
+            break;
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x06): // Disconnect
+            con_handle = little_endian_read_16(params, 0);
+            connection = virtual_connection_for_handle(con_handle);
+            if ((connection == NULL) || (connection->state != VIRTUAL_CONNECTION_OPEN)){
+                virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            virtual_link_send_disconnect(connection->peer_con_handle, params[2]);
+            virtual_connection_free(connection);
+            virtual_emit_disconnection_complete(con_handle, ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST);
+            break;
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x09): // Accept Connection Request
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x0a): // Reject Connection Request
+            reverse_bd_addr(params, addr);
+            connection = virtual_connection_for_state(VIRTUAL_CONNECTION_W4_ACCEPT, 0);
+            if ((connection == NULL) || (bd_addr_cmp(addr, connection->peer_addr) != 0)){
+                virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            if (opcode == VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x0a)){
+                virtual_link_send_connect_response(connection->peer_con_handle, params[6], 0);
+                virtual_emit_connection_complete(addr, params[6], 0);
+                virtual_connection_free(connection);
+                break;
+            }
+            connection->state = VIRTUAL_CONNECTION_OPEN;
+            virtual_link_send_connect_response(connection->peer_con_handle, ERROR_CODE_SUCCESS, connection->con_handle);
+            virtual_emit_connection_complete(addr, ERROR_CODE_SUCCESS, connection->con_handle);
+            break;
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x11): // Authentication Requested
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x13): // Set Connection Encryption
+            // Classic pairing is not emulated
+            con_handle = little_endian_read_16(params, 0);
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            if (opcode == VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x11)){
+                event = virtual_event_reserve(HCI_EVENT_AUTHENTICATION_COMPLETE, 3);
+                if (event == NULL) break;
+                event[2] = ERROR_CODE_PIN_OR_KEY_MISSING;
+                little_endian_store_16(event, 3, con_handle);
+            } else {
+                virtual_emit_encryption_change(con_handle, ERROR_CODE_PIN_OR_KEY_MISSING, 0);
+            }
+            break;
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x19): // Remote Name Request
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            event = virtual_event_reserve(HCI_EVENT_REMOTE_NAME_REQUEST_COMPLETE, 255);
+            if (event == NULL) break;
+            event[2] = (virtual_peer_scan_enable & 0x02) ? ERROR_CODE_SUCCESS : ERROR_CODE_PAGE_TIMEOUT;
+            (void)memcpy(&event[3], params, 6);
+            (void)memcpy(&event[9], virtual_peer_name, 248);
+            break;
+        case VIRTUAL_OPCODE(OGF_LINK_CONTROL, 0x1b): // Read Remote Supported Features
+            con_handle = little_endian_read_16(params, 0);
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            event = virtual_event_reserve(HCI_EVENT_READ_REMOTE_SUPPORTED_FEATURES_COMPLETE, 11);
+            if (event == NULL) break;
+            event[2] = (virtual_connection_for_handle(con_handle) != NULL) ? ERROR_CODE_SUCCESS : ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+            little_endian_store_16(event, 3, con_handle);
+            (void)memcpy(&event[5], virtual_local_supported_features, 8);
+            break;
+
+        // LE Controller
+
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x02): // LE Read Buffer Size: shared with Classic
+            virtual_emit_command_complete(opcode, return_params, 4);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x03): // LE Read Local Supported Features
+            return_params[1] = 0x20;    // LE Data Packet Length Extension
+            return_params[2] = 0x10;    // LE Extended Advertising
+            virtual_emit_command_complete(opcode, return_params, 9);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x05): // LE Set Random Address
+            reverse_bd_addr(params, virtual_le_random_address);
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x06): // LE Set Advertising Parameters
+            virtual_le_advertising_interval = little_endian_read_16(params, 0);
+            virtual_le_advertising_type = params[4];
+            virtual_le_advertising_own_address_type = params[5];
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x08): // LE Set Advertising Data
+            virtual_le_advertising_data_len = btstack_min(params[0], 31);
+            (void)memcpy(virtual_le_advertising_data, &params[1], 31);
+            if (virtual_le_advertising_enabled){
+                virtual_link_send_advertising();
+            }
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x09): // LE Set Scan Response Data
+            virtual_le_scan_response_data_len = btstack_min(params[0], 31);
+            (void)memcpy(virtual_le_scan_response_data, &params[1], 31);
+            if (virtual_le_advertising_enabled){
+                virtual_link_send_advertising();
+            }
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x0a): // LE Set Advertise Enable
+            virtual_le_advertising_enabled = params[0];
+            virtual_link_send_advertising();
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x0b): // LE Set Scan Parameters
+            virtual_le_scan_type = params[0];
+            virtual_le_scan_phys = 0x01;
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x0c): // LE Set Scan Enable
+            virtual_le_scan_enable = params[0];
+            virtual_le_scan_extended = 0;
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            virtual_le_advertising_timer_update();
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x0d): // LE Create Connection
+            if (virtual_le_connecting){
+                virtual_emit_command_status(opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            (void)memcpy(virtual_le_create_connection, params, sizeof(virtual_le_create_connection));
+            virtual_le_initiating_phys = 0x01;
+            virtual_le_connecting = 1;
+            virtual_le_connect_if_ready();
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x0e): // LE Create Connection Cancel
+            connection = virtual_connection_for_state(VIRTUAL_CONNECTION_W4_CONNECT_RESPONSE, 1);
+            if ((virtual_le_connecting == 0) && ((connection == NULL) || connection->cancelled)){
+                virtual_emit_command_complete_status(opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            virtual_le_connecting = 0;
+            if (connection != NULL){
+                connection->cancelled = 1;
+            }
+            virtual_emit_le_connection_complete(NULL, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, 0, 0);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x0f): // LE Read White List Size
+            return_params[1] = 8;
+            virtual_emit_command_complete(opcode, return_params, 2);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x13): // LE Connection Update
+            con_handle = little_endian_read_16(params, 0);
+            connection = virtual_connection_for_handle(con_handle);
+            if ((connection == NULL) || (connection->state != VIRTUAL_CONNECTION_OPEN)){
+                virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            {
+                // use max interval, latency, supervision timeout
+                uint8_t message[9 + 8];
+                message[0] = LINK_MESSAGE_LE_CONNECTION_UPDATE;
+                little_endian_store_16(message, 9, connection->peer_con_handle);
+                (void)memcpy(&message[11], &params[4], 6);
+                virtual_link_send(message, sizeof(message), 0);
+                event = virtual_le_event_reserve(HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE, 9);
+                if (event == NULL) break;
+                event[3] = ERROR_CODE_SUCCESS;
+                little_endian_store_16(event, 4, con_handle);
+                (void)memcpy(&event[6], &params[4], 6);
+            }
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x17): // LE Encrypt
+            virtual_le_encrypt(&params[0], &params[16], &return_params[1]);
+            virtual_emit_command_complete(opcode, return_params, 17);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x18): // LE Rand
+            little_endian_store_32(return_params, 1, virtual_random());
+            little_endian_store_32(return_params, 5, virtual_random());
+            virtual_emit_command_complete(opcode, return_params, 9);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x19): // LE Start Encryption
+            con_handle = little_endian_read_16(params, 0);
+            connection = virtual_connection_for_handle(con_handle);
+            if ((connection == NULL) || (connection->state != VIRTUAL_CONNECTION_OPEN) || (connection->le == 0)){
+                virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            {
+                // rand, ediv, ltk
+                uint8_t message[9 + 28];
+                message[0] = LINK_MESSAGE_LE_ENCRYPTION_REQUEST;
+                (void)memcpy(&message[9], params, 28);
+                little_endian_store_16(message, 9, connection->peer_con_handle);
+                virtual_link_send(message, sizeof(message), 0);
+            }
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x1a): // LE Long Term Key Request Reply
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x1b): // LE Long Term Key Request Negative Reply
+            con_handle = little_endian_read_16(params, 0);
+            connection = virtual_connection_for_handle(con_handle);
+            if ((connection == NULL) || (connection->ltk_request_pending == 0)){
+                virtual_emit_command_complete_status_handle(opcode, ERROR_CODE_COMMAND_DISALLOWED, con_handle);
+                break;
+            }
+            virtual_emit_command_complete_status_handle(opcode, ERROR_CODE_SUCCESS, con_handle);
+            connection->ltk_request_pending = 0;
+            {
+                uint8_t status = ERROR_CODE_PIN_OR_KEY_MISSING;
+                if ((opcode == VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x1a)) && (memcmp(&params[2], connection->requested_ltk, 16) == 0)){
+                    status = ERROR_CODE_SUCCESS;
+                }
+                uint8_t message[9 + 3];
+                message[0] = LINK_MESSAGE_LE_ENCRYPTION_RESPONSE;
+                little_endian_store_16(message, 9, connection->peer_con_handle);
+                message[11] = status;
+                virtual_link_send(message, sizeof(message), 0);
+                uint8_t refresh = connection->encrypted && (status == ERROR_CODE_SUCCESS);
+                if (status == ERROR_CODE_SUCCESS){
+                    connection->encrypted = 1;
+                }
+                virtual_emit_encryption_change(con_handle, status, refresh);
+            }
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x22): // LE Set Data Length
+            virtual_emit_command_complete_status_handle(opcode, ERROR_CODE_SUCCESS, little_endian_read_16(params, 0));
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x2f): // LE Read Maximum Data Length
+            little_endian_store_16(return_params, 1, 251);
+            little_endian_store_16(return_params, 3, 2120);
+            little_endian_store_16(return_params, 5, 251);
+            little_endian_store_16(return_params, 7, 2120);
+            virtual_emit_command_complete(opcode, return_params, 9);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x35): // LE Set Advertising Set Random Address
+            advertising_set = virtual_advertising_set_for_handle(virtual_le_advertising_sets, params[0]);
+            if (advertising_set == NULL){
+                virtual_emit_command_complete_status(opcode, ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER);
+                break;
+            }
+            // address of enabled connectable advertising set cannot be changed
+            if (advertising_set->enabled && (advertising_set->properties & 0x01)){
+                virtual_emit_command_complete_status(opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            (void)memcpy(advertising_set->address, &params[1], 6);
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x36): // LE Set Extended Advertising Parameters
+            advertising_set = virtual_advertising_set_for_handle(virtual_le_advertising_sets, params[0]);
+            if (advertising_set == NULL){
+                advertising_set = virtual_advertising_set_create(virtual_le_advertising_sets, params[0]);
+            }
+            if (advertising_set == NULL){
+                return_params[0] = ERROR_CODE_MEMORY_CAPACITY_EXCEEDED;
+            } else if (advertising_set->enabled){
+                return_params[0] = ERROR_CODE_COMMAND_DISALLOWED;
+            } else {
+                // primary advertising channel map, peer address, filter policy are ignored
+                advertising_set->properties = little_endian_read_16(params, 1);
+                advertising_set->interval = (uint16_t) btstack_min(little_endian_read_24(params, 3), 0xffff);
+                advertising_set->address_type = params[10];
+                advertising_set->primary_phy = params[20];
+                advertising_set->secondary_phy = params[22];
+                advertising_set->sid = params[23];
+                return_params[1] = 0;   // selected TX power: 0 dBm
+            }
+            virtual_emit_command_complete(opcode, return_params, 2);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x37): // LE Set Extended Advertising Data
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x38): // LE Set Extended Scan Response Data
+            virtual_emit_command_complete_status(opcode, virtual_le_set_extended_advertising_data(params, opcode == VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x38)));
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x39): // LE Set Extended Advertising Enable
+            virtual_emit_command_complete_status(opcode, virtual_le_set_extended_advertising_enable(params));
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x3a): // LE Read Maximum Advertising Data Length
+            little_endian_store_16(return_params, 1, VIRTUAL_MAX_ADVERTISING_DATA_LEN);
+            virtual_emit_command_complete(opcode, return_params, 3);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x3b): // LE Read Number of Supported Advertising Sets
+            return_params[1] = VIRTUAL_MAX_ADVERTISING_SETS;
+            virtual_emit_command_complete(opcode, return_params, 2);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x3c): // LE Remove Advertising Set
+            advertising_set = virtual_advertising_set_for_handle(virtual_le_advertising_sets, params[0]);
+            if (advertising_set == NULL){
+                virtual_emit_command_complete_status(opcode, ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER);
+                break;
+            }
+            if (advertising_set->enabled){
+                virtual_emit_command_complete_status(opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            advertising_set->in_use = 0;
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x3d): // LE Clear Advertising Sets
+            {
+                uint8_t status = ERROR_CODE_SUCCESS;
+                int i;
+                for (i = 0; i < VIRTUAL_MAX_ADVERTISING_SETS; i++){
+                    if (virtual_le_advertising_sets[i].in_use && virtual_le_advertising_sets[i].enabled){
+                        status = ERROR_CODE_COMMAND_DISALLOWED;
+                    }
+                }
+                if (status == ERROR_CODE_SUCCESS){
+                    memset(virtual_le_advertising_sets, 0, sizeof(virtual_le_advertising_sets));
+                }
+                virtual_emit_command_complete_status(opcode, status);
+            }
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x41): // LE Set Extended Scan Parameters, scan type of first PHY used for all
+            // LE 1M and/or LE Coded, one parameter block per PHY
+            if ((params[2] == 0) || ((params[2] & ~0x05) != 0) || (packet[2] != (3 + (5 * virtual_count_bits_set(params[2]))))){
+                virtual_emit_command_complete_status(opcode, ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS);
+                break;
+            }
+            virtual_le_scan_phys = params[2];
+            virtual_le_scan_type = params[3];
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x42): // LE Set Extended Scan Enable, duration and period are ignored
+            virtual_le_scan_enable = params[0];
+            virtual_le_scan_extended = 1;
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            virtual_le_advertising_timer_update();
+            break;
+        case VIRTUAL_OPCODE(OGF_LE_CONTROLLER, 0x43): // LE Extended Create Connection, parameters of first PHY used for all
+            if (virtual_le_connecting){
+                virtual_emit_command_status(opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            // LE 1M and/or LE Coded, optionally LE 2M, one parameter block per PHY
+            if (((params[9] & 0x05) == 0) || ((params[9] & ~0x07) != 0) || (packet[2] != (10 + (16 * virtual_count_bits_set(params[9]))))){
+                virtual_emit_command_status(opcode, ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS);
+                break;
+            }
+            virtual_le_initiating_phys = params[9];
+            virtual_emit_command_status(opcode, ERROR_CODE_SUCCESS);
+            // store as LE Create Connection parameters
+            little_endian_store_16(virtual_le_create_connection, 0, little_endian_read_16(params, 10));    // scan interval
+            little_endian_store_16(virtual_le_create_connection, 2, little_endian_read_16(params, 12));    // scan window
+            virtual_le_create_connection[4] = params[0];                                                    // initiator filter policy
+            virtual_le_create_connection[5] = params[2];                                                    // peer address type
+            (void)memcpy(&virtual_le_create_connection[6], &params[3], 6);                                  // peer address
+            virtual_le_create_connection[12] = params[1];                                                   // own address type
+            (void)memcpy(&virtual_le_create_connection[13], &params[14], 12);                               // connection parameters
+            virtual_le_connecting = 1;
+            virtual_le_connect_if_ready();
+            break;
+
+        default:
+            // event masks, page timeout, link policy, ...
+            log_debug("virtual: command 0x%04x not emulated", opcode);
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_SUCCESS);
+            break;
+    }
+}
+
+static void virtual_handle_acl_packet(uint8_t * packet, int size){
+    hci_con_handle_t con_handle = little_endian_read_16(packet, 0) & 0x0fff;
+    virtual_connection_t * connection = virtual_connection_for_handle(con_handle);
+    if ((connection == NULL) || (connection->state != VIRTUAL_CONNECTION_OPEN)){
+        log_error("virtual: ACL packet for unknown handle 0x%04x", con_handle);
+        return;
+    }
+    if (virtual_acl_buffers_used >= virtual_config.acl_buffer_count){
+        log_error("virtual: ACL buffer overrun, dropping packet");
+        return;
+    }
+    if ((size - 4) > virtual_config.acl_buffer_size){
+        log_error("virtual: ACL packet too large, size %u", size);
+        return;
+    }
+
+    // transmit to peer with peer's connection handle, first non-flushable packets arrive as first automatically flushable
+    uint16_t flags = little_endian_read_16(packet, 0) & 0xf000;
+    if ((flags & 0x3000) == 0x0000){
+        flags |= 0x2000;
+    }
+    uint8_t message[VIRTUAL_LINK_MESSAGE_MAX_SIZE];
+    message[0] = LINK_MESSAGE_ACL;
+    (void)memcpy(&message[9], packet, size);
+    little_endian_store_16(message, 9, flags | connection->peer_con_handle);
+    uint64_t arrival_us = virtual_link_send(message, 9 + size, 1);
+
+    // buffer becomes available when acknowledgement would arrive
+    virtual_packet_t * completed = virtual_packet_create(0, 2, 2);
+    if (completed == NULL) return;
+    completed->due_us = arrival_us + virtual_config.latency_us;
+    little_endian_store_16(completed->data, 0, con_handle);
+    virtual_queue_add(&virtual_completed_queue, completed);
+    virtual_acl_buffers_used++;
+}
+
+// transport
+
+static void virtual_init(const void * transport_config){
+    if (transport_config == NULL){
+        log_error("virtual: no config");
+        return;
+    }
+    (void)memcpy(&virtual_config, transport_config, sizeof(hci_transport_config_virtual_t));
+    if (virtual_config.acl_buffer_size == 0){
+        virtual_config.acl_buffer_size = VIRTUAL_ACL_BUFFER_SIZE;
+    }
+    if (virtual_config.acl_buffer_size > 1021){
+        virtual_config.acl_buffer_size = 1021;
+    }
+    if (virtual_config.acl_buffer_count == 0){
+        virtual_config.acl_buffer_count = VIRTUAL_ACL_BUFFER_COUNT;
+    }
+    if (virtual_config.num_command_packets == 0){
+        virtual_config.num_command_packets = 1;
+    }
+    virtual_random_state = virtual_config.random_seed;
+    if (virtual_random_state == 0){
+        virtual_random_state = big_endian_read_32(virtual_config.bd_addr, 2) | 1u;
+    }
+}
+
+static int virtual_open(void){
+    log_info("virtual: open, %u ACL buffers of %u bytes, latency %u us, bit rate %u, loss %u/1000, HCI latency %u us, %u command packets",
+             virtual_config.acl_buffer_count, virtual_config.acl_buffer_size, virtual_config.latency_us,
+             virtual_config.bit_rate, virtual_config.loss_per_mille, virtual_config.hci_latency_us, virtual_config.num_command_packets);
+    memset(virtual_connections, 0, sizeof(virtual_connections));
+    virtual_link_tx_busy_until_us = 0;
+    virtual_link_last_arrival_us = 0;
+    btstack_run_loop_set_data_source_fd(&virtual_link_data_source, virtual_config.link_fd);
+    btstack_run_loop_set_data_source_handler(&virtual_link_data_source, &virtual_link_process);
+    btstack_run_loop_enable_data_source_callbacks(&virtual_link_data_source, DATA_SOURCE_CALLBACK_READ);
+    btstack_run_loop_add_data_source(&virtual_link_data_source);
+    return 0;
+}
+
+static int virtual_close(void){
+    btstack_run_loop_remove_data_source(&virtual_link_data_source);
+    if (virtual_timer_active){
+        btstack_run_loop_remove_timer(&virtual_timer);
+        virtual_timer_active = 0;
+    }
+    if (virtual_advertising_timer_active){
+        btstack_run_loop_remove_timer(&virtual_advertising_timer);
+        virtual_advertising_timer_active = 0;
+    }
+    virtual_queue_free(&virtual_host_queue);
+    // keep state of peer from link messages in flight, e.g. advertising enabled during power cycle
+    virtual_packet_t * packet;
+    while ((packet = virtual_queue_pop(&virtual_link_queue)) != NULL){
+        switch ((virtual_link_message_t) packet->data[0]){
+            case LINK_MESSAGE_INFO:
+                reverse_bd_addr(&packet->data[9], virtual_peer_addr);
+                virtual_peer_scan_enable = packet->data[15];
+                virtual_peer_class_of_device = little_endian_read_24(packet->data, 16);
+                (void)memcpy(virtual_peer_name, &packet->data[19], 248);
+                break;
+            case LINK_MESSAGE_ADVERTISING:
+                (void)memcpy(virtual_peer_advertising, &packet->data[9], sizeof(virtual_peer_advertising));
+                break;
+            case LINK_MESSAGE_EXTENDED_ADVERTISING:
+                virtual_peer_advertising_set_update(packet->data);
+                break;
+            default:
+                break;
+        }
+        free(packet);
+    }
+    virtual_queue_free(&virtual_completed_queue);
+    virtual_acl_buffers_used = 0;
+    return 0;
+}
+
+static void virtual_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    virtual_packet_handler = handler;
+}
+
+static int virtual_send_packet(uint8_t packet_type, uint8_t * packet, int size){
+    switch (packet_type){
+        case HCI_COMMAND_DATA_PACKET:
+            virtual_handle_command(packet, size);
+            break;
+        case HCI_ACL_DATA_PACKET:
+            virtual_handle_acl_packet(packet, size);
+            break;
+        default:
+            log_error("virtual: packet type %u not supported", packet_type);
+            return -1;
+    }
+    // events are delivered from the run loop
+    virtual_schedule();
+    return 0;
+}
+
+static const hci_transport_t hci_transport_virtual = {
+    /* const char * name; */                                        "VIRTUAL",
+    /* void   (*init) (const void *transport_config); */            &virtual_init,
+    /* int    (*open)(void); */                                     &virtual_open,
+    /* int    (*close)(void); */                                    &virtual_close,
+    /* void   (*register_packet_handler)(void (*handler)(...); */   &virtual_register_packet_handler,
+    /* int    (*can_send_packet_now)(uint8_t packet_type); */       NULL,
+    /* int    (*send_packet)(...); */                               &virtual_send_packet,
+    /* int    (*set_baudrate)(uint32_t baudrate); */                NULL,
+    /* void   (*reset_link)(void); */                               NULL,
+    /* void   (*set_sco_config)(uint16_t voice_setting, int num_connections); */ NULL,
+};
+
+const hci_transport_t * hci_transport_virtual_instance(void){
+    return &hci_transport_virtual;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_transport_virtual.h
+ *  Software Bluetooth Controller connected to a second instance via a local socket
+ */
+
+#ifndef HCI_TRANSPORT_VIRTUAL_H
+#define HCI_TRANSPORT_VIRTUAL_H
+
+#include <stdint.h>
+
+#include "bluetooth.h"
+#include "hci_transport.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+// LE Extended Advertising limits reported by the virtual controller
+#define HCI_TRANSPORT_VIRTUAL_MAX_ADVERTISING_SETS     4
+#define HCI_TRANSPORT_VIRTUAL_MAX_ADVERTISING_DATA_LEN 1650
+// max data in one LE Extended Advertising Report, longer data is reported in chained reports
+#define HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORT_DATA_LEN 229
+
+// chained LE Extended Advertising Reports
+#define HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORTS_COMPLETE    0    // reports of one advertising set back to back
+#define HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORTS_TRUNCATED   1    // last report with data status 'truncated' and no data
+#define HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORTS_INTERLEAVED 2    // reports of all advertising sets in turn
+
+typedef struct {
+    hci_transport_config_type_t type; // == HCI_TRANSPORT_CONFIG_VIRTUAL
+    int        link_fd;               // SOCK_SEQPACKET socket connected to the peer virtual controller
+    bd_addr_t  bd_addr;               // public address of this controller
+    uint16_t   acl_buffer_size;       // ACL payload size reported by Read Buffer Size, 0 = 1021
+    uint16_t   acl_buffer_count;      // number of ACL buffers reported by Read Buffer Size, 0 = 8
+    uint32_t   latency_us;            // one-way latency of the radio link
+    uint32_t   bit_rate;              // bit rate of the radio link, 0 = unlimited
+    uint16_t   loss_per_mille;        // probability that a transmission attempt is lost and has to be repeated
+    uint32_t   random_seed;           // seed for LE Rand and losses, 0 = derived from bd_addr
+    uint32_t   hci_latency_us;        // delay of events and ACL packets to the host, i.e. HCI command round trip time
+    uint8_t    num_command_packets;   // Num_HCI_Command_Packets in Command Complete and Command Status events, 0 = 1
+    uint8_t    extended_advertising_report_mode; // HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORTS_...
+} hci_transport_config_virtual_t;
+
+/**
+ * @brief Provide virtual controller transport
+ * @note Two BTstack processes using a virtual controller each and connected via socketpair(AF_UNIX, SOCK_SEQPACKET)
+ *       can connect to each other via LE or Classic. ACL flow control is done via Number Of Completed Packets events.
+ *       Commands not emulated are acknowledged with a Command Complete event.
+ */
+const hci_transport_t * hci_transport_virtual_instance(void);
+
+/* API_END */
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // HCI_TRANSPORT_VIRTUAL_H
@@ -93,6 +93,24 @@ typedef struct {
      */
     void (*set_bd_addr_command)(bd_addr_t addr, uint8_t *hci_cmd_buffer); 
 
+    /**
+     * optional: support custom init sequences that are already in memory, e.g. a memory-mapped init script.
+     * If set, it is used instead of next_command. The command can be stored in hci_cmd_buffer or in
+     * chipset memory that stays valid until the next call. The HCI_OUTGOING_PRE_BUFFER_SIZE bytes before
+     * it must be writable, as the HCI transport may store the packet type there.
+     * @param  hci_cmd_buffer to store generated command
+     * @param  hci_cmd set to generated command, either hci_cmd_buffer or chipset memory
+     * @return result see btstack_chipset_result_t
+     */
+    btstack_chipset_result_t (*next_command_in_place)(uint8_t * hci_cmd_buffer, uint8_t ** hci_cmd);
+
+    /**
+     * optional: identify the init script that will be sent, e.g. by size and modification time of an init script file.
+     * The init script can change controller capabilities, so it is part of the key of the controller cache.
+     * @return identity of init script, 0 if there is none
+     */
+    uint32_t (*init_script_identity)(void);
+
 } btstack_chipset_t;
 
 #if defined __cplusplus
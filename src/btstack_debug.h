@@ -93,7 +93,12 @@ static inline void __log_unused(const char *format, ...) {
 #endif
 #endif
 
-#ifdef __AVR__
+#if defined(ENABLE_HCI_DUMP_BINARY_LOG) && !defined(__AVR__)
+// file name and line number are part of the format string, so that binary log only stores the arguments
+#define HCI_DUMP_LOG_STRINGIFY(x) #x
+#define HCI_DUMP_LOG_LINE(x) HCI_DUMP_LOG_STRINGIFY(x)
+#define HCI_DUMP_LOG(log_level, format, ...) hci_dump_log(log_level, BTSTACK_FILE__ "." HCI_DUMP_LOG_LINE(__LINE__) ": " format, ## __VA_ARGS__)
+#elif defined(__AVR__)
 #define HCI_DUMP_LOG(log_level, format, ...) hci_dump_log_P(log_level, PSTR("%s.%u: " format), BTSTACK_FILE__, __LINE__, ## __VA_ARGS__)
 #else
 #define HCI_DUMP_LOG(log_level, format, ...) hci_dump_log(log_level, "%s.%u: " format, BTSTACK_FILE__, __LINE__, ## __VA_ARGS__)
@@ -132,6 +132,10 @@ typedef uint8_t sm_key_t[16];
 // debug log messages
 #define LOG_MESSAGE_PACKET      0xfc
 
+// binary debug log: format string definition and message with raw arguments, see ENABLE_HCI_DUMP_BINARY_LOG
+#define LOG_FORMAT_PACKET       0xf0
+#define LOG_BINARY_PACKET       0xf1
+
 
 // DAEMON COMMANDS
 
@@ -627,6 +631,25 @@ typedef uint8_t sm_key_t[16];
 // array of advertisements, not handled by event accessor generator
 #define HCI_SUBEVENT_LE_DIRECT_ADVERTISING_REPORT          0x0B
 
+// array of extended advertisements, not handled by event accessor generator
+#define HCI_SUBEVENT_LE_EXTENDED_ADVERTISING_REPORT        0x0D
+
+/**
+ * @format 1
+ * @param subevent_code
+ */
+#define HCI_SUBEVENT_LE_SCAN_TIMEOUT                       0x11
+
+/**
+ * @format 111H1
+ * @param subevent_code
+ * @param status
+ * @param advertising_handle
+ * @param connection_handle
+ * @param num_completed_extended_advertising_events
+ */
+#define HCI_SUBEVENT_LE_ADVERTISING_SET_TERMINATED         0x12
+
 
 /**
  * @format 1
@@ -1362,6 +1385,27 @@ typedef uint8_t sm_key_t[16];
  */
 #define GAP_EVENT_RSSI_MEASUREMENT                            0xE5
 
+/**
+ * @format 21B1111121BLV
+ * @param advertising_event_type
+ * @param address_type
+ * @param address
+ * @param primary_phy
+ * @param secondary_phy
+ * @param advertising_sid
+ * @param tx_power
+ * @param rssi
+ * @param periodic_advertising_interval
+ * @param direct_address_type
+ * @param direct_address
+ * @param data_length
+ * @param data
+ * @note Data of chained AUX PDUs is reassembled. Data status in bits 5-6 of advertising_event_type is 0 (complete) or 2 (truncated)
+ * @note With more than 230 bytes of data, the event length does not fit into event[1], which is set to 255 then.
+ *       Use the size passed to the packet handler or data_length instead of event[1]
+ */
+#define GAP_EVENT_EXTENDED_ADVERTISING_REPORT                 0xE6
+
 // Meta Events, see below for sub events
 #define HCI_EVENT_HSP_META                                 0xE8
 #define HCI_EVENT_HFP_META                                 0xE9
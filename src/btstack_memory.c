@@ -35,6 +35,7 @@
  *
  */
 
+
 #define BTSTACK_FILE__ "btstack_memory.c"
 
 
@@ -194,6 +195,55 @@ void btstack_memory_l2cap_channel_free(l2cap_channel_t *l2cap_channel){
 #endif
 
 
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+
+// MARK: hci_acl_recombination_buffer_t
+#if !defined(HAVE_MALLOC) && !defined(MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS)
+    #if defined(MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS)
+        #error "Deprecated MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS defined instead of MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS. Please update your btstack_config.h to use MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS."
+    #else
+        #define MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS 0
+    #endif
+#endif
+
+#ifdef MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS
+#if MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS > 0
+static hci_acl_recombination_buffer_t hci_acl_recombination_buffer_storage[MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS];
+static btstack_memory_pool_t hci_acl_recombination_buffer_pool;
+hci_acl_recombination_buffer_t * btstack_memory_hci_acl_recombination_buffer_get(void){
+    void * buffer = btstack_memory_pool_get(&hci_acl_recombination_buffer_pool);
+    if (buffer){
+        memset(buffer, 0, sizeof(hci_acl_recombination_buffer_t));
+    }
+    return (hci_acl_recombination_buffer_t *) buffer;
+}
+void btstack_memory_hci_acl_recombination_buffer_free(hci_acl_recombination_buffer_t *hci_acl_recombination_buffer){
+    btstack_memory_pool_free(&hci_acl_recombination_buffer_pool, hci_acl_recombination_buffer);
+}
+#else
+hci_acl_recombination_buffer_t * btstack_memory_hci_acl_recombination_buffer_get(void){
+    return NULL;
+}
+void btstack_memory_hci_acl_recombination_buffer_free(hci_acl_recombination_buffer_t *hci_acl_recombination_buffer){
+    // silence compiler warning about unused parameter in a portable way
+    (void) hci_acl_recombination_buffer;
+};
+#endif
+#elif defined(HAVE_MALLOC)
+hci_acl_recombination_buffer_t * btstack_memory_hci_acl_recombination_buffer_get(void){
+    void * buffer = malloc(sizeof(hci_acl_recombination_buffer_t));
+    if (buffer){
+        memset(buffer, 0, sizeof(hci_acl_recombination_buffer_t));
+    }
+    return (hci_acl_recombination_buffer_t *) buffer;
+}
+void btstack_memory_hci_acl_recombination_buffer_free(hci_acl_recombination_buffer_t *hci_acl_recombination_buffer){
+    free(hci_acl_recombination_buffer);
+}
+#endif
+
+
+#endif
 #ifdef ENABLE_CLASSIC
 
 // MARK: rfcomm_multiplexer_t
@@ -1188,6 +1238,11 @@ void btstack_memory_init(void){
 #if MAX_NR_L2CAP_CHANNELS > 0
     btstack_memory_pool_create(&l2cap_channel_pool, l2cap_channel_storage, MAX_NR_L2CAP_CHANNELS, sizeof(l2cap_channel_t));
 #endif
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+#if MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS > 0
+    btstack_memory_pool_create(&hci_acl_recombination_buffer_pool, hci_acl_recombination_buffer_storage, MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS, sizeof(hci_acl_recombination_buffer_t));
+#endif
+#endif
 #ifdef ENABLE_CLASSIC
 #if MAX_NR_RFCOMM_MULTIPLEXERS > 0
     btstack_memory_pool_create(&rfcomm_multiplexer_pool, rfcomm_multiplexer_storage, MAX_NR_RFCOMM_MULTIPLEXERS, sizeof(rfcomm_multiplexer_t));
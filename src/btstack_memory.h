@@ -99,6 +99,11 @@ void   btstack_memory_l2cap_service_free(l2cap_service_t *l2cap_service);
 l2cap_channel_t * btstack_memory_l2cap_channel_get(void);
 void   btstack_memory_l2cap_channel_free(l2cap_channel_t *l2cap_channel);
 
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+// hci_acl_recombination_buffer
+hci_acl_recombination_buffer_t * btstack_memory_hci_acl_recombination_buffer_get(void);
+void   btstack_memory_hci_acl_recombination_buffer_free(hci_acl_recombination_buffer_t *hci_acl_recombination_buffer);
+#endif
 #ifdef ENABLE_CLASSIC
 // rfcomm_multiplexer, rfcomm_service, rfcomm_channel
 rfcomm_multiplexer_t * btstack_memory_rfcomm_multiplexer_get(void);
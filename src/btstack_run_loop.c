@@ -134,9 +134,28 @@ int btstack_run_loop_remove_data_source(btstack_data_source_t *ds){
 
 void btstack_run_loop_set_timer(btstack_timer_source_t *a, uint32_t timeout_in_ms){
     btstack_run_loop_assert();
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+    a->timeout_us = 0;
+#endif
     the_run_loop->set_timer(a, timeout_in_ms);
 }
 
+void btstack_run_loop_set_timer_us(btstack_timer_source_t *a, uint32_t timeout_in_us){
+    btstack_run_loop_assert();
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+    // requires get_time_ms() == get_time_us() / 1000
+    if (the_run_loop->get_time_us != NULL){
+        uint64_t timeout_us = the_run_loop->get_time_us() + timeout_in_us;
+        a->timeout    = (uint32_t) (timeout_us / 1000u);
+        a->timeout_us = (uint16_t) (timeout_us % 1000u);
+        return;
+    }
+    a->timeout_us = 0;
+#endif
+    // round up to next ms
+    the_run_loop->set_timer(a, (timeout_in_us + 999u) / 1000u);
+}
+
 /**
  * @brief Set context for this timer
  */
@@ -175,6 +194,17 @@ uint32_t btstack_run_loop_get_time_ms(void){
     return the_run_loop->get_time_ms();
 }
 
+/**
+ * @brief Get current time in us
+ */
+uint64_t btstack_run_loop_get_time_us(void){
+    btstack_run_loop_assert();
+    if (the_run_loop->get_time_us){
+        return the_run_loop->get_time_us();
+    }
+    return ((uint64_t) the_run_loop->get_time_ms()) * 1000u;
+}
+
 
 void btstack_run_loop_timer_dump(void){
     btstack_run_loop_assert();
@@ -189,6 +219,15 @@ void btstack_run_loop_execute(void){
     the_run_loop->execute();
 }
 
+void btstack_run_loop_execute_on_main_thread(btstack_context_callback_registration_t * callback_registration){
+    btstack_run_loop_assert();
+    if (the_run_loop->execute_on_main_thread){
+        the_run_loop->execute_on_main_thread(callback_registration);
+    } else {
+        log_error("btstack_run_loop_execute_on_main_thread not implemented");
+    }
+}
+
 // init must be called before any other run_loop call
 void btstack_run_loop_init(const btstack_run_loop_t * run_loop){
     if (the_run_loop){
@@ -47,6 +47,7 @@
 #include "btstack_config.h"
 
 #include "btstack_bool.h"
+#include "btstack_defines.h"
 #include "btstack_linked_list.h"
 
 #include <stdint.h>
@@ -92,6 +93,18 @@ typedef struct btstack_timer_source {
     // will be called when timer fired
     void  (*process)(struct btstack_timer_source *ts); 
     void * context;
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+    // sub-millisecond part of timeout in microseconds (0..999), see btstack_run_loop_set_timer_us
+    uint16_t timeout_us;
+#endif
+#ifdef ENABLE_RUN_LOOP_TIMER_HEAP
+    // binary heap links used by btstack_run_loop_base instead of item.next
+    struct btstack_timer_source * heap_parent;
+    struct btstack_timer_source * heap_left;
+    struct btstack_timer_source * heap_right;
+    // 1-based position in heap, 0 if not in heap
+    uint32_t heap_position;
+#endif
 } btstack_timer_source_t;
 
 typedef struct btstack_run_loop {
@@ -106,6 +119,8 @@ typedef struct btstack_run_loop {
 	void (*execute)(void);
 	void (*dump_timer)(void);
 	uint32_t (*get_time_ms)(void);
+	void (*execute_on_main_thread)(btstack_context_callback_registration_t * callback_registration);
+	uint64_t (*get_time_us)(void);
 } btstack_run_loop_t;
 
 void btstack_run_loop_timer_dump(void);
@@ -124,6 +139,13 @@ void btstack_run_loop_init(const btstack_run_loop_t * run_loop);
  */
 void btstack_run_loop_set_timer(btstack_timer_source_t * ts, uint32_t timeout_in_ms);
 
+/**
+ * @brief Set timer based on current time in microseconds.
+ * @note Sub-millisecond deadlines require ENABLE_RUN_LOOP_TIMER_US and a run loop that provides get_time_us,
+ *       otherwise the timeout is rounded up to the next millisecond.
+ */
+void btstack_run_loop_set_timer_us(btstack_timer_source_t * ts, uint32_t timeout_in_us);
+
 /**
  * @brief Set callback that will be executed when timer expires.
  */
@@ -155,6 +177,12 @@ int  btstack_run_loop_remove_timer(btstack_timer_source_t * timer);
  */
 uint32_t btstack_run_loop_get_time_ms(void);
 
+/**
+ * @brief Get current time in us from monotonic clock
+ * @note 64-bit us counter does not overflow. If not supported by run loop, get_time_ms is used instead
+ */
+uint64_t btstack_run_loop_get_time_us(void);
+
 /**
  * @brief Set data source callback.
  */
@@ -220,6 +248,13 @@ int btstack_run_loop_remove_data_source(btstack_data_source_t * data_source);
  */
 void btstack_run_loop_execute(void);
 
+/**
+ * @brief Execute callback on the run loop thread. Can be called from any thread.
+ * @param callback_registration with callback and context. Must stay valid until callback was executed.
+ * @note Callbacks are executed in the order they have been posted. Not supported by all run loops.
+ */
+void btstack_run_loop_execute_on_main_thread(btstack_context_callback_registration_t * callback_registration);
+
 /* API_END */
 
 #if defined __cplusplus
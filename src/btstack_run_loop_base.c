@@ -48,14 +48,24 @@
 #include "btstack_util.h"
 
 #include "btstack_run_loop_base.h"
+#include "btstack_run_loop_profiler.h"
 
 // private data (access only by run loop implementations)
 btstack_linked_list_t btstack_run_loop_base_timers;
 btstack_linked_list_t btstack_run_loop_base_data_sources;
 
+#ifdef ENABLE_RUN_LOOP_TIMER_HEAP
+static btstack_timer_source_t * btstack_run_loop_base_heap_root;
+static uint32_t btstack_run_loop_base_heap_size;
+#endif
+
 void btstack_run_loop_base_init(void){
     btstack_run_loop_base_timers = NULL;
     btstack_run_loop_base_data_sources = NULL;    
+#ifdef ENABLE_RUN_LOOP_TIMER_HEAP
+    btstack_run_loop_base_heap_root = NULL;
+    btstack_run_loop_base_heap_size = 0;
+#endif
 }
 
 void btstack_run_loop_base_add_data_source(btstack_data_source_t *ds){
@@ -75,6 +85,192 @@ void btstack_run_loop_base_disable_data_source_callbacks(btstack_data_source_t *
 }
 
 
+static bool btstack_run_loop_base_timer_before(const btstack_timer_source_t * a, const btstack_timer_source_t * b){
+    int32_t delta = btstack_time_delta(a->timeout, b->timeout);
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+    if (delta == 0){
+        return a->timeout_us < b->timeout_us;
+    }
+#endif
+    return delta < 0;
+}
+
+// time from now until timeout of timer in us, now given as ms and sub-millisecond part in us
+static int64_t btstack_run_loop_base_timer_delta_us(const btstack_timer_source_t * ts, uint32_t now_ms, uint16_t now_us){
+    int64_t delta_us = ((int64_t) btstack_time_delta(ts->timeout, now_ms)) * 1000;
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+    delta_us += (int64_t) ts->timeout_us - (int64_t) now_us;
+#else
+    UNUSED(now_us);
+#endif
+    return delta_us;
+}
+
+#ifdef ENABLE_RUN_LOOP_TIMER_HEAP
+
+// Timers are kept in a binary min-heap linked via heap_parent/heap_left/heap_right.
+// Node at position n (1-based, breadth first) has children at 2n and 2n+1, so the path
+// from the root to position n is given by the bits of n below its most significant bit.
+// Insert and remove are O(log n). Timers with identical timeout fire in unspecified order.
+// Each timer stores its position, which is only trusted if the heap has the timer at that position.
+
+static bool btstack_run_loop_base_heap_less(const btstack_timer_source_t * a, const btstack_timer_source_t * b){
+    return btstack_run_loop_base_timer_before(a, b);
+}
+
+static btstack_timer_source_t * btstack_run_loop_base_heap_get_node(uint32_t position){
+    int bit = 31;
+    while ((position & (1u << bit)) == 0u){
+        bit--;
+    }
+    btstack_timer_source_t * node = btstack_run_loop_base_heap_root;
+    while (bit > 0){
+        bit--;
+        node = ((position & (1u << bit)) != 0u) ? node->heap_right : node->heap_left;
+    }
+    return node;
+}
+
+static void btstack_run_loop_base_heap_set_child(btstack_timer_source_t * parent, btstack_timer_source_t * old_child, btstack_timer_source_t * new_child){
+    if (parent == NULL){
+        btstack_run_loop_base_heap_root = new_child;
+    } else if (parent->heap_left == old_child){
+        parent->heap_left = new_child;
+    } else {
+        parent->heap_right = new_child;
+    }
+}
+
+// swap node with its parent
+static void btstack_run_loop_base_heap_swap_with_parent(btstack_timer_source_t * node){
+    btstack_timer_source_t * parent = node->heap_parent;
+    btstack_timer_source_t * left   = node->heap_left;
+    btstack_timer_source_t * right  = node->heap_right;
+    uint32_t position = node->heap_position;
+    node->heap_position   = parent->heap_position;
+    parent->heap_position = position;
+    btstack_run_loop_base_heap_set_child(parent->heap_parent, parent, node);
+    node->heap_parent = parent->heap_parent;
+    if (parent->heap_left == node){
+        node->heap_left  = parent;
+        node->heap_right = parent->heap_right;
+        if (node->heap_right != NULL){
+            node->heap_right->heap_parent = node;
+        }
+    } else {
+        node->heap_right = parent;
+        node->heap_left  = parent->heap_left;
+        if (node->heap_left != NULL){
+            node->heap_left->heap_parent = node;
+        }
+    }
+    parent->heap_parent = node;
+    parent->heap_left   = left;
+    parent->heap_right  = right;
+    if (left != NULL){
+        left->heap_parent = parent;
+    }
+    if (right != NULL){
+        right->heap_parent = parent;
+    }
+}
+
+static void btstack_run_loop_base_heap_sift_up(btstack_timer_source_t * node){
+    while ((node->heap_parent != NULL) && btstack_run_loop_base_heap_less(node, node->heap_parent)){
+        btstack_run_loop_base_heap_swap_with_parent(node);
+    }
+}
+
+static void btstack_run_loop_base_heap_sift_down(btstack_timer_source_t * node){
+    while (true){
+        btstack_timer_source_t * child = node->heap_left;
+        if (child == NULL) break;
+        if ((node->heap_right != NULL) && btstack_run_loop_base_heap_less(node->heap_right, child)){
+            child = node->heap_right;
+        }
+        if (btstack_run_loop_base_heap_less(child, node) == false) break;
+        btstack_run_loop_base_heap_swap_with_parent(child);
+    }
+}
+
+// timer might be uninitialized, a copy of a timer in the heap, or reused after removal
+static bool btstack_run_loop_base_heap_contains(const btstack_timer_source_t * ts){
+    uint32_t position = ts->heap_position;
+    if ((position == 0u) || (position > btstack_run_loop_base_heap_size)) return false;
+    return btstack_run_loop_base_heap_get_node(position) == ts;
+}
+
+bool btstack_run_loop_base_remove_timer(btstack_timer_source_t *ts){
+    if (btstack_run_loop_base_heap_contains(ts) == false) return false;
+
+    // detach last node
+    btstack_timer_source_t * last = btstack_run_loop_base_heap_get_node(btstack_run_loop_base_heap_size);
+    btstack_run_loop_base_heap_set_child(last->heap_parent, last, NULL);
+    btstack_run_loop_base_heap_size--;
+
+    // move last node into position of removed timer
+    if (last != ts){
+        last->heap_position = ts->heap_position;
+        last->heap_parent = ts->heap_parent;
+        last->heap_left   = ts->heap_left;
+        last->heap_right  = ts->heap_right;
+        btstack_run_loop_base_heap_set_child(ts->heap_parent, ts, last);
+        if (last->heap_left != NULL){
+            last->heap_left->heap_parent = last;
+        }
+        if (last->heap_right != NULL){
+            last->heap_right->heap_parent = last;
+        }
+        btstack_run_loop_base_heap_sift_up(last);
+        btstack_run_loop_base_heap_sift_down(last);
+    }
+
+    ts->heap_parent = NULL;
+    ts->heap_left   = NULL;
+    ts->heap_right  = NULL;
+    ts->heap_position = 0;
+    return true;
+}
+
+void btstack_run_loop_base_add_timer(btstack_timer_source_t *ts){
+    // don't add timer that's already in there
+    if (btstack_run_loop_base_heap_contains(ts)){
+        log_error( "btstack_run_loop_timer_add error: timer to add already in list!");
+        return;
+    }
+    ts->heap_left  = NULL;
+    ts->heap_right = NULL;
+    btstack_run_loop_base_heap_size++;
+    ts->heap_position = btstack_run_loop_base_heap_size;
+    if (btstack_run_loop_base_heap_size == 1u){
+        ts->heap_parent = NULL;
+        btstack_run_loop_base_heap_root = ts;
+        return;
+    }
+    btstack_timer_source_t * parent = btstack_run_loop_base_heap_get_node(btstack_run_loop_base_heap_size >> 1);
+    ts->heap_parent = parent;
+    if ((btstack_run_loop_base_heap_size & 1u) == 0u){
+        parent->heap_left = ts;
+    } else {
+        parent->heap_right = ts;
+    }
+    btstack_run_loop_base_heap_sift_up(ts);
+}
+
+static btstack_timer_source_t * btstack_run_loop_base_get_first_timer(void){
+    return btstack_run_loop_base_heap_root;
+}
+
+void btstack_run_loop_base_dump_timer(void){
+    uint32_t i;
+    for (i = 1; i <= btstack_run_loop_base_heap_size; i++){
+        btstack_timer_source_t * ts = btstack_run_loop_base_heap_get_node(i);
+        log_info("timer %u (%p): timeout %u\n", (unsigned int) i, ts, ts->timeout);
+    }
+}
+
+#else
+
 bool btstack_run_loop_base_remove_timer(btstack_timer_source_t *ts){
     return btstack_linked_list_remove(&btstack_run_loop_base_timers, (btstack_linked_item_t *) ts);
 }
@@ -88,36 +284,83 @@ void btstack_run_loop_base_add_timer(btstack_timer_source_t *ts){
             return;
         }
         // exit if list timeout is after new timeout
-        uint32_t list_timeout = ((btstack_timer_source_t *) it->next)->timeout;
-        int32_t delta = btstack_time_delta(ts->timeout, list_timeout);
-        if (delta < 0) break;
+        if (btstack_run_loop_base_timer_before(ts, (btstack_timer_source_t *) it->next)) break;
     }
     ts->item.next = it->next;
     it->next = (btstack_linked_item_t *) ts;
 }
 
-void  btstack_run_loop_base_process_timers(uint32_t now){
+static btstack_timer_source_t * btstack_run_loop_base_get_first_timer(void){
+    return (btstack_timer_source_t *) btstack_run_loop_base_timers;
+}
+
+void btstack_run_loop_base_dump_timer(void){
+    btstack_linked_item_t *it;
+    int i = 0;
+    for (it = (btstack_linked_item_t *) btstack_run_loop_base_timers; it ; it = it->next){
+        btstack_timer_source_t *ts = (btstack_timer_source_t*) it;
+        log_info("timer %u (%p): timeout %u\n", i, ts, ts->timeout);
+        i++;
+    }
+}
+
+#endif
+
+static void btstack_run_loop_base_process_timers_internal(uint32_t now_ms, uint16_t now_us){
     // process timers, exit when timeout is in the future
-    while (btstack_run_loop_base_timers) {
-        btstack_timer_source_t * ts = (btstack_timer_source_t *) btstack_run_loop_base_timers;
-        int32_t delta = btstack_time_delta(ts->timeout, now);
-        if (delta > 0) break;
+    while (true) {
+        btstack_timer_source_t * ts = btstack_run_loop_base_get_first_timer();
+        if (ts == NULL) break;
+        int64_t delta_us = btstack_run_loop_base_timer_delta_us(ts, now_ms, now_us);
+        if (delta_us > 0) break;
         btstack_run_loop_base_remove_timer(ts);
+#ifdef ENABLE_RUN_LOOP_PROFILER
+        // ts might be freed by callback
+        btstack_run_loop_profiler_callback_t callback = (btstack_run_loop_profiler_callback_t) ts->process;
+        btstack_run_loop_profiler_record(BTSTACK_RUN_LOOP_PROFILER_TIMER_DELAY, callback, (uint32_t) (-delta_us));
+        uint32_t start_us = btstack_run_loop_profiler_get_time_us();
+        ts->process(ts);
+        btstack_run_loop_profiler_record(BTSTACK_RUN_LOOP_PROFILER_TIMER, callback, btstack_run_loop_profiler_get_time_us() - start_us);
+#else
         ts->process(ts);
+#endif
     }
 }
 
+void  btstack_run_loop_base_process_timers(uint32_t now){
+    btstack_run_loop_base_process_timers_internal(now, 0);
+}
+
 /**
  * @brief Get time until first timer fires
  * @returns -1 if no timers, time until next timeout otherwise
  */
 int32_t btstack_run_loop_base_get_time_until_timeout(uint32_t now){
-    if (btstack_run_loop_base_timers == NULL) return -1;
-    btstack_timer_source_t * ts = (btstack_timer_source_t *) btstack_run_loop_base_timers;
-    uint32_t list_timeout  = ts->timeout;
-    int32_t delta = btstack_time_delta(list_timeout, now);
-    if (delta < 0){
-        delta = 0;
+    btstack_timer_source_t * ts = btstack_run_loop_base_get_first_timer();
+    if (ts == NULL) return -1;
+    int64_t delta_us = btstack_run_loop_base_timer_delta_us(ts, now, 0);
+    if (delta_us < 0){
+        delta_us = 0;
+    }
+    // round up
+    return (int32_t) ((delta_us + 999) / 1000);
+}
+
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+void btstack_run_loop_base_process_timers_us(uint64_t now_us){
+    btstack_run_loop_base_process_timers_internal((uint32_t) (now_us / 1000u), (uint16_t) (now_us % 1000u));
+}
+
+int32_t btstack_run_loop_base_get_time_until_timeout_us(uint64_t now_us){
+    btstack_timer_source_t * ts = btstack_run_loop_base_get_first_timer();
+    if (ts == NULL) return -1;
+    int64_t delta_us = btstack_run_loop_base_timer_delta_us(ts, (uint32_t) (now_us / 1000u), (uint16_t) (now_us % 1000u));
+    if (delta_us < 0){
+        delta_us = 0;
+    }
+    if (delta_us > INT32_MAX){
+        delta_us = INT32_MAX;
     }
-    return delta;
+    return (int32_t) delta_us;
 }
+#endif
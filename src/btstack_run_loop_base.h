@@ -55,6 +55,7 @@ extern "C" {
 #endif
 
 // private data (access only by run loop implementations)
+// timers are kept in a sorted list, or in a binary heap if ENABLE_RUN_LOOP_TIMER_HEAP is defined
 extern btstack_linked_list_t btstack_run_loop_base_timers;
 extern btstack_linked_list_t btstack_run_loop_base_data_sources;
 	
@@ -76,6 +77,11 @@ void btstack_run_loop_base_add_timer(btstack_timer_source_t * timer);
  */
 bool  btstack_run_loop_base_remove_timer(btstack_timer_source_t * timer);
 
+/**
+ * @brief Log all timers
+ */
+void btstack_run_loop_base_dump_timer(void);
+
 /**
  * @brief Process timers: remove expired timers from list and call their process function
  * @param now
@@ -88,6 +94,21 @@ void  btstack_run_loop_base_process_timers(uint32_t now);
  */
 int32_t btstack_run_loop_base_get_time_until_timeout(uint32_t now);
 
+#ifdef ENABLE_RUN_LOOP_TIMER_US
+/**
+ * @brief Process timers with sub-millisecond deadlines: remove expired timers from list and call their process function
+ * @param now_us in us, get_time_ms() == now_us / 1000
+ */
+void btstack_run_loop_base_process_timers_us(uint64_t now_us);
+
+/**
+ * @brief Get time until first timer fires in us
+ * @param now_us
+ * @returns -1 if no timers, time until next timeout in us otherwise
+ */
+int32_t btstack_run_loop_base_get_time_until_timeout_us(uint64_t now_us);
+#endif
+
 /**
  * @brief Add data source to run loop
  * @param data_source to add
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "btstack_run_loop_profiler.c"
+
+/*
+ *  btstack_run_loop_profiler.c
+ *
+ *  HDR-style histograms for run loop callbacks: bucket width grows with the value, so that
+ *  relative error stays constant while memory per histogram stays fixed.
+ */
+
+#include "btstack_run_loop_profiler.h"
+
+#include "btstack_debug.h"
+#include "btstack_run_loop.h"
+#include "btstack_util.h"
+
+#include <string.h>
+
+#define SUB_BUCKET_COUNT (1u << BTSTACK_RUN_LOOP_PROFILER_SUB_BUCKET_BITS)
+#define MAX_VALUE        ((1u << BTSTACK_RUN_LOOP_PROFILER_MAX_VALUE_BITS) - 1u)
+
+static btstack_run_loop_profiler_histogram_t btstack_run_loop_profiler_histograms[MAX_NR_RUN_LOOP_PROFILER_HISTOGRAMS];
+static uint16_t btstack_run_loop_profiler_num_histograms;
+static uint32_t btstack_run_loop_profiler_dropped;
+
+static btstack_timer_source_t btstack_run_loop_profiler_dump_timer;
+static uint32_t btstack_run_loop_profiler_dump_interval_ms;
+
+static const char * btstack_run_loop_profiler_type_names[] = {
+    "data source", "timer", "timer delay", "wait"
+};
+
+static uint16_t btstack_run_loop_profiler_bucket_for_value(uint32_t value){
+    if (value > MAX_VALUE){
+        value = MAX_VALUE;
+    }
+    if (value < SUB_BUCKET_COUNT) return (uint16_t) value;
+    int msb = BTSTACK_RUN_LOOP_PROFILER_MAX_VALUE_BITS - 1;
+    while ((value & (1u << msb)) == 0u){
+        msb--;
+    }
+    int shift = msb - BTSTACK_RUN_LOOP_PROFILER_SUB_BUCKET_BITS;
+    return (uint16_t) (((shift + 1) << BTSTACK_RUN_LOOP_PROFILER_SUB_BUCKET_BITS) + ((value >> shift) & (SUB_BUCKET_COUNT - 1u)));
+}
+
+static uint32_t btstack_run_loop_profiler_lower_bound_for_bucket(uint16_t bucket){
+    if (bucket < SUB_BUCKET_COUNT) return bucket;
+    int shift = (bucket >> BTSTACK_RUN_LOOP_PROFILER_SUB_BUCKET_BITS) - 1;
+    return (SUB_BUCKET_COUNT + (bucket & (SUB_BUCKET_COUNT - 1u))) << shift;
+}
+
+static btstack_run_loop_profiler_histogram_t * btstack_run_loop_profiler_get_or_create(btstack_run_loop_profiler_type_t type, btstack_run_loop_profiler_callback_t callback){
+    uint16_t i;
+    for (i = 0; i < btstack_run_loop_profiler_num_histograms; i++){
+        btstack_run_loop_profiler_histogram_t * histogram = &btstack_run_loop_profiler_histograms[i];
+        if ((histogram->callback == callback) && (histogram->type == type)) return histogram;
+    }
+    if (btstack_run_loop_profiler_num_histograms >= MAX_NR_RUN_LOOP_PROFILER_HISTOGRAMS) return NULL;
+    btstack_run_loop_profiler_histogram_t * histogram = &btstack_run_loop_profiler_histograms[btstack_run_loop_profiler_num_histograms++];
+    memset(histogram, 0, sizeof(btstack_run_loop_profiler_histogram_t));
+    histogram->callback = callback;
+    histogram->type = type;
+    return histogram;
+}
+
+void btstack_run_loop_profiler_init(void){
+    btstack_run_loop_profiler_reset();
+}
+
+uint32_t btstack_run_loop_profiler_get_time_us(void){
+    return (uint32_t) btstack_run_loop_get_time_us();
+}
+
+void btstack_run_loop_profiler_record(btstack_run_loop_profiler_type_t type, btstack_run_loop_profiler_callback_t callback, uint32_t duration_us){
+    btstack_run_loop_profiler_histogram_t * histogram = btstack_run_loop_profiler_get_or_create(type, callback);
+    if (histogram == NULL){
+        btstack_run_loop_profiler_dropped++;
+        return;
+    }
+    histogram->count++;
+    histogram->total_us += duration_us;
+    if (duration_us > histogram->max_us){
+        histogram->max_us = duration_us;
+    }
+    histogram->buckets[btstack_run_loop_profiler_bucket_for_value(duration_us)]++;
+}
+
+uint16_t btstack_run_loop_profiler_get_num_histograms(void){
+    return btstack_run_loop_profiler_num_histograms;
+}
+
+const btstack_run_loop_profiler_histogram_t * btstack_run_loop_profiler_get_histogram(uint16_t index){
+    if (index >= btstack_run_loop_profiler_num_histograms) return NULL;
+    return &btstack_run_loop_profiler_histograms[index];
+}
+
+uint32_t btstack_run_loop_profiler_get_percentile(const btstack_run_loop_profiler_histogram_t * histogram, uint8_t percentile){
+    if (histogram->count == 0u) return 0;
+    uint64_t threshold = (((uint64_t) histogram->count) * btstack_min(percentile, 100) + 99u) / 100u;
+    uint64_t sum = 0;
+    uint16_t bucket;
+    for (bucket = 0; bucket < BTSTACK_RUN_LOOP_PROFILER_NUM_BUCKETS; bucket++){
+        sum += histogram->buckets[bucket];
+        if ((sum >= threshold) && (sum > 0u)) break;
+    }
+    if (bucket >= (BTSTACK_RUN_LOOP_PROFILER_NUM_BUCKETS - 1)) return histogram->max_us;
+    // report upper bound of bucket, but not more than max value seen
+    return btstack_min(btstack_run_loop_profiler_lower_bound_for_bucket(bucket + 1) - 1u, histogram->max_us);
+}
+
+void btstack_run_loop_profiler_reset(void){
+    btstack_run_loop_profiler_num_histograms = 0;
+    btstack_run_loop_profiler_dropped = 0;
+}
+
+void btstack_run_loop_profiler_dump(void){
+    log_info("Run loop profiler: %u histograms, %u samples dropped", btstack_run_loop_profiler_num_histograms, btstack_run_loop_profiler_dropped);
+    uint16_t i;
+    for (i = 0; i < btstack_run_loop_profiler_num_histograms; i++){
+        const btstack_run_loop_profiler_histogram_t * histogram = &btstack_run_loop_profiler_histograms[i];
+        log_info("%-11s %p: count %6u, avg %6u us, p50 %6u us, p99 %6u us, max %6u us",
+                 btstack_run_loop_profiler_type_names[histogram->type], (void *) (uintptr_t) histogram->callback, histogram->count,
+                 (uint32_t) (histogram->total_us / histogram->count),
+                 btstack_run_loop_profiler_get_percentile(histogram, 50),
+                 btstack_run_loop_profiler_get_percentile(histogram, 99),
+                 histogram->max_us);
+    }
+}
+
+static void btstack_run_loop_profiler_dump_timer_handler(btstack_timer_source_t * ts){
+    btstack_run_loop_profiler_dump();
+    btstack_run_loop_set_timer(ts, btstack_run_loop_profiler_dump_interval_ms);
+    btstack_run_loop_add_timer(ts);
+}
+
+void btstack_run_loop_profiler_set_dump_interval(uint32_t interval_ms){
+    btstack_run_loop_remove_timer(&btstack_run_loop_profiler_dump_timer);
+    btstack_run_loop_profiler_dump_interval_ms = interval_ms;
+    if (interval_ms == 0u) return;
+    btstack_run_loop_set_timer_handler(&btstack_run_loop_profiler_dump_timer, &btstack_run_loop_profiler_dump_timer_handler);
+    btstack_run_loop_set_timer(&btstack_run_loop_profiler_dump_timer, interval_ms);
+    btstack_run_loop_add_timer(&btstack_run_loop_profiler_dump_timer);
+}
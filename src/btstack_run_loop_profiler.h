@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  btstack_run_loop_profiler.h
+ *
+ *  Optional latency histograms for run loop callbacks, enabled by ENABLE_RUN_LOOP_PROFILER
+ */
+
+#ifndef BTSTACK_RUN_LOOP_PROFILER_H
+#define BTSTACK_RUN_LOOP_PROFILER_H
+
+#include "btstack_config.h"
+#include "btstack_bool.h"
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+// max number of histograms, one per callback function and type
+#ifndef MAX_NR_RUN_LOOP_PROFILER_HISTOGRAMS
+#define MAX_NR_RUN_LOOP_PROFILER_HISTOGRAMS 32
+#endif
+
+// log-linear buckets: 8 sub-buckets per power of two (max. 12.5% error), values up to 2^24 us
+#define BTSTACK_RUN_LOOP_PROFILER_SUB_BUCKET_BITS 3
+#define BTSTACK_RUN_LOOP_PROFILER_MAX_VALUE_BITS  24
+#define BTSTACK_RUN_LOOP_PROFILER_NUM_BUCKETS     ((BTSTACK_RUN_LOOP_PROFILER_MAX_VALUE_BITS - BTSTACK_RUN_LOOP_PROFILER_SUB_BUCKET_BITS + 1) << BTSTACK_RUN_LOOP_PROFILER_SUB_BUCKET_BITS)
+
+typedef enum {
+    BTSTACK_RUN_LOOP_PROFILER_DATA_SOURCE = 0,  // duration of data source process callback
+    BTSTACK_RUN_LOOP_PROFILER_TIMER,            // duration of timer process callback
+    BTSTACK_RUN_LOOP_PROFILER_TIMER_DELAY,      // time between timeout and call of timer process callback
+    BTSTACK_RUN_LOOP_PROFILER_WAIT,             // time spent waiting for data sources or timers, e.g. in select
+} btstack_run_loop_profiler_type_t;
+
+// generic function pointer to identify callback
+typedef void (*btstack_run_loop_profiler_callback_t)(void);
+
+typedef struct {
+    btstack_run_loop_profiler_callback_t callback;
+    btstack_run_loop_profiler_type_t type;
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[BTSTACK_RUN_LOOP_PROFILER_NUM_BUCKETS];
+} btstack_run_loop_profiler_histogram_t;
+
+/* API_START */
+
+/**
+ * @brief Init profiler, called by run loop implementation
+ */
+void btstack_run_loop_profiler_init(void);
+
+/**
+ * @brief Get current time from btstack_run_loop_get_time_us
+ * @returns time in us, might wrap around
+ */
+uint32_t btstack_run_loop_profiler_get_time_us(void);
+
+/**
+ * @brief Record duration for callback, called by run loop implementation
+ * @param type
+ * @param callback function or NULL
+ * @param duration_us
+ */
+void btstack_run_loop_profiler_record(btstack_run_loop_profiler_type_t type, btstack_run_loop_profiler_callback_t callback, uint32_t duration_us);
+
+/**
+ * @brief Get number of histograms
+ * @returns num histograms
+ */
+uint16_t btstack_run_loop_profiler_get_num_histograms(void);
+
+/**
+ * @brief Get histogram by index
+ * @param index < btstack_run_loop_profiler_get_num_histograms()
+ * @returns histogram or NULL
+ */
+const btstack_run_loop_profiler_histogram_t * btstack_run_loop_profiler_get_histogram(uint16_t index);
+
+/**
+ * @brief Get upper bound of duration for given percentile
+ * @param histogram
+ * @param percentile 0..100
+ * @returns duration in us
+ */
+uint32_t btstack_run_loop_profiler_get_percentile(const btstack_run_loop_profiler_histogram_t * histogram, uint8_t percentile);
+
+/**
+ * @brief Clear all histograms
+ */
+void btstack_run_loop_profiler_reset(void);
+
+/**
+ * @brief Log summary of all histograms with log_info
+ */
+void btstack_run_loop_profiler_dump(void);
+
+/**
+ * @brief Dump histograms periodically
+ * @param interval_ms or 0 to disable
+ */
+void btstack_run_loop_profiler_set_dump_interval(uint32_t interval_ms);
+
+/* API_END */
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // BTSTACK_RUN_LOOP_PROFILER_H
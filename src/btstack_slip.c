@@ -45,6 +45,8 @@
 #include "btstack_slip.h"
 #include "btstack_debug.h"
 
+#include <string.h>
+
 typedef enum {
 	SLIP_ENCODER_DEFAULT,
 	SLIP_ENCODER_SEND_DC,
@@ -218,6 +220,72 @@ void btstack_slip_decoder_process(uint8_t input){
     }
 }
 
+// scan in blocks of this size without early exit, which allows compiler to vectorize the comparisons
+#define SLIP_DECODER_SCAN_BLOCK_SIZE 16
+
+static int btstack_slip_decoder_is_special(uint8_t input){
+	return (input == BTSTACK_SLIP_SOF) | (input == 0xdb);
+}
+
+// returns offset of first SOF or escape byte, or size if there is none
+static uint16_t btstack_slip_decoder_find_special(const uint8_t * data, uint16_t size){
+	uint16_t pos = 0;
+	while ((size - pos) >= SLIP_DECODER_SCAN_BLOCK_SIZE){
+		int found = 0;
+		int i;
+		for (i = 0; i < SLIP_DECODER_SCAN_BLOCK_SIZE; i++){
+			found |= btstack_slip_decoder_is_special(data[pos + i]);
+		}
+		if (found) break;
+		pos += SLIP_DECODER_SCAN_BLOCK_SIZE;
+	}
+	while (pos < size){
+		if (btstack_slip_decoder_is_special(data[pos])) break;
+		pos++;
+	}
+	return pos;
+}
+
+/**
+ * @brief Process block of received data until a frame is complete
+ * @param data
+ * @param size
+ * @return number of bytes processed
+ */
+uint16_t btstack_slip_decoder_process_block(const uint8_t * data, uint16_t size){
+	uint16_t pos = 0;
+	while ((pos < size) && (decoder_state != SLIP_DECODER_COMPLETE)){
+		switch (decoder_state){
+			case SLIP_DECODER_UNKNOWN:
+			case SLIP_DECODER_ACTIVE: {
+				// skip to next SOF or copy unescaped data in one go
+				uint16_t run_len = btstack_slip_decoder_find_special(&data[pos], size - pos);
+				if (decoder_state == SLIP_DECODER_UNKNOWN){
+					pos += run_len;
+					break;
+				}
+				if ((decoder_pos + run_len) > decoder_max_size){
+					// let byte-wise processing handle overrun
+					btstack_slip_decoder_process(data[pos++]);
+					break;
+				}
+				(void)memcpy(&decoder_buffer[decoder_pos], &data[pos], run_len);
+				decoder_pos += run_len;
+				pos += run_len;
+				break;
+			}
+			default:
+				btstack_slip_decoder_process(data[pos++]);
+				break;
+		}
+		// process SOF or escape byte
+		if ((pos < size) && (decoder_state != SLIP_DECODER_COMPLETE) && btstack_slip_decoder_is_special(data[pos])){
+			btstack_slip_decoder_process(data[pos++]);
+		}
+	}
+	return pos;
+}
+
 /**
  * @brief Get size of decoded frame
  * @return size of frame. Size = 0 => frame not complete
@@ -88,6 +88,15 @@ void btstack_slip_decoder_init(uint8_t * buffer, uint16_t max_size);
 
 void btstack_slip_decoder_process(uint8_t input);
 
+/**
+ * @brief Process block of received data until a frame is complete
+ * @note If a frame is complete, the remaining data needs to be processed after the frame was handled and the decoder re-initialised
+ * @param data
+ * @param size
+ * @return number of bytes processed
+ */
+uint16_t btstack_slip_decoder_process_block(const uint8_t * data, uint16_t size);
+
 /**
  * @brief Get size of decoded frame
  * @return size of frame. Size = 0 => frame not complete
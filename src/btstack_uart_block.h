@@ -68,6 +68,14 @@ typedef enum {
     BTSTACK_UART_SLEEP_MASK_RTS_LOW_WAKE_ON_RX_EDGE     = 1 << BTSTACK_UART_SLEEP_RTS_LOW_WAKE_ON_RX_EDGE
 } btstack_uart_sleep_mode_mask_t;
 
+// max number of blocks passed to send_blocks
+#define BTSTACK_UART_MAX_SEND_BLOCKS 8
+
+typedef struct {
+    const uint8_t * data;
+    uint16_t        len;
+} btstack_uart_block_segment_t;
+
 typedef struct {
     /**
      * init transport
@@ -143,10 +151,27 @@ typedef struct {
      */
     void (*set_wakeup_handler)(void (*wakeup_handler)(void));
 
+    /**
+     * set data received handler - optional, enables streaming mode
+     * In streaming mode, all received data is passed to the handler as it arrives and receive_block is not used.
+     * Must be called before open
+     * @param data_handler or NULL to return to block mode
+     */
+    void (*set_data_received)(void (*data_handler)(const uint8_t * data, uint16_t size));
+
+    /**
+     * send multiple blocks with a single write - optional
+     * block_sent is called once after all blocks have been sent
+     * @param blocks array of up to BTSTACK_UART_MAX_SEND_BLOCKS blocks, needs to stay valid until block_sent
+     * @param num_blocks
+     */
+    void (*send_blocks)(const btstack_uart_block_segment_t * blocks, uint16_t num_blocks);
+
 } btstack_uart_block_t;
 
 // common implementations
 const btstack_uart_block_t * btstack_uart_block_posix_instance(void);
+const btstack_uart_block_t * btstack_uart_block_io_uring_instance(void);
 const btstack_uart_block_t * btstack_uart_block_windows_instance(void);
 const btstack_uart_block_t * btstack_uart_block_embedded_instance(void);
 const btstack_uart_block_t * btstack_uart_block_freertos_instance(void);
@@ -43,6 +43,7 @@ extern "C" {
 #endif
 
 #include "btstack_defines.h"
+#include "btstack_linked_list.h"
 #include "btstack_util.h"
 #include "classic/btstack_link_key_db.h"
 
@@ -97,6 +98,52 @@ typedef struct le_connection_parameter_range{
     uint16_t le_supervision_timeout_max;
 } le_connection_parameter_range_t;
 
+// parsed LE Advertising Report, see gap_le_register_advertising_reports_handler
+typedef struct {
+    uint8_t        event_type;
+    bd_addr_type_t address_type;
+    bd_addr_t      address;
+    int8_t         rssi;
+    uint8_t        data_length;
+    uint8_t        data[LE_ADVERTISING_DATA_SIZE];
+} gap_le_advertising_report_t;
+
+typedef void (*gap_le_advertising_reports_handler_t)(const gap_le_advertising_report_t * reports, uint16_t num_reports);
+
+// LE Extended Advertising Parameters, see gap_extended_advertising_setup
+typedef struct {
+    uint16_t  advertising_event_properties;         // bit 0: connectable, 1: scannable, 2: directed, 3: high duty cycle, 4: legacy PDUs
+    uint32_t  primary_advertising_interval_min;     // unit: 0.625 ms
+    uint32_t  primary_advertising_interval_max;     // unit: 0.625 ms
+    uint8_t   primary_advertising_channel_map;
+    uint8_t   peer_address_type;
+    bd_addr_t peer_address;
+    uint8_t   advertising_filter_policy;
+    int8_t    advertising_tx_power;                 // 127: no preference
+    uint8_t   primary_advertising_phy;              // 1: LE 1M, 3: LE Coded
+    uint8_t   secondary_advertising_max_skip;
+    uint8_t   secondary_advertising_phy;            // 1: LE 1M, 2: LE 2M, 3: LE Coded
+    uint8_t   advertising_sid;
+    uint8_t   scan_request_notification_enable;
+} le_extended_advertising_parameters_t;
+
+// LE Advertising Set, storage provided by application, see gap_extended_advertising_setup
+typedef struct {
+    btstack_linked_item_t item;
+    le_extended_advertising_parameters_t params;
+    const uint8_t * adv_data;
+    uint16_t        adv_data_len;
+    const uint8_t * scan_data;
+    uint16_t        scan_data_len;
+    uint16_t        adv_data_pos;       // next fragment of adv data
+    uint16_t        scan_data_pos;      // next fragment of scan data
+    uint16_t        enable_timeout;     // unit: 10 ms
+    uint8_t         enable_max_events;
+    uint8_t         advertising_handle;
+    uint8_t         state;
+    uint8_t         tasks;
+} le_advertising_set_t;
+
 typedef enum {
     GAP_RANDOM_ADDRESS_TYPE_OFF = 0,
     GAP_RANDOM_ADDRESS_TYPE_STATIC,
@@ -251,8 +298,18 @@ int  gap_mitm_protection_required_for_security_level(gap_security_level_t level)
  */
 void gap_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window);
 
+/**
+ * @brief Set PHYs for LE Extended Scanning, requires ENABLE_LE_EXTENDED_ADVERTISING
+ * @note Scan parameters are used for all PHYs. PHYs are used for the next scan parameters, call before gap_set_scan_parameters
+ * @param phys 1 = 1M, 4 = Coded, or both, default: 1M
+ * @return status ERROR_CODE_SUCCESS or ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS
+ */
+uint8_t gap_set_scan_phys(uint8_t phys);
+
 /**
  * @brief Start LE Scan 
+ * @note With ENABLE_LE_EXTENDED_ADVERTISING and Controller support, Extended Scanning on the PHYs from gap_set_scan_phys is used. Legacy PDUs are
+ *       reported as GAP_EVENT_ADVERTISING_REPORT, extended advertisements as GAP_EVENT_EXTENDED_ADVERTISING_REPORT
  */
 void gap_start_scan(void);
 
@@ -261,6 +318,96 @@ void gap_start_scan(void);
  */
 void gap_stop_scan(void);
 
+/**
+ * @brief Register handler for batched LE Advertising Reports, requires ENABLE_LE_ADVERTISING_REPORT_BATCHING
+ * @note While registered, GAP_EVENT_ADVERTISING_REPORT is not emitted. Reports are collected and delivered
+ *       when LE_ADVERTISING_REPORT_BATCH_SIZE reports are pending, after the batch delay, or when scanning stops
+ * @param handler or NULL to emit GAP_EVENT_ADVERTISING_REPORT again
+ */
+void gap_le_register_advertising_reports_handler(gap_le_advertising_reports_handler_t handler);
+
+/**
+ * @brief Set max time an LE Advertising Report is held back to collect a batch, requires ENABLE_LE_ADVERTISING_REPORT_BATCHING
+ * @param max_delay_ms or 0 to deliver the reports of each HCI event right away (default)
+ */
+void gap_le_set_advertising_reports_batch_delay(uint16_t max_delay_ms);
+
+/**
+ * @brief Drop LE Advertising Reports with the same address, event type and data as an earlier report within the given time,
+ *        requires ENABLE_LE_ADVERTISING_REPORT_BATCHING. Applies to batched reports and GAP_EVENT_ADVERTISING_REPORT.
+ * @note  Independent of the duplicate filter of the Controller. The last LE_ADVERTISING_REPORT_DEDUP_CACHE_SIZE reports are tracked.
+ * @param ttl_ms or 0 to deliver all reports (default)
+ */
+void gap_le_set_advertising_report_dedup_ttl(uint32_t ttl_ms);
+
+/**
+ * @brief Set up LE Advertising Set, requires ENABLE_LE_EXTENDED_ADVERTISING and Controller support for LE Extended Advertising
+ * @note Own address type is used from gap_random_address_set_mode. Advertising Sets and gap_advertisements_* can be used at the same time,
+ *       the latter uses advertising handle 0 with legacy PDUs. If the random address changes, it is set for all advertising sets again,
+ *       enabled sets are disabled for this
+ * @param storage for advertising set, has to stay valid until the set is removed
+ * @param advertising_parameters are copied
+ * @param out_advertising_handle
+ * @return status ERROR_CODE_SUCCESS or ERROR_CODE_LIMIT_REACHED if no advertising handle is free or the Controller
+ *         does not support more advertising sets. The limit of the Controller is checked after the first power on
+ */
+uint8_t gap_extended_advertising_setup(le_advertising_set_t * storage, const le_extended_advertising_parameters_t * advertising_parameters, uint8_t * out_advertising_handle);
+
+/**
+ * @brief Set Advertising Parameters of LE Advertising Set
+ * @param advertising_handle
+ * @param advertising_parameters are copied
+ * @return status ERROR_CODE_SUCCESS, ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER, or ERROR_CODE_COMMAND_DISALLOWED if advertising is enabled
+ */
+uint8_t gap_extended_advertising_set_params(uint8_t advertising_handle, const le_extended_advertising_parameters_t * advertising_parameters);
+
+/**
+ * @brief Set Advertising Data of LE Advertising Set, sent in fragments of up to 251 octets
+ * @param advertising_handle
+ * @param advertising_data_length
+ * @param advertising_data
+ * @note data is not copied, pointer has to stay valid. Bd addr placeholder is not replaced
+ * @return status ERROR_CODE_SUCCESS, ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER, ERROR_CODE_MEMORY_CAPACITY_EXCEEDED if data
+ *         is longer than the Controller supports, or ERROR_CODE_COMMAND_DISALLOWED if data needs to be fragmented while advertising is enabled
+ */
+uint8_t gap_extended_advertising_set_adv_data(uint8_t advertising_handle, uint16_t advertising_data_length, const uint8_t * advertising_data);
+
+/**
+ * @brief Set Scan Response Data of LE Advertising Set, sent in fragments of up to 251 octets
+ * @param advertising_handle
+ * @param scan_response_data_length
+ * @param scan_response_data
+ * @note data is not copied, pointer has to stay valid. Bd addr placeholder is not replaced
+ * @return status ERROR_CODE_SUCCESS, ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER, ERROR_CODE_MEMORY_CAPACITY_EXCEEDED if data
+ *         is longer than the Controller supports, or ERROR_CODE_COMMAND_DISALLOWED if data needs to be fragmented while advertising is enabled
+ */
+uint8_t gap_extended_advertising_set_scan_response_data(uint8_t advertising_handle, uint16_t scan_response_data_length, const uint8_t * scan_response_data);
+
+/**
+ * @brief Start advertising of LE Advertising Set
+ * @note HCI_SUBEVENT_LE_ADVERTISING_SET_TERMINATED is emitted when advertising stops due to timeout, max events, or a connection
+ * @param advertising_handle
+ * @param timeout in 10 ms, or 0 for no timeout
+ * @param num_extended_advertising_events or 0 for no limit
+ * @return status ERROR_CODE_SUCCESS or ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER
+ */
+uint8_t gap_extended_advertising_start(uint8_t advertising_handle, uint16_t timeout, uint8_t num_extended_advertising_events);
+
+/**
+ * @brief Stop advertising of LE Advertising Set
+ * @param advertising_handle
+ * @return status ERROR_CODE_SUCCESS or ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER
+ */
+uint8_t gap_extended_advertising_stop(uint8_t advertising_handle);
+
+/**
+ * @brief Stop advertising and remove LE Advertising Set. Storage can be reused after LE Remove Advertising Set was sent,
+ *        i.e. on the HCI Command Complete event for it
+ * @param advertising_handle
+ * @return status ERROR_CODE_SUCCESS or ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER
+ */
+uint8_t gap_extended_advertising_remove(uint8_t advertising_handle);
+
 /**
  * @brief Enable privacy by using random addresses
  * @param random_address_type to use (incl. OFF)
@@ -341,6 +488,14 @@ void gap_set_connection_parameters(uint16_t conn_scan_interval, uint16_t conn_sc
     uint16_t conn_interval_min, uint16_t conn_interval_max, uint16_t conn_latency,
     uint16_t supervision_timeout, uint16_t min_ce_length, uint16_t max_ce_length);
 
+/**
+ * @brief Set initiating PHYs for outgoing connections with LE Extended Create Connection, requires ENABLE_LE_EXTENDED_ADVERTISING
+ * @note Connection parameters are used for all PHYs
+ * @param phys 1 = 1M, 2 = 2M, 4 = Coded, at least 1M or Coded, default: 1M
+ * @return status ERROR_CODE_SUCCESS or ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS
+ */
+uint8_t gap_set_connection_phys(uint8_t phys);
+
 /**
  * @brief Request an update of the connection parameter for a given LE connection
  * @param handle
@@ -93,6 +93,18 @@
 #endif
 #endif
 
+#if defined(ENABLE_HCI_ACL_RECOMBINATION_POOL) && !defined(HAVE_MALLOC) && !defined(MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS)
+#error "ENABLE_HCI_ACL_RECOMBINATION_POOL requires to define MAX_NR_HCI_ACL_RECOMBINATION_BUFFERS"
+#endif
+
+#if defined(ENABLE_HCI_COMMAND_PIPELINING) && (HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT < 1)
+#error "HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT must be at least 1"
+#endif
+
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+#define HCI_CONTROLLER_CACHE_TAG (((uint32_t) 'H' << 24) | ((uint32_t) 'C' << 16) | ((uint32_t) 'C' << 8) | (uint32_t) 'A')
+#endif
+
 #define HCI_CONNECTION_TIMEOUT_MS 10000
 #define HCI_RESET_RESEND_TIMEOUT_MS 200
 
@@ -151,6 +163,7 @@ static void hci_emit_dedicated_bonding_result(bd_addr_t address, uint8_t status)
 static void hci_emit_event(uint8_t * event, uint16_t size, int dump);
 static void hci_emit_acl_packet(uint8_t * packet, uint16_t size);
 static void hci_run(void);
+static void hci_initializing_command_completed(void);
 static int  hci_is_le_connection(hci_connection_t * connection);
 static int  hci_number_free_acl_slots_for_connection_type( bd_addr_type_t address_type);
 
@@ -203,6 +216,11 @@ static hci_connection_t * create_connection_for_bd_addr_and_type(bd_addr_t addr,
 #endif
     conn->acl_recombination_length = 0;
     conn->acl_recombination_pos = 0;
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+    conn->acl_recombination_buffer = NULL;
+    conn->acl_recombination_reserved = 0;
+    conn->acl_recombination_dropping = 0;
+#endif
     conn->num_packets_sent = 0;
 
     conn->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE;
@@ -554,9 +572,65 @@ static int hci_can_send_comand_packet_transport(void){
     return 1;
 }
 
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+static void hci_command_in_flight_add(uint16_t opcode){
+    if (hci_stack->num_commands_in_flight >= HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT){
+        log_error("hci_command_in_flight_add: too many commands in flight, opcode %04x", opcode);
+        return;
+    }
+    hci_command_in_flight_t * command = &hci_stack->commands_in_flight[hci_stack->num_commands_in_flight++];
+    command->opcode = opcode;
+    command->queue = hci_stack->command_queue;
+    command->con_handle = hci_stack->command_queue_con_handle;
+}
+
+// remove oldest command with matching opcode, Command Complete for opcode 0x0000 only provides new credits
+static void hci_command_in_flight_remove(uint16_t opcode){
+    // initialization and shutdown send a single command, which is done with any Command Complete or Status event
+    if (hci_stack->state != HCI_STATE_WORKING){
+        hci_stack->num_commands_in_flight = 0;
+        return;
+    }
+    uint8_t i;
+    for (i = 0; i < hci_stack->num_commands_in_flight; i++){
+        if (hci_stack->commands_in_flight[i].opcode != opcode) continue;
+        hci_stack->num_commands_in_flight--;
+        (void)memmove(&hci_stack->commands_in_flight[i], &hci_stack->commands_in_flight[i + 1],
+                      (hci_stack->num_commands_in_flight - i) * sizeof(hci_command_in_flight_t));
+        return;
+    }
+}
+
+static bool hci_command_queue_busy(hci_command_queue_t queue, hci_con_handle_t con_handle){
+    uint8_t i;
+    for (i = 0; i < hci_stack->num_commands_in_flight; i++){
+        const hci_command_in_flight_t * command = &hci_stack->commands_in_flight[i];
+        if (command->queue != queue) continue;
+        if ((queue == HCI_COMMAND_QUEUE_CONNECTION) && (command->con_handle != con_handle)) continue;
+        return true;
+    }
+    return false;
+}
+#endif
+
+// assume that a single command can be sent, e.g. after a timeout or for commands without Command Complete event
+static void hci_command_flow_control_reset(void){
+    hci_stack->num_cmd_packets = 1;
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+    hci_stack->num_commands_in_flight = 0;
+#endif
+}
+
 // new functions replacing hci_can_send_packet_now[_using_packet_buffer]
 int hci_can_send_command_packet_now(void){
     if (hci_can_send_comand_packet_transport() == 0) return 0;
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+    if (hci_stack->num_commands_in_flight > 0){
+        // initialization and shutdown depend on the result of the previous command
+        if (hci_stack->state != HCI_STATE_WORKING) return 0;
+        if (hci_stack->num_commands_in_flight >= HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT) return 0;
+    }
+#endif
     return hci_stack->num_cmd_packets > 0;
 }
 
@@ -680,6 +754,12 @@ static int hci_send_acl_packet_fragments(hci_connection_t *connection){
 
         // count packet
         connection->num_packets_sent++;
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+        // each ACL packet of a channel selected by the scheduler uses one controller buffer of its quantum
+        if (hci_stack->acl_fragmentation_tx_scheduled && (connection->acl_tx_deficit > INT16_MIN)){
+            connection->acl_tx_deficit--;
+        }
+#endif
         log_debug("hci_send_acl_packet_fragments loop before send (more fragments %d)", more_fragments);
 
         // update state for next fragment (if any) as "transport done" might be sent during send_packet already
@@ -758,6 +838,10 @@ int hci_send_acl_packet_buffer(int size){
     // setup data
     hci_stack->acl_fragmentation_total_size = size;
     hci_stack->acl_fragmentation_pos = 4;   // start of L2CAP packet
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+    // remaining fragments are sent later, remember if packet is charged
+    hci_stack->acl_fragmentation_tx_scheduled = connection->acl_tx_scheduled;
+#endif
 
     return hci_send_acl_packet_fragments(connection);
 }
@@ -820,6 +904,80 @@ int hci_send_sco_packet_buffer(int size){
 }
 #endif
 
+static uint8_t * hci_acl_recombination_buffer(hci_connection_t * conn){
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+    return conn->acl_recombination_buffer->data;
+#else
+    return conn->acl_recombination_buffer;
+#endif
+}
+
+// get buffer for first fragment. returns 0 if no buffer is available
+static int hci_acl_recombination_start(hci_connection_t * conn){
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+    conn->acl_recombination_dropping = 0;
+    if (conn->acl_recombination_buffer == NULL){
+        conn->acl_recombination_buffer = btstack_memory_hci_acl_recombination_buffer_get();
+        if (conn->acl_recombination_buffer == NULL){
+            conn->acl_recombination_dropping = 1;
+            return 0;
+        }
+    }
+#else
+    UNUSED(conn);
+#endif
+    return 1;
+}
+
+// reset recombination and return buffer to pool if not reserved
+static void hci_acl_recombination_done(hci_connection_t * conn){
+    conn->acl_recombination_length = 0;
+    conn->acl_recombination_pos = 0;
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+    if ((conn->acl_recombination_buffer != NULL) && (conn->acl_recombination_reserved == 0u)){
+        btstack_memory_hci_acl_recombination_buffer_free(conn->acl_recombination_buffer);
+        conn->acl_recombination_buffer = NULL;
+    }
+#endif
+}
+
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+uint8_t hci_get_acl_tx_stats(hci_con_handle_t con_handle, hci_acl_tx_stats_t * stats){
+    hci_connection_t * conn = hci_connection_for_handle(con_handle);
+    if (conn == NULL) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    stats->queue_depth = conn->acl_tx_queue_depth;
+    stats->wait_time_ms = 0;
+    if (conn->acl_tx_waiting){
+        stats->wait_time_ms = btstack_run_loop_get_time_ms() - conn->acl_tx_wait_start_ms;
+    }
+    stats->max_wait_time_ms = btstack_max(conn->acl_tx_max_wait_ms, stats->wait_time_ms);
+    return ERROR_CODE_SUCCESS;
+}
+#endif
+
+uint8_t hci_reserve_acl_recombination_buffer(hci_con_handle_t con_handle, int reserve){
+    hci_connection_t * conn = hci_connection_for_handle(con_handle);
+    if (conn == NULL) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+    if (reserve){
+        if (conn->acl_recombination_buffer == NULL){
+            conn->acl_recombination_buffer = btstack_memory_hci_acl_recombination_buffer_get();
+            if (conn->acl_recombination_buffer == NULL) return ERROR_CODE_MEMORY_CAPACITY_EXCEEDED;
+        }
+        conn->acl_recombination_reserved = 1;
+    } else {
+        conn->acl_recombination_reserved = 0;
+        // keep buffer while fragmented packet is received
+        if (conn->acl_recombination_pos == 0u){
+            hci_acl_recombination_done(conn);
+        }
+    }
+#else
+    UNUSED(reserve);
+#endif
+    return ERROR_CODE_SUCCESS;
+}
+
 static void acl_handler(uint8_t *packet, int size){
 
     // log_info("acl_handler: size %u", size);
@@ -859,18 +1017,22 @@ static void acl_handler(uint8_t *packet, int size){
             
             // sanity checks
             if (conn->acl_recombination_pos == 0) {
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+                // first fragment has been dropped already
+                if (conn->acl_recombination_dropping) return;
+#endif
                 log_error( "ACL Cont Fragment but no first fragment for handle 0x%02x", con_handle);
                 return;
             }
             if ((conn->acl_recombination_pos + acl_length) > (4 + HCI_ACL_BUFFER_SIZE)){
                 log_error( "ACL Cont Fragment to large: combined packet %u > buffer size %u for handle 0x%02x",
                     conn->acl_recombination_pos + acl_length, 4 + HCI_ACL_BUFFER_SIZE, con_handle);
-                conn->acl_recombination_pos = 0;
+                hci_acl_recombination_done(conn);
                 return;
             }
 
             // append fragment payload (header already stored)
-            (void)memcpy(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + conn->acl_recombination_pos],
+            (void)memcpy(&hci_acl_recombination_buffer(conn)[HCI_INCOMING_PRE_BUFFER_SIZE + conn->acl_recombination_pos],
                          &packet[4], acl_length);
             conn->acl_recombination_pos += acl_length;
             
@@ -879,10 +1041,9 @@ static void acl_handler(uint8_t *packet, int size){
             
             // forward complete L2CAP packet if complete. 
             if (conn->acl_recombination_pos >= (conn->acl_recombination_length + 4 + 4)){ // pos already incl. ACL header
-                hci_emit_acl_packet(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE], conn->acl_recombination_pos);
+                hci_emit_acl_packet(&hci_acl_recombination_buffer(conn)[HCI_INCOMING_PRE_BUFFER_SIZE], conn->acl_recombination_pos);
                 // reset recombination buffer
-                conn->acl_recombination_length = 0;
-                conn->acl_recombination_pos = 0;
+                hci_acl_recombination_done(conn);
             }
             break;
             
@@ -891,7 +1052,7 @@ static void acl_handler(uint8_t *packet, int size){
             // sanity check
             if (conn->acl_recombination_pos) {
                 log_error( "ACL First Fragment but data in buffer for handle 0x%02x, dropping stale fragments", con_handle);
-                conn->acl_recombination_pos = 0;
+                hci_acl_recombination_done(conn);
             }
 
             // peek into L2CAP packet!
@@ -911,12 +1072,18 @@ static void acl_handler(uint8_t *packet, int size){
                     return;
                 }
 
+                if (!hci_acl_recombination_start(conn)){
+                    log_error( "ACL First Fragment: no recombination buffer for handle 0x%02x, dropping L2CAP packet", con_handle);
+                    return;
+                }
+
                 // store first fragment and tweak acl length for complete package
-                (void)memcpy(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE],
+                uint8_t * recombination_buffer = hci_acl_recombination_buffer(conn);
+                (void)memcpy(&recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE],
                              packet, acl_length + 4);
                 conn->acl_recombination_pos    = acl_length + 4;
                 conn->acl_recombination_length = l2cap_length;
-                little_endian_store_16(conn->acl_recombination_buffer, HCI_INCOMING_PRE_BUFFER_SIZE + 2, l2cap_length +4);
+                little_endian_store_16(recombination_buffer, HCI_INCOMING_PRE_BUFFER_SIZE + 2, l2cap_length +4);
             }
             break;
             
@@ -940,6 +1107,11 @@ static void hci_shutdown_connection(hci_connection_t *conn){
 #endif
 
     btstack_run_loop_remove_timer(&conn->timeout);
+
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+    conn->acl_recombination_reserved = 0;
+    hci_acl_recombination_done(conn);
+#endif
     
     btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
     btstack_memory_hci_connection_free( conn );
@@ -1068,7 +1240,155 @@ void gap_le_get_own_address(uint8_t * addr_type, bd_addr_t addr){
     }
 }
 
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+// Controller does not allow to mix legacy and extended advertising, scanning, and initiating commands
+static bool hci_le_extended_advertising_supported(void){
+    // bit 7 = Octet 36, bit 2 / LE Set Extended Advertising Parameters
+    return (hci_stack->local_supported_commands[0] & 0x80) != 0;
+}
+#endif
+
 #ifdef ENABLE_LE_CENTRAL
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+// same scan parameters for all scanning PHYs
+static void hci_send_le_set_extended_scan_parameters(uint8_t scan_type){
+    uint8_t  scan_types[2];
+    uint16_t scan_intervals[2];
+    uint16_t scan_windows[2];
+    int i;
+    for (i = 0; i < 2; i++){
+        scan_types[i]     = scan_type;
+        scan_intervals[i] = hci_stack->le_scan_interval;
+        scan_windows[i]   = hci_stack->le_scan_window;
+    }
+    hci_send_cmd(&hci_le_set_extended_scan_parameters, hci_stack->le_own_addr_type, 0, hci_stack->le_scan_phys,
+                 scan_types, scan_intervals, scan_windows);
+}
+#endif
+
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+// FNV-1a over event type and data
+static uint32_t hci_le_advertising_report_hash(const gap_le_advertising_report_t * report){
+    uint32_t hash = 0x811c9dc5u;
+    hash = (hash ^ report->event_type) * 0x01000193u;
+    uint16_t i;
+    for (i=0;i<report->data_length;i++){
+        hash = (hash ^ report->data[i]) * 0x01000193u;
+    }
+    return hash;
+}
+
+// returns 1 if the same report was delivered less than dedup ttl ago
+static int hci_le_advertising_report_is_duplicate(const gap_le_advertising_report_t * report){
+    if (hci_stack->le_advertising_report_dedup_ttl_ms == 0) return 0;
+    uint32_t now_ms = btstack_run_loop_get_time_ms();
+    uint32_t hash = hci_le_advertising_report_hash(report);
+    le_advertising_report_dedup_entry_t * lru_entry = NULL;
+    int i;
+    for (i=0;i<LE_ADVERTISING_REPORT_DEDUP_CACHE_SIZE;i++){
+        le_advertising_report_dedup_entry_t * entry = &hci_stack->le_advertising_report_dedup_cache[i];
+        if (entry->valid == 0){
+            if ((lru_entry == NULL) || lru_entry->valid){
+                lru_entry = entry;
+            }
+            continue;
+        }
+        if ((entry->hash == hash) && (entry->address_type == report->address_type) && (bd_addr_cmp(entry->address, report->address) == 0)){
+            entry->seen_ms = now_ms;
+            if ((now_ms - entry->reported_ms) < hci_stack->le_advertising_report_dedup_ttl_ms) return 1;
+            entry->reported_ms = now_ms;
+            return 0;
+        }
+        if ((lru_entry == NULL) || (lru_entry->valid && ((now_ms - entry->seen_ms) > (now_ms - lru_entry->seen_ms)))){
+            lru_entry = entry;
+        }
+    }
+    // replace least recently seen entry
+    (void)memcpy(lru_entry->address, report->address, 6);
+    lru_entry->address_type = report->address_type;
+    lru_entry->valid = 1;
+    lru_entry->hash = hash;
+    lru_entry->reported_ms = now_ms;
+    lru_entry->seen_ms = now_ms;
+    return 0;
+}
+
+static void hci_le_advertising_reports_flush(void){
+    if (hci_stack->le_advertising_reports_timer_active){
+        btstack_run_loop_remove_timer(&hci_stack->le_advertising_reports_timer);
+        hci_stack->le_advertising_reports_timer_active = 0;
+    }
+    uint16_t num_reports = hci_stack->le_advertising_reports_count;
+    if (num_reports == 0) return;
+    // reset before callback, handler might stop scanning
+    hci_stack->le_advertising_reports_count = 0;
+    if (hci_stack->le_advertising_reports_handler == NULL) return;
+    (*hci_stack->le_advertising_reports_handler)(hci_stack->le_advertising_reports, num_reports);
+}
+
+static void hci_le_advertising_reports_timeout_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    hci_stack->le_advertising_reports_timer_active = 0;
+    hci_le_advertising_reports_flush();
+}
+#endif
+
+static void hci_le_emit_advertising_report(const gap_le_advertising_report_t * report){
+    uint8_t event[12 + LE_ADVERTISING_DATA_SIZE]; // use upper bound to avoid var size automatic var
+    int pos = 0;
+    event[pos++] = GAP_EVENT_ADVERTISING_REPORT;
+    event[pos++] = 10 + report->data_length;
+    event[pos++] = report->event_type;
+    event[pos++] = (uint8_t) report->address_type;
+    reverse_bd_addr(report->address, &event[pos]);
+    pos += 6;
+    event[pos++] = (uint8_t) report->rssi;
+    event[pos++] = report->data_length;
+    (void)memcpy(&event[pos], report->data, report->data_length);
+    pos += report->data_length;
+    hci_emit_event(event, pos, 1);
+}
+
+// returns storage for parsed report, parse directly into batch if batching
+static gap_le_advertising_report_t * hci_le_advertising_report_storage(gap_le_advertising_report_t * single_report){
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+    if (hci_stack->le_advertising_reports_handler != NULL){
+        return &hci_stack->le_advertising_reports[hci_stack->le_advertising_reports_count];
+    }
+#endif
+    return single_report;
+}
+
+static void hci_le_advertising_report_received(const gap_le_advertising_report_t * report){
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+    if (hci_le_advertising_report_is_duplicate(report)) return;
+    if (hci_stack->le_advertising_reports_handler != NULL){
+        hci_stack->le_advertising_reports_count++;
+        if (hci_stack->le_advertising_reports_count == LE_ADVERTISING_REPORT_BATCH_SIZE){
+            hci_le_advertising_reports_flush();
+        }
+        return;
+    }
+#endif
+    hci_le_emit_advertising_report(report);
+}
+
+// called after all reports of an HCI event have been processed
+static void hci_le_advertising_reports_received_all(void){
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+    if (hci_stack->le_advertising_reports_count == 0) return;
+    if (hci_stack->le_advertising_reports_batch_delay_ms == 0){
+        hci_le_advertising_reports_flush();
+        return;
+    }
+    if (hci_stack->le_advertising_reports_timer_active) return;
+    hci_stack->le_advertising_reports_timer_active = 1;
+    btstack_run_loop_set_timer_handler(&hci_stack->le_advertising_reports_timer, hci_le_advertising_reports_timeout_handler);
+    btstack_run_loop_set_timer(&hci_stack->le_advertising_reports_timer, hci_stack->le_advertising_reports_batch_delay_ms);
+    btstack_run_loop_add_timer(&hci_stack->le_advertising_reports_timer);
+#endif
+}
+
 void le_handle_advertisement_report(uint8_t *packet, uint16_t size){
 
     int offset = 3;
@@ -1077,29 +1397,166 @@ void le_handle_advertisement_report(uint8_t *packet, uint16_t size){
 
     int i;
     // log_info("HCI: handle adv report with num reports: %d", num_reports);
-    uint8_t event[12 + LE_ADVERTISING_DATA_SIZE]; // use upper bound to avoid var size automatic var
+    gap_le_advertising_report_t single_report;
     for (i=0; (i<num_reports) && (offset < size);i++){
         // sanity checks on data_length:
         uint8_t data_length = packet[offset + 8];
-        if (data_length > LE_ADVERTISING_DATA_SIZE) return;
-        if ((offset + 9 + data_length + 1) > size)    return;
-        // setup event
-        uint8_t event_size = 10 + data_length;
-        int pos = 0;
-        event[pos++] = GAP_EVENT_ADVERTISING_REPORT;
-        event[pos++] = event_size;
-        (void)memcpy(&event[pos], &packet[offset], 1 + 1 + 6); // event type + address type + address
-        offset += 8;
-        pos += 8;
-        event[pos++] = packet[offset + 1 + data_length]; // rssi
-        event[pos++] = data_length;
+        if (data_length > LE_ADVERTISING_DATA_SIZE) break;
+        if ((offset + 9 + data_length + 1) > size)    break;
+        gap_le_advertising_report_t * report = hci_le_advertising_report_storage(&single_report);
+        report->event_type   = packet[offset];
+        report->address_type = (bd_addr_type_t) packet[offset + 1];
+        reverse_bd_addr(&packet[offset + 2], report->address);
+        report->data_length  = data_length;
+        offset += 9;
+        (void)memcpy(report->data, &packet[offset], data_length);
+        offset += data_length;
+        report->rssi = (int8_t) packet[offset];
         offset++;
-        (void)memcpy(&event[pos], &packet[offset], data_length);
-        pos +=    data_length;
-        offset += data_length + 1; // rssi
-        hci_emit_event(event, pos, 1);
+        hci_le_advertising_report_received(report);
+    }
+    hci_le_advertising_reports_received_all();
+}
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+// map event type of legacy PDU in LE Extended Advertising Report to LE Advertising Report
+static uint8_t hci_le_legacy_advertising_event_type(uint16_t extended_event_type){
+    switch (extended_event_type & 0x1f){
+        case 0x13:
+            return 0x00;    // ADV_IND
+        case 0x15:
+            return 0x01;    // ADV_DIRECT_IND
+        case 0x12:
+            return 0x02;    // ADV_SCAN_IND
+        case 0x1a:
+        case 0x1b:
+            return 0x04;    // SCAN_RSP
+        default:
+            return 0x03;    // ADV_NONCONN_IND
     }
 }
+
+static void hci_le_extended_advertising_report_emit(uint8_t data_status){
+    uint8_t * event = hci_stack->le_extended_advertising_report;
+    uint16_t data_length = hci_stack->le_extended_advertising_report_len;
+    uint16_t event_type = little_endian_read_16(event, 2);
+    little_endian_store_16(event, 2, (event_type & ~0x0060) | (data_status << 5));
+    little_endian_store_16(event, 25, data_length);
+    uint16_t size = LE_EXTENDED_ADVERTISING_REPORT_HEADER_SIZE + data_length;
+    // event length does not fit into 8 bit for data longer than 230 bytes, use 255 and data_length instead
+    event[1] = (uint8_t) btstack_min(size - 2, 255);
+    hci_stack->le_extended_advertising_report_state = LE_EXTENDED_ADVERTISING_REPORT_IDLE;
+    hci_emit_event(event, size, 1);
+}
+
+// report: single report from LE Extended Advertising Report
+static bool hci_le_extended_advertising_report_from(const uint8_t * report, uint8_t address_type, const uint8_t * address, uint8_t sid){
+    return (report[2] == address_type) && (memcmp(&report[3], address, 6) == 0) && (report[11] == sid);
+}
+
+// report: single report from LE Extended Advertising Report without data
+static void hci_le_extended_advertising_report_reassemble(const uint8_t * report, const uint8_t * data, uint8_t data_length){
+    uint8_t * event = hci_stack->le_extended_advertising_report;
+    uint8_t * interrupted = hci_stack->le_extended_advertising_report_interrupted_advertiser;
+    uint16_t event_type = little_endian_read_16(report, 0);
+    uint8_t data_status = (event_type >> 5) & 0x03;
+
+    // remaining reports of interrupted chain
+    if (hci_stack->le_extended_advertising_report_interrupted
+    &&  hci_le_extended_advertising_report_from(report, interrupted[0], &interrupted[1], interrupted[7])){
+        if (data_status != 1){
+            hci_stack->le_extended_advertising_report_interrupted = 0;
+        }
+        return;
+    }
+
+    // chained reports of one advertiser are expected back to back. If another advertiser is reported before the
+    // last report, the chain is interrupted -> report incomplete data as truncated and discard the remaining reports
+    if (hci_stack->le_extended_advertising_report_state != LE_EXTENDED_ADVERTISING_REPORT_IDLE){
+        if (!hci_le_extended_advertising_report_from(report, event[4], &event[5], event[13])){
+            interrupted[0] = event[4];
+            (void)memcpy(&interrupted[1], &event[5], 6);
+            interrupted[7] = event[13];
+            hci_stack->le_extended_advertising_report_interrupted = 1;
+            if (hci_stack->le_extended_advertising_report_state == LE_EXTENDED_ADVERTISING_REPORT_REASSEMBLING){
+                hci_le_extended_advertising_report_emit(2);
+            }
+            hci_stack->le_extended_advertising_report_state = LE_EXTENDED_ADVERTISING_REPORT_IDLE;
+        }
+    }
+
+    switch (hci_stack->le_extended_advertising_report_state){
+        case LE_EXTENDED_ADVERTISING_REPORT_IDLE:
+            // fields from first fragment
+            event[0] = GAP_EVENT_EXTENDED_ADVERTISING_REPORT;
+            little_endian_store_16(event, 2, event_type);
+            // address type, address, primary phy, secondary phy, sid, tx power, rssi, periodic advertising interval,
+            // direct address type, direct address
+            (void)memcpy(&event[4], &report[2], 21);
+            hci_stack->le_extended_advertising_report_len = 0;
+            hci_stack->le_extended_advertising_report_state = LE_EXTENDED_ADVERTISING_REPORT_REASSEMBLING;
+            break;
+        case LE_EXTENDED_ADVERTISING_REPORT_DISCARDING:
+            if (data_status != 1){
+                hci_stack->le_extended_advertising_report_state = LE_EXTENDED_ADVERTISING_REPORT_IDLE;
+            }
+            return;
+        default:
+            break;
+    }
+
+    uint16_t len = hci_stack->le_extended_advertising_report_len;
+    if ((len + data_length) > LE_EXTENDED_ADVERTISING_REPORT_DATA_SIZE){
+        log_info("extended advertising report exceeds %u bytes, truncated", LE_EXTENDED_ADVERTISING_REPORT_DATA_SIZE);
+        hci_le_extended_advertising_report_emit(2);
+        if (data_status == 1){
+            hci_stack->le_extended_advertising_report_state = LE_EXTENDED_ADVERTISING_REPORT_DISCARDING;
+        }
+        return;
+    }
+    (void)memcpy(&event[LE_EXTENDED_ADVERTISING_REPORT_HEADER_SIZE + len], data, data_length);
+    hci_stack->le_extended_advertising_report_len = len + data_length;
+
+    // more data to come
+    if (data_status == 1) return;
+
+    hci_le_extended_advertising_report_emit(data_status);
+}
+
+static void le_handle_extended_advertisement_report(uint8_t *packet, uint16_t size){
+    int offset = 3;
+    int num_reports = packet[offset];
+    offset += 1;
+
+    int i;
+    gap_le_advertising_report_t single_report;
+    for (i=0; (i<num_reports) && (offset < size);i++){
+        // sanity checks on data_length:
+        if ((offset + 24) > size) break;
+        uint8_t data_length = packet[offset + 23];
+        if ((offset + 24 + data_length) > size) break;
+        const uint8_t * report = &packet[offset];
+        const uint8_t * data   = &packet[offset + 24];
+        offset += 24 + data_length;
+        uint16_t event_type = little_endian_read_16(report, 0);
+        if ((event_type & 0x10) == 0){
+            hci_le_extended_advertising_report_reassemble(report, data, data_length);
+            continue;
+        }
+        // legacy PDU
+        if (data_length > LE_ADVERTISING_DATA_SIZE) continue;
+        gap_le_advertising_report_t * legacy_report = hci_le_advertising_report_storage(&single_report);
+        legacy_report->event_type   = hci_le_legacy_advertising_event_type(event_type);
+        legacy_report->address_type = (bd_addr_type_t) report[2];
+        reverse_bd_addr(&report[3], legacy_report->address);
+        legacy_report->rssi = (int8_t) report[13];
+        legacy_report->data_length = data_length;
+        (void)memcpy(legacy_report->data, data, data_length);
+        hci_le_advertising_report_received(legacy_report);
+    }
+    hci_le_advertising_reports_received_all();
+}
+#endif
 #endif
 #endif
 
@@ -1125,6 +1582,125 @@ static void hci_reenable_advertisements_if_needed(void){
         }
     }
 }
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+static le_advertising_set_t * hci_advertising_set_for_handle(uint8_t advertising_handle){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &hci_stack->le_advertising_sets);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        le_advertising_set_t * advertising_set = (le_advertising_set_t *) btstack_linked_list_iterator_next(&it);
+        if (advertising_set->advertising_handle == advertising_handle) return advertising_set;
+    }
+    return NULL;
+}
+
+// advertising stopped by Controller due to timeout, max events, or connection
+static void hci_le_advertising_set_terminated(uint8_t advertising_handle){
+    if (advertising_handle == LE_EXTENDED_ADVERTISING_LEGACY_HANDLE){
+        hci_stack->le_advertisements_active = 0;
+        return;
+    }
+    le_advertising_set_t * advertising_set = hci_advertising_set_for_handle(advertising_handle);
+    if (advertising_set == NULL) return;
+    advertising_set->state &= ~(LE_ADVERTISEMENT_STATE_ENABLED | LE_ADVERTISEMENT_STATE_ACTIVE);
+}
+
+static void hci_le_advertising_set_parameters_complete(uint8_t status){
+    uint8_t advertising_handle = hci_stack->le_advertising_set_command_handle;
+    if (status == ERROR_CODE_SUCCESS) return;
+    log_error("LE Set Extended Advertising Parameters for handle %u failed, status 0x%02x", advertising_handle, status);
+    if (advertising_handle == LE_EXTENDED_ADVERTISING_LEGACY_HANDLE){
+        hci_stack->le_advertisements_set_created = 0;
+    }
+}
+
+// advertising is enabled or disabled on Controller only if command succeeded
+static void hci_le_advertising_set_enable_complete(uint8_t status){
+    uint8_t advertising_handle = hci_stack->le_advertising_set_command_handle;
+    uint8_t enable = hci_stack->le_advertising_set_command_enable;
+    if (status != ERROR_CODE_SUCCESS){
+        log_error("LE Set Extended Advertising Enable %u for handle %u failed, status 0x%02x", enable, advertising_handle, status);
+    }
+    if (advertising_handle == LE_EXTENDED_ADVERTISING_LEGACY_HANDLE){
+        if (status != ERROR_CODE_SUCCESS) return;
+        hci_stack->le_advertisements_active = enable;
+        // disabled by application while command was in flight
+        if (enable && !hci_stack->le_advertisements_enabled){
+            hci_stack->le_advertisements_todo |= LE_ADVERTISEMENT_TASKS_DISABLE;
+        }
+        return;
+    }
+    le_advertising_set_t * advertising_set = hci_advertising_set_for_handle(advertising_handle);
+    if (advertising_set == NULL) return;
+    if (status != ERROR_CODE_SUCCESS){
+        if (enable){
+            advertising_set->state &= ~LE_ADVERTISEMENT_STATE_ENABLED;
+        }
+        return;
+    }
+    if (enable){
+        advertising_set->state |= LE_ADVERTISEMENT_STATE_ACTIVE;
+        // stopped by application while command was in flight
+        if ((advertising_set->state & LE_ADVERTISEMENT_STATE_ENABLED) == 0){
+            advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_DISABLE;
+        }
+    } else {
+        advertising_set->state &= ~LE_ADVERTISEMENT_STATE_ACTIVE;
+    }
+}
+
+// LE Set Random Address does not change the random address of advertising sets, set it again.
+// Controller rejects LE Set Advertising Set Random Address for enabled connectable sets -> pause them
+static void hci_le_advertising_sets_random_address_changed(void){
+    if (hci_stack->le_own_addr_type == BD_ADDR_TYPE_LE_PUBLIC) return;
+    if (hci_stack->le_advertisements_set_created){
+        hci_stack->le_advertisements_todo |= LE_ADVERTISEMENT_TASKS_SET_ADDRESS;
+        if (hci_stack->le_advertisements_active){
+            hci_stack->le_advertisements_todo |= LE_ADVERTISEMENT_TASKS_DISABLE | LE_ADVERTISEMENT_TASKS_ENABLE;
+        }
+    }
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &hci_stack->le_advertising_sets);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        le_advertising_set_t * advertising_set = (le_advertising_set_t *) btstack_linked_list_iterator_next(&it);
+        if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_REMOVE_SET) continue;
+        advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_SET_ADDRESS;
+        if (advertising_set->state & LE_ADVERTISEMENT_STATE_ACTIVE){
+            advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_DISABLE | LE_ADVERTISEMENT_TASKS_ENABLE;
+        }
+    }
+}
+
+// advertising sets are lost on power off, configure them again after power on
+static void hci_le_advertising_sets_reset(void){
+    if (hci_stack->le_advertisements_set_created){
+        hci_stack->le_advertisements_set_created = 0;
+        hci_stack->le_advertisements_todo |= LE_ADVERTISEMENT_TASKS_SET_PARAMS;
+        if (hci_stack->le_advertisements_data != NULL){
+            hci_stack->le_advertisements_todo |= LE_ADVERTISEMENT_TASKS_SET_ADV_DATA;
+        }
+        if (hci_stack->le_scan_response_data != NULL){
+            hci_stack->le_advertisements_todo |= LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA;
+        }
+    }
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &hci_stack->le_advertising_sets);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        le_advertising_set_t * advertising_set = (le_advertising_set_t *) btstack_linked_list_iterator_next(&it);
+        if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_REMOVE_SET){
+            btstack_linked_list_iterator_remove(&it);
+            continue;
+        }
+        advertising_set->state &= ~LE_ADVERTISEMENT_STATE_ACTIVE;
+        advertising_set->adv_data_pos = 0;
+        advertising_set->scan_data_pos = 0;
+        advertising_set->tasks = LE_ADVERTISEMENT_TASKS_SET_PARAMS | LE_ADVERTISEMENT_TASKS_SET_ADV_DATA | LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA;
+        if (advertising_set->state & LE_ADVERTISEMENT_STATE_ENABLED){
+            advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_ENABLE;
+        }
+    }
+}
+#endif
 #endif
 #endif
 
@@ -1140,6 +1716,146 @@ static uint32_t hci_transport_uart_get_main_baud_rate(void){
     return baud_rate;
 }
 
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+// configuration options that select which capabilities are read during init
+static uint16_t hci_controller_cache_host_configuration(void){
+    uint16_t configuration = 0;
+#ifdef ENABLE_CLASSIC
+    configuration |= 1u << 0;
+#endif
+#ifdef ENABLE_BLE
+    configuration |= 1u << 1;
+#endif
+#ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
+    configuration |= 1u << 2;
+#endif
+#ifdef ENABLE_LE_CENTRAL
+    configuration |= 1u << 3;
+#endif
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+    configuration |= 1u << 4;
+#endif
+    return configuration;
+}
+
+static uint32_t hci_controller_cache_init_script_identity(void){
+    if (hci_stack->chipset == NULL) return 0;
+    if (hci_stack->chipset->init_script_identity == NULL) return 0;
+    return (*hci_stack->chipset->init_script_identity)();
+}
+
+static void hci_controller_cache_load(void){
+    hci_stack->controller_cache_hit = 0;
+    if (hci_stack->controller_cache_tlv_impl == NULL) return;
+    hci_controller_cache_t cache;
+    int size = hci_stack->controller_cache_tlv_impl->get_tag(hci_stack->controller_cache_tlv_context, HCI_CONTROLLER_CACHE_TAG, (uint8_t *) &cache, sizeof(cache));
+    if (size != sizeof(cache)){
+        log_info("Controller cache: no entry");
+        return;
+    }
+    // BD_ADDR is verified after init script
+    const hci_controller_cache_t * current = &hci_stack->controller_cache;
+    if ((cache.hci_version    != current->hci_version)
+    ||  (cache.hci_revision   != current->hci_revision)
+    ||  (cache.lmp_version    != current->lmp_version)
+    ||  (cache.manufacturer   != current->manufacturer)
+    ||  (cache.lmp_subversion != current->lmp_subversion)
+    ||  (cache.acl_payload_size != HCI_ACL_PAYLOAD_SIZE)
+    ||  (cache.host_configuration != hci_controller_cache_host_configuration())){
+        log_info("Controller cache: different controller or host configuration");
+        return;
+    }
+    // init script might add features or change buffer sizes
+    if (cache.init_script_identity != hci_controller_cache_init_script_identity()){
+        log_info("Controller cache: different init script");
+        return;
+    }
+    hci_stack->controller_cache = cache;
+    hci_stack->controller_cache_hit = 1;
+
+    hci_stack->local_supported_commands[0] = cache.local_supported_commands;
+    (void)memcpy(hci_stack->local_supported_features, cache.local_supported_features, 8);
+#ifdef ENABLE_CLASSIC
+    hci_stack->packet_types = hci_acl_packet_types_for_buffer_size_and_local_features(HCI_ACL_PAYLOAD_SIZE, &hci_stack->local_supported_features[0]);
+#endif
+    hci_stack->acl_data_packet_length = cache.acl_data_packet_length;
+    hci_stack->acl_packets_total_num  = cache.acl_packets_total_num;
+    hci_stack->sco_data_packet_length = cache.sco_data_packet_length;
+    hci_stack->sco_packets_total_num  = cache.sco_packets_total_num;
+    hci_stack->le_data_packets_length   = cache.le_data_packets_length;
+    hci_stack->le_acl_packets_total_num = cache.le_acl_packets_total_num;
+#ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
+    hci_stack->le_supported_max_tx_octets = cache.le_supported_max_tx_octets;
+    hci_stack->le_supported_max_tx_time   = cache.le_supported_max_tx_time;
+#endif
+#ifdef ENABLE_LE_CENTRAL
+    hci_stack->le_whitelist_capacity = cache.le_whitelist_capacity;
+#endif
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+    hci_stack->le_number_of_supported_advertising_sets = cache.le_number_of_supported_advertising_sets;
+    hci_stack->le_maximum_advertising_data_length      = cache.le_maximum_advertising_data_length;
+#endif
+    log_info("Controller cache: use stored controller capabilities");
+}
+
+static void hci_controller_cache_store(void){
+    if (hci_stack->controller_cache_tlv_impl == NULL) return;
+    if (hci_stack->controller_cache_hit) return;
+    hci_controller_cache_t * cache = &hci_stack->controller_cache;
+    (void)memcpy(cache->bd_addr, hci_stack->local_bd_addr, 6);
+    cache->acl_payload_size = HCI_ACL_PAYLOAD_SIZE;
+    cache->host_configuration = hci_controller_cache_host_configuration();
+    cache->init_script_identity = hci_controller_cache_init_script_identity();
+    cache->local_supported_commands = hci_stack->local_supported_commands[0];
+    (void)memcpy(cache->local_supported_features, hci_stack->local_supported_features, 8);
+    cache->acl_data_packet_length = hci_stack->acl_data_packet_length;
+    cache->acl_packets_total_num  = hci_stack->acl_packets_total_num;
+    cache->sco_data_packet_length = hci_stack->sco_data_packet_length;
+    cache->sco_packets_total_num  = hci_stack->sco_packets_total_num;
+    cache->le_data_packets_length   = hci_stack->le_data_packets_length;
+    cache->le_acl_packets_total_num = hci_stack->le_acl_packets_total_num;
+#ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
+    cache->le_supported_max_tx_octets = hci_stack->le_supported_max_tx_octets;
+    cache->le_supported_max_tx_time   = hci_stack->le_supported_max_tx_time;
+#endif
+#ifdef ENABLE_LE_CENTRAL
+    cache->le_whitelist_capacity = hci_stack->le_whitelist_capacity;
+#endif
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+    cache->le_number_of_supported_advertising_sets = hci_stack->le_number_of_supported_advertising_sets;
+    cache->le_maximum_advertising_data_length      = hci_stack->le_maximum_advertising_data_length;
+#endif
+    int result = hci_stack->controller_cache_tlv_impl->store_tag(hci_stack->controller_cache_tlv_context, HCI_CONTROLLER_CACHE_TAG, (const uint8_t *) cache, sizeof(hci_controller_cache_t));
+    log_info("Controller cache: store controller capabilities, result %d", result);
+}
+#endif
+
+#if defined(ENABLE_HCI_CONTROLLER_CACHE) || (defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING))
+// skip command, substate has to be set to wait for the command
+static void hci_initializing_skip_command(void){
+    hci_initializing_command_completed();
+    hci_run();
+}
+#endif
+
+// skip read command if result is known from controller cache, substate has to be set to wait for the command
+static int hci_initializing_use_controller_cache(void){
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    if (hci_stack->controller_cache_hit == 0) return 0;
+    log_debug("Controller cache: skip command at substate %u", hci_stack->substate);
+    hci_initializing_skip_command();
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static void hci_initializing_read_local_supported_commands(void){
+    hci_stack->substate = HCI_INIT_W4_READ_LOCAL_SUPPORTED_COMMANDS;
+    if (hci_initializing_use_controller_cache()) return;
+    hci_send_cmd(&hci_read_local_supported_commands);
+}
+
 static void hci_initialization_timeout_handler(btstack_timer_source_t * ds){
     UNUSED(ds);
 
@@ -1147,7 +1863,7 @@ static void hci_initialization_timeout_handler(btstack_timer_source_t * ds){
         case HCI_INIT_W4_SEND_RESET:
             log_info("Resend HCI Reset");
             hci_stack->substate = HCI_INIT_SEND_RESET;
-            hci_stack->num_cmd_packets = 1;
+            hci_command_flow_control_reset();
             hci_run();
             break;
         case HCI_INIT_W4_CUSTOM_INIT_CSR_WARM_BOOT_LINK_RESET:
@@ -1161,7 +1877,7 @@ static void hci_initialization_timeout_handler(btstack_timer_source_t * ds){
         case HCI_INIT_W4_CUSTOM_INIT_CSR_WARM_BOOT:
             log_info("Resend HCI Reset - CSR Warm Boot");
             hci_stack->substate = HCI_INIT_SEND_RESET_CSR_WARM_BOOT;
-            hci_stack->num_cmd_packets = 1;
+            hci_command_flow_control_reset();
             hci_run();
             break;
         case HCI_INIT_W4_SEND_BAUD_CHANGE:
@@ -1182,8 +1898,7 @@ static void hci_initialization_timeout_handler(btstack_timer_source_t * ds){
             break;
         case HCI_INIT_W4_CUSTOM_INIT_BCM_DELAY:
             // otherwise continue
-            hci_stack->substate = HCI_INIT_W4_READ_LOCAL_SUPPORTED_COMMANDS;
-            hci_send_cmd(&hci_read_local_supported_commands);
+            hci_initializing_read_local_supported_commands();
             break;
         default:
             break;
@@ -1234,8 +1949,9 @@ static void hci_initializing_run(void){
             hci_stack->substate = HCI_INIT_W4_SEND_READ_LOCAL_VERSION_INFORMATION;
             break;
         case HCI_INIT_SEND_READ_LOCAL_NAME:
-            hci_send_cmd(&hci_read_local_name);
             hci_stack->substate = HCI_INIT_W4_SEND_READ_LOCAL_NAME;
+            if (hci_initializing_use_controller_cache()) break;
+            hci_send_cmd(&hci_read_local_name);
             break;
 
 #if !defined(HAVE_PLATFORM_IPHONE_OS) && !defined (HAVE_HOST_CONTROLLER_API)
@@ -1278,8 +1994,13 @@ static void hci_initializing_run(void){
         }
         case HCI_INIT_CUSTOM_INIT:
             // Custom initialization
-            if (hci_stack->chipset && hci_stack->chipset->next_command){
-                hci_stack->chipset_result = (*hci_stack->chipset->next_command)(hci_stack->hci_packet_buffer);
+            if (hci_stack->chipset && (hci_stack->chipset->next_command || hci_stack->chipset->next_command_in_place)){
+                uint8_t * hci_cmd = hci_stack->hci_packet_buffer;
+                if (hci_stack->chipset->next_command_in_place){
+                    hci_stack->chipset_result = (*hci_stack->chipset->next_command_in_place)(hci_stack->hci_packet_buffer, &hci_cmd);
+                } else {
+                    hci_stack->chipset_result = (*hci_stack->chipset->next_command)(hci_stack->hci_packet_buffer);
+                }
                 int send_cmd = 0;
                 switch (hci_stack->chipset_result){
                     case BTSTACK_CHIPSET_VALID_COMMAND:
@@ -1309,10 +2030,10 @@ static void hci_initializing_run(void){
                 }
 
                 if (send_cmd){
-                    int size = 3 + hci_stack->hci_packet_buffer[2];
-                    hci_stack->last_cmd_opcode = little_endian_read_16(hci_stack->hci_packet_buffer, 0);
-                    hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, hci_stack->hci_packet_buffer, size);
-                    hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, hci_stack->hci_packet_buffer, size);
+                    int size = 3 + hci_cmd[2];
+                    hci_stack->last_cmd_opcode = little_endian_read_16(hci_cmd, 0);
+                    hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, hci_cmd, size);
+                    hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, hci_cmd, size);
                     break;
                 }
                 log_info("Init script done");
@@ -1345,8 +2066,7 @@ static void hci_initializing_run(void){
                 }
             }
             // otherwise continue
-            hci_stack->substate = HCI_INIT_W4_READ_LOCAL_SUPPORTED_COMMANDS;
-            hci_send_cmd(&hci_read_local_supported_commands);
+            hci_initializing_read_local_supported_commands();
             break;            
         case HCI_INIT_SET_BD_ADDR:
             log_info("Set Public BD ADDR to %s", bd_addr_to_str(hci_stack->custom_bd_addr));
@@ -1359,19 +2079,26 @@ static void hci_initializing_run(void){
 
         case HCI_INIT_READ_LOCAL_SUPPORTED_COMMANDS:
             log_info("Resend hci_read_local_supported_commands after CSR Warm Boot double reset");
-            hci_stack->substate = HCI_INIT_W4_READ_LOCAL_SUPPORTED_COMMANDS;
-            hci_send_cmd(&hci_read_local_supported_commands);
+            hci_initializing_read_local_supported_commands();
             break;       
         case HCI_INIT_READ_BD_ADDR:
             hci_stack->substate = HCI_INIT_W4_READ_BD_ADDR;
             hci_send_cmd(&hci_read_bd_addr);
             break;
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+        case HCI_INIT_CONTROLLER_CACHE_MISS_READ_LOCAL_SUPPORTED_COMMANDS:
+            hci_stack->substate = HCI_INIT_W4_CONTROLLER_CACHE_MISS_READ_LOCAL_SUPPORTED_COMMANDS;
+            hci_send_cmd(&hci_read_local_supported_commands);
+            break;
+#endif
         case HCI_INIT_READ_BUFFER_SIZE:
             hci_stack->substate = HCI_INIT_W4_READ_BUFFER_SIZE;
+            if (hci_initializing_use_controller_cache()) break;
             hci_send_cmd(&hci_read_buffer_size);
             break;
         case HCI_INIT_READ_LOCAL_SUPPORTED_FEATURES:
             hci_stack->substate = HCI_INIT_W4_READ_LOCAL_SUPPORTED_FEATURES;
+            if (hci_initializing_use_controller_cache()) break;
             hci_send_cmd(&hci_read_local_supported_features);
             break;                
 
@@ -1430,6 +2157,10 @@ static void hci_initializing_run(void){
             // expand '00:00:00:00:00:00' in name with bd_addr
             hci_replace_bd_addr_placeholder(&packet[3], DEVICE_NAME_LEN);
             hci_send_cmd_packet(packet, HCI_CMD_HEADER_SIZE + DEVICE_NAME_LEN);
+            // release packet buffer for synchronous transport implementations
+            if (hci_transport_synchronous()){
+                hci_release_packet_buffer();
+            }
             break;
         }
         case HCI_INIT_WRITE_EIR_DATA: {
@@ -1455,6 +2186,10 @@ static void hci_initializing_run(void){
             // expand '00:00:00:00:00:00' in name with bd_addr
             hci_replace_bd_addr_placeholder(&packet[4], 240);
             hci_send_cmd_packet(packet, HCI_CMD_HEADER_SIZE + 1 + 240);
+            // release packet buffer for synchronous transport implementations
+            if (hci_transport_synchronous()){
+                hci_release_packet_buffer();
+            }
             break;
         }
         case HCI_INIT_WRITE_INQUIRY_MODE:
@@ -1486,12 +2221,39 @@ static void hci_initializing_run(void){
         // LE INIT
         case HCI_INIT_LE_READ_BUFFER_SIZE:
             hci_stack->substate = HCI_INIT_W4_LE_READ_BUFFER_SIZE;
+            if (hci_initializing_use_controller_cache()) break;
             hci_send_cmd(&hci_le_read_buffer_size);
             break;
         case HCI_INIT_LE_SET_EVENT_MASK:
             hci_stack->substate = HCI_INIT_W4_LE_SET_EVENT_MASK;
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+            if (hci_le_extended_advertising_supported()){
+                hci_send_cmd(&hci_le_set_event_mask, 0xB19FF, 0x0); // bits 0-8, 11, 12, 16, 17, 19
+                break;
+            }
+#endif
             hci_send_cmd(&hci_le_set_event_mask, 0x809FF, 0x0); // bits 0-8, 11, 19 
             break;
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+        case HCI_INIT_LE_READ_MAXIMUM_ADVERTISING_DATA_LENGTH:
+            hci_stack->substate = HCI_INIT_W4_LE_READ_MAXIMUM_ADVERTISING_DATA_LENGTH;
+            if (hci_initializing_use_controller_cache()) break;
+            if (!hci_le_extended_advertising_supported()){
+                hci_initializing_skip_command();
+                break;
+            }
+            hci_send_cmd(&hci_le_read_maximum_advertising_data_length);
+            break;
+        case HCI_INIT_LE_READ_NUMBER_OF_SUPPORTED_ADVERTISING_SETS:
+            hci_stack->substate = HCI_INIT_W4_LE_READ_NUMBER_OF_SUPPORTED_ADVERTISING_SETS;
+            if (hci_initializing_use_controller_cache()) break;
+            if (!hci_le_extended_advertising_supported()){
+                hci_initializing_skip_command();
+                break;
+            }
+            hci_send_cmd(&hci_le_read_number_of_supported_advertising_sets);
+            break;
+#endif
         case HCI_INIT_WRITE_LE_HOST_SUPPORTED:
             // LE Supported Host = 1, Simultaneous Host = 0
             hci_stack->substate = HCI_INIT_W4_WRITE_LE_HOST_SUPPORTED;
@@ -1502,6 +2264,7 @@ static void hci_initializing_run(void){
 #ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
         case HCI_INIT_LE_READ_MAX_DATA_LENGTH:
             hci_stack->substate = HCI_INIT_W4_LE_READ_MAX_DATA_LENGTH;
+            if (hci_initializing_use_controller_cache()) break;
             hci_send_cmd(&hci_le_read_maximum_data_length);
             break;
         case HCI_INIT_LE_WRITE_SUGGESTED_DATA_LENGTH:
@@ -1513,11 +2276,18 @@ static void hci_initializing_run(void){
 #ifdef ENABLE_LE_CENTRAL
         case HCI_INIT_READ_WHITE_LIST_SIZE:
             hci_stack->substate = HCI_INIT_W4_READ_WHITE_LIST_SIZE;
+            if (hci_initializing_use_controller_cache()) break;
             hci_send_cmd(&hci_le_read_white_list_size);
             break;
         case HCI_INIT_LE_SET_SCAN_PARAMETERS:
             // LE Scan Parameters: active scanning, 300 ms interval, 30 ms window, own address type, accept all advs
             hci_stack->substate = HCI_INIT_W4_LE_SET_SCAN_PARAMETERS;
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+            if (hci_le_extended_advertising_supported()){
+                hci_send_le_set_extended_scan_parameters(1);
+                break;
+            }
+#endif
             hci_send_cmd(&hci_le_set_scan_parameters, 1, hci_stack->le_scan_interval, hci_stack->le_scan_window, hci_stack->le_own_addr_type, 0);
             break;
 #endif
@@ -1529,6 +2299,9 @@ static void hci_initializing_run(void){
 static void hci_init_done(void){
     // done. tell the app
     log_info("hci_init_done -> HCI_STATE_WORKING");
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    hci_controller_cache_store();
+#endif
     hci_stack->state = HCI_STATE_WORKING;
     hci_emit_state();
     hci_run();
@@ -1578,7 +2351,7 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
         // TODO: track actual command
         command_completed = 1;
         // Fix: no HCI Command Complete received, so num_cmd_packets not reset
-        hci_stack->num_cmd_packets = 1;
+        hci_command_flow_control_reset();
     }
 
     // Late response (> 100 ms) for HCI Reset e.g. on Toshiba TC35661:
@@ -1636,6 +2409,12 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
 
     if (!command_completed) return;
 
+    hci_initializing_command_completed();
+}
+
+// transition to next substate after command for current substate is complete
+static void hci_initializing_command_completed(void){
+
     int need_baud_change = 0;
     int need_addr_change = 0;
 
@@ -1735,8 +2514,24 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
         case HCI_INIT_W4_SEND_RESET_ST_WARM_BOOT:
             hci_stack->substate = HCI_INIT_READ_BD_ADDR;
             return;
+#endif
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+        case HCI_INIT_W4_SEND_READ_LOCAL_VERSION_INFORMATION:
+            hci_controller_cache_load();
+            break;
 #endif
         case HCI_INIT_W4_READ_BD_ADDR:
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            // same model but different controller, e.g. after swapping modules, read all capabilities
+            if (hci_stack->controller_cache_hit && (bd_addr_cmp(hci_stack->controller_cache.bd_addr, hci_stack->local_bd_addr) != 0)){
+                log_info("Controller cache: different BD_ADDR");
+                hci_stack->controller_cache_hit = 0;
+                hci_stack->substate = HCI_INIT_CONTROLLER_CACHE_MISS_READ_LOCAL_SUPPORTED_COMMANDS;
+                return;
+            }
+            /* fall through */
+        case HCI_INIT_W4_CONTROLLER_CACHE_MISS_READ_LOCAL_SUPPORTED_COMMANDS:
+#endif
             // only read buffer size if supported
             if (hci_stack->local_supported_commands[0] & 0x01) {
                 hci_stack->substate = HCI_INIT_READ_BUFFER_SIZE;
@@ -1901,8 +2696,14 @@ static void event_handler(uint8_t *packet, int size){
     switch (hci_event_packet_get_type(packet)) {
                         
         case HCI_EVENT_COMMAND_COMPLETE:
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+            // get num cmd packets, limited by HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT
+            hci_stack->num_cmd_packets = packet[2];
+            hci_command_in_flight_remove(little_endian_read_16(packet, 3));
+#else
             // get num cmd packets - limit to 1 to reduce complexity
             hci_stack->num_cmd_packets = packet[2] ? 1 : 0;
+#endif
 
             if (HCI_EVENT_IS_COMMAND_COMPLETE(packet, hci_read_local_name)){
                 if (packet[5]) break;
@@ -1960,6 +2761,22 @@ static void event_handler(uint8_t *packet, int size){
                 hci_stack->le_whitelist_capacity = packet[6];
                 log_info("hci_le_read_white_list_size: size %u", hci_stack->le_whitelist_capacity);
             }   
+#endif
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+            if (HCI_EVENT_IS_COMMAND_COMPLETE(packet, hci_le_read_maximum_advertising_data_length)){
+                hci_stack->le_maximum_advertising_data_length = little_endian_read_16(packet, 6);
+                log_info("hci_le_read_maximum_advertising_data_length: %u", hci_stack->le_maximum_advertising_data_length);
+            }
+            if (HCI_EVENT_IS_COMMAND_COMPLETE(packet, hci_le_read_number_of_supported_advertising_sets)){
+                hci_stack->le_number_of_supported_advertising_sets = packet[6];
+                log_info("hci_le_read_number_of_supported_advertising_sets: %u", hci_stack->le_number_of_supported_advertising_sets);
+            }
+            if (HCI_EVENT_IS_COMMAND_COMPLETE(packet, hci_le_set_extended_advertising_parameters)){
+                hci_le_advertising_set_parameters_complete(packet[5]);
+            }
+            if (HCI_EVENT_IS_COMMAND_COMPLETE(packet, hci_le_set_extended_advertising_enable)){
+                hci_le_advertising_set_enable_complete(packet[5]);
+            }
 #endif
             if (HCI_EVENT_IS_COMMAND_COMPLETE(packet, hci_read_bd_addr)) {
                 reverse_bd_addr(&packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE + 1],
@@ -2003,6 +2820,13 @@ static void event_handler(uint8_t *packet, int size){
                 // hci_stack->hci_version    = little_endian_read_16(packet, 4);
                 // hci_stack->hci_revision   = little_endian_read_16(packet, 6);
                 uint16_t manufacturer = little_endian_read_16(packet, 10);
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+                hci_stack->controller_cache.hci_version    = packet[6];
+                hci_stack->controller_cache.hci_revision   = little_endian_read_16(packet, 7);
+                hci_stack->controller_cache.lmp_version    = packet[9];
+                hci_stack->controller_cache.manufacturer   = manufacturer;
+                hci_stack->controller_cache.lmp_subversion = little_endian_read_16(packet, 12);
+#endif
                 // map Cypress to Broadcom
                 if (manufacturer  == BLUETOOTH_COMPANY_ID_CYPRESS_SEMICONDUCTOR){
                     log_info("Treat Cypress as Broadcom");
@@ -2022,7 +2846,8 @@ static void event_handler(uint8_t *packet, int size){
                      (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+18] & 0x08)       |  // bit 3 = Octet 18, bit 3 / Write Default Erroneous Data Reporting 
                     ((packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+34] & 0x01) << 4) |  // bit 4 = Octet 34, bit 0 / LE Write Suggested Default Data Length
                     ((packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+35] & 0x08) << 2) |  // bit 5 = Octet 35, bit 3 / LE Read Maximum Data Length
-                    ((packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+35] & 0x20) << 1);   // bit 6 = Octet 35, bit 5 / LE Set Default PHY
+                    ((packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+35] & 0x20) << 1) |  // bit 6 = Octet 35, bit 5 / LE Set Default PHY
+                    ((packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+36] & 0x04) << 5);   // bit 7 = Octet 36, bit 2 / LE Set Extended Advertising Parameters
                     log_info("Local supported commands summary 0x%02x", hci_stack->local_supported_commands[0]); 
             }
 #ifdef ENABLE_CLASSIC
@@ -2051,8 +2876,14 @@ static void event_handler(uint8_t *packet, int size){
             break;
             
         case HCI_EVENT_COMMAND_STATUS:
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+            // get num cmd packets, limited by HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT
+            hci_stack->num_cmd_packets = packet[3];
+            hci_command_in_flight_remove(little_endian_read_16(packet, 4));
+#else
             // get num cmd packets - limit to 1 to reduce complexity
             hci_stack->num_cmd_packets = packet[3] ? 1 : 0;
+#endif
 
             // check command status to detected failed outgoing connections
             create_connection_cmd = 0;
@@ -2065,6 +2896,11 @@ static void event_handler(uint8_t *packet, int size){
             if (HCI_EVENT_IS_COMMAND_STATUS(packet, hci_le_create_connection)){
                 create_connection_cmd = 1;
             }
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+            if (HCI_EVENT_IS_COMMAND_STATUS(packet, hci_le_extended_create_connection)){
+                create_connection_cmd = 1;
+            }
+#endif
 #endif
             if (create_connection_cmd) {
                 uint8_t status = hci_event_command_status_get_status(packet);
@@ -2450,6 +3286,17 @@ static void event_handler(uint8_t *packet, int size){
                     if (!hci_stack->le_scanning_enabled) break;
                     le_handle_advertisement_report(packet, size);
                     break;
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+                case HCI_SUBEVENT_LE_EXTENDED_ADVERTISING_REPORT:
+                    if (!hci_stack->le_scanning_enabled) break;
+                    le_handle_extended_advertisement_report(packet, size);
+                    break;
+#endif
+#endif
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+                case HCI_SUBEVENT_LE_ADVERTISING_SET_TERMINATED:
+                    hci_le_advertising_set_terminated(hci_subevent_le_advertising_set_terminated_get_advertising_handle(packet));
+                    break;
 #endif
                 case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
                     // Connection management
@@ -2571,7 +3418,7 @@ static void event_handler(uint8_t *packet, int size){
             // To avoid getting stuck as num_cmds_packets is zero, reset it to 1 for controllers with this behaviour
             switch (hci_stack->manufacturer){
                 case BLUETOOTH_COMPANY_ID_CAMBRIDGE_SILICON_RADIO:
-                    hci_stack->num_cmd_packets = 1;
+                    hci_command_flow_control_reset();
                     break;
                 default:
                     break;
@@ -2785,6 +3632,13 @@ static void hci_state_reset(void){
     hci_stack->le_connecting_state = LE_CONNECTING_IDLE;
     hci_stack->le_whitelist = 0;
     hci_stack->le_whitelist_capacity = 0;
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    hci_stack->le_extended_advertising_report_state = LE_EXTENDED_ADVERTISING_REPORT_IDLE;
+    hci_stack->le_extended_advertising_report_interrupted = 0;
+#endif
+#endif
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+    hci_le_advertising_sets_reset();
 #endif
 }
 
@@ -2801,6 +3655,18 @@ void hci_set_link_key_db(btstack_link_key_db_t const * link_key_db){
 }
 #endif
 
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+void hci_set_controller_cache(const btstack_tlv_t * tlv_impl, void * tlv_context){
+    hci_stack->controller_cache_tlv_impl = tlv_impl;
+    hci_stack->controller_cache_tlv_context = tlv_context;
+}
+
+void hci_delete_controller_cache(void){
+    if (hci_stack->controller_cache_tlv_impl == NULL) return;
+    hci_stack->controller_cache_tlv_impl->delete_tag(hci_stack->controller_cache_tlv_context, HCI_CONTROLLER_CACHE_TAG);
+}
+#endif
+
 void hci_init(const hci_transport_t *transport, const void *config){
     
 #ifdef HAVE_MALLOC
@@ -2869,10 +3735,20 @@ void hci_init(const hci_transport_t *transport, const void *config){
     // default LE Scanning
     hci_stack->le_scan_interval = 0x1e0;
     hci_stack->le_scan_window   =  0x30;
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    hci_stack->le_scan_phys       = 0x01;    // LE 1M
+    hci_stack->le_connection_phys = 0x01;    // LE 1M
+#endif
 #endif
 
 #ifdef ENABLE_LE_PERIPHERAL
     hci_stack->le_max_number_peripheral_connections = 1; // only single connection as peripheral
+
+    // default advertising parameters of Controller: 1.28 s, ADV_IND, all channels
+    hci_stack->le_advertisements_interval_min = 0x0800;
+    hci_stack->le_advertisements_interval_max = 0x0800;
+    hci_stack->le_advertisements_channel_map  = 0x07;
 #endif
 
     // connection parameter range used to answer connection parameter update requests in l2cap
@@ -3015,6 +3891,11 @@ static void hci_power_control_off(void){
     
     log_info("hci_power_control_off");
 
+#if defined(ENABLE_LE_CENTRAL) && defined(ENABLE_LE_ADVERTISING_REPORT_BATCHING)
+    // deliver collected advertising reports and stop batch timer
+    hci_le_advertising_reports_flush();
+#endif
+
     // close low-level device
     hci_stack->hci_transport->close();
 
@@ -3076,8 +3957,11 @@ static int hci_power_control_wake(void){
 
 static void hci_power_transition_to_initializing(void){
     // set up state machine
-    hci_stack->num_cmd_packets = 1; // assume that one cmd can be sent
+    hci_command_flow_control_reset();
     hci_stack->hci_packet_buffer_reserved = 0;
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    hci_stack->controller_cache_hit = 0;
+#endif
     hci_stack->state = HCI_STATE_INITIALIZING;
     hci_stack->substate = HCI_INIT_SEND_RESET;
 }
@@ -3309,73 +4193,39 @@ static void hci_halting_timeout_handler(btstack_timer_source_t * ds){
     hci_run();
 }   
 
-static void hci_run(void){
-    
-    // log_info("hci_run: entered");
-    btstack_linked_item_t * it;
-
-    // send continuation fragments first, as they block the prepared packet buffer
-    if (hci_stack->acl_fragmentation_total_size > 0) {
-        hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(hci_stack->hci_packet_buffer);
-        hci_connection_t *connection = hci_connection_for_handle(con_handle);
-        if (connection) {
-            if (hci_can_send_prepared_acl_packet_now(con_handle)){
-                hci_send_acl_packet_fragments(connection);
-                return;
-            }
-        } else {
-            // connection gone -> discard further fragments
-            log_info("hci_run: fragmented ACL packet no connection -> discard fragment");
-            hci_stack->acl_fragmentation_total_size = 0;
-            hci_stack->acl_fragmentation_pos = 0;
-        }
-    }
-
-#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
-    // send host num completed packets next as they don't require num_cmd_packets > 0
-    if (!hci_can_send_comand_packet_transport()) return;
-    if (hci_stack->host_completed_packets){
-        hci_host_num_completed_packets();        
-        return;
-    }
-#endif
-
-    if (!hci_can_send_command_packet_now()) return;
-
-    // global/non-connection oriented commands
-
 #ifdef ENABLE_CLASSIC
+static bool hci_run_general_gap_classic(void){
     // decline incoming connections
     if (hci_stack->decline_reason){
         uint8_t reason = hci_stack->decline_reason;
         hci_stack->decline_reason = 0;
         hci_send_cmd(&hci_reject_connection_request, hci_stack->decline_addr, reason);
-        return;
+        return true;
     }
     // send scan enable
     if ((hci_stack->state == HCI_STATE_WORKING) && (hci_stack->new_scan_enable_value != 0xff) && hci_classic_supported()){
         hci_send_cmd(&hci_write_scan_enable, hci_stack->new_scan_enable_value);
         hci_stack->new_scan_enable_value = 0xff;
-        return;
+        return true;
     }
     // start/stop inquiry
     if ((hci_stack->inquiry_state >= GAP_INQUIRY_DURATION_MIN) && (hci_stack->inquiry_state <= GAP_INQUIRY_DURATION_MAX)){
         uint8_t duration = hci_stack->inquiry_state;
         hci_stack->inquiry_state = GAP_INQUIRY_STATE_ACTIVE;
         hci_send_cmd(&hci_inquiry, GAP_IAC_GENERAL_INQUIRY, duration, 0);
-        return;
+        return true;
     }
     if (hci_stack->inquiry_state == GAP_INQUIRY_STATE_W2_CANCEL){
         hci_stack->inquiry_state = GAP_INQUIRY_STATE_W4_CANCELLED;
         hci_send_cmd(&hci_inquiry_cancel);
-        return;
+        return true;
     }
     // remote name request
     if (hci_stack->remote_name_state == GAP_REMOTE_NAME_STATE_W2_SEND){
         hci_stack->remote_name_state = GAP_REMOTE_NAME_STATE_W4_COMPLETE;
         hci_send_cmd(&hci_remote_name_request, hci_stack->remote_name_addr, 
             hci_stack->remote_name_page_scan_repetition_mode, 0, hci_stack->remote_name_clock_offset);
-        return;
+        return true;
     }
     // pairing
     if (hci_stack->gap_pairing_state != GAP_PAIRING_STATE_IDLE){
@@ -3403,11 +4253,269 @@ static void hci_run(void){
             default:
                 break;
         }
+        return true;
+    }
+    return false;
+}
+#endif
+
+#ifdef ENABLE_BLE
+#ifdef ENABLE_LE_CENTRAL
+static void hci_send_le_create_connection(uint8_t initiator_filter_policy, bd_addr_type_t address_type, bd_addr_t address){
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    if (hci_le_extended_advertising_supported()){
+        // same connection parameters for all initiating PHYs
+        uint16_t scan_interval[3];
+        uint16_t scan_window[3];
+        uint16_t conn_interval_min[3];
+        uint16_t conn_interval_max[3];
+        uint16_t conn_latency[3];
+        uint16_t supervision_timeout[3];
+        uint16_t min_ce_length[3];
+        uint16_t max_ce_length[3];
+        int i;
+        for (i = 0; i < 3; i++){
+            scan_interval[i]       = hci_stack->le_connection_scan_interval;
+            scan_window[i]         = hci_stack->le_connection_scan_window;
+            conn_interval_min[i]   = hci_stack->le_connection_interval_min;
+            conn_interval_max[i]   = hci_stack->le_connection_interval_max;
+            conn_latency[i]        = hci_stack->le_connection_latency;
+            supervision_timeout[i] = hci_stack->le_supervision_timeout;
+            min_ce_length[i]       = hci_stack->le_minimum_ce_length;
+            max_ce_length[i]       = hci_stack->le_maximum_ce_length;
+        }
+        hci_send_cmd(&hci_le_extended_create_connection,
+             initiator_filter_policy,
+             hci_stack->le_own_addr_type, // our addr type:
+             address_type,                // peer address type
+             address,                     // peer bd addr
+             hci_stack->le_connection_phys, // initiating phys
+             scan_interval, scan_window, conn_interval_min, conn_interval_max,
+             conn_latency, supervision_timeout, min_ce_length, max_ce_length);
         return;
     }
+#endif
+    hci_send_cmd(&hci_le_create_connection,
+         hci_stack->le_connection_scan_interval,    // conn scan interval
+         hci_stack->le_connection_scan_window,      // conn scan windows
+         initiator_filter_policy,
+         address_type,                // peer address type
+         address,                     // peer bd addr
+         hci_stack->le_own_addr_type, // our addr type:
+         hci_stack->le_connection_interval_min,    // conn interval min
+         hci_stack->le_connection_interval_max,    // conn interval max
+         hci_stack->le_connection_latency,         // conn latency
+         hci_stack->le_supervision_timeout,        // conn latency
+         hci_stack->le_minimum_ce_length,          // min ce length
+         hci_stack->le_maximum_ce_length           // max ce length
+         );
+}
+#endif
+
+#ifdef ENABLE_LE_PERIPHERAL
+static bool hci_run_general_gap_le_legacy_advertising(void){
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_DISABLE){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_DISABLE;
+        hci_send_cmd(&hci_le_set_advertise_enable, 0);
+        return true;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_PARAMS){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_PARAMS;
+        hci_send_cmd(&hci_le_set_advertising_parameters,
+             hci_stack->le_advertisements_interval_min,
+             hci_stack->le_advertisements_interval_max,
+             hci_stack->le_advertisements_type,
+             hci_stack->le_own_addr_type,
+             hci_stack->le_advertisements_direct_address_type,
+             hci_stack->le_advertisements_direct_address,
+             hci_stack->le_advertisements_channel_map,
+             hci_stack->le_advertisements_filter_policy);
+        return true;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_ADV_DATA){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_ADV_DATA;
+        uint8_t adv_data_clean[31];
+        memset(adv_data_clean, 0, sizeof(adv_data_clean));
+        (void)memcpy(adv_data_clean, hci_stack->le_advertisements_data,
+                     hci_stack->le_advertisements_data_len);
+        hci_replace_bd_addr_placeholder(adv_data_clean, hci_stack->le_advertisements_data_len);
+        hci_send_cmd(&hci_le_set_advertising_data, hci_stack->le_advertisements_data_len, adv_data_clean);
+        return true;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA;
+        uint8_t scan_data_clean[31];
+        memset(scan_data_clean, 0, sizeof(scan_data_clean));
+        (void)memcpy(scan_data_clean, hci_stack->le_scan_response_data,
+                     hci_stack->le_scan_response_data_len);
+        hci_replace_bd_addr_placeholder(scan_data_clean, hci_stack->le_scan_response_data_len);
+        hci_send_cmd(&hci_le_set_scan_response_data, hci_stack->le_scan_response_data_len, scan_data_clean);
+        return true;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_ENABLE){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_ENABLE;
+        hci_send_cmd(&hci_le_set_advertise_enable, 1);
+        return true;
+    }
+    return false;
+}
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+// advertising event properties for legacy advertising type
+static uint16_t hci_le_legacy_advertising_event_properties(uint8_t advertising_type){
+    switch (advertising_type){
+        case 0x00:
+            return 0x13;    // ADV_IND
+        case 0x01:
+            return 0x1D;    // ADV_DIRECT_IND, high duty cycle
+        case 0x02:
+            return 0x12;    // ADV_SCAN_IND
+        case 0x04:
+            return 0x15;    // ADV_DIRECT_IND, low duty cycle
+        default:
+            return 0x10;    // ADV_NONCONN_IND
+    }
+}
+
+// returns operation for next fragment of advertising or scan response data and its length
+static uint8_t hci_le_extended_advertising_data_operation(uint16_t data_len, uint16_t data_pos, uint8_t * fragment_len){
+    uint16_t remaining = data_len - data_pos;
+    if (remaining <= LE_EXTENDED_ADVERTISING_DATA_FRAGMENT_SIZE){
+        *fragment_len = (uint8_t) remaining;
+        return (data_pos == 0) ? 0x03 : 0x02;   // complete or last fragment
+    }
+    *fragment_len = LE_EXTENDED_ADVERTISING_DATA_FRAGMENT_SIZE;
+    return (data_pos == 0) ? 0x01 : 0x00;       // first or intermediate fragment
+}
+
+static bool hci_run_general_gap_le_advertising_set(le_advertising_set_t * advertising_set){
+    uint8_t handle = advertising_set->advertising_handle;
+    const le_extended_advertising_parameters_t * params = &advertising_set->params;
+    uint8_t fragment_len;
+    uint8_t operation;
+    if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_DISABLE){
+        advertising_set->tasks &= ~LE_ADVERTISEMENT_TASKS_DISABLE;
+        hci_send_cmd(&hci_le_set_extended_advertising_enable, 0, 1, handle, 0, 0);
+        return true;
+    }
+    if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_REMOVE_SET){
+        advertising_set->tasks = 0;
+        btstack_linked_list_remove(&hci_stack->le_advertising_sets, (btstack_linked_item_t *) advertising_set);
+        hci_send_cmd(&hci_le_remove_advertising_set, handle);
+        return true;
+    }
+    if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_SET_PARAMS){
+        advertising_set->tasks &= ~LE_ADVERTISEMENT_TASKS_SET_PARAMS;
+        if (hci_stack->le_own_addr_type != BD_ADDR_TYPE_LE_PUBLIC){
+            advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_SET_ADDRESS;
+        }
+        hci_send_cmd(&hci_le_set_extended_advertising_parameters, handle, params->advertising_event_properties,
+                     params->primary_advertising_interval_min, params->primary_advertising_interval_max,
+                     params->primary_advertising_channel_map, hci_stack->le_own_addr_type, params->peer_address_type,
+                     params->peer_address, params->advertising_filter_policy, params->advertising_tx_power,
+                     params->primary_advertising_phy, params->secondary_advertising_max_skip,
+                     params->secondary_advertising_phy, params->advertising_sid, params->scan_request_notification_enable);
+        return true;
+    }
+    if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_SET_ADDRESS){
+        advertising_set->tasks &= ~LE_ADVERTISEMENT_TASKS_SET_ADDRESS;
+        hci_send_cmd(&hci_le_set_advertising_set_random_address, handle, hci_stack->le_random_address);
+        return true;
+    }
+    if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_SET_ADV_DATA){
+        operation = hci_le_extended_advertising_data_operation(advertising_set->adv_data_len, advertising_set->adv_data_pos, &fragment_len);
+        hci_send_cmd(&hci_le_set_extended_advertising_data, handle, operation, 1, fragment_len, &advertising_set->adv_data[advertising_set->adv_data_pos]);
+        advertising_set->adv_data_pos += fragment_len;
+        if (advertising_set->adv_data_pos == advertising_set->adv_data_len){
+            advertising_set->adv_data_pos = 0;
+            advertising_set->tasks &= ~LE_ADVERTISEMENT_TASKS_SET_ADV_DATA;
+        }
+        return true;
+    }
+    if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA){
+        operation = hci_le_extended_advertising_data_operation(advertising_set->scan_data_len, advertising_set->scan_data_pos, &fragment_len);
+        hci_send_cmd(&hci_le_set_extended_scan_response_data, handle, operation, 1, fragment_len, &advertising_set->scan_data[advertising_set->scan_data_pos]);
+        advertising_set->scan_data_pos += fragment_len;
+        if (advertising_set->scan_data_pos == advertising_set->scan_data_len){
+            advertising_set->scan_data_pos = 0;
+            advertising_set->tasks &= ~LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA;
+        }
+        return true;
+    }
+    if (advertising_set->tasks & LE_ADVERTISEMENT_TASKS_ENABLE){
+        advertising_set->tasks &= ~LE_ADVERTISEMENT_TASKS_ENABLE;
+        hci_send_cmd(&hci_le_set_extended_advertising_enable, 1, 1, handle, advertising_set->enable_timeout, advertising_set->enable_max_events);
+        return true;
+    }
+    return false;
+}
+
+// gap_advertisements_* API uses advertising handle 0 with legacy PDUs
+static bool hci_run_general_gap_le_advertising_sets(void){
+    uint8_t handle = LE_EXTENDED_ADVERTISING_LEGACY_HANDLE;
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_DISABLE){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_DISABLE;
+        hci_send_cmd(&hci_le_set_extended_advertising_enable, 0, 1, handle, 0, 0);
+        return true;
+    }
+    // unlike legacy advertising, handle 0 has to be created before data can be set -> use default parameters
+    if ((hci_stack->le_advertisements_set_created == 0) &&
+        (hci_stack->le_advertisements_todo & (LE_ADVERTISEMENT_TASKS_SET_ADV_DATA | LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA | LE_ADVERTISEMENT_TASKS_ENABLE))){
+        hci_stack->le_advertisements_todo |= LE_ADVERTISEMENT_TASKS_SET_PARAMS;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_PARAMS){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_PARAMS;
+        hci_stack->le_advertisements_set_created = 1;
+        if (hci_stack->le_own_addr_type != BD_ADDR_TYPE_LE_PUBLIC){
+            hci_stack->le_advertisements_todo |= LE_ADVERTISEMENT_TASKS_SET_ADDRESS;
+        }
+        hci_send_cmd(&hci_le_set_extended_advertising_parameters, handle,
+                     hci_le_legacy_advertising_event_properties(hci_stack->le_advertisements_type),
+                     hci_stack->le_advertisements_interval_min, hci_stack->le_advertisements_interval_max,
+                     hci_stack->le_advertisements_channel_map, hci_stack->le_own_addr_type,
+                     hci_stack->le_advertisements_direct_address_type, hci_stack->le_advertisements_direct_address,
+                     hci_stack->le_advertisements_filter_policy, 127, 1, 0, 1, 0, 0);
+        return true;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_ADDRESS){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_ADDRESS;
+        hci_send_cmd(&hci_le_set_advertising_set_random_address, handle, hci_stack->le_random_address);
+        return true;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_ADV_DATA){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_ADV_DATA;
+        uint8_t adv_data_clean[31];
+        (void)memcpy(adv_data_clean, hci_stack->le_advertisements_data, hci_stack->le_advertisements_data_len);
+        hci_replace_bd_addr_placeholder(adv_data_clean, hci_stack->le_advertisements_data_len);
+        hci_send_cmd(&hci_le_set_extended_advertising_data, handle, 0x03, 1, hci_stack->le_advertisements_data_len, adv_data_clean);
+        return true;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA;
+        uint8_t scan_data_clean[31];
+        (void)memcpy(scan_data_clean, hci_stack->le_scan_response_data, hci_stack->le_scan_response_data_len);
+        hci_replace_bd_addr_placeholder(scan_data_clean, hci_stack->le_scan_response_data_len);
+        hci_send_cmd(&hci_le_set_extended_scan_response_data, handle, 0x03, 1, hci_stack->le_scan_response_data_len, scan_data_clean);
+        return true;
+    }
+    if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_ENABLE){
+        hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_ENABLE;
+        hci_send_cmd(&hci_le_set_extended_advertising_enable, 1, 1, handle, 0, 0);
+        return true;
+    }
+
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &hci_stack->le_advertising_sets);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        le_advertising_set_t * advertising_set = (le_advertising_set_t *) btstack_linked_list_iterator_next(&it);
+        if (hci_run_general_gap_le_advertising_set(advertising_set)) return true;
+    }
+    return false;
+}
+#endif
 #endif
 
-#ifdef ENABLE_BLE
+static bool hci_run_general_gap_le(void){
     // advertisements, active scanning, and creating connections requires randaom address to be set if using private address
     if ((hci_stack->state == HCI_STATE_WORKING)
     && ((hci_stack->le_own_addr_type == BD_ADDR_TYPE_LE_PUBLIC) || hci_stack->le_random_address_set)){
@@ -3416,15 +4524,27 @@ static void hci_run(void){
         // handle le scan
         if ((hci_stack->le_scanning_enabled != hci_stack->le_scanning_active)){
             hci_stack->le_scanning_active = hci_stack->le_scanning_enabled;
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+            if (hci_le_extended_advertising_supported()){
+                hci_send_cmd(&hci_le_set_extended_scan_enable, hci_stack->le_scanning_enabled, 0, 0, 0);
+                return true;
+            }
+#endif
             hci_send_cmd(&hci_le_set_scan_enable, hci_stack->le_scanning_enabled, 0);
-            return;
+            return true;
         }
         if (hci_stack->le_scan_type != 0xff){
             // defaults: active scanning, accept all advertisement packets
             int scan_type = hci_stack->le_scan_type;
             hci_stack->le_scan_type = 0xff;
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+            if (hci_le_extended_advertising_supported()){
+                hci_send_le_set_extended_scan_parameters(scan_type);
+                return true;
+            }
+#endif
             hci_send_cmd(&hci_le_set_scan_parameters, scan_type, hci_stack->le_scan_interval, hci_stack->le_scan_window, hci_stack->le_own_addr_type, 0);
-            return;
+            return true;
         }
 #endif
 #ifdef ENABLE_LE_PERIPHERAL
@@ -3432,49 +4552,12 @@ static void hci_run(void){
         if (hci_stack->le_advertisements_todo){
             log_info("hci_run: gap_le: adv todo: %x", hci_stack->le_advertisements_todo );
         }
-        if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_DISABLE){
-            hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_DISABLE;
-            hci_send_cmd(&hci_le_set_advertise_enable, 0);
-            return;
-        }
-        if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_PARAMS){
-            hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_PARAMS;
-            hci_send_cmd(&hci_le_set_advertising_parameters,
-                 hci_stack->le_advertisements_interval_min,
-                 hci_stack->le_advertisements_interval_max,
-                 hci_stack->le_advertisements_type,
-                 hci_stack->le_own_addr_type,
-                 hci_stack->le_advertisements_direct_address_type,
-                 hci_stack->le_advertisements_direct_address,
-                 hci_stack->le_advertisements_channel_map,
-                 hci_stack->le_advertisements_filter_policy);
-            return;
-        }
-        if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_ADV_DATA){
-            hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_ADV_DATA;
-            uint8_t adv_data_clean[31];
-            memset(adv_data_clean, 0, sizeof(adv_data_clean));
-            (void)memcpy(adv_data_clean, hci_stack->le_advertisements_data,
-                         hci_stack->le_advertisements_data_len);
-            hci_replace_bd_addr_placeholder(adv_data_clean, hci_stack->le_advertisements_data_len);
-            hci_send_cmd(&hci_le_set_advertising_data, hci_stack->le_advertisements_data_len, adv_data_clean);
-            return;
-        }
-        if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA){
-            hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA;
-            uint8_t scan_data_clean[31];
-            memset(scan_data_clean, 0, sizeof(scan_data_clean));
-            (void)memcpy(scan_data_clean, hci_stack->le_scan_response_data,
-                         hci_stack->le_scan_response_data_len);
-            hci_replace_bd_addr_placeholder(scan_data_clean, hci_stack->le_scan_response_data_len);
-            hci_send_cmd(&hci_le_set_scan_response_data, hci_stack->le_scan_response_data_len, scan_data_clean);
-            return;
-        }
-        if (hci_stack->le_advertisements_todo & LE_ADVERTISEMENT_TASKS_ENABLE){
-            hci_stack->le_advertisements_todo &= ~LE_ADVERTISEMENT_TASKS_ENABLE;
-            hci_send_cmd(&hci_le_set_advertise_enable, 1);
-            return;
-        }
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+        if (hci_le_extended_advertising_supported()){
+            if (hci_run_general_gap_le_advertising_sets()) return true;
+        } else
+#endif
+        if (hci_run_general_gap_le_legacy_advertising()) return true;
 #endif
 
 #ifdef ENABLE_LE_CENTRAL
@@ -3498,7 +4581,7 @@ static void hci_run(void){
             // stop connnecting if modification pending
             if (hci_stack->le_connecting_state != LE_CONNECTING_IDLE){
                 hci_send_cmd(&hci_le_create_connection_cancel);
-                return;
+                return true;
             }
 
             // add/remove entries
@@ -3508,7 +4591,7 @@ static void hci_run(void){
                 if (entry->state & LE_WHITELIST_ADD_TO_CONTROLLER){
                     entry->state = LE_WHITELIST_ON_CONTROLLER;
                     hci_send_cmd(&hci_le_add_device_to_white_list, entry->address_type, entry->address);
-                    return;
+                    return true;
 
                 }
                 if (entry->state & LE_WHITELIST_REMOVE_FROM_CONTROLLER){
@@ -3518,7 +4601,7 @@ static void hci_run(void){
                     btstack_linked_list_remove(&hci_stack->le_whitelist, (btstack_linked_item_t *) entry);
                     btstack_memory_whitelist_entry_free(entry);
                     hci_send_cmd(&hci_le_remove_device_from_white_list, address_type, address);
-                    return;
+                    return true;
                 }
             }
         }
@@ -3528,252 +4611,324 @@ static void hci_run(void){
             !btstack_linked_list_empty(&hci_stack->le_whitelist)){
             bd_addr_t null_addr;
             memset(null_addr, 0, 6);
-            hci_send_cmd(&hci_le_create_connection,
-                hci_stack->le_connection_scan_interval,    // scan interval: 60 ms
-                hci_stack->le_connection_scan_window,    // scan interval: 30 ms
-                 1,         // use whitelist
-                 0,         // peer address type
-                 null_addr, // peer bd addr
-                 hci_stack->le_own_addr_type, // our addr type:
-                 hci_stack->le_connection_interval_min,    // conn interval min
-                 hci_stack->le_connection_interval_max,    // conn interval max
-                 hci_stack->le_connection_latency,         // conn latency
-                 hci_stack->le_supervision_timeout,        // conn latency
-                 hci_stack->le_minimum_ce_length,          // min ce length
-                 hci_stack->le_maximum_ce_length           // max ce length
-                );
-            return;
+            hci_send_le_create_connection(1, BD_ADDR_TYPE_LE_PUBLIC, null_addr);    // use whitelist
+            return true;
         }
 #endif
     }
+    return false;
+}
 #endif
-    
-    // send pending HCI commands
-    for (it = (btstack_linked_item_t *) hci_stack->connections; it != NULL; it = it->next){
-        hci_connection_t * connection = (hci_connection_t *) it;
-        
-        switch(connection->state){
-            case SEND_CREATE_CONNECTION:
-                switch(connection->address_type){
+
+static bool hci_run_general_pending_commands_for_connection(hci_connection_t * connection){
+    switch(connection->state){
+        case SEND_CREATE_CONNECTION:
+            switch(connection->address_type){
 #ifdef ENABLE_CLASSIC
-                    case BD_ADDR_TYPE_ACL:
-                        log_info("sending hci_create_connection");
-                        hci_send_cmd(&hci_create_connection, connection->address, hci_usable_acl_packet_types(), 0, 0, 0, 1);
-                        break;
+                case BD_ADDR_TYPE_ACL:
+                    log_info("sending hci_create_connection");
+                    hci_send_cmd(&hci_create_connection, connection->address, hci_usable_acl_packet_types(), 0, 0, 0, 1);
+                    break;
 #endif
-                    default:
+                default:
 #ifdef ENABLE_BLE
 #ifdef ENABLE_LE_CENTRAL
-                        // track outgoing connection
-                        hci_stack->outgoing_addr_type = connection->address_type;
-                        (void)memcpy(hci_stack->outgoing_addr,
-                                     connection->address, 6);
-                        log_info("sending hci_le_create_connection");
-                        hci_send_cmd(&hci_le_create_connection,
-                             hci_stack->le_connection_scan_interval,    // conn scan interval
-                             hci_stack->le_connection_scan_window,      // conn scan windows
-                             0,         // don't use whitelist
-                             connection->address_type, // peer address type
-                             connection->address,      // peer bd addr
-                             hci_stack->le_own_addr_type, // our addr type:
-                             hci_stack->le_connection_interval_min,    // conn interval min
-                             hci_stack->le_connection_interval_max,    // conn interval max
-                             hci_stack->le_connection_latency,         // conn latency
-                             hci_stack->le_supervision_timeout,        // conn latency
-                             hci_stack->le_minimum_ce_length,          // min ce length
-                             hci_stack->le_maximum_ce_length          // max ce length
-                             );
-                        connection->state = SENT_CREATE_CONNECTION;
+                    // track outgoing connection
+                    hci_stack->outgoing_addr_type = connection->address_type;
+                    (void)memcpy(hci_stack->outgoing_addr,
+                                 connection->address, 6);
+                    log_info("sending hci_le_create_connection");
+                    hci_send_le_create_connection(0, connection->address_type, connection->address);   // don't use whitelist
+                    connection->state = SENT_CREATE_CONNECTION;
 #endif
 #endif
-                        break;
-                }
-                return;
-               
+                    break;
+            }
+            return true;
+           
 #ifdef ENABLE_CLASSIC
-            case RECEIVED_CONNECTION_REQUEST:
-                connection->role  = HCI_ROLE_SLAVE;
-                if (connection->address_type == BD_ADDR_TYPE_ACL){
-                    log_info("sending hci_accept_connection_request, remote eSCO %u", connection->remote_supported_feature_eSCO);
-                    connection->state = ACCEPTED_CONNECTION_REQUEST;
-                    hci_send_cmd(&hci_accept_connection_request, connection->address, hci_stack->master_slave_policy);
-                } 
-                return;
+        case RECEIVED_CONNECTION_REQUEST:
+            connection->role  = HCI_ROLE_SLAVE;
+            if (connection->address_type == BD_ADDR_TYPE_ACL){
+                log_info("sending hci_accept_connection_request, remote eSCO %u", connection->remote_supported_feature_eSCO);
+                connection->state = ACCEPTED_CONNECTION_REQUEST;
+                hci_send_cmd(&hci_accept_connection_request, connection->address, hci_stack->master_slave_policy);
+            } 
+            return true;
 #endif
 
 #ifdef ENABLE_BLE
 #ifdef ENABLE_LE_CENTRAL
-            case SEND_CANCEL_CONNECTION:
-                connection->state = SENT_CANCEL_CONNECTION;
-                hci_send_cmd(&hci_le_create_connection_cancel);
-                return;
+        case SEND_CANCEL_CONNECTION:
+            connection->state = SENT_CANCEL_CONNECTION;
+            hci_send_cmd(&hci_le_create_connection_cancel);
+            return true;
 #endif
 #endif                
-            case SEND_DISCONNECT:
-                connection->state = SENT_DISCONNECT;
-                hci_send_cmd(&hci_disconnect, connection->con_handle, 0x13); // remote closed connection
-                return;
-                
-            default:
-                break;
-        }
-        
-        // no further commands if connection is about to get shut down
-        if (connection->state == SENT_DISCONNECT) continue;
+        case SEND_DISCONNECT:
+            connection->state = SENT_DISCONNECT;
+            hci_send_cmd(&hci_disconnect, connection->con_handle, 0x13); // remote closed connection
+            return true;
+            
+        default:
+            break;
+    }
+    
+    // no further commands if connection is about to get shut down
+    if (connection->state == SENT_DISCONNECT) return false;
 
-        if (connection->authentication_flags & READ_RSSI){
-            connectionClearAuthenticationFlags(connection, READ_RSSI);
-            hci_send_cmd(&hci_read_rssi, connection->con_handle);
-            return;
-        }
+    if (connection->authentication_flags & READ_RSSI){
+        connectionClearAuthenticationFlags(connection, READ_RSSI);
+        hci_send_cmd(&hci_read_rssi, connection->con_handle);
+        return true;
+    }
 
 #ifdef ENABLE_CLASSIC
 
-        if (connection->authentication_flags & WRITE_SUPERVISION_TIMEOUT){
-            connectionClearAuthenticationFlags(connection, WRITE_SUPERVISION_TIMEOUT);
-            hci_send_cmd(&hci_write_link_supervision_timeout, connection->con_handle, hci_stack->link_supervision_timeout);
-            return;
-        }
+    if (connection->authentication_flags & WRITE_SUPERVISION_TIMEOUT){
+        connectionClearAuthenticationFlags(connection, WRITE_SUPERVISION_TIMEOUT);
+        hci_send_cmd(&hci_write_link_supervision_timeout, connection->con_handle, hci_stack->link_supervision_timeout);
+        return true;
+    }
 
-        if (connection->authentication_flags & HANDLE_LINK_KEY_REQUEST){
-            log_info("responding to link key request");
-            connectionClearAuthenticationFlags(connection, HANDLE_LINK_KEY_REQUEST);
-            link_key_t link_key;
-            link_key_type_t link_key_type;
-            if ( hci_stack->link_key_db
-              && hci_stack->link_key_db->get_link_key(connection->address, link_key, &link_key_type)
-              && (gap_security_level_for_link_key_type(link_key_type) >= connection->requested_security_level)){
-               connection->link_key_type = link_key_type;
-               hci_send_cmd(&hci_link_key_request_reply, connection->address, &link_key);
-            } else {
-               hci_send_cmd(&hci_link_key_request_negative_reply, connection->address);
-            }
-            return;
+    if (connection->authentication_flags & HANDLE_LINK_KEY_REQUEST){
+        log_info("responding to link key request");
+        connectionClearAuthenticationFlags(connection, HANDLE_LINK_KEY_REQUEST);
+        link_key_t link_key;
+        link_key_type_t link_key_type;
+        if ( hci_stack->link_key_db
+          && hci_stack->link_key_db->get_link_key(connection->address, link_key, &link_key_type)
+          && (gap_security_level_for_link_key_type(link_key_type) >= connection->requested_security_level)){
+           connection->link_key_type = link_key_type;
+           hci_send_cmd(&hci_link_key_request_reply, connection->address, &link_key);
+        } else {
+           hci_send_cmd(&hci_link_key_request_negative_reply, connection->address);
         }
+        return true;
+    }
 
-        if (connection->authentication_flags & DENY_PIN_CODE_REQUEST){
-            log_info("denying to pin request");
-            connectionClearAuthenticationFlags(connection, DENY_PIN_CODE_REQUEST);
-            hci_send_cmd(&hci_pin_code_request_negative_reply, connection->address);
-            return;
-        }
+    if (connection->authentication_flags & DENY_PIN_CODE_REQUEST){
+        log_info("denying to pin request");
+        connectionClearAuthenticationFlags(connection, DENY_PIN_CODE_REQUEST);
+        hci_send_cmd(&hci_pin_code_request_negative_reply, connection->address);
+        return true;
+    }
 
-        if (connection->authentication_flags & SEND_IO_CAPABILITIES_REPLY){
-            connectionClearAuthenticationFlags(connection, SEND_IO_CAPABILITIES_REPLY);
-            log_info("IO Capability Request received, stack bondable %u, io cap %u", hci_stack->bondable, hci_stack->ssp_io_capability);
-            if (hci_stack->bondable && (hci_stack->ssp_io_capability != SSP_IO_CAPABILITY_UNKNOWN)){
-                // tweak authentication requirements
-                uint8_t authreq = hci_stack->ssp_authentication_requirement;
-                if (connection->bonding_flags & BONDING_DEDICATED){
-                    authreq = SSP_IO_AUTHREQ_MITM_PROTECTION_NOT_REQUIRED_DEDICATED_BONDING;
-                }
-                if (gap_mitm_protection_required_for_security_level(connection->requested_security_level)){
-                    authreq |= 1;
-                } 
-                hci_send_cmd(&hci_io_capability_request_reply, &connection->address, hci_stack->ssp_io_capability, NULL, authreq);
-            } else {
-                hci_send_cmd(&hci_io_capability_request_negative_reply, &connection->address, ERROR_CODE_PAIRING_NOT_ALLOWED);
+    if (connection->authentication_flags & SEND_IO_CAPABILITIES_REPLY){
+        connectionClearAuthenticationFlags(connection, SEND_IO_CAPABILITIES_REPLY);
+        log_info("IO Capability Request received, stack bondable %u, io cap %u", hci_stack->bondable, hci_stack->ssp_io_capability);
+        if (hci_stack->bondable && (hci_stack->ssp_io_capability != SSP_IO_CAPABILITY_UNKNOWN)){
+            // tweak authentication requirements
+            uint8_t authreq = hci_stack->ssp_authentication_requirement;
+            if (connection->bonding_flags & BONDING_DEDICATED){
+                authreq = SSP_IO_AUTHREQ_MITM_PROTECTION_NOT_REQUIRED_DEDICATED_BONDING;
             }
-            return;
-        }
-        
-        if (connection->authentication_flags & SEND_USER_CONFIRM_REPLY){
-            connectionClearAuthenticationFlags(connection, SEND_USER_CONFIRM_REPLY);
-            hci_send_cmd(&hci_user_confirmation_request_reply, &connection->address);
-            return;
+            if (gap_mitm_protection_required_for_security_level(connection->requested_security_level)){
+                authreq |= 1;
+            } 
+            hci_send_cmd(&hci_io_capability_request_reply, &connection->address, hci_stack->ssp_io_capability, NULL, authreq);
+        } else {
+            hci_send_cmd(&hci_io_capability_request_negative_reply, &connection->address, ERROR_CODE_PAIRING_NOT_ALLOWED);
         }
+        return true;
+    }
+    
+    if (connection->authentication_flags & SEND_USER_CONFIRM_REPLY){
+        connectionClearAuthenticationFlags(connection, SEND_USER_CONFIRM_REPLY);
+        hci_send_cmd(&hci_user_confirmation_request_reply, &connection->address);
+        return true;
+    }
 
-        if (connection->authentication_flags & SEND_USER_PASSKEY_REPLY){
-            connectionClearAuthenticationFlags(connection, SEND_USER_PASSKEY_REPLY);
-            hci_send_cmd(&hci_user_passkey_request_reply, &connection->address, 000000);
-            return;
-        }
+    if (connection->authentication_flags & SEND_USER_PASSKEY_REPLY){
+        connectionClearAuthenticationFlags(connection, SEND_USER_PASSKEY_REPLY);
+        hci_send_cmd(&hci_user_passkey_request_reply, &connection->address, 000000);
+        return true;
+    }
 
-        if (connection->bonding_flags & BONDING_REQUEST_REMOTE_FEATURES){
-            connection->bonding_flags &= ~BONDING_REQUEST_REMOTE_FEATURES;
-            hci_send_cmd(&hci_read_remote_supported_features_command, connection->con_handle);
-            return;
-        }
+    if (connection->bonding_flags & BONDING_REQUEST_REMOTE_FEATURES){
+        connection->bonding_flags &= ~BONDING_REQUEST_REMOTE_FEATURES;
+        hci_send_cmd(&hci_read_remote_supported_features_command, connection->con_handle);
+        return true;
+    }
 
-        if (connection->bonding_flags & BONDING_DISCONNECT_DEDICATED_DONE){
-            connection->bonding_flags &= ~BONDING_DISCONNECT_DEDICATED_DONE;
-            connection->bonding_flags |= BONDING_EMIT_COMPLETE_ON_DISCONNECT;
-            hci_send_cmd(&hci_disconnect, connection->con_handle, 0x13);  // authentication done
-            return;
-        }
+    if (connection->bonding_flags & BONDING_DISCONNECT_DEDICATED_DONE){
+        connection->bonding_flags &= ~BONDING_DISCONNECT_DEDICATED_DONE;
+        connection->bonding_flags |= BONDING_EMIT_COMPLETE_ON_DISCONNECT;
+        hci_send_cmd(&hci_disconnect, connection->con_handle, 0x13);  // authentication done
+        return true;
+    }
 
-        if (connection->bonding_flags & BONDING_SEND_AUTHENTICATE_REQUEST){
-            connection->bonding_flags &= ~BONDING_SEND_AUTHENTICATE_REQUEST;
-            hci_send_cmd(&hci_authentication_requested, connection->con_handle);
-            return;
-        }
+    if (connection->bonding_flags & BONDING_SEND_AUTHENTICATE_REQUEST){
+        connection->bonding_flags &= ~BONDING_SEND_AUTHENTICATE_REQUEST;
+        hci_send_cmd(&hci_authentication_requested, connection->con_handle);
+        return true;
+    }
 
-        if (connection->bonding_flags & BONDING_SEND_ENCRYPTION_REQUEST){
-            connection->bonding_flags &= ~BONDING_SEND_ENCRYPTION_REQUEST;
-            hci_send_cmd(&hci_set_connection_encryption, connection->con_handle, 1);
-            return;
-        }
-        if (connection->bonding_flags & BONDING_SEND_READ_ENCRYPTION_KEY_SIZE){
-            connection->bonding_flags &= ~BONDING_SEND_READ_ENCRYPTION_KEY_SIZE;
-            hci_send_cmd(&hci_read_encryption_key_size, connection->con_handle, 1);
-            return;
-        }
+    if (connection->bonding_flags & BONDING_SEND_ENCRYPTION_REQUEST){
+        connection->bonding_flags &= ~BONDING_SEND_ENCRYPTION_REQUEST;
+        hci_send_cmd(&hci_set_connection_encryption, connection->con_handle, 1);
+        return true;
+    }
+    if (connection->bonding_flags & BONDING_SEND_READ_ENCRYPTION_KEY_SIZE){
+        connection->bonding_flags &= ~BONDING_SEND_READ_ENCRYPTION_KEY_SIZE;
+        hci_send_cmd(&hci_read_encryption_key_size, connection->con_handle, 1);
+        return true;
+    }
 #endif
 
-        if (connection->bonding_flags & BONDING_DISCONNECT_SECURITY_BLOCK){
-            connection->bonding_flags &= ~BONDING_DISCONNECT_SECURITY_BLOCK;
-            hci_send_cmd(&hci_disconnect, connection->con_handle, 0x0005);  // authentication failure
-            return;
-        }
+    if (connection->bonding_flags & BONDING_DISCONNECT_SECURITY_BLOCK){
+        connection->bonding_flags &= ~BONDING_DISCONNECT_SECURITY_BLOCK;
+        hci_send_cmd(&hci_disconnect, connection->con_handle, 0x0005);  // authentication failure
+        return true;
+    }
 
 #ifdef ENABLE_CLASSIC
-        uint16_t sniff_min_interval;
-        switch (connection->sniff_min_interval){
-            case 0:
-                break;
-            case 0xffff:
-                connection->sniff_min_interval = 0;
-                hci_send_cmd(&hci_exit_sniff_mode, connection->con_handle);
-                return;
-            default:
-                sniff_min_interval = connection->sniff_min_interval;
-                connection->sniff_min_interval = 0;
-                hci_send_cmd(&hci_sniff_mode, connection->con_handle, connection->sniff_max_interval, sniff_min_interval, connection->sniff_attempt, connection->sniff_timeout);
-                return;
-        }
+    uint16_t sniff_min_interval;
+    switch (connection->sniff_min_interval){
+        case 0:
+            break;
+        case 0xffff:
+            connection->sniff_min_interval = 0;
+            hci_send_cmd(&hci_exit_sniff_mode, connection->con_handle);
+            return true;
+        default:
+            sniff_min_interval = connection->sniff_min_interval;
+            connection->sniff_min_interval = 0;
+            hci_send_cmd(&hci_sniff_mode, connection->con_handle, connection->sniff_max_interval, sniff_min_interval, connection->sniff_attempt, connection->sniff_timeout);
+            return true;
+    }
 #endif
 
 #ifdef ENABLE_BLE
-        switch (connection->le_con_parameter_update_state){
-            // response to L2CAP CON PARAMETER UPDATE REQUEST
-            case CON_PARAMETER_UPDATE_CHANGE_HCI_CON_PARAMETERS:
-                connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE; 
-                hci_send_cmd(&hci_le_connection_update, connection->con_handle, connection->le_conn_interval_min,
-                    connection->le_conn_interval_max, connection->le_conn_latency, connection->le_supervision_timeout,
-                    0x0000, 0xffff);
-                return;
-            case CON_PARAMETER_UPDATE_REPLY:
-                connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE;
-                hci_send_cmd(&hci_le_remote_connection_parameter_request_reply, connection->con_handle, connection->le_conn_interval_min,
-                    connection->le_conn_interval_max, connection->le_conn_latency, connection->le_supervision_timeout,
-                    0x0000, 0xffff);
-                return;
-            case CON_PARAMETER_UPDATE_NEGATIVE_REPLY:
-                connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE;
-                hci_send_cmd(&hci_le_remote_connection_parameter_request_negative_reply, ERROR_CODE_UNSUPPORTED_LMP_PARAMETER_VALUE_UNSUPPORTED_LL_PARAMETER_VALUE);
-                return;
-            default:
-                break;
+    switch (connection->le_con_parameter_update_state){
+        // response to L2CAP CON PARAMETER UPDATE REQUEST
+        case CON_PARAMETER_UPDATE_CHANGE_HCI_CON_PARAMETERS:
+            connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE; 
+            hci_send_cmd(&hci_le_connection_update, connection->con_handle, connection->le_conn_interval_min,
+                connection->le_conn_interval_max, connection->le_conn_latency, connection->le_supervision_timeout,
+                0x0000, 0xffff);
+            return true;
+        case CON_PARAMETER_UPDATE_REPLY:
+            connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE;
+            hci_send_cmd(&hci_le_remote_connection_parameter_request_reply, connection->con_handle, connection->le_conn_interval_min,
+                connection->le_conn_interval_max, connection->le_conn_latency, connection->le_supervision_timeout,
+                0x0000, 0xffff);
+            return true;
+        case CON_PARAMETER_UPDATE_NEGATIVE_REPLY:
+            connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE;
+            hci_send_cmd(&hci_le_remote_connection_parameter_request_negative_reply, ERROR_CODE_UNSUPPORTED_LMP_PARAMETER_VALUE_UNSUPPORTED_LL_PARAMETER_VALUE);
+            return true;
+        default:
+            break;
+    }
+    if (connection->le_phy_update_all_phys != 0xff){
+        uint8_t all_phys = connection->le_phy_update_all_phys;
+        connection->le_phy_update_all_phys = 0xff;
+        hci_send_cmd(&hci_le_set_phy, connection->con_handle, all_phys, connection->le_phy_update_tx_phys, connection->le_phy_update_rx_phys, connection->le_phy_update_phy_options);
+        return true;
+    }
+#endif
+    return false;
+}
+
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+// commands from the same queue are sent one after the other, returns false if none can be sent now
+static bool hci_command_queue_select(hci_command_queue_t queue, hci_con_handle_t con_handle){
+    if (!hci_can_send_command_packet_now()) return false;
+    if (hci_command_queue_busy(queue, con_handle)) return false;
+    hci_stack->command_queue = queue;
+    hci_stack->command_queue_con_handle = con_handle;
+    return true;
+}
+
+// visit all queues until the controller doesn't accept further commands or no queue has a command ready
+static bool hci_run_general_pending_commands_pipelined(void){
+    bool command_sent = false;
+    uint8_t num_commands_in_flight;
+    do {
+        num_commands_in_flight = hci_stack->num_commands_in_flight;
+#ifdef ENABLE_CLASSIC
+        if (hci_command_queue_select(HCI_COMMAND_QUEUE_GAP_CLASSIC, HCI_CON_HANDLE_INVALID)){
+            (void) hci_run_general_gap_classic();
         }
-        if (connection->le_phy_update_all_phys != 0xff){
-            uint8_t all_phys = connection->le_phy_update_all_phys;
-            connection->le_phy_update_all_phys = 0xff;
-            hci_send_cmd(&hci_le_set_phy, connection->con_handle, all_phys, connection->le_phy_update_tx_phys, connection->le_phy_update_rx_phys, connection->le_phy_update_phy_options);
-            return;
+#endif
+#ifdef ENABLE_BLE
+        if (hci_command_queue_select(HCI_COMMAND_QUEUE_GAP_LE, HCI_CON_HANDLE_INVALID)){
+            (void) hci_run_general_gap_le();
         }
 #endif
+        btstack_linked_item_t * it;
+        for (it = (btstack_linked_item_t *) hci_stack->connections; it != NULL; it = it->next){
+            hci_connection_t * connection = (hci_connection_t *) it;
+            if (hci_command_queue_select(HCI_COMMAND_QUEUE_CONNECTION, connection->con_handle)){
+                (void) hci_run_general_pending_commands_for_connection(connection);
+            }
+        }
+        hci_stack->command_queue = HCI_COMMAND_QUEUE_OTHER;
+        if (hci_stack->num_commands_in_flight > num_commands_in_flight){
+            command_sent = true;
+        }
+    } while (hci_stack->num_commands_in_flight > num_commands_in_flight);
+    return command_sent;
+}
+#else
+static bool hci_run_general_pending_commands(void){
+    btstack_linked_item_t * it;
+    for (it = (btstack_linked_item_t *) hci_stack->connections; it != NULL; it = it->next){
+        hci_connection_t * connection = (hci_connection_t *) it;
+        if (hci_run_general_pending_commands_for_connection(connection)) return true;
     }
+    return false;
+}
+#endif
+
+static void hci_run(void){
     
+    // log_info("hci_run: entered");
+
+    // send continuation fragments first, as they block the prepared packet buffer
+    if (hci_stack->acl_fragmentation_total_size > 0) {
+        hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(hci_stack->hci_packet_buffer);
+        hci_connection_t *connection = hci_connection_for_handle(con_handle);
+        if (connection) {
+            if (hci_can_send_prepared_acl_packet_now(con_handle)){
+                hci_send_acl_packet_fragments(connection);
+                return;
+            }
+        } else {
+            // connection gone -> discard further fragments
+            log_info("hci_run: fragmented ACL packet no connection -> discard fragment");
+            hci_stack->acl_fragmentation_total_size = 0;
+            hci_stack->acl_fragmentation_pos = 0;
+        }
+    }
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    // send host num completed packets next as they don't require num_cmd_packets > 0
+    if (!hci_can_send_comand_packet_transport()) return;
+    if (hci_stack->host_completed_packets){
+        hci_host_num_completed_packets();        
+        return;
+    }
+#endif
+
+    if (!hci_can_send_command_packet_now()) return;
+
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+    if (hci_run_general_pending_commands_pipelined()) return;
+#else
+    // global/non-connection oriented commands
+#ifdef ENABLE_CLASSIC
+    if (hci_run_general_gap_classic()) return;
+#endif
+#ifdef ENABLE_BLE
+    if (hci_run_general_gap_le()) return;
+#endif
+
+    // send pending HCI commands
+    if (hci_run_general_pending_commands()) return;
+#endif
+
     hci_connection_t * connection;
     switch (hci_stack->state){
         case HCI_STATE_INITIALIZING:
@@ -4022,16 +5177,35 @@ int hci_send_cmd_packet(uint8_t *packet, int size){
     if (IS_COMMAND(packet, hci_le_set_random_address)){
         hci_stack->le_random_address_set = 1;
         reverse_bd_addr(&packet[3], hci_stack->le_random_address);
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+        hci_le_advertising_sets_random_address_changed();
+#endif
     }
 #ifdef ENABLE_LE_PERIPHERAL
     if (IS_COMMAND(packet, hci_le_set_advertise_enable)){
         hci_stack->le_advertisements_active = packet[3];
     }
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    // advertising set state is updated on Command Complete, only one advertising set per command
+    if (IS_COMMAND(packet, hci_le_set_extended_advertising_parameters)){
+        hci_stack->le_advertising_set_command_handle = packet[3];
+    }
+    if (IS_COMMAND(packet, hci_le_set_extended_advertising_enable)){
+        hci_stack->le_advertising_set_command_enable = packet[3];
+        hci_stack->le_advertising_set_command_handle = packet[5];
+    }
+#endif
 #endif
 #ifdef ENABLE_LE_CENTRAL
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    if (IS_COMMAND(packet, hci_le_create_connection) || IS_COMMAND(packet, hci_le_extended_create_connection)){
+        // white list used?
+        uint8_t initiator_filter_policy = IS_COMMAND(packet, hci_le_create_connection) ? packet[7] : packet[3];
+#else
     if (IS_COMMAND(packet, hci_le_create_connection)){
         // white list used?
         uint8_t initiator_filter_policy = packet[7];
+#endif
         switch (initiator_filter_policy){
             case 0:
                 // whitelist not used
@@ -4052,6 +5226,9 @@ int hci_send_cmd_packet(uint8_t *packet, int size){
 #endif
 
     hci_stack->num_cmd_packets--;
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+    hci_command_in_flight_add(little_endian_read_16(packet, 0));
+#endif
 
     hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, packet, size);
     return hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
@@ -4586,9 +5763,33 @@ void gap_start_scan(void){
 
 void gap_stop_scan(void){
     hci_stack->le_scanning_enabled = 0;
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+    hci_le_advertising_reports_flush();
+#endif
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    // drop partially reassembled extended advertising report
+    hci_stack->le_extended_advertising_report_state = LE_EXTENDED_ADVERTISING_REPORT_IDLE;
+#endif
     hci_run();
 }
 
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+void gap_le_register_advertising_reports_handler(gap_le_advertising_reports_handler_t handler){
+    // deliver reports collected for previous handler
+    hci_le_advertising_reports_flush();
+    hci_stack->le_advertising_reports_handler = handler;
+}
+
+void gap_le_set_advertising_reports_batch_delay(uint16_t max_delay_ms){
+    hci_stack->le_advertising_reports_batch_delay_ms = max_delay_ms;
+}
+
+void gap_le_set_advertising_report_dedup_ttl(uint32_t ttl_ms){
+    hci_stack->le_advertising_report_dedup_ttl_ms = ttl_ms;
+    memset(hci_stack->le_advertising_report_dedup_cache, 0, sizeof(hci_stack->le_advertising_report_dedup_cache));
+}
+#endif
+
 void gap_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window){
     hci_stack->le_scan_type     = scan_type;
     hci_stack->le_scan_interval = scan_interval;
@@ -4596,6 +5797,22 @@ void gap_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval, uint16_t
     hci_run();
 }
 
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+uint8_t gap_set_scan_phys(uint8_t phys){
+    // LE 1M and/or LE Coded
+    if ((phys == 0) || ((phys & ~0x05) != 0)) return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+    hci_stack->le_scan_phys = phys;
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_set_connection_phys(uint8_t phys){
+    // LE 1M and/or LE Coded for scanning, LE 2M only in addition
+    if (((phys & 0x05) == 0) || ((phys & ~0x07) != 0)) return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+    hci_stack->le_connection_phys = phys;
+    return ERROR_CODE_SUCCESS;
+}
+#endif
+
 uint8_t gap_connect(bd_addr_t addr, bd_addr_type_t addr_type){
     hci_connection_t * conn = hci_connection_for_bd_addr_and_type(addr, addr_type);
     if (!conn){
@@ -4819,6 +6036,131 @@ void gap_advertisements_enable(int enabled){
     hci_run();
 }
 
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+// limit is not known before first power on
+static bool hci_le_advertising_data_length_exceeded(uint16_t data_length){
+    if (hci_stack->le_maximum_advertising_data_length == 0) return false;
+    return data_length > hci_stack->le_maximum_advertising_data_length;
+}
+
+uint8_t gap_extended_advertising_setup(le_advertising_set_t * storage, const le_extended_advertising_parameters_t * advertising_parameters, uint8_t * out_advertising_handle){
+    // find free advertising handle, handle 0 is used by gap_advertisements_* API
+    uint8_t advertising_handle;
+    for (advertising_handle = 1; advertising_handle <= LE_EXTENDED_ADVERTISING_MAX_HANDLE; advertising_handle++){
+        if (hci_advertising_set_for_handle(advertising_handle) == NULL) break;
+    }
+    if (advertising_handle > LE_EXTENDED_ADVERTISING_MAX_HANDLE){
+        return ERROR_CODE_LIMIT_REACHED;
+    }
+    // one advertising set of the Controller is reserved for handle 0, limit is not known before first power on
+    if (hci_stack->le_number_of_supported_advertising_sets > 0){
+        int num_sets = btstack_linked_list_count(&hci_stack->le_advertising_sets);
+        if ((num_sets + 1) >= hci_stack->le_number_of_supported_advertising_sets){
+            return ERROR_CODE_LIMIT_REACHED;
+        }
+    }
+
+    memset(storage, 0, sizeof(le_advertising_set_t));
+    storage->advertising_handle = advertising_handle;
+    storage->params = *advertising_parameters;
+    storage->tasks = LE_ADVERTISEMENT_TASKS_SET_PARAMS;
+    btstack_linked_list_add_tail(&hci_stack->le_advertising_sets, (btstack_linked_item_t *) storage);
+    *out_advertising_handle = advertising_handle;
+
+    hci_run();
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_extended_advertising_set_params(uint8_t advertising_handle, const le_extended_advertising_parameters_t * advertising_parameters){
+    le_advertising_set_t * advertising_set = hci_advertising_set_for_handle(advertising_handle);
+    if (advertising_set == NULL) return ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER;
+    if (advertising_set->state & LE_ADVERTISEMENT_STATE_ACTIVE) return ERROR_CODE_COMMAND_DISALLOWED;
+
+    advertising_set->params = *advertising_parameters;
+    advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_SET_PARAMS;
+
+    hci_run();
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_extended_advertising_set_adv_data(uint8_t advertising_handle, uint16_t advertising_data_length, const uint8_t * advertising_data){
+    le_advertising_set_t * advertising_set = hci_advertising_set_for_handle(advertising_handle);
+    if (advertising_set == NULL) return ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER;
+    if (hci_le_advertising_data_length_exceeded(advertising_data_length)) return ERROR_CODE_MEMORY_CAPACITY_EXCEEDED;
+    // Controller rejects fragmented data while advertising is enabled
+    if ((advertising_set->state & LE_ADVERTISEMENT_STATE_ACTIVE) && (advertising_data_length > LE_EXTENDED_ADVERTISING_DATA_FRAGMENT_SIZE)){
+        return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+
+    advertising_set->adv_data = advertising_data;
+    advertising_set->adv_data_len = advertising_data_length;
+    advertising_set->adv_data_pos = 0;
+    advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_SET_ADV_DATA;
+
+    hci_run();
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_extended_advertising_set_scan_response_data(uint8_t advertising_handle, uint16_t scan_response_data_length, const uint8_t * scan_response_data){
+    le_advertising_set_t * advertising_set = hci_advertising_set_for_handle(advertising_handle);
+    if (advertising_set == NULL) return ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER;
+    if (hci_le_advertising_data_length_exceeded(scan_response_data_length)) return ERROR_CODE_MEMORY_CAPACITY_EXCEEDED;
+    // Controller rejects fragmented data while advertising is enabled
+    if ((advertising_set->state & LE_ADVERTISEMENT_STATE_ACTIVE) && (scan_response_data_length > LE_EXTENDED_ADVERTISING_DATA_FRAGMENT_SIZE)){
+        return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+
+    advertising_set->scan_data = scan_response_data;
+    advertising_set->scan_data_len = scan_response_data_length;
+    advertising_set->scan_data_pos = 0;
+    advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA;
+
+    hci_run();
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_extended_advertising_start(uint8_t advertising_handle, uint16_t timeout, uint8_t num_extended_advertising_events){
+    le_advertising_set_t * advertising_set = hci_advertising_set_for_handle(advertising_handle);
+    if (advertising_set == NULL) return ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER;
+
+    advertising_set->enable_timeout = timeout;
+    advertising_set->enable_max_events = num_extended_advertising_events;
+    advertising_set->state |= LE_ADVERTISEMENT_STATE_ENABLED;
+    advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_ENABLE;
+
+    hci_run();
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_extended_advertising_stop(uint8_t advertising_handle){
+    le_advertising_set_t * advertising_set = hci_advertising_set_for_handle(advertising_handle);
+    if (advertising_set == NULL) return ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER;
+
+    advertising_set->state &= ~LE_ADVERTISEMENT_STATE_ENABLED;
+    advertising_set->tasks &= ~LE_ADVERTISEMENT_TASKS_ENABLE;
+    if (advertising_set->state & LE_ADVERTISEMENT_STATE_ACTIVE){
+        advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_DISABLE;
+    }
+
+    hci_run();
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_extended_advertising_remove(uint8_t advertising_handle){
+    le_advertising_set_t * advertising_set = hci_advertising_set_for_handle(advertising_handle);
+    if (advertising_set == NULL) return ERROR_CODE_UNKNOWN_ADVERTISING_IDENTIFIER;
+
+    advertising_set->state &= ~LE_ADVERTISEMENT_STATE_ENABLED;
+    advertising_set->tasks = LE_ADVERTISEMENT_TASKS_REMOVE_SET;
+    if (advertising_set->state & LE_ADVERTISEMENT_STATE_ACTIVE){
+        advertising_set->tasks |= LE_ADVERTISEMENT_TASKS_DISABLE;
+    }
+
+    hci_run();
+    return ERROR_CODE_SUCCESS;
+}
+#endif
+
 #endif
 
 void hci_le_set_own_address_type(uint8_t own_address_type){
@@ -5380,6 +6722,10 @@ void hci_free_connections_fuzz(void){
     while (btstack_linked_list_iterator_has_next(&it)){
         hci_connection_t * con = (hci_connection_t*) btstack_linked_list_iterator_next(&it);
         btstack_linked_list_iterator_remove(&it);
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+        con->acl_recombination_reserved = 0;
+        hci_acl_recombination_done(con);
+#endif
         btstack_memory_hci_connection_free(con);
     }
 }
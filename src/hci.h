@@ -56,6 +56,7 @@
 #include "gap.h"
 #include "hci_transport.h"
 #include "btstack_run_loop.h"
+#include "btstack_tlv.h"
 
 #ifdef ENABLE_BLE
 #include "ble/att_db.h"
@@ -72,9 +73,12 @@ extern "C" {
 // packet buffer sizes
 
 // Max HCI Command LE payload size:
+// 255 from LE Set Extended Advertising Data command
 // 64 from LE Generate DHKey command
 // 32 from LE Encrypt command
-#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(ENABLE_MICRO_ECC_FOR_LE_SECURE_CONNECTIONS)
+#if defined(ENABLE_LE_EXTENDED_ADVERTISING)
+#define HCI_CMD_PAYLOAD_SIZE_LE 255
+#elif defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(ENABLE_MICRO_ECC_FOR_LE_SECURE_CONNECTIONS)
 #define HCI_CMD_PAYLOAD_SIZE_LE 64
 #else
 #define HCI_CMD_PAYLOAD_SIZE_LE 32
@@ -470,6 +474,126 @@ typedef struct {
 } l2cap_state_t;
 #endif
 
+// traffic classes for outgoing ACL data, lower value has higher priority
+typedef enum {
+    HCI_ACL_TX_CLASS_AUDIO = 0,
+    HCI_ACL_TX_CLASS_CONTROL,
+    HCI_ACL_TX_CLASS_BULK,
+    HCI_ACL_TX_CLASS_NUM
+} hci_acl_tx_class_t;
+
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+typedef struct {
+    uint16_t queue_depth;           // number of L2CAP channels waiting to send
+    uint32_t wait_time_ms;          // time since connection is waiting to send, 0 if not waiting
+    uint32_t max_wait_time_ms;      // max wait time since connection was established
+} hci_acl_tx_stats_t;
+#endif
+
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+// max number of HCI Commands without Command Complete or Command Status event
+#ifndef HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT
+#define HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT 4
+#endif
+
+// commands from the same queue are sent one after the other, different queues can have commands in flight at the same time
+typedef enum {
+    HCI_COMMAND_QUEUE_OTHER = 0,        // sent by other layers or the application via hci_send_cmd
+    HCI_COMMAND_QUEUE_GAP_CLASSIC,
+    HCI_COMMAND_QUEUE_GAP_LE,
+    HCI_COMMAND_QUEUE_CONNECTION,       // one queue per connection handle
+} hci_command_queue_t;
+
+typedef struct {
+    uint16_t            opcode;
+    hci_command_queue_t queue;
+    hci_con_handle_t    con_handle;
+} hci_command_in_flight_t;
+#endif
+
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+// max number of LE Advertising Reports delivered in one batch
+#ifndef LE_ADVERTISING_REPORT_BATCH_SIZE
+#define LE_ADVERTISING_REPORT_BATCH_SIZE 8
+#endif
+
+// number of recent LE Advertising Reports tracked to suppress duplicates
+#ifndef LE_ADVERTISING_REPORT_DEDUP_CACHE_SIZE
+#define LE_ADVERTISING_REPORT_DEDUP_CACHE_SIZE 16
+#endif
+
+typedef struct {
+    bd_addr_t      address;
+    bd_addr_type_t address_type;
+    uint8_t        valid;
+    uint32_t       hash;            // event type and data
+    uint32_t       reported_ms;     // last time report was delivered
+    uint32_t       seen_ms;         // last time report was received, for LRU replacement
+} le_advertising_report_dedup_entry_t;
+#endif
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+// max data of chained LE Extended Advertising Reports reassembled into one GAP_EVENT_EXTENDED_ADVERTISING_REPORT,
+// larger data is reported as truncated
+#ifndef LE_EXTENDED_ADVERTISING_REPORT_DATA_SIZE
+#define LE_EXTENDED_ADVERTISING_REPORT_DATA_SIZE 1650
+#endif
+
+// GAP_EVENT_EXTENDED_ADVERTISING_REPORT without data
+#define LE_EXTENDED_ADVERTISING_REPORT_HEADER_SIZE 27
+
+// max data in LE Set Extended Advertising Data and LE Set Extended Scan Response Data
+#define LE_EXTENDED_ADVERTISING_DATA_FRAGMENT_SIZE 251
+
+// advertising handle used for gap_advertisements_* API, advertising sets start at 1
+#define LE_EXTENDED_ADVERTISING_LEGACY_HANDLE 0
+#define LE_EXTENDED_ADVERTISING_MAX_HANDLE    0xEF
+
+typedef enum {
+    LE_EXTENDED_ADVERTISING_REPORT_IDLE = 0,
+    LE_EXTENDED_ADVERTISING_REPORT_REASSEMBLING,
+    LE_EXTENDED_ADVERTISING_REPORT_DISCARDING,     // remaining fragments of truncated report
+} le_extended_advertising_report_state_t;
+#endif
+
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+// controller capabilities stored in TLV, only used if Local Version Information, BD_ADDR, host configuration and init script match
+typedef struct {
+    // controller identity
+    uint8_t   hci_version;
+    uint16_t  hci_revision;
+    uint8_t   lmp_version;
+    uint16_t  manufacturer;
+    uint16_t  lmp_subversion;
+    bd_addr_t bd_addr;
+    // host configuration and init script
+    uint16_t  acl_payload_size;
+    uint16_t  host_configuration;
+    uint32_t  init_script_identity;
+    // results of read commands during init
+    uint8_t   local_supported_commands;
+    uint8_t   local_supported_features[8];
+    uint16_t  acl_data_packet_length;
+    uint8_t   acl_packets_total_num;
+    uint8_t   sco_data_packet_length;
+    uint8_t   sco_packets_total_num;
+    uint16_t  le_data_packets_length;
+    uint8_t   le_acl_packets_total_num;
+    uint16_t  le_supported_max_tx_octets;
+    uint16_t  le_supported_max_tx_time;
+    uint8_t   le_whitelist_capacity;
+    uint8_t   le_number_of_supported_advertising_sets;
+    uint16_t  le_maximum_advertising_data_length;
+} hci_controller_cache_t;
+#endif
+
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+// ACL packet recombination buffer - PRE_BUFFER + ACL Header + ACL payload
+typedef struct {
+    uint8_t data[HCI_INCOMING_PRE_BUFFER_SIZE + 4 + HCI_ACL_BUFFER_SIZE];
+} hci_acl_recombination_buffer_t;
+#endif
+
 //
 typedef struct {
     // linked list - assert: first field
@@ -535,8 +659,16 @@ typedef struct {
     // timeout in system ticks (HAVE_EMBEDDED_TICK) or milliseconds (HAVE_EMBEDDED_TIME_MS)
     uint32_t timestamp;
 
+#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL
+    // ACL packet recombination - buffer from pool while fragmented packet is received or if reserved
+    hci_acl_recombination_buffer_t * acl_recombination_buffer;
+    uint8_t  acl_recombination_reserved;
+    // first fragment was dropped as no buffer was available, drop continuation fragments
+    uint8_t  acl_recombination_dropping;
+#else
     // ACL packet recombination - PRE_BUFFER + ACL Header + ACL payload
     uint8_t  acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 4 + HCI_ACL_BUFFER_SIZE];
+#endif
     uint16_t acl_recombination_pos;
     uint16_t acl_recombination_length;
     
@@ -544,6 +676,17 @@ typedef struct {
     // number packets sent to controller
     uint8_t num_packets_sent;
 
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+    // ACL TX scheduler: deficit in ACL packets, deficit round, channel selected by scheduler sending, channels waiting to send, and wait time
+    int16_t  acl_tx_deficit;
+    uint16_t acl_tx_round;
+    uint8_t  acl_tx_scheduled;
+    uint16_t acl_tx_queue_depth;
+    uint8_t  acl_tx_waiting;
+    uint32_t acl_tx_wait_start_ms;
+    uint32_t acl_tx_max_wait_ms;
+#endif
+
 #ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
     uint8_t num_packets_completed;
 #endif
@@ -614,6 +757,11 @@ typedef enum hci_init_state{
     HCI_INIT_READ_BD_ADDR,
     HCI_INIT_W4_READ_BD_ADDR,
 
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    HCI_INIT_CONTROLLER_CACHE_MISS_READ_LOCAL_SUPPORTED_COMMANDS,
+    HCI_INIT_W4_CONTROLLER_CACHE_MISS_READ_LOCAL_SUPPORTED_COMMANDS,
+#endif
+
     HCI_INIT_READ_BUFFER_SIZE,
     HCI_INIT_W4_READ_BUFFER_SIZE,
     HCI_INIT_READ_LOCAL_SUPPORTED_FEATURES,
@@ -665,6 +813,13 @@ typedef enum hci_init_state{
     HCI_INIT_W4_LE_SET_EVENT_MASK,
 #endif
 
+#if defined(ENABLE_LE_PERIPHERAL) && defined(ENABLE_LE_EXTENDED_ADVERTISING)
+    HCI_INIT_LE_READ_MAXIMUM_ADVERTISING_DATA_LENGTH,
+    HCI_INIT_W4_LE_READ_MAXIMUM_ADVERTISING_DATA_LENGTH,
+    HCI_INIT_LE_READ_NUMBER_OF_SUPPORTED_ADVERTISING_SETS,
+    HCI_INIT_W4_LE_READ_NUMBER_OF_SUPPORTED_ADVERTISING_SETS,
+#endif
+
 #ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
     HCI_INIT_LE_READ_MAX_DATA_LENGTH,
     HCI_INIT_W4_LE_READ_MAX_DATA_LENGTH,
@@ -701,6 +856,13 @@ enum {
     LE_ADVERTISEMENT_TASKS_SET_SCAN_DATA = 1 << 2,
     LE_ADVERTISEMENT_TASKS_SET_PARAMS    = 1 << 3,
     LE_ADVERTISEMENT_TASKS_ENABLE        = 1 << 4,
+    LE_ADVERTISEMENT_TASKS_SET_ADDRESS   = 1 << 5,
+    LE_ADVERTISEMENT_TASKS_REMOVE_SET    = 1 << 6,
+};
+
+enum {
+    LE_ADVERTISEMENT_STATE_ENABLED       = 1 << 0,  // requested by application
+    LE_ADVERTISEMENT_STATE_ACTIVE        = 1 << 1,  // enabled on controller
 };
 
 enum {
@@ -733,6 +895,14 @@ typedef struct {
     /* link key db */
     const btstack_link_key_db_t * link_key_db;
 
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    // controller capabilities from last init
+    const btstack_tlv_t  * controller_cache_tlv_impl;
+    void                 * controller_cache_tlv_context;
+    hci_controller_cache_t controller_cache;
+    uint8_t                controller_cache_hit;
+#endif
+
     // list of existing baseband connections
     btstack_linked_list_t     connections;
 
@@ -777,9 +947,19 @@ typedef struct {
     uint16_t  acl_fragmentation_pos;
     uint16_t  acl_fragmentation_total_size;
     uint8_t   acl_fragmentation_tx_active;
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+    uint8_t   acl_fragmentation_tx_scheduled;
+#endif
      
     /* host to controller flow control */
     uint8_t  num_cmd_packets;
+#ifdef ENABLE_HCI_COMMAND_PIPELINING
+    hci_command_in_flight_t commands_in_flight[HCI_COMMAND_PIPELINING_MAX_IN_FLIGHT];
+    uint8_t  num_commands_in_flight;
+    // queue of command that is sent next by hci_run
+    hci_command_queue_t command_queue;
+    hci_con_handle_t    command_queue_con_handle;
+#endif
     uint8_t  acl_packets_total_num;
     uint16_t acl_data_packet_length;
     uint8_t  sco_packets_total_num;
@@ -875,6 +1055,33 @@ typedef struct {
     uint16_t le_scan_interval;  
     uint16_t le_scan_window;
 
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    // PHYs for Extended Scanning and Extended Create Connection
+    uint8_t  le_scan_phys;
+    uint8_t  le_connection_phys;
+#endif
+
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+    gap_le_advertising_reports_handler_t le_advertising_reports_handler;
+    gap_le_advertising_report_t le_advertising_reports[LE_ADVERTISING_REPORT_BATCH_SIZE];
+    uint16_t                    le_advertising_reports_count;
+    uint16_t                    le_advertising_reports_batch_delay_ms;
+    btstack_timer_source_t      le_advertising_reports_timer;
+    uint8_t                     le_advertising_reports_timer_active;
+    uint32_t                    le_advertising_report_dedup_ttl_ms;
+    le_advertising_report_dedup_entry_t le_advertising_report_dedup_cache[LE_ADVERTISING_REPORT_DEDUP_CACHE_SIZE];
+#endif
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    // reassembly of chained LE Extended Advertising Reports, stored as GAP_EVENT_EXTENDED_ADVERTISING_REPORT
+    uint8_t  le_extended_advertising_report[LE_EXTENDED_ADVERTISING_REPORT_HEADER_SIZE + LE_EXTENDED_ADVERTISING_REPORT_DATA_SIZE];
+    uint16_t le_extended_advertising_report_len;
+    le_extended_advertising_report_state_t le_extended_advertising_report_state;
+    // remaining reports of chain interrupted by another advertiser are discarded: address type, address, sid
+    uint8_t  le_extended_advertising_report_interrupted;
+    uint8_t  le_extended_advertising_report_interrupted_advertiser[8];
+#endif
+
     // LE Whitelist Management
     uint8_t               le_whitelist_capacity;
     btstack_linked_list_t le_whitelist;
@@ -912,6 +1119,18 @@ typedef struct {
     bd_addr_t le_advertisements_direct_address;
 
     uint8_t le_max_number_peripheral_connections;
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    btstack_linked_list_t le_advertising_sets;
+    // LE Set Extended Advertising Parameters for advertising handle 0 used by gap_advertisements_* API has been sent
+    uint8_t  le_advertisements_set_created;
+    // Controller limits, 0 = not read yet
+    uint8_t  le_number_of_supported_advertising_sets;
+    uint16_t le_maximum_advertising_data_length;
+    // advertising handle and enable of LE Set Extended Advertising Parameters/Enable command in flight
+    uint8_t  le_advertising_set_command_handle;
+    uint8_t  le_advertising_set_command_enable;
+#endif
 #endif
 
 #ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
@@ -1087,6 +1306,40 @@ void hci_release_packet_buffer(void);
 */
 void hci_set_master_slave_policy(uint8_t policy);
 
+/**
+ * @brief Keep ACL recombination buffer for connection until disconnect instead of returning it to the pool
+ * @note requires ENABLE_HCI_ACL_RECOMBINATION_POOL, without it, every connection has its own buffer
+ * @param con_handle
+ * @param reserve
+ * @return status ERROR_CODE_SUCCESS, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER or ERROR_CODE_MEMORY_CAPACITY_EXCEEDED if pool is empty
+ */
+uint8_t hci_reserve_acl_recombination_buffer(hci_con_handle_t con_handle, int reserve);
+
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+/**
+ * @brief Get queue depth and wait time of ACL TX scheduler for connection
+ * @param con_handle
+ * @param stats
+ * @return status ERROR_CODE_SUCCESS or ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER
+ */
+uint8_t hci_get_acl_tx_stats(hci_con_handle_t con_handle, hci_acl_tx_stats_t * stats);
+#endif
+
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+/**
+ * @brief Store controller capabilities in TLV to skip reading them during init if the same controller is found. Has to be called before power on.
+ * @note The TLV is used during init, so a TLV that is selected by the local BD_ADDR cannot be used
+ * @param tlv_impl or NULL to disable cache
+ * @param tlv_context
+ */
+void hci_set_controller_cache(const btstack_tlv_t * tlv_impl, void * tlv_context);
+
+/**
+ * @brief Delete stored controller capabilities, e.g. after a firmware update that changes them
+ */
+void hci_delete_controller_cache(void);
+#endif
+
 /* API_END */
 
 
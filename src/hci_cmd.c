@@ -55,6 +55,20 @@
 // calculate combined ogf/ocf value
 #define OPCODE(ogf, ocf) ((ocf) | ((ogf) << 10))
 
+// max number of parameters in repeated parameter block
+#define HCI_CMD_MAX_BLOCK_PARAMETERS 8
+
+#ifdef ENABLE_BLE
+static uint8_t hci_cmd_count_bits_set(uint8_t value){
+    uint8_t num_bits = 0;
+    while (value != 0){
+        num_bits += value & 1;
+        value >>= 1;
+    }
+    return num_bits;
+}
+#endif
+
 /**
  * construct HCI Command based on template
  *
@@ -69,6 +83,9 @@
  *   A: 31 bytes advertising data
  *   S: Service Record (Data Element Sequence)
  *   Q: 32 byte data block, e.g. for X and Y coordinates of P-256 public key
+ *   [: begin of parameter block repeated for each bit set in preceding 8 bit value, e.g. for each PHY
+ *      arguments are pointers to arrays with one entry per block, uint8_t for '1' and uint16_t for '2'
+ *   ]: end of parameter block
  */
 uint16_t hci_cmd_create_from_template(uint8_t *hci_cmd_buffer, const hci_cmd_t *cmd, va_list argptr){
     
@@ -80,12 +97,21 @@ uint16_t hci_cmd_create_from_template(uint8_t *hci_cmd_buffer, const hci_cmd_t *
     uint16_t word;
     uint32_t longword;
     uint8_t * ptr;
+#ifdef ENABLE_BLE
+    uint8_t var_len = 0;
+    uint8_t num_blocks = 0;
+#endif
     while (*format) {
         switch(*format) {
             case '1': //  8 bit value
             case '2': // 16 bit value
             case 'H': // hci_handle
                 word = va_arg(argptr, int);  // minimal va_arg is int: 2 bytes on 8+16 bit CPUs
+#ifdef ENABLE_BLE
+                if (*format == '1'){
+                    num_blocks = hci_cmd_count_bits_set(word & 0xff);
+                }
+#endif
                 hci_cmd_buffer[pos++] = word & 0xff;
                 if (*format == '2') {
                     hci_cmd_buffer[pos++] = word >> 8;
@@ -150,6 +176,41 @@ uint16_t hci_cmd_create_from_template(uint8_t *hci_cmd_buffer, const hci_cmd_t *
                 (void)memcpy(&hci_cmd_buffer[pos], ptr, 31);
                 pos += 31;
                 break;
+            case 'J': // 8 bit length of following variable sized data block
+                var_len = (uint8_t) va_arg(argptr, int);
+                hci_cmd_buffer[pos++] = var_len;
+                break;
+            case 'V': // variable sized data block, length given by preceding 'J'
+                ptr = va_arg(argptr, uint8_t *);
+                (void)memcpy(&hci_cmd_buffer[pos], ptr, var_len);
+                pos += var_len;
+                break;
+            case '[': { // parameter block for each bit set in preceding 8 bit value
+                const void * arrays[HCI_CMD_MAX_BLOCK_PARAMETERS];
+                const char * block_format = format + 1;
+                uint8_t num_parameters = 0;
+                while ((block_format[num_parameters] != ']') && (block_format[num_parameters] != 0) &&
+                       (num_parameters < HCI_CMD_MAX_BLOCK_PARAMETERS)){
+                    arrays[num_parameters] = va_arg(argptr, const void *);
+                    num_parameters++;
+                }
+                uint8_t block;
+                for (block = 0; block < num_blocks; block++){
+                    uint8_t i;
+                    for (i = 0; i < num_parameters; i++){
+                        if (block_format[i] == '2'){
+                            little_endian_store_16(hci_cmd_buffer, pos, ((const uint16_t *) arrays[i])[block]);
+                            pos += 2;
+                        } else {
+                            hci_cmd_buffer[pos++] = ((const uint8_t *) arrays[i])[block];
+                        }
+                    }
+                }
+                format += num_parameters;
+                break;
+            }
+            case ']':
+                break;
 #endif
 #ifdef ENABLE_SDP
             case 'S': { // Service Record (Data Element Sequence)
@@ -1282,6 +1343,149 @@ OPCODE(OGF_LE_CONTROLLER, 0x32), "H1111"
 // LE PHY Update Complete is generated on completion
 };
 
+/**
+ * @param advertising_handle
+ * @param random_address
+ */
+const hci_cmd_t hci_le_set_advertising_set_random_address = {
+OPCODE(OGF_LE_CONTROLLER, 0x35), "1B"
+// return: status
+};
+
+/**
+ * @param advertising_handle
+ * @param advertising_event_properties
+ * @param primary_advertising_interval_min (24 bit)
+ * @param primary_advertising_interval_max (24 bit)
+ * @param primary_advertising_channel_map
+ * @param own_address_type
+ * @param peer_address_type
+ * @param peer_address
+ * @param advertising_filter_policy
+ * @param advertising_tx_power
+ * @param primary_advertising_phy
+ * @param secondary_advertising_max_skip
+ * @param secondary_advertising_phy
+ * @param advertising_sid
+ * @param scan_request_notification_enable
+ */
+const hci_cmd_t hci_le_set_extended_advertising_parameters = {
+OPCODE(OGF_LE_CONTROLLER, 0x36), "1233111B1111111"
+// return: status, selected tx power
+};
+
+/**
+ * @param advertising_handle
+ * @param operation
+ * @param fragment_preference
+ * @param advertising_data_length
+ * @param advertising_data
+ */
+const hci_cmd_t hci_le_set_extended_advertising_data = {
+OPCODE(OGF_LE_CONTROLLER, 0x37), "111JV"
+// return: status
+};
+
+/**
+ * @param advertising_handle
+ * @param operation
+ * @param fragment_preference
+ * @param scan_response_data_length
+ * @param scan_response_data
+ */
+const hci_cmd_t hci_le_set_extended_scan_response_data = {
+OPCODE(OGF_LE_CONTROLLER, 0x38), "111JV"
+// return: status
+};
+
+/**
+ * @note BTstack enables or disables a single advertising set per command
+ * @param enable
+ * @param number_of_sets (1)
+ * @param advertising_handle
+ * @param duration in 10 ms
+ * @param max_extended_advertising_events
+ */
+const hci_cmd_t hci_le_set_extended_advertising_enable = {
+OPCODE(OGF_LE_CONTROLLER, 0x39), "11121"
+// return: status
+};
+
+/**
+ */
+const hci_cmd_t hci_le_read_maximum_advertising_data_length = {
+OPCODE(OGF_LE_CONTROLLER, 0x3a), ""
+// return: status, maximum advertising data length
+};
+
+/**
+ */
+const hci_cmd_t hci_le_read_number_of_supported_advertising_sets = {
+OPCODE(OGF_LE_CONTROLLER, 0x3b), ""
+// return: status, number of supported advertising sets
+};
+
+/**
+ * @param advertising_handle
+ */
+const hci_cmd_t hci_le_remove_advertising_set = {
+OPCODE(OGF_LE_CONTROLLER, 0x3c), "1"
+// return: status
+};
+
+/**
+ */
+const hci_cmd_t hci_le_clear_advertising_sets = {
+OPCODE(OGF_LE_CONTROLLER, 0x3d), ""
+// return: status
+};
+
+/**
+ * @note scan_type, scan_interval, and scan_window are arrays with one entry for each PHY in scanning_phys
+ * @param own_address_type
+ * @param scanning_filter_policy
+ * @param scanning_phys 0x01 = LE 1M, 0x04 = LE Coded
+ * @param scan_type
+ * @param scan_interval
+ * @param scan_window
+ */
+const hci_cmd_t hci_le_set_extended_scan_parameters = {
+OPCODE(OGF_LE_CONTROLLER, 0x41), "111[122]"
+// return: status
+};
+
+/**
+ * @param enable
+ * @param filter_duplicates
+ * @param duration in 10 ms
+ * @param period in 1.28 s
+ */
+const hci_cmd_t hci_le_set_extended_scan_enable = {
+OPCODE(OGF_LE_CONTROLLER, 0x42), "1122"
+// return: status
+};
+
+/**
+ * @note scan_interval to max_ce_length are arrays with one entry for each PHY in initiating_phys
+ * @param initiator_filter_policy
+ * @param own_address_type
+ * @param peer_address_type
+ * @param peer_address
+ * @param initiating_phys 0x01 = LE 1M, 0x02 = LE 2M, 0x04 = LE Coded
+ * @param scan_interval
+ * @param scan_window
+ * @param conn_interval_min
+ * @param conn_interval_max
+ * @param conn_latency
+ * @param supervision_timeout
+ * @param min_ce_length
+ * @param max_ce_length
+ */
+const hci_cmd_t hci_le_extended_create_connection = {
+OPCODE(OGF_LE_CONTROLLER, 0x43), "111B1[22222222]"
+// LE Connection Complete or LE Enhanced Connection Complete is generated on completion
+};
+
 
 #endif
 
@@ -171,11 +171,13 @@ extern const hci_cmd_t hci_write_simple_pairing_mode;
 extern const hci_cmd_t hci_write_synchronous_flow_control_enable;
 
 extern const hci_cmd_t hci_le_add_device_to_white_list;
+extern const hci_cmd_t hci_le_clear_advertising_sets;
 extern const hci_cmd_t hci_le_clear_white_list;
 extern const hci_cmd_t hci_le_connection_update;
 extern const hci_cmd_t hci_le_create_connection;
 extern const hci_cmd_t hci_le_create_connection_cancel;
 extern const hci_cmd_t hci_le_encrypt;
+extern const hci_cmd_t hci_le_extended_create_connection;
 extern const hci_cmd_t hci_le_generate_dhkey;
 extern const hci_cmd_t hci_le_long_term_key_negative_reply;
 extern const hci_cmd_t hci_le_long_term_key_request_reply;
@@ -184,7 +186,9 @@ extern const hci_cmd_t hci_le_read_advertising_channel_tx_power;
 extern const hci_cmd_t hci_le_read_buffer_size ;
 extern const hci_cmd_t hci_le_read_channel_map;
 extern const hci_cmd_t hci_le_read_local_p256_public_key;
+extern const hci_cmd_t hci_le_read_maximum_advertising_data_length;
 extern const hci_cmd_t hci_le_read_maximum_data_length;
+extern const hci_cmd_t hci_le_read_number_of_supported_advertising_sets;
 extern const hci_cmd_t hci_le_read_phy;
 extern const hci_cmd_t hci_le_read_remote_used_features;
 extern const hci_cmd_t hci_le_read_suggested_default_data_length;
@@ -194,13 +198,21 @@ extern const hci_cmd_t hci_le_read_white_list_size;
 extern const hci_cmd_t hci_le_receiver_test;
 extern const hci_cmd_t hci_le_remote_connection_parameter_request_negative_reply;
 extern const hci_cmd_t hci_le_remote_connection_parameter_request_reply;
+extern const hci_cmd_t hci_le_remove_advertising_set;
 extern const hci_cmd_t hci_le_remove_device_from_white_list;
 extern const hci_cmd_t hci_le_set_advertise_enable;
 extern const hci_cmd_t hci_le_set_advertising_data;
 extern const hci_cmd_t hci_le_set_advertising_parameters;
+extern const hci_cmd_t hci_le_set_advertising_set_random_address;
 extern const hci_cmd_t hci_le_set_data_length;
 extern const hci_cmd_t hci_le_set_default_phy;
 extern const hci_cmd_t hci_le_set_event_mask;
+extern const hci_cmd_t hci_le_set_extended_advertising_data;
+extern const hci_cmd_t hci_le_set_extended_advertising_enable;
+extern const hci_cmd_t hci_le_set_extended_advertising_parameters;
+extern const hci_cmd_t hci_le_set_extended_scan_enable;
+extern const hci_cmd_t hci_le_set_extended_scan_parameters;
+extern const hci_cmd_t hci_le_set_extended_scan_response_data;
 extern const hci_cmd_t hci_le_set_host_channel_classification;
 extern const hci_cmd_t hci_le_set_phy;
 extern const hci_cmd_t hci_le_set_random_address;
@@ -59,6 +59,8 @@
 #include "hci_cmd.h"
 #include "btstack_run_loop.h"
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
 
 #ifdef HAVE_POSIX_FILE_IO
 #include <fcntl.h>        // open
@@ -86,6 +88,95 @@
 static char segger_rtt_packetlog_buffer[SEGGER_RTT_PACKETLOG_BUFFER_SIZE];
 #endif
 
+#ifdef ENABLE_HCI_DUMP_ASYNC_WRITER
+#ifndef HAVE_POSIX_FILE_IO
+#error "ENABLE_HCI_DUMP_ASYNC_WRITER requires HAVE_POSIX_FILE_IO"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>      // writev
+
+// size of ring buffer between stack and writer thread, must be a power of two
+#ifndef HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE
+#define HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE 65536
+#endif
+#if (HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE & (HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE - 1)) != 0
+#error "HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE must be a power of two"
+#endif
+
+// max time records stay in the ring buffer, writer thread is woken up earlier if ring buffer is half full
+#ifndef HCI_DUMP_ASYNC_WRITER_FLUSH_INTERVAL_MS
+#define HCI_DUMP_ASYNC_WRITER_FLUSH_INTERVAL_MS 100
+#endif
+
+// single producer / single consumer ring buffer with free running positions
+// async_head is only written by the stack thread, async_tail only by the writer thread
+static uint8_t  async_ring[HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE];
+static uint32_t async_head;
+static uint32_t async_tail;
+
+// file truncation requested by stack thread: sequence number in upper, ring position in lower 32 bits. Both are
+// published with a single store, so the writer thread latches one consistent request and a newer request replaces
+// an older one that has not been handled yet
+static uint64_t async_truncate_request;
+static uint32_t async_truncate_handled;
+
+// records dropped as ring buffer was full, number since last note is reported in the packet log
+static uint32_t async_dropped_records;
+static uint32_t async_dropped_records_unreported;
+
+static int             async_writer_running;
+static int             async_writer_stop;
+static pthread_t       async_writer_thread;
+static pthread_mutex_t async_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  async_writer_cond  = PTHREAD_COND_INITIALIZER;
+#endif
+
+// btsnoop segments are memory mapped, not available on Windows
+#if defined(HAVE_POSIX_FILE_IO) && !defined(_WIN32)
+#define HAVE_HCI_DUMP_BTSNOOP_SEGMENTS
+
+#include <sys/mman.h>
+
+// size of each segment file, incl. 16 byte btsnoop file header
+#ifndef HCI_DUMP_BTSNOOP_SEGMENT_SIZE
+#define HCI_DUMP_BTSNOOP_SEGMENT_SIZE (1024 * 1024)
+#endif
+#if HCI_DUMP_BTSNOOP_SEGMENT_SIZE < 4096
+#error "HCI_DUMP_BTSNOOP_SEGMENT_SIZE must be at least 4096"
+#endif
+
+#ifndef HCI_DUMP_BTSNOOP_NUM_SEGMENTS
+#define HCI_DUMP_BTSNOOP_NUM_SEGMENTS 4
+#endif
+
+typedef struct {
+    int       fd;
+    uint8_t * data;
+    uint32_t  used;
+} hci_dump_btsnoop_segment_t;
+
+static hci_dump_btsnoop_segment_t btsnoop_segments[HCI_DUMP_BTSNOOP_NUM_SEGMENTS];
+static uint16_t btsnoop_segment_index;
+static uint32_t btsnoop_dropped_packets;
+#endif
+
+// btsnoop - struct not used directly, all fields big endian
+typedef struct {
+    uint32_t    original_len;
+    uint32_t    included_len;
+    uint32_t    flags;          // bit 0: received, bit 1: command/event
+    uint32_t    cumulative_drops;
+    uint64_t    ts_us;          // since 0000-01-01
+}
+btsnoop_hdr;
+#define BTSNOOP_HDR_SIZE 24
+#define BTSNOOP_FILE_HDR_SIZE 16
+#define BTSNOOP_DATALINK_H4 1002
+// microseconds from 0000-01-01 to 1970-01-01
+#define BTSNOOP_EPOCH_OFFSET_US 0x00dcddb30f2f8000ULL
+
 // BLUEZ hcidump - struct not used directly, but left here as documentation
 typedef struct {
     uint16_t    len;
@@ -123,13 +214,346 @@ static char log_message_buffer[256];
 // levels: debug, info, error
 static int log_level_enabled[3] = { 1, 1, 1};
 
+#ifdef ENABLE_HCI_DUMP_BINARY_LOG
+
+// max number of distinct format strings, must be a power of two
+#ifndef HCI_DUMP_BINARY_LOG_MAX_FORMATS
+#define HCI_DUMP_BINARY_LOG_MAX_FORMATS 512
+#endif
+#if (HCI_DUMP_BINARY_LOG_MAX_FORMATS & (HCI_DUMP_BINARY_LOG_MAX_FORMATS - 1)) != 0
+#error "HCI_DUMP_BINARY_LOG_MAX_FORMATS must be a power of two"
+#endif
+
+#define BINARY_LOG_MAX_ARGS     12
+#define BINARY_LOG_UNSUPPORTED  0xff
+
+// argument types, integers are stored as 4 (int) or 8 bytes little endian, strings with 1 byte length
+typedef enum {
+    BINARY_LOG_ARG_INT = 0,
+    BINARY_LOG_ARG_LONG,
+    BINARY_LOG_ARG_LONG_LONG,
+    BINARY_LOG_ARG_SIZE,
+    BINARY_LOG_ARG_POINTER,
+    BINARY_LOG_ARG_DOUBLE,
+    BINARY_LOG_ARG_STRING,
+} binary_log_arg_type_t;
+
+// set for signed conversions, used to extend long and size_t to 8 bytes
+#define BINARY_LOG_ARG_SIGNED 0x80
+
+typedef struct {
+    const char * format;        // NULL if entry unused
+    uint32_t     generation;    // definition has been logged in this generation of the packet log
+    uint16_t     id;
+    uint8_t      num_args;      // BINARY_LOG_UNSUPPORTED if format requires text log
+    uint8_t      arg_types[BINARY_LOG_MAX_ARGS];
+} hci_dump_binary_log_format_t;
+
+// hash table of format strings by address
+static hci_dump_binary_log_format_t binary_log_formats[HCI_DUMP_BINARY_LOG_MAX_FORMATS];
+static uint16_t binary_log_num_formats;
+// incremented when the packet log is (re)started and format definitions need to be logged again
+static uint32_t binary_log_generation = 1;
+#endif
+
+// max number of selected connection handles and L2CAP CIDs
+#ifndef HCI_DUMP_FILTER_MAX_ENTRIES
+#define HCI_DUMP_FILTER_MAX_ENTRIES 4
+#endif
+
+// number of ACL fragment streams (connection handle + direction) tracked to filter continuation fragments
+#ifndef HCI_DUMP_FILTER_NUM_ACL_STREAMS
+#define HCI_DUMP_FILTER_NUM_ACL_STREAMS 8
+#endif
+
+typedef struct {
+    uint16_t con_handle;
+    uint8_t  in;
+    uint8_t  valid;
+    uint16_t cid;
+} hci_dump_acl_stream_t;
+
+// filters: packet types as bitmask, empty selection = all handles / CIDs
+static uint16_t packet_types_enabled = 0xffff;
+static uint16_t filter_con_handles[HCI_DUMP_FILTER_MAX_ENTRIES];
+static uint8_t  filter_num_con_handles;
+static uint16_t filter_l2cap_cids[HCI_DUMP_FILTER_MAX_ENTRIES];
+static uint8_t  filter_num_l2cap_cids;
+static int      filter_max_payload_len = -1;
+static hci_dump_acl_stream_t filter_acl_streams[HCI_DUMP_FILTER_NUM_ACL_STREAMS];
+static uint8_t  filter_acl_streams_next;
+
+#ifdef ENABLE_HCI_DUMP_ASYNC_WRITER
+
+static void hci_dump_async_writer_write(uint32_t start, uint32_t end){
+    while (start != end){
+        // up to two iovecs as data might wrap around
+        struct iovec iov[2];
+        int      iovcnt = 1;
+        uint32_t offset = start & (HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE - 1);
+        uint32_t len    = end - start;
+        uint32_t len_before_wrap = btstack_min(len, HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE - offset);
+        iov[0].iov_base = &async_ring[offset];
+        iov[0].iov_len  = len_before_wrap;
+        if (len_before_wrap < len){
+            iov[1].iov_base = &async_ring[0];
+            iov[1].iov_len  = len - len_before_wrap;
+            iovcnt = 2;
+        }
+        ssize_t res = writev(dump_file, iov, iovcnt);
+        if (res < 0){
+            if (errno == EINTR) continue;
+            // drop data on write error
+            return;
+        }
+        start += (uint32_t) res;
+    }
+}
+
+// writer thread: write all queued records, truncate file if requested
+static void hci_dump_async_writer_flush(void){
+    // read request before head, truncation position was queued before the request and is not after head
+    uint64_t request = __atomic_load_n(&async_truncate_request, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&async_head, __ATOMIC_ACQUIRE);
+    uint32_t sequence_nr = (uint32_t) (request >> 32);
+    if (sequence_nr != async_truncate_handled){
+        uint32_t truncate_pos = (uint32_t) request;
+        hci_dump_async_writer_write(async_tail, truncate_pos);
+        lseek(dump_file, 0, SEEK_SET);
+        // avoid -Wunused-result
+        int res = ftruncate(dump_file, 0);
+        UNUSED(res);
+        async_truncate_handled = sequence_nr;
+        __atomic_store_n(&async_tail, truncate_pos, __ATOMIC_RELEASE);
+    }
+    hci_dump_async_writer_write(async_tail, head);
+    __atomic_store_n(&async_tail, head, __ATOMIC_RELEASE);
+}
+
+static void * hci_dump_async_writer_thread_main(void * context){
+    UNUSED(context);
+    pthread_mutex_lock(&async_writer_mutex);
+    while (async_writer_stop == 0){
+        uint32_t fill = __atomic_load_n(&async_head, __ATOMIC_ACQUIRE) - async_tail;
+        if (fill < (HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE / 2)){
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (HCI_DUMP_ASYNC_WRITER_FLUSH_INTERVAL_MS % 1000) * 1000000L;
+            deadline.tv_sec  += (HCI_DUMP_ASYNC_WRITER_FLUSH_INTERVAL_MS / 1000) + (deadline.tv_nsec / 1000000000L);
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&async_writer_cond, &async_writer_mutex, &deadline);
+        }
+        pthread_mutex_unlock(&async_writer_mutex);
+        hci_dump_async_writer_flush();
+        pthread_mutex_lock(&async_writer_mutex);
+    }
+    pthread_mutex_unlock(&async_writer_mutex);
+    // write remaining records
+    hci_dump_async_writer_flush();
+    return NULL;
+}
+
+static void hci_dump_async_writer_start(void){
+    async_head = 0;
+    async_tail = 0;
+    async_truncate_request = 0;
+    async_truncate_handled = 0;
+    async_dropped_records = 0;
+    async_dropped_records_unreported = 0;
+    async_writer_stop = 0;
+    if (pthread_create(&async_writer_thread, NULL, &hci_dump_async_writer_thread_main, NULL) != 0){
+        printf("hci_dump_open: failed to start writer thread, writing synchronously\n");
+        return;
+    }
+    async_writer_running = 1;
+}
+
+static void hci_dump_async_writer_stop(void){
+    if (async_writer_running == 0) return;
+    pthread_mutex_lock(&async_writer_mutex);
+    async_writer_stop = 1;
+    pthread_cond_signal(&async_writer_cond);
+    pthread_mutex_unlock(&async_writer_mutex);
+    pthread_join(async_writer_thread, NULL);
+    async_writer_running = 0;
+}
+
+static void hci_dump_async_ring_store(uint32_t pos, const uint8_t * data, uint16_t len){
+    uint32_t offset = pos & (HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE - 1);
+    uint32_t len_before_wrap = btstack_min(len, HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE - offset);
+    (void)memcpy(&async_ring[offset], data, len_before_wrap);
+    (void)memcpy(&async_ring[0], &data[len_before_wrap], len - len_before_wrap);
+}
+
+// stack thread: copy record into ring buffer, returns 0 if ring buffer is full
+static int hci_dump_async_writer_queue(const uint8_t * header, uint16_t header_len, const uint8_t * packet, uint16_t len){
+    uint32_t fill = async_head - __atomic_load_n(&async_tail, __ATOMIC_ACQUIRE);
+    uint32_t record_len = header_len + len;
+    if ((fill + record_len) > HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE) return 0;
+    hci_dump_async_ring_store(async_head, header, header_len);
+    hci_dump_async_ring_store(async_head + header_len, packet, len);
+    __atomic_store_n(&async_head, async_head + record_len, __ATOMIC_RELEASE);
+
+    // wake up writer thread when ring buffer becomes half full
+    const uint32_t half = HCI_DUMP_ASYNC_WRITER_BUFFER_SIZE / 2;
+    if ((fill < half) && ((fill + record_len) >= half)){
+        pthread_mutex_lock(&async_writer_mutex);
+        pthread_cond_signal(&async_writer_cond);
+        pthread_mutex_unlock(&async_writer_mutex);
+    }
+    return 1;
+}
+
+static void hci_dump_async_writer_request_truncate(void){
+    uint32_t sequence_nr = (uint32_t) (async_truncate_request >> 32) + 1;
+    __atomic_store_n(&async_truncate_request, ((uint64_t) sequence_nr << 32) | async_head, __ATOMIC_RELEASE);
+}
+
+uint32_t hci_dump_get_dropped_records(void){
+    return async_dropped_records;
+}
+
+#else
+
+uint32_t hci_dump_get_dropped_records(void){
+    return 0;
+}
+
+#endif
+
+#ifdef HAVE_HCI_DUMP_BTSNOOP_SEGMENTS
+
+// mark end of valid records in a segment that is still in use, real records have at least packet type
+static void hci_dump_btsnoop_segment_terminate(hci_dump_btsnoop_segment_t * segment){
+    memset(&segment->data[segment->used], 0, 8);
+}
+
+static void hci_dump_btsnoop_segments_close(void){
+    uint16_t i;
+    for (i = 0; i < HCI_DUMP_BTSNOOP_NUM_SEGMENTS; i++){
+        hci_dump_btsnoop_segment_t * segment = &btsnoop_segments[i];
+        if (segment->data != NULL){
+            munmap(segment->data, HCI_DUMP_BTSNOOP_SEGMENT_SIZE);
+            segment->data = NULL;
+            // drop unused part so that each segment is a valid btsnoop file
+            int res = ftruncate(segment->fd, segment->used);
+            UNUSED(res);
+        }
+        if (segment->fd >= 0){
+            close(segment->fd);
+            segment->fd = -1;
+        }
+    }
+}
+
+// returns fd of first segment or -1 on error
+static int hci_dump_btsnoop_segments_open(const char * filename){
+    uint16_t i;
+    for (i = 0; i < HCI_DUMP_BTSNOOP_NUM_SEGMENTS; i++){
+        btsnoop_segments[i].fd   = -1;
+        btsnoop_segments[i].data = NULL;
+    }
+    for (i = 0; i < HCI_DUMP_BTSNOOP_NUM_SEGMENTS; i++){
+        hci_dump_btsnoop_segment_t * segment = &btsnoop_segments[i];
+        char path[256];
+        snprintf(path, sizeof(path), "%s.%u", filename, i);
+        segment->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (segment->fd < 0){
+            printf("hci_dump_open: failed to open file %s\n", path);
+            hci_dump_btsnoop_segments_close();
+            return -1;
+        }
+        if (ftruncate(segment->fd, HCI_DUMP_BTSNOOP_SEGMENT_SIZE) < 0){
+            printf("hci_dump_open: failed to resize file %s\n", path);
+            hci_dump_btsnoop_segments_close();
+            return -1;
+        }
+        void * data = mmap(NULL, HCI_DUMP_BTSNOOP_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+        if (data == MAP_FAILED){
+            printf("hci_dump_open: failed to map file %s\n", path);
+            hci_dump_btsnoop_segments_close();
+            return -1;
+        }
+        segment->data = (uint8_t *) data;
+        // btsnoop file header: identification pattern, version 1, datalink type
+        (void)memcpy(segment->data, "btsnoop\0", 8);
+        big_endian_store_32(segment->data, 8, 1);
+        big_endian_store_32(segment->data, 12, BTSNOOP_DATALINK_H4);
+        segment->used = BTSNOOP_FILE_HDR_SIZE;
+        hci_dump_btsnoop_segment_terminate(segment);
+    }
+    btsnoop_segment_index = 0;
+    btsnoop_dropped_packets = 0;
+    return btsnoop_segments[0].fd;
+}
+
+// store record in current segment, switch to next segment if full. no system calls
+static void hci_dump_btsnoop_segments_write(uint32_t tv_sec, uint32_t tv_us, uint8_t packet_type, uint8_t in, const uint8_t * packet, uint16_t len, uint16_t original_len){
+    uint32_t flags = in ? 1 : 0;
+    switch (packet_type){
+        case HCI_COMMAND_DATA_PACKET:
+        case HCI_EVENT_PACKET:
+            flags |= 2;
+            break;
+        case HCI_ACL_DATA_PACKET:
+        case HCI_SCO_DATA_PACKET:
+            break;
+        default:
+            // log messages cannot be stored in btsnoop
+            return;
+    }
+
+    // record + 8 bytes end marker
+    uint32_t record_len = BTSNOOP_HDR_SIZE + 1 + len;
+    if ((BTSNOOP_FILE_HDR_SIZE + record_len + 8) > HCI_DUMP_BTSNOOP_SEGMENT_SIZE){
+        btsnoop_dropped_packets++;
+        return;
+    }
+    hci_dump_btsnoop_segment_t * segment = &btsnoop_segments[btsnoop_segment_index];
+    if ((segment->used + record_len + 8) > HCI_DUMP_BTSNOOP_SEGMENT_SIZE){
+        // continue with oldest segment, discarding its records
+        btsnoop_segment_index++;
+        if (btsnoop_segment_index == HCI_DUMP_BTSNOOP_NUM_SEGMENTS){
+            btsnoop_segment_index = 0;
+        }
+        segment = &btsnoop_segments[btsnoop_segment_index];
+        segment->used = BTSNOOP_FILE_HDR_SIZE;
+    }
+
+    uint64_t ts_us = BTSNOOP_EPOCH_OFFSET_US + (((uint64_t) tv_sec) * 1000000u) + tv_us;
+    uint8_t * record = &segment->data[segment->used];
+    big_endian_store_32(record,  0, 1 + original_len);
+    big_endian_store_32(record,  4, 1 + len);
+    big_endian_store_32(record,  8, flags);
+    big_endian_store_32(record, 12, btsnoop_dropped_packets);
+    big_endian_store_32(record, 16, (uint32_t) (ts_us >> 32));
+    big_endian_store_32(record, 20, (uint32_t) ts_us);
+    record[24] = packet_type;
+    (void)memcpy(&record[25], packet, len);
+    segment->used += record_len;
+    hci_dump_btsnoop_segment_terminate(segment);
+}
+#endif
+
 void hci_dump_open(const char *filename, hci_dump_format_t format){
 
+#ifdef ENABLE_HCI_DUMP_ASYNC_WRITER
+    hci_dump_async_writer_stop();
+#endif
+
+#ifdef ENABLE_HCI_DUMP_BINARY_LOG
+    binary_log_generation++;
+#endif
+
     dump_format = format;
 
 #ifdef HAVE_POSIX_FILE_IO
     if (dump_format == HCI_DUMP_STDOUT) {
         dump_file = fileno(stdout);
+#ifdef HAVE_HCI_DUMP_BTSNOOP_SEGMENTS
+    } else if (dump_format == HCI_DUMP_BTSNOOP_SEGMENTS){
+        dump_file = hci_dump_btsnoop_segments_open(filename);
+#endif
     } else {
 
         int oflags = O_WRONLY | O_CREAT | O_TRUNC;
@@ -140,6 +564,11 @@ void hci_dump_open(const char *filename, hci_dump_format_t format){
         if (dump_file < 0){
             printf("hci_dump_open: failed to open file %s\n", filename);
         }
+#ifdef ENABLE_HCI_DUMP_ASYNC_WRITER
+        else {
+            hci_dump_async_writer_start();
+        }
+#endif
     }
 #else
 
@@ -187,6 +616,12 @@ static void hci_dump_packetlogger_setup_header(uint8_t * buffer, uint32_t tv_sec
         case LOG_MESSAGE_PACKET:
             packet_logger_type = 0xfc;
             break;
+        case LOG_FORMAT_PACKET:
+            packet_logger_type = 0xf0;
+            break;
+        case LOG_BINARY_PACKET:
+            packet_logger_type = 0xf1;
+            break;
         default:
             return;
     }
@@ -202,6 +637,20 @@ static void hci_dump_bluez_setup_header(uint8_t * buffer, uint32_t tv_sec, uint3
     buffer[12] = packet_type;
 }
 
+// returns header len or 0 for stdout format
+static uint16_t hci_dump_setup_header(uint8_t * buffer, uint32_t tv_sec, uint32_t tv_us, uint8_t packet_type, uint8_t in, uint16_t len){
+    switch (dump_format){
+        case HCI_DUMP_BLUEZ:
+            hci_dump_bluez_setup_header(buffer, tv_sec, tv_us, packet_type, in, len);
+            return HCIDUMP_HDR_SIZE;
+        case HCI_DUMP_PACKETLOGGER:
+            hci_dump_packetlogger_setup_header(buffer, tv_sec, tv_us, packet_type, in, len);
+            return PKTLOG_HDR_SIZE;
+        default:
+            return 0;
+    }
+}
+
 static void printf_packet(uint8_t packet_type, uint8_t in, uint8_t * packet, uint16_t len){
     switch (packet_type){
         case HCI_COMMAND_DATA_PACKET:
@@ -262,6 +711,91 @@ static void printf_timestamp(void){
 #endif
 }
 
+static int hci_dump_filter_list_contains(const uint16_t * list, uint8_t num_entries, uint16_t value){
+    uint8_t i;
+    for (i = 0; i < num_entries; i++){
+        if (list[i] == value) return 1;
+    }
+    return 0;
+}
+
+static void hci_dump_filter_list_update(uint16_t * list, uint8_t * num_entries, uint16_t value, int enable){
+    uint8_t i;
+    for (i = 0; i < *num_entries; i++){
+        if (list[i] != value) continue;
+        if (enable) return;
+        // remove by moving last entry
+        (*num_entries)--;
+        list[i] = list[*num_entries];
+        return;
+    }
+    if (!enable) return;
+    if (*num_entries == HCI_DUMP_FILTER_MAX_ENTRIES) return;
+    list[*num_entries] = value;
+    (*num_entries)++;
+}
+
+static hci_dump_acl_stream_t * hci_dump_filter_get_acl_stream(uint16_t con_handle, uint8_t in, int create){
+    uint8_t i;
+    for (i = 0; i < HCI_DUMP_FILTER_NUM_ACL_STREAMS; i++){
+        hci_dump_acl_stream_t * stream = &filter_acl_streams[i];
+        if (stream->valid && (stream->con_handle == con_handle) && (stream->in == in)) return stream;
+    }
+    if (!create) return NULL;
+    // replace oldest entry
+    hci_dump_acl_stream_t * stream = &filter_acl_streams[filter_acl_streams_next];
+    filter_acl_streams_next = (filter_acl_streams_next + 1) % HCI_DUMP_FILTER_NUM_ACL_STREAMS;
+    stream->con_handle = con_handle;
+    stream->in = in;
+    stream->valid = 1;
+    return stream;
+}
+
+static int hci_dump_filter_truncate(uint16_t header_len, uint16_t len){
+    if (filter_max_payload_len < 0) return len;
+    return btstack_min(len, header_len + filter_max_payload_len);
+}
+
+static int hci_dump_filter_acl(uint8_t in, const uint8_t * packet, uint16_t len){
+    if (len < 4) return len;
+    uint16_t con_handle = little_endian_read_16(packet, 0) & 0x0fff;
+    if (filter_num_con_handles && !hci_dump_filter_list_contains(filter_con_handles, filter_num_con_handles, con_handle)) return -1;
+    if ((filter_num_l2cap_cids == 0) && (filter_max_payload_len < 0)) return len;
+
+    // get L2CAP CID from first fragment, continuation fragments belong to last first fragment
+    uint16_t cid = 0;
+    uint8_t  packet_boundary_flags = (packet[1] >> 4) & 0x03;
+    if (packet_boundary_flags == 0x01){
+        hci_dump_acl_stream_t * stream = hci_dump_filter_get_acl_stream(con_handle, in, 0);
+        if (stream != NULL){
+            cid = stream->cid;
+        }
+    } else if (len >= 8){
+        cid = little_endian_read_16(packet, 6);
+        hci_dump_filter_get_acl_stream(con_handle, in, 1)->cid = cid;
+    }
+    if (filter_num_l2cap_cids && !hci_dump_filter_list_contains(filter_l2cap_cids, filter_num_l2cap_cids, cid)) return -1;
+
+    // keep fixed channels like L2CAP Signaling, ATT, and SM complete
+    if ((cid != 0) && (cid < 0x0040)) return len;
+    return hci_dump_filter_truncate(4, len);
+}
+
+// returns number of bytes to log or -1 if packet is filtered
+static int hci_dump_filter_packet(uint8_t packet_type, uint8_t in, const uint8_t * packet, uint16_t len){
+    if ((packet_type < 16) && ((packet_types_enabled & (1u << packet_type)) == 0)) return -1;
+    switch (packet_type){
+        case HCI_ACL_DATA_PACKET:
+            return hci_dump_filter_acl(in, packet, len);
+        case HCI_SCO_DATA_PACKET:
+            if (len < 3) return len;
+            if (filter_num_con_handles && !hci_dump_filter_list_contains(filter_con_handles, filter_num_con_handles, little_endian_read_16(packet, 0) & 0x0fff)) return -1;
+            return hci_dump_filter_truncate(3, len);
+        default:
+            return len;
+    }
+}
+
 void hci_dump_packet(uint8_t packet_type, uint8_t in, uint8_t *packet, uint16_t len) {
 
     static union {
@@ -271,15 +805,35 @@ void hci_dump_packet(uint8_t packet_type, uint8_t in, uint8_t *packet, uint16_t
 
     if (dump_file < 0) return; // not activated yet
 
+    // apply filters, log messages are controlled by log levels. HCI header keeps original length
+#ifdef HAVE_HCI_DUMP_BTSNOOP_SEGMENTS
+    uint16_t original_len = len;
+#endif
+    if (packet_type != LOG_MESSAGE_PACKET){
+        int filtered_len = hci_dump_filter_packet(packet_type, in, packet, len);
+        if (filtered_len < 0) return;
+        len = (uint16_t) filtered_len;
+    }
+
 #ifdef HAVE_POSIX_FILE_IO
     // don't grow bigger than max_nr_packets
-    if (dump_format != HCI_DUMP_STDOUT && max_nr_packets > 0){
+    if (dump_format != HCI_DUMP_STDOUT && dump_format != HCI_DUMP_BTSNOOP_SEGMENTS && max_nr_packets > 0){
         if (nr_packets >= max_nr_packets){
-            lseek(dump_file, 0, SEEK_SET);
-            // avoid -Wunused-result
-            int res = ftruncate(dump_file, 0);
-            UNUSED(res);
+#ifdef ENABLE_HCI_DUMP_ASYNC_WRITER
+            if (async_writer_running){
+                hci_dump_async_writer_request_truncate();
+            } else
+#endif
+            {
+                lseek(dump_file, 0, SEEK_SET);
+                // avoid -Wunused-result
+                int res = ftruncate(dump_file, 0);
+                UNUSED(res);
+            }
             nr_packets = 0;
+#ifdef ENABLE_HCI_DUMP_BINARY_LOG
+            binary_log_generation++;
+#endif
         }
         nr_packets++;
     }
@@ -320,19 +874,38 @@ void hci_dump_packet(uint8_t packet_type, uint8_t in, uint8_t *packet, uint16_t
 #endif
 #endif
 
-    uint16_t header_len = 0;
-    switch (dump_format){
-        case HCI_DUMP_BLUEZ:
-            hci_dump_bluez_setup_header(header.header_bluez, tv_sec, tv_us, packet_type, in, len);
-            header_len = HCIDUMP_HDR_SIZE;
-            break;
-        case HCI_DUMP_PACKETLOGGER:
-            hci_dump_packetlogger_setup_header(header.header_packetlogger, tv_sec, tv_us, packet_type, in, len);
-            header_len = PKTLOG_HDR_SIZE;
-            break;
-        default:
-            return;
+#ifdef HAVE_HCI_DUMP_BTSNOOP_SEGMENTS
+    if (dump_format == HCI_DUMP_BTSNOOP_SEGMENTS){
+        hci_dump_btsnoop_segments_write(tv_sec, tv_us, packet_type, in, packet, len, original_len);
+        return;
+    }
+#endif
+
+    uint16_t header_len = hci_dump_setup_header((uint8_t *) &header, tv_sec, tv_us, packet_type, in, len);
+    if (header_len == 0) return;
+
+#ifdef ENABLE_HCI_DUMP_ASYNC_WRITER
+    if (async_writer_running){
+        // report dropped records first
+        if (async_dropped_records_unreported > 0){
+            char note[40];
+            uint16_t note_len = (uint16_t) snprintf(note, sizeof(note), "hci_dump: %u records dropped", (unsigned int) async_dropped_records_unreported);
+            uint8_t note_header[PKTLOG_HDR_SIZE];
+            uint16_t note_header_len = hci_dump_setup_header(note_header, tv_sec, tv_us, LOG_MESSAGE_PACKET, 0, note_len);
+            if (hci_dump_async_writer_queue(note_header, note_header_len, (const uint8_t *) note, note_len) == 0){
+                async_dropped_records++;
+                async_dropped_records_unreported++;
+                return;
+            }
+            async_dropped_records_unreported = 0;
+        }
+        if (hci_dump_async_writer_queue((const uint8_t *) &header, header_len, packet, len) == 0){
+            async_dropped_records++;
+            async_dropped_records_unreported++;
+        }
+        return;
     }
+#endif
 
 #ifdef HAVE_POSIX_FILE_IO
     // avoid -Wunused-result
@@ -365,9 +938,230 @@ static int hci_dump_log_level_active(int log_level){
     return log_level_enabled[log_level];
 }
 
+#ifdef ENABLE_HCI_DUMP_BINARY_LOG
+
+static int hci_dump_binary_log_is_digit(char c){
+    return (c >= '0') && (c <= '9');
+}
+
+static void hci_dump_binary_log_add_arg(hci_dump_binary_log_format_t * entry, uint8_t arg_type){
+    if (entry->num_args == BINARY_LOG_UNSUPPORTED) return;
+    if (entry->num_args == BINARY_LOG_MAX_ARGS){
+        entry->num_args = BINARY_LOG_UNSUPPORTED;
+        return;
+    }
+    entry->arg_types[entry->num_args++] = arg_type;
+}
+
+// get argument types from printf conversion specifications
+static void hci_dump_binary_log_parse_format(hci_dump_binary_log_format_t * entry){
+    entry->num_args = 0;
+    // format definition has to fit into log message buffer
+    if (strlen(entry->format) > (sizeof(log_message_buffer) - 2)){
+        entry->num_args = BINARY_LOG_UNSUPPORTED;
+        return;
+    }
+    const char * pos = entry->format;
+    while (*pos != 0){
+        if (*pos++ != '%') continue;
+        if (*pos == '%'){
+            pos++;
+            continue;
+        }
+        // flags
+        while ((*pos == '-') || (*pos == '+') || (*pos == ' ') || (*pos == '#') || (*pos == '0')) pos++;
+        // width and precision, '*' takes an int argument
+        if (*pos == '*'){
+            hci_dump_binary_log_add_arg(entry, BINARY_LOG_ARG_INT);
+            pos++;
+        }
+        while (hci_dump_binary_log_is_digit(*pos)) pos++;
+        if (*pos == '.'){
+            pos++;
+            if (*pos == '*'){
+                hci_dump_binary_log_add_arg(entry, BINARY_LOG_ARG_INT);
+                pos++;
+            }
+            while (hci_dump_binary_log_is_digit(*pos)) pos++;
+        }
+        // length modifier
+        uint8_t int_type = BINARY_LOG_ARG_INT;
+        switch (*pos){
+            case 'h':
+                pos++;
+                if (*pos == 'h') pos++;
+                break;
+            case 'l':
+                pos++;
+                int_type = BINARY_LOG_ARG_LONG;
+                if (*pos == 'l'){
+                    pos++;
+                    int_type = BINARY_LOG_ARG_LONG_LONG;
+                }
+                break;
+            case 'j':
+                pos++;
+                int_type = BINARY_LOG_ARG_LONG_LONG;
+                break;
+            case 'z':
+            case 't':
+                pos++;
+                int_type = BINARY_LOG_ARG_SIZE;
+                break;
+            default:
+                break;
+        }
+        // conversion
+        switch (*pos){
+            case 'd':
+            case 'i':
+                hci_dump_binary_log_add_arg(entry, int_type | BINARY_LOG_ARG_SIGNED);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            case 'c':
+                hci_dump_binary_log_add_arg(entry, int_type);
+                break;
+            case 'p':
+                hci_dump_binary_log_add_arg(entry, BINARY_LOG_ARG_POINTER);
+                break;
+            case 's':
+                hci_dump_binary_log_add_arg(entry, BINARY_LOG_ARG_STRING);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+                hci_dump_binary_log_add_arg(entry, BINARY_LOG_ARG_DOUBLE);
+                break;
+            default:
+                // e.g. long double, %n
+                entry->num_args = BINARY_LOG_UNSUPPORTED;
+                return;
+        }
+        pos++;
+    }
+}
+
+static hci_dump_binary_log_format_t * hci_dump_binary_log_get_format(const char * format){
+    uint32_t hash = ((uint32_t) (((uintptr_t) format) >> 2)) * 2654435761u;
+    uint16_t i;
+    for (i = 0; i < HCI_DUMP_BINARY_LOG_MAX_FORMATS; i++){
+        hci_dump_binary_log_format_t * entry = &binary_log_formats[((hash >> 16) + i) & (HCI_DUMP_BINARY_LOG_MAX_FORMATS - 1)];
+        if (entry->format == format) return entry;
+        if (entry->format != NULL) continue;
+        entry->format = format;
+        entry->id = binary_log_num_formats++;
+        entry->generation = 0;
+        hci_dump_binary_log_parse_format(entry);
+        return entry;
+    }
+    // table full
+    return NULL;
+}
+
+static void hci_dump_binary_log_store_64(uint8_t * buffer, uint16_t pos, uint64_t value){
+    little_endian_store_32(buffer, pos, (uint32_t) value);
+    little_endian_store_32(buffer, pos + 4, (uint32_t) (value >> 32));
+}
+
+// log format id and raw arguments, format string is logged once per packet log. returns 0 if text log is needed
+static int hci_dump_binary_log(const char * format, va_list argptr){
+    hci_dump_binary_log_format_t * entry = hci_dump_binary_log_get_format(format);
+    if ((entry == NULL) || (entry->num_args == BINARY_LOG_UNSUPPORTED)) return 0;
+
+    uint8_t * buffer = (uint8_t *) log_message_buffer;
+    if (entry->generation != binary_log_generation){
+        uint16_t format_len = (uint16_t) strlen(format);
+        little_endian_store_16(buffer, 0, entry->id);
+        (void)memcpy(&buffer[2], format, format_len);
+        uint32_t dropped_records = hci_dump_get_dropped_records();
+        hci_dump_packet(LOG_FORMAT_PACKET, 0, buffer, 2 + format_len);
+        // log definition again if it was dropped by async writer
+        if (dropped_records == hci_dump_get_dropped_records()){
+            entry->generation = binary_log_generation;
+        }
+    }
+
+    // numeric arguments use at most 8 * BINARY_LOG_MAX_ARGS bytes, strings are truncated to fit
+    little_endian_store_16(buffer, 0, entry->id);
+    uint16_t pos = 2;
+    uint8_t i;
+    for (i = 0; i < entry->num_args; i++){
+        uint8_t arg_type = entry->arg_types[i];
+        int is_signed = (arg_type & BINARY_LOG_ARG_SIGNED) != 0;
+        switch ((binary_log_arg_type_t) (arg_type & ~BINARY_LOG_ARG_SIGNED)){
+            case BINARY_LOG_ARG_INT:
+                little_endian_store_32(buffer, pos, (uint32_t) va_arg(argptr, int));
+                pos += 4;
+                break;
+            case BINARY_LOG_ARG_LONG:
+                if (is_signed){
+                    hci_dump_binary_log_store_64(buffer, pos, (uint64_t) (int64_t) va_arg(argptr, long));
+                } else {
+                    hci_dump_binary_log_store_64(buffer, pos, (uint64_t) va_arg(argptr, unsigned long));
+                }
+                pos += 8;
+                break;
+            case BINARY_LOG_ARG_LONG_LONG:
+                hci_dump_binary_log_store_64(buffer, pos, (uint64_t) va_arg(argptr, long long));
+                pos += 8;
+                break;
+            case BINARY_LOG_ARG_SIZE:
+                if (is_signed){
+                    hci_dump_binary_log_store_64(buffer, pos, (uint64_t) (int64_t) va_arg(argptr, ptrdiff_t));
+                } else {
+                    hci_dump_binary_log_store_64(buffer, pos, (uint64_t) va_arg(argptr, size_t));
+                }
+                pos += 8;
+                break;
+            case BINARY_LOG_ARG_POINTER:
+                hci_dump_binary_log_store_64(buffer, pos, (uint64_t) (uintptr_t) va_arg(argptr, void *));
+                pos += 8;
+                break;
+            case BINARY_LOG_ARG_DOUBLE: {
+                double value = va_arg(argptr, double);
+                uint64_t bits;
+                (void)memcpy(&bits, &value, sizeof(bits));
+                hci_dump_binary_log_store_64(buffer, pos, bits);
+                pos += 8;
+                break;
+            }
+            case BINARY_LOG_ARG_STRING: {
+                const char * string = va_arg(argptr, const char *);
+                if (string == NULL){
+                    string = "(null)";
+                }
+                // reserve space for remaining numeric arguments
+                uint16_t max_len = sizeof(log_message_buffer) - pos - 1 - ((entry->num_args - i - 1) * 8);
+                uint16_t len = (uint16_t) btstack_min(btstack_min(strlen(string), max_len), 255);
+                buffer[pos++] = (uint8_t) len;
+                (void)memcpy(&buffer[pos], string, len);
+                pos += len;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    hci_dump_packet(LOG_BINARY_PACKET, 0, buffer, pos);
+    return 1;
+}
+#endif
+
 void hci_dump_log_va_arg(int log_level, const char * format, va_list argptr){
     if (!hci_dump_log_level_active(log_level)) return;
 
+#ifdef ENABLE_HCI_DUMP_BINARY_LOG
+    if ((dump_file >= 0) && (dump_format == HCI_DUMP_PACKETLOGGER) && hci_dump_binary_log(format, argptr)){
+        return;
+    }
+#endif
+
 #if defined(HAVE_POSIX_FILE_IO) || defined (ENABLE_SEGGER_RTT)
     if (dump_file >= 0){
         int len = vsnprintf(log_message_buffer, sizeof(log_message_buffer), format, argptr);
@@ -402,8 +1196,19 @@ void hci_dump_log_P(int log_level, PGM_P format, ...){
 #endif
 
 void hci_dump_close(void){
+#ifdef ENABLE_HCI_DUMP_ASYNC_WRITER
+    hci_dump_async_writer_stop();
+#endif
+#ifdef HAVE_HCI_DUMP_BTSNOOP_SEGMENTS
+    if ((dump_format == HCI_DUMP_BTSNOOP_SEGMENTS) && (dump_file >= 0)){
+        hci_dump_btsnoop_segments_close();
+        dump_file = -1;
+    }
+#endif
 #ifdef HAVE_POSIX_FILE_IO
-    close(dump_file);
+    if (dump_file >= 0){
+        close(dump_file);
+    }
 #endif
     dump_file = -1;
 }
@@ -414,3 +1219,23 @@ void hci_dump_enable_log_level(int log_level, int enable){
     log_level_enabled[log_level] = enable;
 }
 
+void hci_dump_enable_packet_type(uint8_t packet_type, int enable){
+    if (packet_type >= 16) return;
+    if (enable){
+        packet_types_enabled |= 1u << packet_type;
+    } else {
+        packet_types_enabled &= ~(1u << packet_type);
+    }
+}
+
+void hci_dump_select_connection_handle(uint16_t con_handle, int enable){
+    hci_dump_filter_list_update(filter_con_handles, &filter_num_con_handles, con_handle, enable);
+}
+
+void hci_dump_select_l2cap_cid(uint16_t cid, int enable){
+    hci_dump_filter_list_update(filter_l2cap_cids, &filter_num_l2cap_cids, cid, enable);
+}
+
+void hci_dump_set_max_payload_len(int max_len){
+    filter_max_payload_len = max_len;
+}
@@ -66,7 +66,8 @@ extern "C" {
 typedef enum {
     HCI_DUMP_BLUEZ = 0,
     HCI_DUMP_PACKETLOGGER,
-    HCI_DUMP_STDOUT
+    HCI_DUMP_STDOUT,
+    HCI_DUMP_BTSNOOP_SEGMENTS,  // btsnoop ring of memory mapped files 'filename.0'...'filename.n' (POSIX)
 } hci_dump_format_t;
 
 /*
@@ -85,7 +86,7 @@ void hci_dump_set_max_packets(int packets); // -1 for unlimited
 void hci_dump_packet(uint8_t packet_type, uint8_t in, uint8_t *packet, uint16_t len);
 
 /*
- * @brief 
+ * @brief Log message. With ENABLE_HCI_DUMP_BINARY_LOG, format strings are identified by their address and must not change
  */
 void hci_dump_log(int log_level, const char * format, ...)
 #ifdef __GNUC__
@@ -98,6 +99,43 @@ __attribute__ ((format (__printf__, 2, 3)))
  */
 void hci_dump_enable_log_level(int log_level, int enable);
 
+/*
+ * @brief Enable/disable logging of HCI packet type, all packet types are enabled by default
+ * @param packet_type HCI_COMMAND_DATA_PACKET, HCI_ACL_DATA_PACKET, HCI_SCO_DATA_PACKET, or HCI_EVENT_PACKET
+ * @param enable
+ */
+void hci_dump_enable_packet_type(uint8_t packet_type, int enable);
+
+/*
+ * @brief Select connection handle for ACL and SCO packets. If any handle is selected, ACL and SCO packets for other handles are not logged
+ * @note up to HCI_DUMP_FILTER_MAX_ENTRIES handles can be selected
+ * @param con_handle
+ * @param enable
+ */
+void hci_dump_select_connection_handle(uint16_t con_handle, int enable);
+
+/*
+ * @brief Select L2CAP CID for ACL packets. If any CID is selected, ACL packets for other CIDs are not logged
+ * @note up to HCI_DUMP_FILTER_MAX_ENTRIES CIDs can be selected. The CID of continuation fragments is taken from the first fragment
+ * @param cid
+ * @param enable
+ */
+void hci_dump_select_l2cap_cid(uint16_t cid, int enable);
+
+/*
+ * @brief Truncate ACL and SCO packets to max_len bytes after HCI header. Packets on L2CAP fixed channels, e.g. Signaling, ATT, SM, are not truncated
+ * @note The HCI header keeps the original length, btsnoop records also store it
+ * @param max_len or -1 for unlimited
+ */
+void hci_dump_set_max_payload_len(int max_len);
+
+/*
+ * @brief Get number of packets and log messages dropped by asynchronous writer as its ring buffer was full
+ * @note requires ENABLE_HCI_DUMP_ASYNC_WRITER, returns 0 otherwise
+ * @returns number of dropped records since hci_dump_open
+ */
+uint32_t hci_dump_get_dropped_records(void);
+
 /*
  * @brief 
  */
@@ -115,7 +115,8 @@ typedef struct {
 
 typedef enum {
     HCI_TRANSPORT_CONFIG_UART,
-    HCI_TRANSPORT_CONFIG_USB
+    HCI_TRANSPORT_CONFIG_USB,
+    HCI_TRANSPORT_CONFIG_VIRTUAL
 } hci_transport_config_type_t;
 
 typedef struct {
@@ -139,6 +140,16 @@ typedef struct {
  */
 const hci_transport_t * hci_transport_h4_instance(const btstack_uart_block_t * uart_driver);
 
+/*
+ * @brief Get H4 UART transmit statistics since transport was opened
+ * @note idle time is measured from the end of one transmission to the start of the next one and thus
+ *       also includes periods without outgoing data
+ * @param num_packets sent
+ * @param idle_time_us total
+ * @param max_idle_time_us between two transmissions
+ */
+void hci_transport_h4_get_tx_idle_time(uint32_t * num_packets, uint64_t * idle_time_us, uint32_t * max_idle_time_us);
+
 /*
  * @brief Setup H5 instance with uart_driver
  * @param uart_driver to use 
@@ -172,6 +183,20 @@ const hci_transport_t * hci_transport_usb_instance(void);
  */
 void hci_transport_usb_set_path(int len, uint8_t * port_numbers);
 
+/**
+ * @brief Set number of USB IN transfers kept posted for HCI Events and ACL Data. Call before the transport is opened.
+ * @param num_event_transfers 1..HCI_TRANSPORT_USB_MAX_EVENT_IN_TRANSFERS, default 3
+ * @param num_acl_transfers 1..HCI_TRANSPORT_USB_MAX_ACL_IN_TRANSFERS, default 3
+ */
+void hci_transport_usb_set_in_transfer_count(int num_event_transfers, int num_acl_transfers);
+
+/**
+ * @brief Get number of times no USB IN transfer was posted for HCI Events and ACL Data since the transport was opened
+ * @param num_event_in_stalls
+ * @param num_acl_in_stalls
+ */
+void hci_transport_usb_get_in_transfer_stalls(uint32_t * num_event_in_stalls, uint32_t * num_acl_in_stalls);
+
 /* API_END */
     
 #if defined __cplusplus
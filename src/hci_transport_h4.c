@@ -103,6 +103,18 @@ static btstack_timer_source_t ehcill_sleep_ack_timer;
 #error HCI_OUTGOING_PRE_BUFFER_SIZE not defined. Please update hci.h
 #endif
 
+// Number of outgoing packets that can be queued. With a queue size > 1, packets are copied into the queue
+// and the next packet is sent from the block sent callback without returning to the run loop
+#ifndef HCI_TRANSPORT_H4_TX_QUEUE_SIZE
+#define HCI_TRANSPORT_H4_TX_QUEUE_SIZE 1
+#endif
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE < 1
+#error "HCI_TRANSPORT_H4_TX_QUEUE_SIZE must be at least 1"
+#endif
+#if defined(ENABLE_EHCILL) && (HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1)
+#error "HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1 is not supported with ENABLE_EHCILL"
+#endif
+
 static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size); 
 
 typedef enum {
@@ -136,6 +148,27 @@ static uint8_t * ehcill_tx_data;
 static uint16_t  ehcill_tx_len;   // 0 == no outgoing packet
 #endif
 
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1
+// outgoing packet queue, each slot holds packet type + packet
+static uint8_t  tx_queue_buffer[HCI_TRANSPORT_H4_TX_QUEUE_SIZE][1 + HCI_OUTGOING_PACKET_BUFFER_SIZE];
+static uint16_t tx_queue_len[HCI_TRANSPORT_H4_TX_QUEUE_SIZE];
+static uint16_t tx_queue_read_index;
+static uint16_t tx_queue_count;
+static uint16_t tx_queue_in_flight;
+static btstack_uart_block_segment_t tx_queue_blocks[BTSTACK_UART_MAX_SEND_BLOCKS];
+
+// stack waits for HCI_EVENT_TRANSPORT_PACKET_SENT, emitted from timer or block sent callback
+static int tx_packet_sent_pending;
+static int tx_packet_sent_timer_active;
+static btstack_timer_source_t tx_packet_sent_timer;
+#endif
+
+// UART idle time between end of one transmission and start of the next one
+static uint64_t tx_done_us;       // 0 == no transmission completed yet
+static uint64_t tx_idle_time_us;
+static uint32_t tx_max_idle_time_us;
+static uint32_t tx_num_packets;
+
 static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size) = dummy_handler;
 
 // packet reader state machine
@@ -143,6 +176,10 @@ static  H4_STATE h4_state;
 static uint16_t bytes_to_read;
 static uint16_t read_pos;
 
+// streaming mode: UART driver provides received data as it arrives, bytes of current block already received
+static int      stream_mode;
+static uint16_t stream_bytes_received;
+
 // incoming packet buffer
 static uint8_t hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + HCI_INCOMING_PACKET_BUFFER_SIZE + 1]; // packet type + max(acl header + acl payload, event header + event data)
 static uint8_t * hci_packet = &hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
@@ -180,6 +217,7 @@ static void hci_transport_h4_reset_statemachine(void){
     h4_state = H4_W4_PACKET_TYPE;
     read_pos = 0;
     bytes_to_read = 1;
+    stream_bytes_received = 0;
 }
 
 static void hci_transport_h4_trigger_next_read(void){
@@ -222,7 +260,8 @@ static void hci_transport_h4_packet_complete(void){
     packet_handler(hci_packet[0], &hci_packet[1], packet_len);
 }
 
-static void hci_transport_h4_block_read(void){
+// process bytes_to_read bytes that have been stored at hci_packet[read_pos]
+static void hci_transport_h4_block_complete(void){
 
     read_pos += bytes_to_read;
 
@@ -312,18 +351,164 @@ static void hci_transport_h4_block_read(void){
     if (h4_state == H4_W4_PAYLOAD && bytes_to_read == 0) {
         hci_transport_h4_packet_complete();
     }
+}
 
+static void hci_transport_h4_block_read(void){
+    hci_transport_h4_block_complete();
     if (h4_state != H4_OFF) {
         hci_transport_h4_trigger_next_read();
     }
 }
 
+// streaming mode: parse all complete packets from the received data in one pass
+static void hci_transport_h4_data_received(const uint8_t * data, uint16_t size){
+    while ((size > 0) && (h4_state != H4_OFF)){
+        uint16_t bytes_to_copy = btstack_min(size, bytes_to_read - stream_bytes_received);
+        (void)memcpy(&hci_packet[read_pos + stream_bytes_received], data, bytes_to_copy);
+        data += bytes_to_copy;
+        size -= bytes_to_copy;
+        stream_bytes_received += bytes_to_copy;
+        if (stream_bytes_received < bytes_to_read) break;
+        stream_bytes_received = 0;
+        // might deliver packet to stack, which might close the transport
+        hci_transport_h4_block_complete();
+    }
+}
+
+static void hci_transport_h4_tx_statistics_start(uint16_t num_packets){
+    uint64_t now_us = btstack_run_loop_get_time_us();
+    if (tx_done_us != 0){
+        uint64_t idle_us = now_us - tx_done_us;
+        tx_idle_time_us += idle_us;
+        // max idle time is capped at ~71 minutes
+        if (idle_us > 0xffffffffu){
+            idle_us = 0xffffffffu;
+        }
+        if (idle_us > tx_max_idle_time_us){
+            tx_max_idle_time_us = (uint32_t) idle_us;
+        }
+    }
+    tx_num_packets += num_packets;
+}
+
+static void hci_transport_h4_tx_statistics_done(void){
+    tx_done_us = btstack_run_loop_get_time_us();
+}
+
+static void hci_transport_h4_tx_statistics_reset(void){
+    tx_done_us          = 0;
+    tx_idle_time_us     = 0;
+    tx_max_idle_time_us = 0;
+    tx_num_packets      = 0;
+}
+
+void hci_transport_h4_get_tx_idle_time(uint32_t * num_packets, uint64_t * idle_time_us, uint32_t * max_idle_time_us){
+    *num_packets      = tx_num_packets;
+    *idle_time_us     = tx_idle_time_us;
+    *max_idle_time_us = tx_max_idle_time_us;
+}
+
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1
+
+static void hci_transport_h4_tx_queue_emit_packet_sent_if_ready(void){
+    static const uint8_t packet_sent_event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
+    if (tx_packet_sent_pending == 0) return;
+    if (tx_queue_count >= HCI_TRANSPORT_H4_TX_QUEUE_SIZE) return;
+    tx_packet_sent_pending = 0;
+    // notify upper stack that it can send again
+    packet_handler(HCI_EVENT_PACKET, (uint8_t *) &packet_sent_event[0], sizeof(packet_sent_event));
+}
+
+static void hci_transport_h4_tx_queue_packet_sent_timer_handler(btstack_timer_source_t * timer){
+    UNUSED(timer);
+    tx_packet_sent_timer_active = 0;
+    hci_transport_h4_tx_queue_emit_packet_sent_if_ready();
+}
+
+static void hci_transport_h4_tx_queue_send_next(void){
+    uint16_t num_packets = 1;
+    if ((btstack_uart->send_blocks != NULL) && (tx_queue_count > 1)){
+        num_packets = btstack_min(tx_queue_count, BTSTACK_UART_MAX_SEND_BLOCKS);
+    }
+    hci_transport_h4_tx_statistics_start(num_packets);
+    tx_queue_in_flight = num_packets;
+    tx_state = TX_W4_PACKET_SENT;
+    if (num_packets == 1){
+        btstack_uart->send_block(tx_queue_buffer[tx_queue_read_index], tx_queue_len[tx_queue_read_index]);
+        return;
+    }
+    // send all queued packets with a single write
+    uint16_t i;
+    for (i = 0; i < num_packets; i++){
+        uint16_t index = (tx_queue_read_index + i) % HCI_TRANSPORT_H4_TX_QUEUE_SIZE;
+        tx_queue_blocks[i].data = tx_queue_buffer[index];
+        tx_queue_blocks[i].len  = tx_queue_len[index];
+    }
+    btstack_uart->send_blocks(tx_queue_blocks, num_packets);
+}
+
+static void hci_transport_h4_tx_queue_block_sent(void){
+    tx_queue_read_index = (tx_queue_read_index + tx_queue_in_flight) % HCI_TRANSPORT_H4_TX_QUEUE_SIZE;
+    tx_queue_count -= tx_queue_in_flight;
+    tx_queue_in_flight = 0;
+    tx_state = TX_IDLE;
+    // chain next packet without returning to the run loop
+    if (tx_queue_count > 0){
+        hci_transport_h4_tx_queue_send_next();
+    }
+    hci_transport_h4_tx_queue_emit_packet_sent_if_ready();
+}
+
+static int hci_transport_h4_tx_queue_send_packet(uint8_t * packet, int size){
+    if (size > (int) sizeof(tx_queue_buffer[0])){
+        log_error("hci_transport_h4: packet too large for tx queue, %u bytes", size);
+        return -1;
+    }
+    uint16_t index = (tx_queue_read_index + tx_queue_count) % HCI_TRANSPORT_H4_TX_QUEUE_SIZE;
+    (void)memcpy(tx_queue_buffer[index], packet, size);
+    tx_queue_len[index] = (uint16_t) size;
+    tx_queue_count++;
+    tx_packet_sent_pending = 1;
+
+    if (tx_state == TX_IDLE){
+        hci_transport_h4_tx_queue_send_next();
+    }
+
+    // packet has been copied, emit packet sent from run loop unless queue is full
+    if (tx_packet_sent_timer_active == 0){
+        tx_packet_sent_timer_active = 1;
+        btstack_run_loop_set_timer_handler(&tx_packet_sent_timer, &hci_transport_h4_tx_queue_packet_sent_timer_handler);
+        btstack_run_loop_set_timer(&tx_packet_sent_timer, 0);
+        btstack_run_loop_add_timer(&tx_packet_sent_timer);
+    }
+    return 0;
+}
+
+static void hci_transport_h4_tx_queue_reset(void){
+    if (tx_packet_sent_timer_active){
+        btstack_run_loop_remove_timer(&tx_packet_sent_timer);
+        tx_packet_sent_timer_active = 0;
+    }
+    tx_packet_sent_pending = 0;
+    tx_queue_read_index = 0;
+    tx_queue_count = 0;
+    tx_queue_in_flight = 0;
+}
+#endif
+
 static void hci_transport_h4_block_sent(void){
 
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE == 1
     static const uint8_t packet_sent_event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
+#endif
 
     switch (tx_state){
         case TX_W4_PACKET_SENT:
+            hci_transport_h4_tx_statistics_done();
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1
+            hci_transport_h4_tx_queue_block_sent();
+            break;
+#else
             // packet fully sent, reset state
 #ifdef ENABLE_EHCILL
             ehcill_tx_len = 0;
@@ -337,6 +522,7 @@ static void hci_transport_h4_block_sent(void){
             // notify upper stack that it can send again
             packet_handler(HCI_EVENT_PACKET, (uint8_t *) &packet_sent_event[0], sizeof(packet_sent_event));
             break;
+#endif
 
 #ifdef ENABLE_EHCILL        
         case TX_W4_EHCILL_SENT: 
@@ -352,7 +538,11 @@ static void hci_transport_h4_block_sent(void){
 
 static int hci_transport_h4_can_send_now(uint8_t packet_type){
     UNUSED(packet_type);
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1
+    return (tx_state != TX_OFF) && (tx_packet_sent_pending == 0) && (tx_queue_count < HCI_TRANSPORT_H4_TX_QUEUE_SIZE);
+#else
     return tx_state == TX_IDLE;
+#endif
 }
 
 static int hci_transport_h4_send_packet(uint8_t packet_type, uint8_t * packet, int size){
@@ -370,6 +560,10 @@ static int hci_transport_h4_send_packet(uint8_t packet_type, uint8_t * packet, i
     }
 #endif
 
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1
+    return hci_transport_h4_tx_queue_send_packet(packet, size);
+#else
+
 #ifdef ENABLE_EHCILL
     // store request for later
     ehcill_tx_len   = size;
@@ -387,9 +581,11 @@ static int hci_transport_h4_send_packet(uint8_t packet_type, uint8_t * packet, i
 #endif
 
     // start sending
+    hci_transport_h4_tx_statistics_start(1);
     tx_state = TX_W4_PACKET_SENT;
     btstack_uart->send_block(packet, size);
     return 0;
+#endif
 }
 
 static void hci_transport_h4_init(const void * transport_config){
@@ -417,6 +613,12 @@ static void hci_transport_h4_init(const void * transport_config){
     btstack_uart->init(&uart_config);
     btstack_uart->set_block_received(&hci_transport_h4_block_read);
     btstack_uart->set_block_sent(&hci_transport_h4_block_sent);
+
+    // use streaming mode if supported by UART driver
+    stream_mode = btstack_uart->set_data_received != NULL;
+    if (stream_mode){
+        btstack_uart->set_data_received(&hci_transport_h4_data_received);
+    }
 }
 
 static int hci_transport_h4_open(void){
@@ -428,8 +630,14 @@ static int hci_transport_h4_open(void){
 
     // init rx + tx state machines
     hci_transport_h4_reset_statemachine();
-    hci_transport_h4_trigger_next_read();
+    if (!stream_mode){
+        hci_transport_h4_trigger_next_read();
+    }
     tx_state = TX_IDLE;
+    hci_transport_h4_tx_statistics_reset();
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1
+    hci_transport_h4_tx_queue_reset();
+#endif
 
 #ifdef ENABLE_EHCILL
     hci_transport_h4_ehcill_open();
@@ -442,6 +650,14 @@ static int hci_transport_h4_close(void){
     tx_state = TX_OFF;
     h4_state = H4_OFF;
 
+#if HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1
+    hci_transport_h4_tx_queue_reset();
+#endif
+    if (tx_num_packets > 0){
+        log_info("hci_transport_h4: sent %" PRIu32 " packets, tx idle time %" PRIu64 " us, max %" PRIu32 " us",
+                 tx_num_packets, tx_idle_time_us, tx_max_idle_time_us);
+    }
+
     // close uart driver
     return btstack_uart->close();
 }
@@ -661,6 +877,7 @@ static void hci_transport_h4_ehcill_handle_command(uint8_t action){
 #ifdef ENABLE_LOG_EHCILL
                     log_info("eHCILL: Received WAKE_UP (%02x)", action);
 #endif
+                    hci_transport_h4_tx_statistics_start(1);
                     tx_state = TX_W4_PACKET_SENT;
                     ehcill_state = EHCILL_STATE_AWAKE;
                     btstack_uart->send_block(ehcill_tx_data, ehcill_tx_len);
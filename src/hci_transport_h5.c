@@ -68,14 +68,21 @@ typedef enum {
     HCI_TRANSPORT_LINK_SEND_SLEEP                 = 1 <<  5,
     HCI_TRANSPORT_LINK_SEND_WOKEN                 = 1 <<  6,
     HCI_TRANSPORT_LINK_SEND_WAKEUP                = 1 <<  7,
-    HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET         = 1 <<  8,
-    HCI_TRANSPORT_LINK_SEND_ACK_PACKET            = 1 <<  9,
-    HCI_TRANSPORT_LINK_ENTER_SLEEP                = 1 << 10,
+    HCI_TRANSPORT_LINK_SEND_ACK_PACKET            = 1 <<  8,
+    HCI_TRANSPORT_LINK_ENTER_SLEEP                = 1 <<  9,
 
 } hci_transport_link_actions_t;
 
-// Configuration Field. No packet buffers -> sliding window = 1, no OOF flow control, support data integrity check
-#define LINK_CONFIG_SLIDING_WINDOW_SIZE 1
+// Max number of unacknowledged reliable packets. Window sizes > 1 require a packet buffer per slot
+#ifndef HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE
+#define HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE 1
+#endif
+#if (HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE < 1) || (HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE > 7)
+#error "HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE must be in range 1..7"
+#endif
+
+// Configuration Field. Sliding window as configured, no OOF flow control, support data integrity check
+#define LINK_CONFIG_SLIDING_WINDOW_SIZE HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE
 #define LINK_CONFIG_OOF_FLOW_CONTROL 0
 #define LINK_CONFIG_DATA_INTEGRITY_CHECK 1
 #define LINK_CONFIG_VERSION_NR 0
@@ -128,10 +135,25 @@ static uint8_t  link_peer_supports_data_integrity_check;
 static btstack_timer_source_t inactivity_timer;
 static uint16_t link_inactivity_timeout_ms; // auto-sleep if set
 
-// Outgoing packet
-static uint8_t   hci_packet_type;
-static uint16_t  hci_packet_size;
-static uint8_t * hci_packet;
+// Outgoing reliable packets, oldest unacknowledged packet has sequence number link_seq_nr
+typedef struct {
+    uint8_t * packet;
+    uint16_t  size;
+    uint8_t   type;
+    uint32_t  sent_ms;
+} hci_transport_link_queue_entry_t;
+
+static hci_transport_link_queue_entry_t link_queue[HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE];
+static uint8_t link_queue_head;
+static uint8_t link_queue_count;    // number of unacknowledged packets
+static uint8_t link_queue_sent;     // number of unacknowledged packets that have been sent since last retransmission
+static uint8_t link_window_size;    // negotiated sliding window size
+static int     link_queue_notify_pending;
+
+#if HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE > 1
+// with window size > 1, packets are copied and the HCI packet buffer is released after sending
+static uint8_t link_queue_storage[HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE][HCI_OUTGOING_PACKET_BUFFER_SIZE];
+#endif
 
 // hci packet handler
 static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
@@ -148,6 +170,7 @@ static int hci_transport_bcsp_mode;
 static void hci_transport_h5_process_frame(uint16_t frame_size);
 static int  hci_transport_link_have_outgoing_packet(void);
 static void hci_transport_link_send_queued_packet(void);
+static void hci_transport_link_update_resend_timer(void);
 static void hci_transport_link_set_timer(uint16_t timeout_ms);
 static void hci_transport_link_timeout_handler(btstack_timer_source_t * timer);
 static void hci_transport_link_run(void);
@@ -348,19 +371,38 @@ static void hci_transport_link_send_sleep(void){
     hci_transport_link_send_control(link_control_sleep, sizeof(link_control_sleep));
 }
 
+static int hci_transport_link_inc_seq_nr(int seq_nr){
+    return (seq_nr + 1) & 0x07;    
+}
+
+static int hci_transport_link_have_unsent_packet(void){
+    return link_queue_sent < link_queue_count;
+}
+
+// send next packet from queue, all packets are sent in order after a retransmission
 static void hci_transport_link_send_queued_packet(void){
 
+    hci_transport_link_queue_entry_t * entry = &link_queue[(link_queue_head + link_queue_sent) % HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE];
+    uint8_t seq_nr = (link_seq_nr + link_queue_sent) & 0x07;
+    link_queue_sent++;
+
     uint8_t header[4];
-    hci_transport_link_calc_header(header, link_seq_nr, link_ack_nr, link_peer_supports_data_integrity_check, 1, hci_packet_type, hci_packet_size);
+    hci_transport_link_calc_header(header, seq_nr, link_ack_nr, link_peer_supports_data_integrity_check, 1, entry->type, entry->size);
 
     uint16_t data_integrity_check = 0;
     if (link_peer_supports_data_integrity_check){
-        data_integrity_check = crc16_calc_for_slip_frame(header, hci_packet, hci_packet_size);
+        data_integrity_check = crc16_calc_for_slip_frame(header, entry->packet, entry->size);
     }
-    log_debug("hci_transport_link_send_queued_packet: seq %u, ack %u, size %u. Append dic %u, dic = 0x%04x", link_seq_nr, link_ack_nr, hci_packet_size, link_peer_supports_data_integrity_check, data_integrity_check);
-    log_debug_hexdump(hci_packet, hci_packet_size);
+    log_debug("hci_transport_link_send_queued_packet: seq %u, ack %u, size %u. Append dic %u, dic = 0x%04x", seq_nr, link_ack_nr, entry->size, link_peer_supports_data_integrity_check, data_integrity_check);
+    log_debug_hexdump(entry->packet, entry->size);
+
+    hci_transport_slip_send_frame(header, entry->packet, entry->size, data_integrity_check);
 
-    hci_transport_slip_send_frame(header, hci_packet, hci_packet_size, data_integrity_check);
+    // start resend timer for this packet
+    entry->sent_ms = btstack_run_loop_get_time_ms();
+    if (link_queue_sent == 1){
+        hci_transport_link_update_resend_timer();
+    }
 
     // reset inactvitiy timer
     hci_transport_inactivity_timer_set();
@@ -414,8 +456,7 @@ static void hci_transport_link_run(void){
         hci_transport_link_send_wakeup();
         return;
     }
-    if (hci_transport_link_actions & HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET){
-        hci_transport_link_actions &= ~HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
+    if (hci_transport_link_have_unsent_packet() && (link_peer_asleep == 0)){
         // packet already contains ack, no need to send addtitional one
         hci_transport_link_actions &= ~HCI_TRANSPORT_LINK_SEND_ACK_PACKET;
         hci_transport_link_send_queued_packet();
@@ -436,6 +477,7 @@ static void hci_transport_link_run(void){
 }
 
 static void hci_transport_link_set_timer(uint16_t timeout_ms){
+    btstack_run_loop_remove_timer(&link_timer);
     btstack_run_loop_set_timer_handler(&link_timer, &hci_transport_link_timeout_handler);
     btstack_run_loop_set_timer(&link_timer, timeout_ms);
     btstack_run_loop_add_timer(&link_timer);
@@ -462,9 +504,9 @@ static void hci_transport_link_timeout_handler(btstack_timer_source_t * ts){
                 hci_transport_link_set_timer(LINK_WAKEUP_MS);
                 return;
             }
-            // resend packet
-            hci_transport_link_actions |= HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
-            hci_transport_link_set_timer(link_resend_timeout_ms);
+            // oldest packet not acknowledged in time, resend all unacknowledged packets
+            log_info("h5 resend %u packets starting with seq %u", link_queue_sent, link_seq_nr);
+            link_queue_sent = 0;
             break;
         default:
             break;
@@ -484,23 +526,70 @@ static void hci_transport_link_init(void){
     hci_transport_link_run();
 }
 
-static int hci_transport_link_inc_seq_nr(int seq_nr){
-    return (seq_nr + 1) & 0x07;    
-}
-
 static int hci_transport_link_have_outgoing_packet(void){
-    return hci_packet != NULL;
+    return link_queue_count > 0;
 }
 
 static void hci_transport_link_clear_queue(void){
     btstack_run_loop_remove_timer(&link_timer);
-    hci_packet = NULL;
+    link_queue_head  = 0;
+    link_queue_count = 0;
+    link_queue_sent  = 0;
+    link_queue_notify_pending = 0;
 }
 
 static void hci_transport_h5_queue_packet(uint8_t packet_type, uint8_t *packet, int size){
-    hci_packet = packet;
-    hci_packet_type = packet_type;
-    hci_packet_size = size;
+    hci_transport_link_queue_entry_t * entry = &link_queue[(link_queue_head + link_queue_count) % HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE];
+#if HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE > 1
+    entry->packet = link_queue_storage[(link_queue_head + link_queue_count) % HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE];
+    (void)memcpy(entry->packet, packet, size);
+#else
+    entry->packet = packet;
+#endif
+    entry->type = packet_type;
+    entry->size = size;
+    link_queue_count++;
+    link_queue_notify_pending = 1;
+}
+
+// resend timer is running for oldest sent packet, wakeup timer while peer is asleep
+static void hci_transport_link_update_resend_timer(void){
+    if (link_peer_asleep) return;
+    if (link_queue_sent == 0){
+        btstack_run_loop_remove_timer(&link_timer);
+        return;
+    }
+    uint32_t elapsed_ms = btstack_run_loop_get_time_ms() - link_queue[link_queue_head].sent_ms;
+    uint16_t timeout_ms = 0;
+    if (elapsed_ms < link_resend_timeout_ms){
+        timeout_ms = link_resend_timeout_ms - elapsed_ms;
+    }
+    hci_transport_link_set_timer(timeout_ms);
+}
+
+// process cumulative acknowledgement: peer expects ack_nr next, i.e. all packets before have been received
+static void hci_transport_link_process_ack(uint8_t ack_nr){
+    uint8_t num_acked = (ack_nr - link_seq_nr) & 0x07;
+    if (num_acked == 0) return;
+    if (num_acked > link_queue_count){
+        log_info("ack nr %u outside of window, seq %u, %u unacknowledged", ack_nr, link_seq_nr, link_queue_count);
+        return;
+    }
+    log_debug("%u outgoing packets starting with seq %u ack'ed", num_acked, link_seq_nr);
+    link_seq_nr      = ack_nr;
+    link_queue_head  = (link_queue_head + num_acked) % HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE;
+    link_queue_count -= num_acked;
+    link_queue_sent  = (link_queue_sent > num_acked) ? (link_queue_sent - num_acked) : 0;
+    hci_transport_link_update_resend_timer();
+}
+
+// notify upper stack that it can send again, if it waits for it
+static void hci_transport_link_notify_packet_sent(void){
+    if (link_queue_notify_pending == 0) return;
+    if (link_queue_count >= link_window_size) return;
+    link_queue_notify_pending = 0;
+    uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
+    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
 }
 
 static void hci_transport_h5_emit_sleep_state(int sleep_active){
@@ -609,9 +698,17 @@ static void hci_transport_h5_process_frame(uint16_t frame_size){
                 break;
             }
             if (memcmp(slip_payload, link_control_config_response, link_control_config_response_prefix_len) == 0){
-                uint8_t config = slip_payload[2];
-                link_peer_supports_data_integrity_check = (config & 0x10) != 0;
-                log_info("link received config response 0x%02x, data integrity check supported %u", config, link_peer_supports_data_integrity_check);
+                if (link_payload_len == link_control_config_response_prefix_len){
+                    // no config field: sliding window size 1, no data integrity check
+                    link_peer_supports_data_integrity_check = 0;
+                    link_window_size = 1;
+                    log_info("link received config response, no config field");
+                } else {
+                    uint8_t config = slip_payload[2];
+                    link_peer_supports_data_integrity_check = (config & 0x10) != 0;
+                    link_window_size = btstack_max(1, btstack_min(config & 0x07, HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE));
+                    log_info("link received config response 0x%02x, data integrity check supported %u, sliding window size %u", config, link_peer_supports_data_integrity_check, link_window_size);
+                }
                 link_state = LINK_ACTIVE;
                 btstack_run_loop_remove_timer(&link_timer);
                 log_info("link activated");
@@ -640,17 +737,8 @@ static void hci_transport_h5_process_frame(uint16_t frame_size){
 
             // Process ACKs in reliable packet and explicit ack packets
             if (reliable_packet || (link_packet_type == LINK_ACKNOWLEDGEMENT_TYPE)){
-                // our packet is good if the remote expects our seq nr + 1
-                int next_seq_nr = hci_transport_link_inc_seq_nr(link_seq_nr);
-                if (hci_transport_link_have_outgoing_packet() && (next_seq_nr == ack_nr)){
-                    log_debug("outoing packet with seq %u ack'ed", link_seq_nr);
-                    link_seq_nr = next_seq_nr;
-                    hci_transport_link_clear_queue();
-
-                    // notify upper stack that it can send again
-                    uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
-                    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
-                }
+                hci_transport_link_process_ack(ack_nr);
+                hci_transport_link_notify_packet_sent();
             } 
 
             switch (link_packet_type){
@@ -684,12 +772,15 @@ static void hci_transport_h5_process_frame(uint16_t frame_size){
                     if (memcmp(slip_payload, link_control_wakeup, sizeof(link_control_wakeup)) == 0){
                         log_info("link: received wakupe message -> send woken");
                         link_peer_asleep = 0;
+                        hci_transport_link_update_resend_timer();
                         hci_transport_link_actions |= HCI_TRANSPORT_LINK_SEND_WOKEN;
                         break;
                     }
                     if (memcmp(slip_payload, link_control_woken, sizeof(link_control_woken)) == 0){
                         log_info("link: received woken message");
                         link_peer_asleep = 0;
+                        // stop wakeup timer
+                        hci_transport_link_update_resend_timer();
                         // queued packet will be sent in hci_transport_link_run if needed
                         break;
                     }
@@ -735,35 +826,55 @@ static void hci_transport_link_update_resend_timeout(uint32_t baudrate){
 static uint8_t hci_transport_link_read_byte;
 static int hci_transport_h5_active;
 
+// streaming mode: UART driver provides received data as it arrives
+static int hci_transport_h5_stream_mode;
+
 static void hci_transport_h5_read_next_byte(void){
     btstack_uart->receive_block(&hci_transport_link_read_byte, 1);    
 }
 
+#ifdef ENABLE_LOG_H5_FRAME_TIMING
 // track time receiving SLIP frame
 static uint32_t hci_transport_h5_receive_start;
-static void hci_transport_h5_block_received(){
-    if (hci_transport_h5_active == 0) return;
-
-    // track start time when receiving first byte // a bit hackish
-    if ((hci_transport_h5_receive_start == 0) && (hci_transport_link_read_byte != BTSTACK_SLIP_SOF)){
-        hci_transport_h5_receive_start = btstack_run_loop_get_time_ms();
-    }
-    btstack_slip_decoder_process(hci_transport_link_read_byte);
-    uint16_t frame_size = btstack_slip_decoder_frame_size();
-    if (frame_size) {
+#endif
+
+static void hci_transport_h5_process_data(const uint8_t * data, uint16_t size){
+    while ((size > 0) && hci_transport_h5_active){
+#ifdef ENABLE_LOG_H5_FRAME_TIMING
+        // track start time when receiving first data // a bit hackish
+        if ((hci_transport_h5_receive_start == 0) && (data[0] != BTSTACK_SLIP_SOF)){
+            hci_transport_h5_receive_start = btstack_run_loop_get_time_ms();
+        }
+#endif
+        uint16_t bytes_processed = btstack_slip_decoder_process_block(data, size);
+        data += bytes_processed;
+        size -= bytes_processed;
+        uint16_t frame_size = btstack_slip_decoder_frame_size();
+        if (frame_size == 0) continue;
+#ifdef ENABLE_LOG_H5_FRAME_TIMING
         // track time
         uint32_t packet_receive_time = btstack_run_loop_get_time_ms() - hci_transport_h5_receive_start;
         uint32_t nominmal_time = (frame_size + 6) * 10 * 1000 / uart_config.baudrate;
         log_info("slip frame time %u ms for %u decoded bytes. nomimal time %u ms", (int) packet_receive_time, frame_size, (int) nominmal_time);
         // reset state
         hci_transport_h5_receive_start = 0;
-        // 
+#endif
         hci_transport_h5_process_frame(frame_size);
         hci_transport_slip_init();
     }
+}
+
+static void hci_transport_h5_block_received(void){
+    if (hci_transport_h5_active == 0) return;
+    hci_transport_h5_process_data(&hci_transport_link_read_byte, 1);
     hci_transport_h5_read_next_byte();
 }
 
+static void hci_transport_h5_data_received(const uint8_t * data, uint16_t size){
+    if (hci_transport_h5_active == 0) return;
+    hci_transport_h5_process_data(data, size);
+}
+
 static void hci_transport_h5_block_sent(void){
     if (hci_transport_h5_active == 0) return;
 
@@ -776,6 +887,9 @@ static void hci_transport_h5_block_sent(void){
     // done
     slip_write_active = 0;
 
+    // with sliding window > 1, upper stack can continue after packet was sent
+    hci_transport_link_notify_packet_sent();
+
     // enter sleep mode after sending sleep message
     if (hci_transport_link_actions & HCI_TRANSPORT_LINK_ENTER_SLEEP){
         hci_transport_link_actions &= ~HCI_TRANSPORT_LINK_ENTER_SLEEP;
@@ -814,6 +928,12 @@ static void hci_transport_h5_init(const void * transport_config){
     btstack_uart->init(&uart_config);
     btstack_uart->set_block_received(&hci_transport_h5_block_received);
     btstack_uart->set_block_sent(&hci_transport_h5_block_sent);
+
+    // use streaming mode if supported by UART driver
+    hci_transport_h5_stream_mode = btstack_uart->set_data_received != NULL;
+    if (hci_transport_h5_stream_mode){
+        btstack_uart->set_data_received(&hci_transport_h5_data_received);
+    }
 }
 
 static int hci_transport_h5_open(void){
@@ -852,7 +972,9 @@ static int hci_transport_h5_open(void){
 
     // start receiving
     hci_transport_h5_active = 1;
-    hci_transport_h5_read_next_byte();
+    if (!hci_transport_h5_stream_mode){
+        hci_transport_h5_read_next_byte();
+    }
 
     return 0;
 }
@@ -867,7 +989,7 @@ static void hci_transport_h5_register_packet_handler(void (*handler)(uint8_t pac
 }
 
 static int hci_transport_h5_can_send_packet_now(uint8_t packet_type){
-    int res = !hci_transport_link_have_outgoing_packet() && (link_state == LINK_ACTIVE);
+    int res = (link_state == LINK_ACTIVE) && (link_queue_count < link_window_size) && (link_queue_notify_pending == 0);
     // log_info("can_send_packet_now: %u", res);
     return res;
 }
@@ -890,9 +1012,6 @@ static int hci_transport_h5_send_packet(uint8_t packet_type, uint8_t *packet, in
         }
         hci_transport_link_actions |= HCI_TRANSPORT_LINK_SEND_WAKEUP;
         hci_transport_link_set_timer(LINK_WAKEUP_MS);
-    } else {
-        hci_transport_link_actions |= HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
-        hci_transport_link_set_timer(link_resend_timeout_ms);
     }
     hci_transport_link_run();
     return 0;
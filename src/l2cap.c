@@ -134,6 +134,14 @@ typedef enum {
 #define L2CAP_USES_CHANNELS
 #endif
 
+// ACL packets a connection may send per round of the ACL TX scheduler
+#ifndef HCI_ACL_TX_SCHEDULER_QUANTUM
+#define HCI_ACL_TX_SCHEDULER_QUANTUM 4
+#endif
+#if HCI_ACL_TX_SCHEDULER_QUANTUM < 1
+#error "HCI_ACL_TX_SCHEDULER_QUANTUM must be at least 1"
+#endif
+
 // prototypes
 static void l2cap_run(void);
 static void l2cap_hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
@@ -205,6 +213,13 @@ static uint16_t  local_source_cid  = 0x40;
 // next signaling sequence number
 static uint8_t   sig_seq_nr  = 0xff;
 
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+// current round of deficit round robin scheduler
+static uint16_t l2cap_tx_scheduler_round;
+// set while a channel is triggered, requests to send during that are handled by the active loop
+static bool     l2cap_tx_scheduler_active;
+#endif
+
 // used to cache l2cap rejects, echo, and informational requests
 static l2cap_signaling_response_t signaling_responses[NR_PENDING_SIGNALING_RESPONSES];
 static int signaling_responses_pending;
@@ -1135,6 +1150,13 @@ void l2cap_request_can_send_now_event(uint16_t local_cid){
     l2cap_notify_channel_can_send();
 }
 
+uint8_t l2cap_set_tx_class(uint16_t local_cid, hci_acl_tx_class_t tx_class){
+    l2cap_channel_t *channel = l2cap_get_channel_for_local_cid(local_cid);
+    if (!channel) return L2CAP_LOCAL_CID_DOES_NOT_EXIST;
+    channel->tx_class = tx_class;
+    return ERROR_CODE_SUCCESS;
+}
+
 int  l2cap_can_send_packet_now(uint16_t local_cid){
     l2cap_channel_t *channel = l2cap_get_channel_for_local_cid(local_cid);
     if (!channel) return 0;
@@ -1925,6 +1947,7 @@ static l2cap_channel_t * l2cap_create_channel_entry(btstack_packet_handler_t pac
     // 
     channel->local_cid = l2cap_next_local_cid();
     channel->con_handle = HCI_CON_HANDLE_INVALID;
+    channel->tx_class = HCI_ACL_TX_CLASS_BULK;
 
     // set initial state
     channel->state = L2CAP_STATE_WILL_SEND_CREATE_CONNECTION;
@@ -2066,32 +2089,28 @@ static void l2cap_handle_connection_success_for_addr(bd_addr_t address, hci_con_
 }
 #endif
 
-static bool l2cap_channel_ready_to_send(l2cap_channel_t * channel){
+// channel has data to send, independent of available buffers on the Bluetooth module
+static bool l2cap_channel_wants_to_send(l2cap_channel_t * channel){
     switch (channel->channel_type){
 #ifdef ENABLE_CLASSIC
         case L2CAP_CHANNEL_TYPE_CLASSIC:
 #ifdef ENABLE_L2CAP_ENHANCED_RETRANSMISSION_MODE
             // send if we have more data and remote windows isn't full yet
             if (channel->mode == L2CAP_CHANNEL_MODE_ENHANCED_RETRANSMISSION) {
-                if (channel->unacked_frames >= btstack_min(channel->num_stored_tx_frames, channel->remote_tx_window_size)) return false;
-                return hci_can_send_acl_classic_packet_now() != 0;
+                return channel->unacked_frames < btstack_min(channel->num_stored_tx_frames, channel->remote_tx_window_size);
             }
 #endif
-            if (!channel->waiting_for_can_send_now) return false;
-            return (hci_can_send_acl_classic_packet_now() != 0);
+            return channel->waiting_for_can_send_now != 0;
         case L2CAP_CHANNEL_TYPE_CONNECTIONLESS:
-            if (!channel->waiting_for_can_send_now) return false;
-            return hci_can_send_acl_classic_packet_now() != 0;
+            return channel->waiting_for_can_send_now != 0;
 #endif
 #ifdef ENABLE_BLE
         case L2CAP_CHANNEL_TYPE_LE_FIXED:
-            if (!channel->waiting_for_can_send_now) return false;
-            return hci_can_send_acl_le_packet_now() != 0;
+            return channel->waiting_for_can_send_now != 0;
 #ifdef ENABLE_LE_DATA_CHANNELS
         case L2CAP_CHANNEL_TYPE_LE_DATA_CHANNEL:
             if (channel->send_sdu_buffer == NULL) return false;
-            if (channel->credits_outgoing == 0) return false;
-            return hci_can_send_acl_le_packet_now() != 0;
+            return channel->credits_outgoing != 0;
 #endif
 #endif
         default:
@@ -2099,6 +2118,26 @@ static bool l2cap_channel_ready_to_send(l2cap_channel_t * channel){
     }
 }
 
+static bool l2cap_channel_ready_to_send(l2cap_channel_t * channel){
+    if (!l2cap_channel_wants_to_send(channel)) return false;
+    switch (channel->channel_type){
+#ifdef ENABLE_CLASSIC
+        case L2CAP_CHANNEL_TYPE_CLASSIC:
+        case L2CAP_CHANNEL_TYPE_CONNECTIONLESS:
+            return hci_can_send_acl_classic_packet_now() != 0;
+#endif
+#ifdef ENABLE_BLE
+        case L2CAP_CHANNEL_TYPE_LE_FIXED:
+#ifdef ENABLE_LE_DATA_CHANNELS
+        case L2CAP_CHANNEL_TYPE_LE_DATA_CHANNEL:
+#endif
+            return hci_can_send_acl_le_packet_now() != 0;
+#endif
+        default:
+            return false;
+    }
+}
+
 static void l2cap_channel_trigger_send(l2cap_channel_t * channel){
     switch (channel->channel_type){
 #ifdef ENABLE_CLASSIC
@@ -2133,6 +2172,169 @@ static void l2cap_channel_trigger_send(l2cap_channel_t * channel){
     }
 }
 
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+
+// fixed channels are shared by all connections
+static hci_connection_t * l2cap_channel_tx_connection(l2cap_channel_t * channel){
+    switch (channel->channel_type){
+#ifdef ENABLE_CLASSIC
+        case L2CAP_CHANNEL_TYPE_CLASSIC:
+#endif
+#ifdef ENABLE_LE_DATA_CHANNELS
+        case L2CAP_CHANNEL_TYPE_LE_DATA_CHANNEL:
+#endif
+            return hci_connection_for_handle(channel->con_handle);
+        default:
+            return NULL;
+    }
+}
+
+static hci_acl_tx_class_t l2cap_channel_tx_class(l2cap_channel_t * channel){
+    switch (channel->channel_type){
+#ifdef ENABLE_CLASSIC
+        case L2CAP_CHANNEL_TYPE_CLASSIC:
+#endif
+#ifdef ENABLE_LE_DATA_CHANNELS
+        case L2CAP_CHANNEL_TYPE_LE_DATA_CHANNEL:
+#endif
+            return channel->tx_class;
+        default:
+            return HCI_ACL_TX_CLASS_CONTROL;
+    }
+}
+
+// update queue depth and wait time of all connections, returns highest class with channel ready to send
+static hci_acl_tx_class_t l2cap_tx_scheduler_update(void){
+    btstack_linked_list_iterator_t it;
+    hci_connections_get_iterator(&it);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+        connection->acl_tx_queue_depth = 0;
+    }
+
+    hci_acl_tx_class_t tx_class = HCI_ACL_TX_CLASS_NUM;
+    btstack_linked_list_iterator_init(&it, &l2cap_channels);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
+        if (!l2cap_channel_wants_to_send(channel)) continue;
+        hci_connection_t * connection = l2cap_channel_tx_connection(channel);
+        if (connection != NULL){
+            connection->acl_tx_queue_depth++;
+        }
+        if (!l2cap_channel_ready_to_send(channel)) continue;
+        hci_acl_tx_class_t channel_tx_class = l2cap_channel_tx_class(channel);
+        if (channel_tx_class < tx_class){
+            tx_class = channel_tx_class;
+        }
+    }
+
+    uint32_t now = btstack_run_loop_get_time_ms();
+    hci_connections_get_iterator(&it);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+        if (connection->acl_tx_queue_depth == 0u){
+            // idle connections don't keep unused quantum, debt is bounded by the fragments of a single packet
+            connection->acl_tx_waiting = 0;
+            if (connection->acl_tx_deficit > 0){
+                connection->acl_tx_deficit = 0;
+            }
+        } else if (connection->acl_tx_waiting == 0u){
+            connection->acl_tx_waiting = 1;
+            connection->acl_tx_wait_start_ms = now;
+        }
+    }
+    return tx_class;
+}
+
+// deficit round robin over connections with channels of given class ready to send
+static l2cap_channel_t * l2cap_tx_scheduler_select(hci_acl_tx_class_t tx_class){
+    l2cap_channel_t * first_channel = NULL;
+    int32_t max_deficit = INT16_MIN;
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &l2cap_channels);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
+        if (l2cap_channel_tx_class(channel) != tx_class) continue;
+        if (!l2cap_channel_ready_to_send(channel)) continue;
+        hci_connection_t * connection = l2cap_channel_tx_connection(channel);
+        if (connection == NULL) return channel;
+        if (connection->acl_tx_deficit > 0) return channel;
+        if (first_channel == NULL){
+            first_channel = channel;
+        }
+        if (connection->acl_tx_deficit > max_deficit){
+            max_deficit = connection->acl_tx_deficit;
+        }
+    }
+    if (first_channel == NULL) return NULL;
+
+    // all connections have used their quantum, add as many rounds as needed for one of them to send.
+    // the rounds are added to all connections with channels ready to send in any class, as the quantum
+    // is shared by all classes of a connection. new deficit is at most HCI_ACL_TX_SCHEDULER_QUANTUM
+    int32_t rounds = ((1 - max_deficit) + HCI_ACL_TX_SCHEDULER_QUANTUM - 1) / HCI_ACL_TX_SCHEDULER_QUANTUM;
+    l2cap_tx_scheduler_round++;
+    btstack_linked_list_iterator_init(&it, &l2cap_channels);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
+        if (!l2cap_channel_ready_to_send(channel)) continue;
+        hci_connection_t * connection = l2cap_channel_tx_connection(channel);
+        if (connection == NULL) continue;
+        if (connection->acl_tx_round == l2cap_tx_scheduler_round) continue;
+        connection->acl_tx_round = l2cap_tx_scheduler_round;
+        int32_t deficit = connection->acl_tx_deficit + (rounds * HCI_ACL_TX_SCHEDULER_QUANTUM);
+        connection->acl_tx_deficit = (int16_t) ((deficit < HCI_ACL_TX_SCHEDULER_QUANTUM) ? deficit : HCI_ACL_TX_SCHEDULER_QUANTUM);
+    }
+
+    // first connection in list order with deficit
+    btstack_linked_list_iterator_init(&it, &l2cap_channels);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
+        if (l2cap_channel_tx_class(channel) != tx_class) continue;
+        if (!l2cap_channel_ready_to_send(channel)) continue;
+        if (l2cap_channel_tx_connection(channel)->acl_tx_deficit > 0) return channel;
+    }
+    return first_channel;
+}
+
+static void l2cap_notify_channel_can_send(void){
+    // sending from a triggered channel might emit packet sent events synchronously. instead of selecting
+    // channels recursively, which lets the triggered connection use all buffers, the loop below continues
+    if (l2cap_tx_scheduler_active) return;
+    l2cap_tx_scheduler_active = true;
+    while (true){
+        hci_acl_tx_class_t tx_class = l2cap_tx_scheduler_update();
+        if (tx_class == HCI_ACL_TX_CLASS_NUM) break;
+        l2cap_channel_t * channel = l2cap_tx_scheduler_select(tx_class);
+        if (channel == NULL) break;
+
+        hci_connection_t * connection = l2cap_channel_tx_connection(channel);
+        if (connection != NULL){
+            uint32_t wait_time_ms = btstack_run_loop_get_time_ms() - connection->acl_tx_wait_start_ms;
+            connection->acl_tx_max_wait_ms = btstack_max(connection->acl_tx_max_wait_ms, wait_time_ms);
+            connection->acl_tx_waiting = 0;
+        }
+
+        // requeue channel for fairness between channels of a connection
+        btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
+        btstack_linked_list_add_tail(&l2cap_channels, (btstack_linked_item_t *) channel);
+
+        // trigger sending, ACL packets sent by the channel are charged to its connection
+        hci_con_handle_t con_handle = HCI_CON_HANDLE_INVALID;
+        if (connection != NULL){
+            con_handle = connection->con_handle;
+            connection->acl_tx_scheduled = 1;
+        }
+        l2cap_channel_trigger_send(channel);
+        connection = hci_connection_for_handle(con_handle);
+        if (connection != NULL){
+            connection->acl_tx_scheduled = 0;
+        }
+    }
+    l2cap_tx_scheduler_active = false;
+}
+
+#else
+
 static void l2cap_notify_channel_can_send(void){
     bool done = false;
     while (!done){
@@ -2157,6 +2359,7 @@ static void l2cap_notify_channel_can_send(void){
         }
     }
 }
+#endif
 
 #ifdef L2CAP_USES_CHANNELS
 
@@ -3810,10 +4013,15 @@ static void l2cap_le_send_pdu(l2cap_channel_t *channel){
 
     channel->credits_outgoing--;
 
+    // update state before sending, synchronous transports emit the packet sent event from within
+    int sdu_complete = channel->send_sdu_pos >= (channel->send_sdu_len + 2);
+    if (sdu_complete){
+        channel->send_sdu_buffer = NULL;
+    }
+
     hci_send_acl_packet_buffer(8 + pos);
 
-    if (channel->send_sdu_pos >= (channel->send_sdu_len + 2)){
-        channel->send_sdu_buffer = NULL;
+    if (sdu_complete){
         // send done event
         l2cap_emit_simple_event_with_cid(channel, L2CAP_EVENT_LE_PACKET_SENT);
         // inform about can send now
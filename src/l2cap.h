@@ -228,6 +228,9 @@ typedef struct {
 
     bd_addr_t address;
     bd_addr_type_t address_type;
+
+    // traffic class for ACL TX scheduler
+    hci_acl_tx_class_t tx_class;
     
     uint8_t   remote_sig_id;    // used by other side, needed for delayed response
     uint8_t   local_sig_id;     // own signaling identifier
@@ -551,6 +554,15 @@ int  l2cap_can_send_packet_now(uint16_t local_cid);
  */
 void l2cap_request_can_send_now_event(uint16_t local_cid);
 
+/**
+ * @brief Set traffic class used by ACL TX scheduler, default: HCI_ACL_TX_CLASS_BULK
+ * @note only used with ENABLE_HCI_ACL_TX_SCHEDULER. Fixed channels, e.g. ATT, use HCI_ACL_TX_CLASS_CONTROL
+ * @param local_cid
+ * @param tx_class
+ * @return status ERROR_CODE_SUCCESS or L2CAP_LOCAL_CID_DOES_NOT_EXIST
+ */
+uint8_t l2cap_set_tx_class(uint16_t local_cid, hci_acl_tx_class_t tx_class);
+
 /** 
  * @brief Reserve outgoing buffer
  * @note Only for L2CAP Basic Mode Channels
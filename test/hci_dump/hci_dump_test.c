@@ -0,0 +1,521 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+
+/*
+ * hci_dump_test.c
+ *
+ * Writes ACL packets with sequence numbers into a PacketLogger file via hci_dump and reports the time spent
+ * in hci_dump_packet. The file is parsed afterwards to verify that all packets have been written in order,
+ * except for records reported as dropped, and that hci_dump_set_max_packets truncates the file, also if truncations
+ * are requested faster than the asynchronous writer handles them.
+ * The btsnoop segment files are verified to contain the most recent packets while open and after close.
+ * Finally, packet type, connection handle, and L2CAP CID filters and payload truncation are checked
+ * and the time spent in log_info is reported. Log messages are verified after decoding them if needed.
+ *
+ * Build with -DENABLE_HCI_DUMP_ASYNC_WRITER to test the asynchronous writer and with
+ * -DENABLE_HCI_DUMP_BINARY_LOG to test binary log messages.
+ */
+
+#define BTSTACK_FILE__ "hci_dump_test.c"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_config.h"
+#include "btstack_debug.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_dump.h"
+
+#define DUMP_FILE   "hci_dump_test.pklg"
+#define SNOOP_FILE  "hci_dump_test.btsnoop"
+#define NUM_PACKETS 200000
+#define NUM_LOGS    100000
+#define MAX_LEN     300
+
+static uint8_t packet[MAX_LEN];
+
+static uint64_t get_time_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint16_t packet_len(uint32_t seq){
+    return (uint16_t) (4 + (seq % (MAX_LEN - 4)));
+}
+
+static void dump_packets(uint32_t first, uint32_t count){
+    uint32_t seq;
+    for (seq = first; seq < (first + count); seq++){
+        uint16_t len = packet_len(seq);
+        little_endian_store_32(packet, 0, seq);
+        memset(&packet[4], seq & 0xff, len - 4);
+        hci_dump_packet(HCI_ACL_DATA_PACKET, 0, packet, len);
+    }
+}
+
+// verify packets first..first+count-1 are stored in order, records reported as dropped are missing
+static int verify_file(uint32_t first, uint32_t count, uint32_t dropped){
+    FILE * file = fopen(DUMP_FILE, "rb");
+    if (file == NULL){
+        printf("Cannot open %s\n", DUMP_FILE);
+        return 1;
+    }
+    uint8_t  buffer[13 + MAX_LEN + 100];
+    uint32_t expected_seq = first;
+    uint32_t num_packets = 0;
+    uint32_t num_missing = 0;
+    uint32_t num_reported = 0;
+    int errors = 0;
+    while (fread(buffer, 1, 4, file) == 4){
+        uint32_t entry_len = big_endian_read_32(buffer, 0);
+        if ((entry_len < 9) || (entry_len > (sizeof(buffer) - 4)) || (fread(&buffer[4], 1, entry_len, file) != entry_len)){
+            printf("Invalid record after %u packets\n", num_packets);
+            errors++;
+            break;
+        }
+        uint16_t len = (uint16_t) (entry_len - 9);
+        const uint8_t * data = &buffer[13];
+        if (buffer[12] == 0xfc){
+            unsigned int records = 0;
+            buffer[13 + len] = 0;
+            if (sscanf((const char *) data, "hci_dump: %u records dropped", &records) == 1){
+                num_reported += records;
+            }
+            continue;
+        }
+        uint32_t seq = little_endian_read_32(data, 0);
+        if ((buffer[12] != 0x02) || (seq < expected_seq) || (len != packet_len(seq))){
+            printf("Unexpected packet %u, expected %u\n", seq, expected_seq);
+            errors++;
+            break;
+        }
+        num_missing += seq - expected_seq;
+        expected_seq = seq + 1;
+        num_packets++;
+    }
+    fclose(file);
+    num_missing += (first + count) - expected_seq;
+    if ((num_missing != dropped) || (num_reported > dropped) || ((num_packets + dropped) != count)){
+        printf("%u packets in file, %u missing, %u reported as dropped, %u dropped\n", num_packets, num_missing, num_reported, dropped);
+        errors++;
+    }
+    return errors;
+}
+
+static int test_throughput(void){
+    hci_dump_open(DUMP_FILE, HCI_DUMP_PACKETLOGGER);
+    uint64_t start_ns = get_time_ns();
+    dump_packets(0, NUM_PACKETS);
+    uint64_t duration_ns = get_time_ns() - start_ns;
+    uint32_t dropped = hci_dump_get_dropped_records();
+    hci_dump_close();
+
+    int errors = verify_file(0, NUM_PACKETS, dropped);
+    printf("%u packets: %6.1f ns per hci_dump_packet, %u dropped %s\n", NUM_PACKETS,
+           (double) duration_ns / NUM_PACKETS, dropped, errors ? "FAILED" : "OK");
+    return errors;
+}
+
+static int test_max_packets(void){
+    // file is truncated when max packets have been written
+    hci_dump_open(DUMP_FILE, HCI_DUMP_PACKETLOGGER);
+    hci_dump_set_max_packets(1000);
+    // give asynchronous writer time to keep up
+    const struct timespec pause = { 0, 1000000 };
+    uint32_t seq;
+    for (seq = 0; seq < 2500; seq += 10){
+        dump_packets(seq, 10);
+        nanosleep(&pause, NULL);
+    }
+    uint32_t dropped = hci_dump_get_dropped_records();
+    hci_dump_set_max_packets(-1);
+    hci_dump_close();
+
+    // drops before last truncation are not visible
+    int errors = 0;
+    if (dropped == 0){
+        errors = verify_file(2000, 500, 0);
+    }
+    printf("max packets: %u dropped %s\n", dropped, errors ? "FAILED" : "OK");
+    return errors;
+}
+
+static int test_max_packets_burst(void){
+    // truncation requests follow each other faster than the asynchronous writer flushes
+    hci_dump_open(DUMP_FILE, HCI_DUMP_PACKETLOGGER);
+    hci_dump_set_max_packets(20);
+    // writer thread is woken up when ring buffer is half full, short pauses avoid dropped records
+    const struct timespec pause = { 0, 200000 };
+    uint32_t seq;
+    for (seq = 0; seq < 2500; seq += 125){
+        dump_packets(seq, 125);
+        nanosleep(&pause, NULL);
+    }
+    dump_packets(2500, 10);
+    uint32_t dropped = hci_dump_get_dropped_records();
+    hci_dump_set_max_packets(-1);
+    hci_dump_close();
+
+    // drops before last truncation are not visible
+    int errors = 0;
+    if (dropped == 0){
+        errors = verify_file(2500, 10, 0);
+    }
+    printf("max packets, burst: %u dropped %s\n", dropped, errors ? "FAILED" : "OK");
+    return errors;
+}
+
+typedef struct {
+    uint32_t first_seq;
+    uint32_t num_packets;
+} segment_info_t;
+
+// check records in segment and return number of packets, records end at zero length marker or end of file
+static int verify_segment(uint16_t index, segment_info_t * info){
+    char path[64];
+    snprintf(path, sizeof(path), "%s.%u", SNOOP_FILE, index);
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) return 1;
+    uint8_t buffer[24 + 1 + MAX_LEN];
+    int errors = 0;
+    if ((fread(buffer, 1, 16, file) != 16) || (memcmp(buffer, "btsnoop", 8) != 0)
+            || (big_endian_read_32(buffer, 8) != 1) || (big_endian_read_32(buffer, 12) != 1002)){
+        printf("%s: invalid file header\n", path);
+        fclose(file);
+        return 1;
+    }
+    info->num_packets = 0;
+    while (fread(buffer, 1, 24, file) == 24){
+        uint32_t len = big_endian_read_32(buffer, 4);
+        if (len == 0) break;
+        if ((len > (1 + MAX_LEN)) || (fread(&buffer[24], 1, len, file) != len) || (buffer[24] != HCI_ACL_DATA_PACKET)
+                || (big_endian_read_32(buffer, 0) != len) || (big_endian_read_32(buffer, 8) != 0)){
+            printf("%s: invalid record\n", path);
+            errors++;
+            break;
+        }
+        uint32_t seq = little_endian_read_32(buffer, 25);
+        if (info->num_packets == 0){
+            info->first_seq = seq;
+        } else if ((seq != (info->first_seq + info->num_packets)) || (len != (1u + packet_len(seq)))){
+            printf("%s: unexpected packet %u\n", path, seq);
+            errors++;
+            break;
+        }
+        info->num_packets++;
+    }
+    fclose(file);
+    return errors;
+}
+
+// segments ordered by first packet need to be contiguous and end with last packet
+static int verify_segments(uint32_t num_packets){
+    segment_info_t info[HCI_DUMP_BTSNOOP_NUM_SEGMENTS];
+    int errors = 0;
+    uint16_t i;
+    uint32_t total = 0;
+    for (i = 0; i < HCI_DUMP_BTSNOOP_NUM_SEGMENTS; i++){
+        errors += verify_segment(i, &info[i]);
+        total += info[i].num_packets;
+    }
+    if (errors) return errors;
+    uint32_t next_seq = num_packets - total;
+    uint16_t num_verified = 0;
+    while (num_verified < HCI_DUMP_BTSNOOP_NUM_SEGMENTS){
+        for (i = 0; i < HCI_DUMP_BTSNOOP_NUM_SEGMENTS; i++){
+            if ((info[i].num_packets > 0) && (info[i].first_seq == next_seq)) break;
+        }
+        if (i == HCI_DUMP_BTSNOOP_NUM_SEGMENTS){
+            printf("No segment starts with packet %u\n", next_seq);
+            return 1;
+        }
+        next_seq += info[i].num_packets;
+        num_verified++;
+        if (next_seq == num_packets) break;
+    }
+    // all segments except the current one are full
+    if ((next_seq != num_packets) || (total * (MAX_LEN / 2) < ((HCI_DUMP_BTSNOOP_NUM_SEGMENTS - 1) * (HCI_DUMP_BTSNOOP_SEGMENT_SIZE / 2)))){
+        printf("Segments contain %u packets\n", total);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_btsnoop_segments(void){
+    hci_dump_open(SNOOP_FILE, HCI_DUMP_BTSNOOP_SEGMENTS);
+    uint64_t start_ns = get_time_ns();
+    dump_packets(0, NUM_PACKETS);
+    uint64_t duration_ns = get_time_ns() - start_ns;
+    // segments are valid while capture is running, e.g. after a crash
+    int errors = verify_segments(NUM_PACKETS);
+    hci_dump_close();
+    errors += verify_segments(NUM_PACKETS);
+    printf("btsnoop segments: %6.1f ns per hci_dump_packet %s\n", (double) duration_ns / NUM_PACKETS, errors ? "FAILED" : "OK");
+    uint16_t i;
+    for (i = 0; i < HCI_DUMP_BTSNOOP_NUM_SEGMENTS; i++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s.%u", SNOOP_FILE, i);
+        remove(path);
+    }
+    return errors;
+}
+
+// filter test: packet type, log type in file, logged len, original len
+typedef struct {
+    uint8_t  packet_type;
+    uint8_t  in;
+    uint16_t con_handle;
+    uint8_t  packet_boundary_flags;
+    uint16_t cid;
+    uint16_t len;
+    // expected result
+    uint16_t logged_len;    // 0 = filtered
+} filter_packet_t;
+
+static const filter_packet_t filter_packets[] = {
+    // event is complete
+    { HCI_EVENT_PACKET,    1, 0,      0, 0,      10,  10 },
+    // L2CAP Signaling is complete
+    { HCI_ACL_DATA_PACKET, 0, 0x0001, 2, 0x0001, 28,  28 },
+    // media channel is truncated, also continuation fragment
+    { HCI_ACL_DATA_PACKET, 0, 0x0001, 2, 0x0041, 208, 12 },
+    { HCI_ACL_DATA_PACKET, 0, 0x0001, 1, 0,      104, 12 },
+    // connection handle not selected
+    { HCI_ACL_DATA_PACKET, 1, 0x0002, 2, 0x0041, 108, 0  },
+    // SCO disabled
+    { HCI_SCO_DATA_PACKET, 1, 0x0001, 0, 0,      63,  0  },
+    // ATT is complete
+    { HCI_ACL_DATA_PACKET, 1, 0x0001, 2, 0x0004, 58,  58 },
+};
+
+static void dump_filter_packets(void){
+    unsigned int i;
+    for (i = 0; i < sizeof(filter_packets) / sizeof(filter_packet_t); i++){
+        const filter_packet_t * filter_packet = &filter_packets[i];
+        memset(packet, i, sizeof(packet));
+        switch (filter_packet->packet_type){
+            case HCI_ACL_DATA_PACKET:
+                little_endian_store_16(packet, 0, filter_packet->con_handle | (filter_packet->packet_boundary_flags << 12));
+                little_endian_store_16(packet, 2, filter_packet->len - 4);
+                if (filter_packet->packet_boundary_flags != 1){
+                    little_endian_store_16(packet, 4, filter_packet->len - 8);
+                    little_endian_store_16(packet, 6, filter_packet->cid);
+                }
+                break;
+            case HCI_SCO_DATA_PACKET:
+                little_endian_store_16(packet, 0, filter_packet->con_handle);
+                packet[2] = filter_packet->len - 3;
+                break;
+            default:
+                break;
+        }
+        hci_dump_packet(filter_packet->packet_type, filter_packet->in, packet, filter_packet->len);
+    }
+}
+
+static int test_filters(void){
+    hci_dump_enable_packet_type(HCI_SCO_DATA_PACKET, 0);
+    hci_dump_select_connection_handle(0x0001, 1);
+    hci_dump_set_max_payload_len(8);
+
+    hci_dump_open(DUMP_FILE, HCI_DUMP_PACKETLOGGER);
+    dump_filter_packets();
+    hci_dump_close();
+    hci_dump_open(SNOOP_FILE, HCI_DUMP_BTSNOOP_SEGMENTS);
+    dump_filter_packets();
+    hci_dump_close();
+
+    hci_dump_enable_packet_type(HCI_SCO_DATA_PACKET, 1);
+    hci_dump_select_connection_handle(0x0001, 0);
+    hci_dump_set_max_payload_len(-1);
+
+    // PacketLogger: 4 byte len, 8 byte timestamp, 1 byte type
+    int errors = 0;
+    FILE * pklg = fopen(DUMP_FILE, "rb");
+    char path[64];
+    snprintf(path, sizeof(path), "%s.0", SNOOP_FILE);
+    FILE * snoop = fopen(path, "rb");
+    uint8_t header[24];
+    if ((pklg == NULL) || (snoop == NULL) || (fread(header, 1, 16, snoop) != 16)){
+        errors++;
+    }
+    unsigned int i;
+    for (i = 0; (errors == 0) && (i < sizeof(filter_packets) / sizeof(filter_packet_t)); i++){
+        const filter_packet_t * filter_packet = &filter_packets[i];
+        if (filter_packet->logged_len == 0) continue;
+        uint8_t data[MAX_LEN];
+        if ((fread(header, 1, 13, pklg) != 13) || (big_endian_read_32(header, 0) != (9u + filter_packet->logged_len))
+                || (fread(data, 1, filter_packet->logged_len, pklg) != filter_packet->logged_len)
+                || (data[filter_packet->logged_len - 1] != i)){
+            printf("PacketLogger: packet %u not logged correctly\n", i);
+            errors++;
+            break;
+        }
+        // btsnoop stores original and included len
+        if ((fread(header, 1, 24, snoop) != 24) || (big_endian_read_32(header, 0) != (1u + filter_packet->len))
+                || (big_endian_read_32(header, 4) != (1u + filter_packet->logged_len))
+                || (fread(data, 1, 1 + filter_packet->logged_len, snoop) != (1u + filter_packet->logged_len))){
+            printf("btsnoop: packet %u not logged correctly\n", i);
+            errors++;
+            break;
+        }
+    }
+    // no additional packets
+    if ((errors == 0) && ((fread(header, 1, 1, pklg) != 0) || (fread(header, 1, 1, snoop) != 0))){
+        printf("Filtered packets logged\n");
+        errors++;
+    }
+    if (pklg != NULL) fclose(pklg);
+    if (snoop != NULL) fclose(snoop);
+    for (i = 0; i < HCI_DUMP_BTSNOOP_NUM_SEGMENTS; i++){
+        snprintf(path, sizeof(path), "%s.%u", SNOOP_FILE, i);
+        remove(path);
+    }
+    printf("filters: %s\n", errors ? "FAILED" : "OK");
+    return errors;
+}
+
+static void log_messages(uint32_t count){
+    uint32_t i;
+    for (i = 0; i < count; i++){
+        log_info("message %u: %s %d %lld %04x", i, (i & 1) ? "odd" : "even", -(int) i, (long long) i << 32, i & 0xffff);
+    }
+    // not supported by binary log
+    log_info("long double %.1Lf", (long double) 1.5);
+}
+
+// decode log message, returns length of text or -1 if message is not a log message
+static int decode_log_message(uint8_t type, const uint8_t * data, uint16_t len, char formats[][200], char * text, uint16_t text_size){
+    if (type == 0xfc){
+        return snprintf(text, text_size, "%.*s", len, (const char *) data);
+    }
+    if ((type != 0xf0) && (type != 0xf1)) return -1;
+    if (len < 2) return -1;
+    uint16_t id = little_endian_read_16(data, 0);
+    if (id >= 4) return -1;
+    if (type == 0xf0){
+        snprintf(formats[id], 200, "%.*s", len - 2, (const char *) &data[2]);
+        return 0;
+    }
+    // arguments: message number, string with length byte, signed int, long long, unsigned int
+    if ((len < 8) || (len != (2 + 4 + 1 + data[6] + 4 + 8 + 4)) || (formats[id][0] == 0)) return -1;
+    uint16_t pos = 7 + data[6];
+    char string[8];
+    snprintf(string, sizeof(string), "%.*s", data[6], (const char *) &data[7]);
+    long long value = (long long) ((((uint64_t) little_endian_read_32(data, pos + 8)) << 32) | little_endian_read_32(data, pos + 4));
+    return snprintf(text, text_size, formats[id], little_endian_read_32(data, 2), string, (int) little_endian_read_32(data, pos),
+                    value, little_endian_read_32(data, pos + 12));
+}
+
+static int verify_log_messages(uint32_t count){
+    FILE * file = fopen(DUMP_FILE, "rb");
+    if (file == NULL) return 1;
+    char formats[4][200];
+    memset(formats, 0, sizeof(formats));
+    uint8_t buffer[13 + 300];
+    uint32_t num_messages = 0;
+    int errors = 0;
+    while ((errors == 0) && (fread(buffer, 1, 4, file) == 4)){
+        uint32_t entry_len = big_endian_read_32(buffer, 0);
+        if ((entry_len < 9) || (entry_len > (sizeof(buffer) - 4)) || (fread(&buffer[4], 1, entry_len, file) != entry_len)){
+            errors++;
+            break;
+        }
+        char text[300];
+        char expected[300];
+        int text_len = decode_log_message(buffer[12], &buffer[13], (uint16_t) (entry_len - 9), formats, text, sizeof(text));
+        if (text_len <= 0) continue;
+        if (num_messages < count){
+            snprintf(expected, sizeof(expected), "message %u: %s %d %lld %04x", num_messages, (num_messages & 1) ? "odd" : "even",
+                     -(int) num_messages, (long long) num_messages << 32, num_messages & 0xffff);
+        } else {
+            snprintf(expected, sizeof(expected), "long double 1.5");
+        }
+        const char * suffix = &text[text_len - btstack_min(text_len, strlen(expected))];
+        if ((strncmp(text, BTSTACK_FILE__ ".", strlen(BTSTACK_FILE__) + 1) != 0) || (strcmp(suffix, expected) != 0)){
+            printf("Unexpected log message '%s', expected '%s'\n", text, expected);
+            errors++;
+        }
+        num_messages++;
+    }
+    fclose(file);
+    if ((errors == 0) && (num_messages != (count + 1))){
+        printf("%u log messages in file, expected %u\n", num_messages, count + 1);
+        errors++;
+    }
+    return errors;
+}
+
+static int test_log_messages(void){
+    // log file is opened twice, format strings must be logged again after reopening
+    hci_dump_open(DUMP_FILE, HCI_DUMP_PACKETLOGGER);
+    log_messages(10);
+    hci_dump_close();
+
+    hci_dump_open(DUMP_FILE, HCI_DUMP_PACKETLOGGER);
+    uint64_t start_ns = get_time_ns();
+    log_messages(NUM_LOGS);
+    uint64_t duration_ns = get_time_ns() - start_ns;
+    uint32_t dropped = hci_dump_get_dropped_records();
+    hci_dump_close();
+
+    int errors = 0;
+    if (dropped == 0){
+        errors = verify_log_messages(NUM_LOGS);
+    }
+    printf("%u log messages: %6.1f ns per log_info, %u dropped %s\n", NUM_LOGS,
+           (double) duration_ns / NUM_LOGS, dropped, errors ? "FAILED" : "OK");
+    return errors;
+}
+
+int main(void){
+    int errors = 0;
+    errors += test_throughput();
+    errors += test_max_packets();
+    errors += test_max_packets_burst();
+    errors += test_btsnoop_segments();
+    errors += test_filters();
+    errors += test_log_messages();
+    remove(DUMP_FILE);
+    return errors ? 1 : 0;
+}
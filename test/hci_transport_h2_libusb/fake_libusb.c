@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "fake_libusb.c"
+
+/*
+ *  fake_libusb.c
+ *
+ *  Fake libusb with a single Bluetooth device. Completed transfers are signalled via an eventfd, which is provided
+ *  as pollfd. The device answers each HCI command with a Command Complete event, accepts all ACL data, and delivers
+ *  events injected by the test.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libusb.h"
+#include "fake_libusb.h"
+
+#define FAKE_QUEUE_SIZE     64
+#define FAKE_MAX_EVENT_SIZE 258
+
+#define FAKE_EVENT_IN_ADDR  0x81
+#define FAKE_ACL_IN_ADDR    0x82
+#define FAKE_ACL_OUT_ADDR   0x02
+
+struct libusb_device {
+    int unused;
+};
+
+struct libusb_device_handle {
+    libusb_device * device;
+};
+
+typedef struct {
+    struct libusb_transfer * items[FAKE_QUEUE_SIZE];
+    int head;
+    int count;
+} fake_transfer_queue_t;
+
+static libusb_device        fake_device;
+static libusb_device_handle fake_device_handle = { &fake_device };
+static libusb_device *      fake_device_list[] = { &fake_device, NULL };
+
+static const struct libusb_endpoint_descriptor fake_endpoints[] = {
+    { 7, 5, FAKE_EVENT_IN_ADDR, LIBUSB_TRANSFER_TYPE_INTERRUPT, 16, 1 },
+    { 7, 5, FAKE_ACL_IN_ADDR,   LIBUSB_TRANSFER_TYPE_BULK,      64, 1 },
+    { 7, 5, FAKE_ACL_OUT_ADDR,  LIBUSB_TRANSFER_TYPE_BULK,      64, 1 },
+};
+static const struct libusb_interface_descriptor fake_interface_descriptor = {
+    9, 4, 0, 0, 3, 0xe0, 0x01, 0x01, 0, fake_endpoints
+};
+static const struct libusb_interface fake_interface = { &fake_interface_descriptor, 1 };
+static struct libusb_config_descriptor fake_config_descriptor = {
+    9, 2, 0, 1, 1, 0, 0x80, 50, &fake_interface
+};
+
+// configuration
+static int      fake_provide_pollfds = 1;
+static uint32_t fake_timeout_ms;
+
+// state, protected by mutex as events are injected from other thread
+static pthread_mutex_t       fake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                   fake_event_fd = -1;
+static struct libusb_pollfd  fake_pollfd;
+static fake_transfer_queue_t fake_completed_transfers;
+static fake_transfer_queue_t fake_event_in_transfers;
+static fake_transfer_queue_t fake_acl_in_transfers;
+static uint8_t               fake_events[FAKE_QUEUE_SIZE][FAKE_MAX_EVENT_SIZE];
+static uint16_t              fake_event_sizes[FAKE_QUEUE_SIZE];
+static int                   fake_events_head;
+static int                   fake_events_count;
+static uint64_t              fake_timeout_deadline_us;
+static uint32_t              fake_num_handle_events_calls;
+
+static uint64_t fake_get_time_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+static void fake_queue_push(fake_transfer_queue_t * queue, struct libusb_transfer * transfer){
+    if (queue->count == FAKE_QUEUE_SIZE){
+        printf("fake libusb: transfer queue full\n");
+        exit(EXIT_FAILURE);
+    }
+    queue->items[(queue->head + queue->count) % FAKE_QUEUE_SIZE] = transfer;
+    queue->count++;
+}
+
+static struct libusb_transfer * fake_queue_pop(fake_transfer_queue_t * queue){
+    if (queue->count == 0) return NULL;
+    struct libusb_transfer * transfer = queue->items[queue->head];
+    queue->head = (queue->head + 1) % FAKE_QUEUE_SIZE;
+    queue->count--;
+    return transfer;
+}
+
+static int fake_queue_remove(fake_transfer_queue_t * queue, struct libusb_transfer * transfer){
+    int i;
+    for (i = 0; i < queue->count; i++){
+        int index = (queue->head + i) % FAKE_QUEUE_SIZE;
+        if (queue->items[index] != transfer) continue;
+        // move following items forward
+        for (; i < (queue->count - 1); i++){
+            queue->items[(queue->head + i) % FAKE_QUEUE_SIZE] = queue->items[(queue->head + i + 1) % FAKE_QUEUE_SIZE];
+        }
+        queue->count--;
+        return 1;
+    }
+    return 0;
+}
+
+// called with mutex held
+static void fake_complete(struct libusb_transfer * transfer, enum libusb_transfer_status status, int actual_length){
+    transfer->status = status;
+    transfer->actual_length = actual_length;
+    fake_queue_push(&fake_completed_transfers, transfer);
+    uint64_t value = 1;
+    ssize_t bytes_written = write(fake_event_fd, &value, sizeof(value));
+    (void) bytes_written;
+}
+
+static void fake_deliver_events(void);
+
+// called with mutex held
+static void fake_queue_event(const uint8_t * event, uint16_t size){
+    if (fake_events_count == FAKE_QUEUE_SIZE){
+        printf("fake libusb: event queue full\n");
+        exit(EXIT_FAILURE);
+    }
+    int index = (fake_events_head + fake_events_count) % FAKE_QUEUE_SIZE;
+    (void)memcpy(fake_events[index], event, size);
+    fake_event_sizes[index] = size;
+    fake_events_count++;
+    fake_deliver_events();
+}
+
+// called with mutex held
+static void fake_deliver_events(void){
+    // deliver as long as event in transfers are posted
+    while ((fake_events_count > 0) && (fake_event_in_transfers.count > 0)){
+        struct libusb_transfer * transfer = fake_queue_pop(&fake_event_in_transfers);
+        uint16_t len = fake_event_sizes[fake_events_head];
+        (void)memcpy(transfer->buffer, fake_events[fake_events_head], len);
+        fake_events_head = (fake_events_head + 1) % FAKE_QUEUE_SIZE;
+        fake_events_count--;
+        fake_complete(transfer, LIBUSB_TRANSFER_COMPLETED, len);
+    }
+}
+
+void fake_libusb_config(int provide_pollfds, uint32_t timeout_ms){
+    fake_provide_pollfds = provide_pollfds;
+    fake_timeout_ms = timeout_ms;
+}
+
+void fake_libusb_inject_event(const uint8_t * event, uint16_t size){
+    pthread_mutex_lock(&fake_mutex);
+    fake_queue_event(event, size);
+    pthread_mutex_unlock(&fake_mutex);
+}
+
+uint32_t fake_libusb_get_num_handle_events_calls(void){
+    return fake_num_handle_events_calls;
+}
+
+int libusb_init(libusb_context ** ctx){
+    (void) ctx;
+    fake_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fake_event_fd < 0) return LIBUSB_ERROR_OTHER;
+    fake_pollfd.fd = fake_event_fd;
+    fake_pollfd.events = POLLIN;
+    fake_timeout_deadline_us = fake_get_time_us() + (fake_timeout_ms * 1000ULL);
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_exit(libusb_context * ctx){
+    (void) ctx;
+    close(fake_event_fd);
+    fake_event_fd = -1;
+}
+
+int libusb_set_option(libusb_context * ctx, enum libusb_option option, ...){
+    (void) ctx;
+    (void) option;
+    return LIBUSB_SUCCESS;
+}
+
+const char * libusb_error_name(int error_code){
+    (void) error_code;
+    return "LIBUSB_ERROR";
+}
+
+ssize_t libusb_get_device_list(libusb_context * ctx, libusb_device *** list){
+    (void) ctx;
+    *list = fake_device_list;
+    return 1;
+}
+
+void libusb_free_device_list(libusb_device ** list, int unref_devices){
+    (void) list;
+    (void) unref_devices;
+}
+
+int libusb_get_device_descriptor(libusb_device * dev, struct libusb_device_descriptor * desc){
+    (void) dev;
+    memset(desc, 0, sizeof(struct libusb_device_descriptor));
+    desc->bLength = 18;
+    desc->bDescriptorType = 1;
+    desc->bDeviceClass = 0xe0;
+    desc->bDeviceSubClass = 0x01;
+    desc->bDeviceProtocol = 0x01;
+    desc->idVendor = 0x1234;
+    desc->idProduct = 0x5678;
+    desc->bNumConfigurations = 1;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_get_active_config_descriptor(libusb_device * dev, struct libusb_config_descriptor ** config){
+    (void) dev;
+    *config = &fake_config_descriptor;
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_free_config_descriptor(struct libusb_config_descriptor * config){
+    (void) config;
+}
+
+uint8_t libusb_get_bus_number(libusb_device * dev){
+    (void) dev;
+    return 1;
+}
+
+uint8_t libusb_get_device_address(libusb_device * dev){
+    (void) dev;
+    return 2;
+}
+
+int libusb_get_port_numbers(libusb_device * dev, uint8_t * port_numbers, int port_numbers_len){
+    (void) dev;
+    if (port_numbers_len < 1) return LIBUSB_ERROR_OVERFLOW;
+    port_numbers[0] = 1;
+    return 1;
+}
+
+int libusb_open(libusb_device * dev, libusb_device_handle ** dev_handle){
+    (void) dev;
+    *dev_handle = &fake_device_handle;
+    return LIBUSB_SUCCESS;
+}
+
+libusb_device_handle * libusb_open_device_with_vid_pid(libusb_context * ctx, uint16_t vendor_id, uint16_t product_id){
+    (void) ctx;
+    (void) vendor_id;
+    (void) product_id;
+    return &fake_device_handle;
+}
+
+void libusb_close(libusb_device_handle * dev_handle){
+    (void) dev_handle;
+}
+
+libusb_device * libusb_get_device(libusb_device_handle * dev_handle){
+    return dev_handle->device;
+}
+
+int libusb_reset_device(libusb_device_handle * dev_handle){
+    (void) dev_handle;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_kernel_driver_active(libusb_device_handle * dev_handle, int interface_number){
+    (void) dev_handle;
+    (void) interface_number;
+    return 0;
+}
+
+int libusb_detach_kernel_driver(libusb_device_handle * dev_handle, int interface_number){
+    (void) dev_handle;
+    (void) interface_number;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_attach_kernel_driver(libusb_device_handle * dev_handle, int interface_number){
+    (void) dev_handle;
+    (void) interface_number;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_set_configuration(libusb_device_handle * dev_handle, int configuration){
+    (void) dev_handle;
+    (void) configuration;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_claim_interface(libusb_device_handle * dev_handle, int interface_number){
+    (void) dev_handle;
+    // no isochronous interface
+    return (interface_number == 0) ? LIBUSB_SUCCESS : LIBUSB_ERROR_NOT_FOUND;
+}
+
+int libusb_release_interface(libusb_device_handle * dev_handle, int interface_number){
+    (void) dev_handle;
+    (void) interface_number;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_set_interface_alt_setting(libusb_device_handle * dev_handle, int interface_number, int alternate_setting){
+    (void) dev_handle;
+    (void) interface_number;
+    (void) alternate_setting;
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_clear_halt(libusb_device_handle * dev_handle, unsigned char endpoint){
+    (void) dev_handle;
+    (void) endpoint;
+    return LIBUSB_SUCCESS;
+}
+
+struct libusb_transfer * libusb_alloc_transfer(int iso_packets){
+    return (struct libusb_transfer *) calloc(1, sizeof(struct libusb_transfer) + (iso_packets * sizeof(struct libusb_iso_packet_descriptor)));
+}
+
+void libusb_free_transfer(struct libusb_transfer * transfer){
+    free(transfer);
+}
+
+int libusb_submit_transfer(struct libusb_transfer * transfer){
+    pthread_mutex_lock(&fake_mutex);
+    if (transfer->endpoint == 0){
+        // HCI command: control transfer completes, device answers with Command Complete
+        uint8_t event[] = { 0x0e, 4, 1, transfer->buffer[LIBUSB_CONTROL_SETUP_SIZE], transfer->buffer[LIBUSB_CONTROL_SETUP_SIZE + 1], 0 };
+        fake_complete(transfer, LIBUSB_TRANSFER_COMPLETED, transfer->length - LIBUSB_CONTROL_SETUP_SIZE);
+        fake_queue_event(event, sizeof(event));
+    } else if (transfer->endpoint == FAKE_EVENT_IN_ADDR){
+        fake_queue_push(&fake_event_in_transfers, transfer);
+        fake_deliver_events();
+    } else if (transfer->endpoint == FAKE_ACL_IN_ADDR){
+        fake_queue_push(&fake_acl_in_transfers, transfer);
+    } else {
+        // ACL out
+        fake_complete(transfer, LIBUSB_TRANSFER_COMPLETED, transfer->length);
+    }
+    pthread_mutex_unlock(&fake_mutex);
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer * transfer){
+    pthread_mutex_lock(&fake_mutex);
+    int found = fake_queue_remove(&fake_event_in_transfers, transfer) || fake_queue_remove(&fake_acl_in_transfers, transfer);
+    if (found){
+        fake_complete(transfer, LIBUSB_TRANSFER_CANCELLED, 0);
+    }
+    pthread_mutex_unlock(&fake_mutex);
+    return found ? LIBUSB_SUCCESS : LIBUSB_ERROR_NOT_FOUND;
+}
+
+int libusb_handle_events_timeout(libusb_context * ctx, struct timeval * tv){
+    (void) ctx;
+    (void) tv;
+    fake_num_handle_events_calls++;
+
+    // emulated transfer timeout expired, libusb would check its transfers now
+    if (fake_timeout_ms > 0){
+        uint64_t now_us = fake_get_time_us();
+        if (now_us >= fake_timeout_deadline_us){
+            fake_timeout_deadline_us = now_us + (fake_timeout_ms * 1000ULL);
+        }
+    }
+
+    uint64_t value;
+    ssize_t bytes_read = read(fake_event_fd, &value, sizeof(value));
+    (void) bytes_read;
+    while (1){
+        pthread_mutex_lock(&fake_mutex);
+        struct libusb_transfer * transfer = fake_queue_pop(&fake_completed_transfers);
+        pthread_mutex_unlock(&fake_mutex);
+        if (transfer == NULL) break;
+        (*transfer->callback)(transfer);
+    }
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_get_next_timeout(libusb_context * ctx, struct timeval * tv){
+    (void) ctx;
+    if (fake_timeout_ms == 0) return 0;
+    uint64_t now_us = fake_get_time_us();
+    uint64_t remaining_us = (fake_timeout_deadline_us > now_us) ? (fake_timeout_deadline_us - now_us) : 0;
+    tv->tv_sec  = (time_t) (remaining_us / 1000000U);
+    tv->tv_usec = (suseconds_t) (remaining_us % 1000000U);
+    return 1;
+}
+
+int libusb_pollfds_handle_timeouts(libusb_context * ctx){
+    (void) ctx;
+    // e.g. no timerfd support in kernel
+    return fake_timeout_ms == 0;
+}
+
+const struct libusb_pollfd ** libusb_get_pollfds(libusb_context * ctx){
+    (void) ctx;
+    if (fake_provide_pollfds == 0) return NULL;
+    const struct libusb_pollfd ** pollfds = (const struct libusb_pollfd **) calloc(2, sizeof(struct libusb_pollfd *));
+    if (pollfds == NULL) return NULL;
+    pollfds[0] = &fake_pollfd;
+    return pollfds;
+}
+
+void libusb_free_pollfds(const struct libusb_pollfd ** pollfds){
+    free((void *) pollfds);
+}
+
+void libusb_set_pollfd_notifiers(libusb_context * ctx, libusb_pollfd_added_cb added_cb, libusb_pollfd_removed_cb removed_cb,
+                                 void * user_data){
+    // single eventfd does not change while open
+    (void) ctx;
+    (void) added_cb;
+    (void) removed_cb;
+    (void) user_data;
+}
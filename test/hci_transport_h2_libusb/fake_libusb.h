@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  fake_libusb.h
+ *
+ *  Control of the fake libusb device used by the libusb transport test
+ */
+
+#ifndef FAKE_LIBUSB_H_CONTROL
+#define FAKE_LIBUSB_H_CONTROL
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Configure fake libusb before libusb_init
+ * @param provide_pollfds 0 emulates a platform without pollfds, e.g. Windows
+ * @param timeout_ms if not 0, emulates a pending transfer timeout every timeout_ms that libusb cannot handle itself
+ */
+void fake_libusb_config(int provide_pollfds, uint32_t timeout_ms);
+
+/**
+ * @brief Deliver HCI event on event in endpoint, can be called from any thread
+ * @param event
+ * @param size
+ */
+void fake_libusb_inject_event(const uint8_t * event, uint16_t size);
+
+/**
+ * @brief Get number of libusb_handle_events_timeout calls
+ */
+uint32_t fake_libusb_get_num_handle_events_calls(void);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // FAKE_LIBUSB_H_CONTROL
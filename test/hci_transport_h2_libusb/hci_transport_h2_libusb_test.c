@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "hci_transport_h2_libusb_test.c"
+
+/*
+ * hci_transport_h2_libusb_test.c
+ *
+ * Runs the libusb H2 transport against a fake libusb device with the POSIX run loop. After HCI Reset, the number of
+ * libusb_handle_events_timeout calls and the CPU time are measured while idle, then events are injected from a
+ * second thread to measure the delivery latency.
+ *
+ * Modes:
+ * - polling: libusb provides no pollfds, transport polls libusb every millisecond
+ * - pollfds: libusb pollfds are used as data sources
+ * - timeout: as pollfds, but libusb requires BTstack to handle a 10 ms timeout
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_debug.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "hci_transport.h"
+#include "fake_libusb.h"
+
+#define IDLE_MS                 1000
+#define LIBUSB_TIMEOUT_MS       10
+#define NUM_EVENTS              200
+#define EVENT_INTERVAL_MIN_US   7000
+#define EVENT_INTERVAL_MAX_US   10000
+#define TEST_EVENT_CODE         0xff
+
+typedef enum {
+    MODE_POLLING,
+    MODE_POLLFDS,
+    MODE_TIMEOUT,
+} test_mode_t;
+
+static test_mode_t mode;
+static const char * mode_name;
+static const hci_transport_t * transport;
+static btstack_timer_source_t idle_timer;
+static btstack_timer_source_t done_timer;
+static int reset_packet_sent;
+static uint32_t idle_start_calls;
+static uint64_t idle_start_cpu_us;
+static uint32_t next_sequence_nr;
+static uint32_t latencies_us[NUM_EVENTS];
+static pthread_t injector_thread;
+
+static uint64_t get_time_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+static uint64_t get_cpu_time_us(void){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (((uint64_t) usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL) + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void * injector(void * context){
+    UNUSED(context);
+    uint32_t i;
+    for (i = 0; i < NUM_EVENTS; i++){
+        usleep(EVENT_INTERVAL_MIN_US + (rand() % (EVENT_INTERVAL_MAX_US - EVENT_INTERVAL_MIN_US)));
+        uint8_t event[14];
+        event[0] = TEST_EVENT_CODE;
+        event[1] = sizeof(event) - 2;
+        little_endian_store_32(event, 2, i);
+        uint64_t now_us = get_time_us();
+        little_endian_store_32(event, 6,  (uint32_t) now_us);
+        little_endian_store_32(event, 10, (uint32_t) (now_us >> 32));
+        fake_libusb_inject_event(event, sizeof(event));
+    }
+    return NULL;
+}
+
+static int compare_uint32(const void * a, const void * b){
+    uint32_t value_a = *(const uint32_t *) a;
+    uint32_t value_b = *(const uint32_t *) b;
+    if (value_a < value_b) return -1;
+    if (value_a > value_b) return 1;
+    return 0;
+}
+
+static void done_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    pthread_join(injector_thread, NULL);
+    qsort(latencies_us, NUM_EVENTS, sizeof(uint32_t), &compare_uint32);
+    printf("%-8s: %u events, latency median %u us, max %u us\n", mode_name, NUM_EVENTS,
+           latencies_us[NUM_EVENTS / 2], latencies_us[NUM_EVENTS - 1]);
+    transport->close();
+    exit(EXIT_SUCCESS);
+}
+
+static void idle_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    uint32_t calls = fake_libusb_get_num_handle_events_calls() - idle_start_calls;
+    uint64_t cpu_us = get_cpu_time_us() - idle_start_cpu_us;
+    printf("%-8s: %u libusb calls in %u ms idle, cpu %u.%u%%\n", mode_name, calls, IDLE_MS,
+           (uint32_t) (cpu_us / (IDLE_MS * 10)), (uint32_t) ((cpu_us / IDLE_MS) % 10));
+
+    int ok = 0;
+    switch (mode){
+        case MODE_POLLING:
+            ok = calls > (IDLE_MS / 2);
+            break;
+        case MODE_POLLFDS:
+            ok = calls == 0;
+            break;
+        case MODE_TIMEOUT:
+            ok = (calls >= (IDLE_MS / LIBUSB_TIMEOUT_MS / 2)) && (calls <= (IDLE_MS / LIBUSB_TIMEOUT_MS * 2));
+            break;
+        default:
+            break;
+    }
+    if (!ok){
+        printf("%-8s: unexpected number of libusb calls while idle\n", mode_name);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_create(&injector_thread, NULL, &injector, NULL);
+}
+
+static void packet_handler(uint8_t packet_type, uint8_t * packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (packet[0]){
+        case HCI_EVENT_TRANSPORT_PACKET_SENT:
+            reset_packet_sent = 1;
+            break;
+        case HCI_EVENT_COMMAND_COMPLETE:
+            if (!reset_packet_sent || (little_endian_read_16(packet, 3) != 0x0c03)){
+                printf("%-8s: unexpected Command Complete\n", mode_name);
+                exit(EXIT_FAILURE);
+            }
+            // start idle measurement
+            idle_start_calls = fake_libusb_get_num_handle_events_calls();
+            idle_start_cpu_us = get_cpu_time_us();
+            btstack_run_loop_set_timer_handler(&idle_timer, &idle_timer_handler);
+            btstack_run_loop_set_timer(&idle_timer, IDLE_MS);
+            btstack_run_loop_add_timer(&idle_timer);
+            break;
+        case TEST_EVENT_CODE: {
+            uint64_t now_us = get_time_us();
+            uint32_t sequence_nr = little_endian_read_32(packet, 2);
+            uint64_t sent_us = little_endian_read_32(packet, 6) | (((uint64_t) little_endian_read_32(packet, 10)) << 32);
+            if ((size != 14) || (sequence_nr != next_sequence_nr)){
+                printf("%-8s: event %u received, expected %u\n", mode_name, sequence_nr, next_sequence_nr);
+                exit(EXIT_FAILURE);
+            }
+            latencies_us[next_sequence_nr++] = (uint32_t) (now_us - sent_us);
+            if (next_sequence_nr == NUM_EVENTS){
+                // close transport after event transfer was resubmitted
+                btstack_run_loop_set_timer_handler(&done_timer, &done_timer_handler);
+                btstack_run_loop_set_timer(&done_timer, 0);
+                btstack_run_loop_add_timer(&done_timer);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+int main(int argc, const char * argv[]){
+    mode_name = (argc > 1) ? argv[1] : "pollfds";
+    if (strcmp(mode_name, "polling") == 0){
+        mode = MODE_POLLING;
+        fake_libusb_config(0, 0);
+    } else if (strcmp(mode_name, "pollfds") == 0){
+        mode = MODE_POLLFDS;
+        fake_libusb_config(1, 0);
+    } else if (strcmp(mode_name, "timeout") == 0){
+        mode = MODE_TIMEOUT;
+        fake_libusb_config(1, LIBUSB_TIMEOUT_MS);
+    } else {
+        printf("usage: %s polling|pollfds|timeout\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    transport = hci_transport_usb_instance();
+    transport->register_packet_handler(&packet_handler);
+    if (transport->open() != 0){
+        printf("%-8s: open failed\n", mode_name);
+        return EXIT_FAILURE;
+    }
+
+    static uint8_t hci_reset[] = { 0x03, 0x0c, 0x00 };
+    transport->send_packet(HCI_COMMAND_DATA_PACKET, hci_reset, sizeof(hci_reset));
+
+    btstack_run_loop_execute();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  libusb.h
+ *
+ *  Subset of the libusb-1.0 API used by hci_transport_h2_libusb.c, implemented by fake_libusb.c
+ */
+
+#ifndef FAKE_LIBUSB_H
+#define FAKE_LIBUSB_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define LIBUSB_API_VERSION 0x01000108
+#define LIBUSB_CALL
+
+#define LIBUSB_CONTROL_SETUP_SIZE 8
+
+enum libusb_error {
+    LIBUSB_SUCCESS             = 0,
+    LIBUSB_ERROR_IO            = -1,
+    LIBUSB_ERROR_INVALID_PARAM = -2,
+    LIBUSB_ERROR_ACCESS        = -3,
+    LIBUSB_ERROR_NO_DEVICE     = -4,
+    LIBUSB_ERROR_NOT_FOUND     = -5,
+    LIBUSB_ERROR_BUSY          = -6,
+    LIBUSB_ERROR_TIMEOUT       = -7,
+    LIBUSB_ERROR_OVERFLOW      = -8,
+    LIBUSB_ERROR_PIPE          = -9,
+    LIBUSB_ERROR_INTERRUPTED   = -10,
+    LIBUSB_ERROR_NO_MEM        = -11,
+    LIBUSB_ERROR_NOT_SUPPORTED = -12,
+    LIBUSB_ERROR_OTHER         = -99,
+};
+
+enum libusb_transfer_type {
+    LIBUSB_TRANSFER_TYPE_CONTROL     = 0,
+    LIBUSB_TRANSFER_TYPE_ISOCHRONOUS = 1,
+    LIBUSB_TRANSFER_TYPE_BULK        = 2,
+    LIBUSB_TRANSFER_TYPE_INTERRUPT   = 3,
+};
+
+enum libusb_transfer_flags {
+    LIBUSB_TRANSFER_SHORT_NOT_OK    = 1 << 0,
+    LIBUSB_TRANSFER_FREE_BUFFER     = 1 << 1,
+    LIBUSB_TRANSFER_FREE_TRANSFER   = 1 << 2,
+    LIBUSB_TRANSFER_ADD_ZERO_PACKET = 1 << 3,
+};
+
+enum libusb_transfer_status {
+    LIBUSB_TRANSFER_COMPLETED,
+    LIBUSB_TRANSFER_ERROR,
+    LIBUSB_TRANSFER_TIMED_OUT,
+    LIBUSB_TRANSFER_CANCELLED,
+    LIBUSB_TRANSFER_STALL,
+    LIBUSB_TRANSFER_NO_DEVICE,
+    LIBUSB_TRANSFER_OVERFLOW,
+};
+
+enum libusb_request_type {
+    LIBUSB_REQUEST_TYPE_STANDARD = (0x00 << 5),
+    LIBUSB_REQUEST_TYPE_CLASS    = (0x01 << 5),
+    LIBUSB_REQUEST_TYPE_VENDOR   = (0x02 << 5),
+};
+
+enum libusb_request_recipient {
+    LIBUSB_RECIPIENT_DEVICE    = 0x00,
+    LIBUSB_RECIPIENT_INTERFACE = 0x01,
+    LIBUSB_RECIPIENT_ENDPOINT  = 0x02,
+    LIBUSB_RECIPIENT_OTHER     = 0x03,
+};
+
+enum libusb_log_level {
+    LIBUSB_LOG_LEVEL_NONE = 0,
+    LIBUSB_LOG_LEVEL_ERROR,
+    LIBUSB_LOG_LEVEL_WARNING,
+    LIBUSB_LOG_LEVEL_INFO,
+    LIBUSB_LOG_LEVEL_DEBUG,
+};
+
+enum libusb_option {
+    LIBUSB_OPTION_LOG_LEVEL = 0,
+};
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+struct libusb_device_descriptor {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t  bDeviceClass;
+    uint8_t  bDeviceSubClass;
+    uint8_t  bDeviceProtocol;
+    uint8_t  bMaxPacketSize0;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t  iManufacturer;
+    uint8_t  iProduct;
+    uint8_t  iSerialNumber;
+    uint8_t  bNumConfigurations;
+};
+
+struct libusb_endpoint_descriptor {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bEndpointAddress;
+    uint8_t  bmAttributes;
+    uint16_t wMaxPacketSize;
+    uint8_t  bInterval;
+};
+
+struct libusb_interface_descriptor {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bInterfaceNumber;
+    uint8_t  bAlternateSetting;
+    uint8_t  bNumEndpoints;
+    uint8_t  bInterfaceClass;
+    uint8_t  bInterfaceSubClass;
+    uint8_t  bInterfaceProtocol;
+    uint8_t  iInterface;
+    const struct libusb_endpoint_descriptor * endpoint;
+};
+
+struct libusb_interface {
+    const struct libusb_interface_descriptor * altsetting;
+    int num_altsetting;
+};
+
+struct libusb_config_descriptor {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint16_t wTotalLength;
+    uint8_t  bNumInterfaces;
+    uint8_t  bConfigurationValue;
+    uint8_t  iConfiguration;
+    uint8_t  bmAttributes;
+    uint8_t  MaxPower;
+    const struct libusb_interface * interface;
+};
+
+struct libusb_iso_packet_descriptor {
+    unsigned int length;
+    unsigned int actual_length;
+    enum libusb_transfer_status status;
+};
+
+struct libusb_transfer;
+typedef void (LIBUSB_CALL * libusb_transfer_cb_fn)(struct libusb_transfer * transfer);
+
+struct libusb_transfer {
+    libusb_device_handle * dev_handle;
+    uint8_t flags;
+    unsigned char endpoint;
+    unsigned char type;
+    unsigned int timeout;
+    enum libusb_transfer_status status;
+    int length;
+    int actual_length;
+    libusb_transfer_cb_fn callback;
+    void * user_data;
+    unsigned char * buffer;
+    int num_iso_packets;
+    struct libusb_iso_packet_descriptor iso_packet_desc[];
+};
+
+struct libusb_pollfd {
+    int fd;
+    short events;
+};
+
+typedef void (LIBUSB_CALL * libusb_pollfd_added_cb)(int fd, short events, void * user_data);
+typedef void (LIBUSB_CALL * libusb_pollfd_removed_cb)(int fd, void * user_data);
+
+static inline void libusb_fill_control_setup(unsigned char * buffer, uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue,
+                                             uint16_t wIndex, uint16_t wLength){
+    buffer[0] = bmRequestType;
+    buffer[1] = bRequest;
+    buffer[2] = (uint8_t) wValue;
+    buffer[3] = (uint8_t) (wValue >> 8);
+    buffer[4] = (uint8_t) wIndex;
+    buffer[5] = (uint8_t) (wIndex >> 8);
+    buffer[6] = (uint8_t) wLength;
+    buffer[7] = (uint8_t) (wLength >> 8);
+}
+
+static inline void libusb_fill_control_transfer(struct libusb_transfer * transfer, libusb_device_handle * dev_handle,
+                                                unsigned char * buffer, libusb_transfer_cb_fn callback, void * user_data,
+                                                unsigned int timeout){
+    transfer->dev_handle = dev_handle;
+    transfer->endpoint   = 0;
+    transfer->type       = LIBUSB_TRANSFER_TYPE_CONTROL;
+    transfer->timeout    = timeout;
+    transfer->buffer     = buffer;
+    if (buffer != NULL){
+        transfer->length = LIBUSB_CONTROL_SETUP_SIZE + (buffer[6] | (buffer[7] << 8));
+    }
+    transfer->user_data  = user_data;
+    transfer->callback   = callback;
+}
+
+static inline void libusb_fill_bulk_transfer(struct libusb_transfer * transfer, libusb_device_handle * dev_handle,
+                                             unsigned char endpoint, unsigned char * buffer, int length,
+                                             libusb_transfer_cb_fn callback, void * user_data, unsigned int timeout){
+    transfer->dev_handle = dev_handle;
+    transfer->endpoint   = endpoint;
+    transfer->type       = LIBUSB_TRANSFER_TYPE_BULK;
+    transfer->timeout    = timeout;
+    transfer->buffer     = buffer;
+    transfer->length     = length;
+    transfer->user_data  = user_data;
+    transfer->callback   = callback;
+}
+
+static inline void libusb_fill_interrupt_transfer(struct libusb_transfer * transfer, libusb_device_handle * dev_handle,
+                                                  unsigned char endpoint, unsigned char * buffer, int length,
+                                                  libusb_transfer_cb_fn callback, void * user_data, unsigned int timeout){
+    libusb_fill_bulk_transfer(transfer, dev_handle, endpoint, buffer, length, callback, user_data, timeout);
+    transfer->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+}
+
+static inline void libusb_fill_iso_transfer(struct libusb_transfer * transfer, libusb_device_handle * dev_handle,
+                                            unsigned char endpoint, unsigned char * buffer, int length, int num_iso_packets,
+                                            libusb_transfer_cb_fn callback, void * user_data, unsigned int timeout){
+    libusb_fill_bulk_transfer(transfer, dev_handle, endpoint, buffer, length, callback, user_data, timeout);
+    transfer->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+    transfer->num_iso_packets = num_iso_packets;
+}
+
+static inline void libusb_set_iso_packet_lengths(struct libusb_transfer * transfer, unsigned int length){
+    int i;
+    for (i = 0; i < transfer->num_iso_packets; i++){
+        transfer->iso_packet_desc[i].length = length;
+    }
+}
+
+static inline unsigned char * libusb_get_iso_packet_buffer_simple(struct libusb_transfer * transfer, unsigned int packet){
+    return transfer->buffer + (transfer->iso_packet_desc[0].length * packet);
+}
+
+int  libusb_init(libusb_context ** ctx);
+void libusb_exit(libusb_context * ctx);
+int  libusb_set_option(libusb_context * ctx, enum libusb_option option, ...);
+const char * libusb_error_name(int error_code);
+
+ssize_t libusb_get_device_list(libusb_context * ctx, libusb_device *** list);
+void    libusb_free_device_list(libusb_device ** list, int unref_devices);
+int     libusb_get_device_descriptor(libusb_device * dev, struct libusb_device_descriptor * desc);
+int     libusb_get_active_config_descriptor(libusb_device * dev, struct libusb_config_descriptor ** config);
+void    libusb_free_config_descriptor(struct libusb_config_descriptor * config);
+uint8_t libusb_get_bus_number(libusb_device * dev);
+uint8_t libusb_get_device_address(libusb_device * dev);
+int     libusb_get_port_numbers(libusb_device * dev, uint8_t * port_numbers, int port_numbers_len);
+
+int  libusb_open(libusb_device * dev, libusb_device_handle ** dev_handle);
+libusb_device_handle * libusb_open_device_with_vid_pid(libusb_context * ctx, uint16_t vendor_id, uint16_t product_id);
+void libusb_close(libusb_device_handle * dev_handle);
+libusb_device * libusb_get_device(libusb_device_handle * dev_handle);
+int  libusb_reset_device(libusb_device_handle * dev_handle);
+int  libusb_kernel_driver_active(libusb_device_handle * dev_handle, int interface_number);
+int  libusb_detach_kernel_driver(libusb_device_handle * dev_handle, int interface_number);
+int  libusb_attach_kernel_driver(libusb_device_handle * dev_handle, int interface_number);
+int  libusb_set_configuration(libusb_device_handle * dev_handle, int configuration);
+int  libusb_claim_interface(libusb_device_handle * dev_handle, int interface_number);
+int  libusb_release_interface(libusb_device_handle * dev_handle, int interface_number);
+int  libusb_set_interface_alt_setting(libusb_device_handle * dev_handle, int interface_number, int alternate_setting);
+int  libusb_clear_halt(libusb_device_handle * dev_handle, unsigned char endpoint);
+
+struct libusb_transfer * libusb_alloc_transfer(int iso_packets);
+void libusb_free_transfer(struct libusb_transfer * transfer);
+int  libusb_submit_transfer(struct libusb_transfer * transfer);
+int  libusb_cancel_transfer(struct libusb_transfer * transfer);
+
+int  libusb_handle_events_timeout(libusb_context * ctx, struct timeval * tv);
+int  libusb_get_next_timeout(libusb_context * ctx, struct timeval * tv);
+int  libusb_pollfds_handle_timeouts(libusb_context * ctx);
+const struct libusb_pollfd ** libusb_get_pollfds(libusb_context * ctx);
+void libusb_free_pollfds(const struct libusb_pollfd ** pollfds);
+void libusb_set_pollfd_notifiers(libusb_context * ctx, libusb_pollfd_added_cb added_cb, libusb_pollfd_removed_cb removed_cb,
+                                 void * user_data);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // FAKE_LIBUSB_H
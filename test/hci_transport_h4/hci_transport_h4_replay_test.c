@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ * hci_transport_h4_replay_test.c
+ *
+ * Replays the incoming packets (events, ACL and SCO) of a PacketLogger capture as H4 byte stream
+ * through hci_transport_h4 with a mock UART driver, both in block mode and in streaming mode.
+ * Verifies that all packets are delivered unmodified and reports throughput and UART callbacks per packet.
+ *
+ * Usage: hci_transport_h4_replay_test [capture.pklg]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_config.h"
+#include "btstack_uart_block.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_transport.h"
+
+#define DEFAULT_CAPTURE   "../hfp/pklg/test1.pklg"
+#define NUM_ITERATIONS    20
+#define STREAM_CHUNK_SIZE 1024
+
+typedef struct {
+    uint32_t pos;
+    uint16_t len;
+} replay_packet_t;
+
+// H4 byte stream and packets in it
+static uint8_t *         h4_stream;
+static uint32_t          h4_stream_len;
+static replay_packet_t * replay_packets;
+static uint32_t          num_replay_packets;
+
+// packet verification
+static uint32_t next_packet;
+static uint32_t num_errors;
+
+// mock UART
+static void (*uart_block_received)(void);
+static void (*uart_data_received)(const uint8_t * data, uint16_t size);
+static uint8_t * uart_read_buffer;
+static uint16_t  uart_read_len;
+static uint32_t  uart_num_callbacks;
+
+static uint64_t get_time_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
+
+static int load_capture(const char * path){
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) return -1;
+    fseek(file, 0, SEEK_END);
+    long file_len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t * capture = malloc(file_len);
+    if (fread(capture, 1, file_len, file) != (size_t) file_len){
+        fclose(file);
+        free(capture);
+        return -1;
+    }
+    fclose(file);
+
+    // H4 stream is shorter than capture: 4 byte len + 8 byte timestamp are replaced by 1 byte packet type
+    h4_stream = malloc(file_len);
+    replay_packets = malloc(sizeof(replay_packet_t) * (file_len / 13 + 1));
+
+    // PacketLogger format: 4 byte len, 8 byte timestamp, 1 byte type, payload (big endian)
+    long pos = 0;
+    while ((pos + 13) <= file_len){
+        uint32_t entry_len = big_endian_read_32(capture, pos);
+        if ((entry_len < 9) || ((pos + 4 + entry_len) > (uint32_t) file_len)) break;
+        uint8_t  type        = capture[pos + 12];
+        uint16_t payload_len = (uint16_t) (entry_len - 9);
+        uint8_t  h4_type     = 0;
+        switch (type){
+            case 0x01:
+                h4_type = HCI_EVENT_PACKET;
+                break;
+            case 0x03:
+                h4_type = HCI_ACL_DATA_PACKET;
+                break;
+            case 0x09:
+                h4_type = HCI_SCO_DATA_PACKET;
+                break;
+            default:
+                break;
+        }
+        if ((h4_type != 0) && (payload_len <= HCI_INCOMING_PACKET_BUFFER_SIZE)){
+            replay_packets[num_replay_packets].pos = h4_stream_len;
+            replay_packets[num_replay_packets].len = payload_len;
+            num_replay_packets++;
+            h4_stream[h4_stream_len++] = h4_type;
+            memcpy(&h4_stream[h4_stream_len], &capture[pos + 13], payload_len);
+            h4_stream_len += payload_len;
+        }
+        pos += 4 + entry_len;
+    }
+    free(capture);
+    return 0;
+}
+
+static void packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (next_packet >= num_replay_packets){
+        num_errors++;
+        return;
+    }
+    const replay_packet_t * expected = &replay_packets[next_packet];
+    next_packet++;
+    if ((packet_type != h4_stream[expected->pos]) || (size != expected->len)
+            || (memcmp(packet, &h4_stream[expected->pos + 1], size) != 0)){
+        if (num_errors == 0){
+            printf("Packet %u mismatch: type %02x, len %u\n", next_packet - 1, packet_type, size);
+        }
+        num_errors++;
+    }
+}
+
+static int mock_uart_init(const btstack_uart_config_t * config){
+    UNUSED(config);
+    return 0;
+}
+
+static int mock_uart_open(void){
+    return 0;
+}
+
+static int mock_uart_close(void){
+    return 0;
+}
+
+static void mock_uart_set_block_received(void (*handler)(void)){
+    uart_block_received = handler;
+}
+
+static void mock_uart_set_block_sent(void (*handler)(void)){
+    UNUSED(handler);
+}
+
+static int mock_uart_set_baudrate(uint32_t baudrate){
+    UNUSED(baudrate);
+    return 0;
+}
+
+static int mock_uart_set_parity(int parity){
+    UNUSED(parity);
+    return 0;
+}
+
+static int mock_uart_set_flowcontrol(int flowcontrol){
+    UNUSED(flowcontrol);
+    return 0;
+}
+
+static void mock_uart_receive_block(uint8_t * buffer, uint16_t len){
+    uart_read_buffer = buffer;
+    uart_read_len = len;
+}
+
+static void mock_uart_send_block(const uint8_t * buffer, uint16_t length){
+    UNUSED(buffer);
+    UNUSED(length);
+}
+
+static void mock_uart_set_data_received(void (*handler)(const uint8_t * data, uint16_t size)){
+    uart_data_received = handler;
+}
+
+static const btstack_uart_block_t mock_uart_block = {
+    &mock_uart_init,
+    &mock_uart_open,
+    &mock_uart_close,
+    &mock_uart_set_block_received,
+    &mock_uart_set_block_sent,
+    &mock_uart_set_baudrate,
+    &mock_uart_set_parity,
+    &mock_uart_set_flowcontrol,
+    &mock_uart_receive_block,
+    &mock_uart_send_block,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static const btstack_uart_block_t mock_uart_stream = {
+    &mock_uart_init,
+    &mock_uart_open,
+    &mock_uart_close,
+    &mock_uart_set_block_received,
+    &mock_uart_set_block_sent,
+    &mock_uart_set_baudrate,
+    &mock_uart_set_parity,
+    &mock_uart_set_flowcontrol,
+    &mock_uart_receive_block,
+    &mock_uart_send_block,
+    NULL,
+    NULL,
+    NULL,
+    &mock_uart_set_data_received,
+};
+
+// block mode: serve each receive_block request from the stream
+static void replay_block_mode(void){
+    uint32_t pos = 0;
+    while (pos < h4_stream_len){
+        uint16_t len = uart_read_len;
+        if ((len == 0) || ((pos + len) > h4_stream_len)) break;
+        memcpy(uart_read_buffer, &h4_stream[pos], len);
+        pos += len;
+        uart_read_len = 0;
+        uart_num_callbacks++;
+        (*uart_block_received)();
+    }
+}
+
+// streaming mode: pass stream in chunks as returned by read()
+static void replay_stream_mode(uint32_t max_chunk_size, int random_chunks){
+    uint32_t pos = 0;
+    while (pos < h4_stream_len){
+        uint32_t len = random_chunks ? (1 + (rand() % max_chunk_size)) : max_chunk_size;
+        len = btstack_min(len, h4_stream_len - pos);
+        uart_num_callbacks++;
+        (*uart_data_received)(&h4_stream[pos], (uint16_t) len);
+        pos += len;
+    }
+}
+
+static int run(const char * name, const btstack_uart_block_t * uart, int iterations, uint32_t chunk_size, int random_chunks){
+    static hci_transport_config_uart_t config = {
+        HCI_TRANSPORT_CONFIG_UART,
+        115200,
+        0,
+        0,
+        NULL,
+    };
+    const hci_transport_t * transport = hci_transport_h4_instance(uart);
+    transport->init(&config);
+    transport->register_packet_handler(&packet_handler);
+
+    uint64_t duration_ns = 0;
+    uint32_t num_packets = 0;
+    uart_num_callbacks = 0;
+    num_errors = 0;
+    int i;
+    for (i = 0; i < iterations; i++){
+        next_packet = 0;
+        transport->open();
+        uint64_t start_ns = get_time_ns();
+        if (uart == &mock_uart_block){
+            replay_block_mode();
+        } else {
+            replay_stream_mode(chunk_size, random_chunks);
+        }
+        duration_ns += get_time_ns() - start_ns;
+        transport->close();
+        if (next_packet != num_replay_packets){
+            printf("%s: received %u of %u packets\n", name, next_packet, num_replay_packets);
+            num_errors++;
+        }
+        num_packets += next_packet;
+    }
+
+    double seconds = duration_ns / 1e9;
+    printf("%-26s %8.1f MB/s %6.2f M packets/s %6.2f UART callbacks/packet %s\n", name,
+           ((double) h4_stream_len * iterations) / seconds / 1e6,
+           num_packets / seconds / 1e6,
+           (double) uart_num_callbacks / num_packets,
+           num_errors ? "FAILED" : "OK");
+    return num_errors ? 1 : 0;
+}
+
+int main(int argc, const char * argv[]){
+    const char * path = argc > 1 ? argv[1] : DEFAULT_CAPTURE;
+    if (load_capture(path) < 0){
+        printf("Could not read %s\n", path);
+        return 1;
+    }
+    printf("%s: %u incoming packets, %u bytes\n", path, num_replay_packets, h4_stream_len);
+
+    int errors = 0;
+    errors += run("block mode", &mock_uart_block, NUM_ITERATIONS, 0, 0);
+    errors += run("stream mode, 1024 bytes", &mock_uart_stream, NUM_ITERATIONS, STREAM_CHUNK_SIZE, 0);
+    errors += run("stream mode, random", &mock_uart_stream, NUM_ITERATIONS, STREAM_CHUNK_SIZE, 1);
+    errors += run("stream mode, 1 byte", &mock_uart_stream, 1, 1, 0);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+
+/*
+ * hci_transport_h4_tx_test.c
+ *
+ * Sends a stream of ACL packets through hci_transport_h4 with a mock UART driver that completes each write
+ * after its air time. The mock host waits for HCI_EVENT_TRANSPORT_PACKET_SENT and then needs some processing
+ * time before it provides the next packet. All timing is simulated by a run loop with virtual time, so the
+ * UART idle time reported by hci_transport_h4_get_tx_idle_time can be checked exactly.
+ *
+ * Build with -DHCI_TRANSPORT_H4_TX_QUEUE_SIZE=n to test the outgoing packet queue.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "btstack_config.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_base.h"
+#include "btstack_uart_block.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_transport.h"
+
+#ifndef HCI_TRANSPORT_H4_TX_QUEUE_SIZE
+#define HCI_TRANSPORT_H4_TX_QUEUE_SIZE 1
+#endif
+
+#define NUM_PACKETS     1000
+#define ACL_PAYLOAD_LEN 251
+#define UART_BAUDRATE   3000000
+
+// simulated run loop
+static uint64_t sim_time_us;
+
+// mock host
+static const hci_transport_t * transport;
+static uint8_t  host_buffer[HCI_OUTGOING_PRE_BUFFER_SIZE + HCI_OUTGOING_PACKET_BUFFER_SIZE];
+static uint32_t host_processing_us;
+static uint32_t host_packets_sent;
+static btstack_timer_source_t host_timer;
+
+// mock UART
+static void (*uart_block_sent)(void);
+static btstack_timer_source_t uart_timer;
+static uint32_t uart_num_writes;
+static uint32_t uart_num_packets;
+static uint32_t uart_num_errors;
+static uint64_t uart_busy_until_us;
+
+// simulated run loop: advances virtual time to the next timer
+static void sim_run_loop_init(void){
+    btstack_run_loop_base_init();
+    sim_time_us = 0;
+}
+
+static uint32_t sim_run_loop_get_time_ms(void){
+    return (uint32_t) (sim_time_us / 1000u);
+}
+
+static uint64_t sim_run_loop_get_time_us(void){
+    return sim_time_us;
+}
+
+static void sim_run_loop_set_timer(btstack_timer_source_t * timer, uint32_t timeout_in_ms){
+    timer->timeout = sim_run_loop_get_time_ms() + timeout_in_ms;
+}
+
+static void sim_run_loop_execute(void){
+    while (true){
+        int32_t delta_us = btstack_run_loop_base_get_time_until_timeout_us(sim_time_us);
+        if (delta_us < 0) break;
+        sim_time_us += delta_us;
+        btstack_run_loop_base_process_timers_us(sim_time_us);
+    }
+}
+
+static const btstack_run_loop_t sim_run_loop = {
+    &sim_run_loop_init,
+    &btstack_run_loop_base_add_data_source,
+    &btstack_run_loop_base_remove_data_source,
+    &btstack_run_loop_base_enable_data_source_callbacks,
+    &btstack_run_loop_base_disable_data_source_callbacks,
+    &sim_run_loop_set_timer,
+    &btstack_run_loop_base_add_timer,
+    &btstack_run_loop_base_remove_timer,
+    &sim_run_loop_execute,
+    &btstack_run_loop_base_dump_timer,
+    &sim_run_loop_get_time_ms,
+    NULL,
+    &sim_run_loop_get_time_us,
+};
+
+static uint32_t air_time_us(uint32_t num_bytes){
+    // 8N1: 10 bits per byte
+    return (uint32_t) ((((uint64_t) num_bytes) * 10u * 1000000u) / UART_BAUDRATE);
+}
+
+// mock host: sends next packet after processing time
+static void host_send_packet(btstack_timer_source_t * timer){
+    UNUSED(timer);
+    if (host_packets_sent == NUM_PACKETS) return;
+    if (!transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+        printf("can send now false after packet sent event\n");
+        uart_num_errors++;
+        return;
+    }
+    uint8_t * packet = &host_buffer[HCI_OUTGOING_PRE_BUFFER_SIZE];
+    little_endian_store_16(packet, 0, 0x2001);
+    little_endian_store_16(packet, 2, ACL_PAYLOAD_LEN);
+    little_endian_store_32(packet, 4, host_packets_sent);
+    memset(&packet[8], host_packets_sent & 0xff, ACL_PAYLOAD_LEN - 4);
+    host_packets_sent++;
+    transport->send_packet(HCI_ACL_DATA_PACKET, packet, 4 + ACL_PAYLOAD_LEN);
+}
+
+static void host_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (packet[0] != HCI_EVENT_TRANSPORT_PACKET_SENT) return;
+    btstack_run_loop_set_timer_handler(&host_timer, &host_send_packet);
+    btstack_run_loop_set_timer_us(&host_timer, host_processing_us);
+    btstack_run_loop_add_timer(&host_timer);
+}
+
+// mock UART: verify packets and complete write after air time
+static void mock_uart_write_complete(btstack_timer_source_t * timer){
+    UNUSED(timer);
+    (*uart_block_sent)();
+}
+
+static void mock_uart_check_packet(const uint8_t * data, uint16_t len){
+    uint8_t expected[1 + 4 + ACL_PAYLOAD_LEN];
+    expected[0] = HCI_ACL_DATA_PACKET;
+    little_endian_store_16(expected, 1, 0x2001);
+    little_endian_store_16(expected, 3, ACL_PAYLOAD_LEN);
+    little_endian_store_32(expected, 5, uart_num_packets);
+    memset(&expected[9], uart_num_packets & 0xff, ACL_PAYLOAD_LEN - 4);
+    if ((len != sizeof(expected)) || (memcmp(data, expected, len) != 0)){
+        if (uart_num_errors == 0){
+            printf("Packet %u mismatch, len %u\n", uart_num_packets, len);
+        }
+        uart_num_errors++;
+    }
+    uart_num_packets++;
+}
+
+static void mock_uart_send_blocks(const btstack_uart_block_segment_t * blocks, uint16_t num_blocks){
+    if (sim_time_us < uart_busy_until_us){
+        printf("write started while UART busy\n");
+        uart_num_errors++;
+    }
+    uint32_t num_bytes = 0;
+    uint16_t i;
+    for (i = 0; i < num_blocks; i++){
+        mock_uart_check_packet(blocks[i].data, blocks[i].len);
+        num_bytes += blocks[i].len;
+    }
+    uart_num_writes++;
+    uart_busy_until_us = sim_time_us + air_time_us(num_bytes);
+    btstack_run_loop_set_timer_handler(&uart_timer, &mock_uart_write_complete);
+    btstack_run_loop_set_timer_us(&uart_timer, air_time_us(num_bytes));
+    btstack_run_loop_add_timer(&uart_timer);
+}
+
+static void mock_uart_send_block(const uint8_t * buffer, uint16_t length){
+    btstack_uart_block_segment_t block = { buffer, length };
+    mock_uart_send_blocks(&block, 1);
+}
+
+static int mock_uart_init(const btstack_uart_config_t * config){
+    UNUSED(config);
+    return 0;
+}
+
+static int mock_uart_open(void){
+    return 0;
+}
+
+static int mock_uart_close(void){
+    return 0;
+}
+
+static void mock_uart_set_block_received(void (*handler)(void)){
+    UNUSED(handler);
+}
+
+static void mock_uart_set_block_sent(void (*handler)(void)){
+    uart_block_sent = handler;
+}
+
+static int mock_uart_set_baudrate(uint32_t baudrate){
+    UNUSED(baudrate);
+    return 0;
+}
+
+static int mock_uart_set_parity(int parity){
+    UNUSED(parity);
+    return 0;
+}
+
+static int mock_uart_set_flowcontrol(int flowcontrol){
+    UNUSED(flowcontrol);
+    return 0;
+}
+
+static void mock_uart_receive_block(uint8_t * buffer, uint16_t len){
+    UNUSED(buffer);
+    UNUSED(len);
+}
+
+static const btstack_uart_block_t mock_uart_single = {
+    &mock_uart_init,
+    &mock_uart_open,
+    &mock_uart_close,
+    &mock_uart_set_block_received,
+    &mock_uart_set_block_sent,
+    &mock_uart_set_baudrate,
+    &mock_uart_set_parity,
+    &mock_uart_set_flowcontrol,
+    &mock_uart_receive_block,
+    &mock_uart_send_block,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static const btstack_uart_block_t mock_uart_scatter_gather = {
+    &mock_uart_init,
+    &mock_uart_open,
+    &mock_uart_close,
+    &mock_uart_set_block_received,
+    &mock_uart_set_block_sent,
+    &mock_uart_set_baudrate,
+    &mock_uart_set_parity,
+    &mock_uart_set_flowcontrol,
+    &mock_uart_receive_block,
+    &mock_uart_send_block,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    &mock_uart_send_blocks,
+};
+
+static int run(const btstack_uart_block_t * uart, uint32_t processing_us){
+    static hci_transport_config_uart_t config = {
+        HCI_TRANSPORT_CONFIG_UART,
+        UART_BAUDRATE,
+        0,
+        1,
+        NULL,
+    };
+
+    sim_time_us = 0;
+    host_processing_us = processing_us;
+    host_packets_sent  = 0;
+    uart_num_writes    = 0;
+    uart_num_packets   = 0;
+    uart_num_errors    = 0;
+    uart_busy_until_us = 0;
+
+    transport = hci_transport_h4_instance(uart);
+    transport->init(&config);
+    transport->register_packet_handler(&host_packet_handler);
+    transport->open();
+
+    host_send_packet(NULL);
+    btstack_run_loop_execute();
+
+    uint32_t num_packets;
+    uint64_t idle_time_us;
+    uint32_t max_idle_time_us;
+    hci_transport_h4_get_tx_idle_time(&num_packets, &idle_time_us, &max_idle_time_us);
+    transport->close();
+
+    // packets are sent back to back if the host provides the next packet while the UART is busy
+    uint32_t packet_air_time_us = air_time_us(1 + 4 + ACL_PAYLOAD_LEN);
+    uint32_t expected_gap_us = processing_us;
+    if (HCI_TRANSPORT_H4_TX_QUEUE_SIZE > 1){
+        expected_gap_us = (processing_us > packet_air_time_us) ? (processing_us - packet_air_time_us) : 0;
+    }
+    uint64_t expected_idle_time_us = ((uint64_t) (NUM_PACKETS - 1)) * expected_gap_us;
+
+    int errors = uart_num_errors;
+    if ((uart_num_packets != NUM_PACKETS) || (num_packets != NUM_PACKETS)){
+        printf("sent %u of %u packets\n", uart_num_packets, NUM_PACKETS);
+        errors++;
+    }
+    if (idle_time_us != expected_idle_time_us){
+        printf("idle time %" PRIu64 " us, expected %" PRIu64 " us\n", idle_time_us, expected_idle_time_us);
+        errors++;
+    }
+
+    printf("queue %u, %-15s host %4u us, air time %u us: %u writes, %6.1f ms, idle %5.1f us/packet, max %4u us %s\n",
+           HCI_TRANSPORT_H4_TX_QUEUE_SIZE,
+           uart->send_blocks ? "scatter-gather," : "single block,",
+           processing_us, packet_air_time_us, uart_num_writes,
+           sim_time_us / 1000.0,
+           (double) idle_time_us / NUM_PACKETS,
+           max_idle_time_us,
+           errors ? "FAILED" : "OK");
+    return errors;
+}
+
+int main(void){
+    static const uint32_t processing_times_us[] = { 0, 200, 1000 };
+    btstack_run_loop_init(&sim_run_loop);
+    int errors = 0;
+    unsigned int i;
+    for (i = 0; i < sizeof(processing_times_us) / sizeof(uint32_t); i++){
+        errors += run(&mock_uart_single, processing_times_us[i]);
+        errors += run(&mock_uart_scatter_gather, processing_times_us[i]);
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ * h5_loopback_test.c
+ *
+ * Connects two H5 endpoints via two pseudo terminals. The parent process relays the data between the
+ * ptys with configurable bit rate, latency, and byte corruption, while each endpoint runs in a forked child
+ * with the POSIX run loop and UART driver. Both endpoints send a sequence of numbered ACL packets,
+ * verify the received sequence, and report throughput. With -c, the relay strips the config field
+ * from Config Response messages, which requires both endpoints to fall back to sliding window size 1
+ * without data integrity check. The relay fails the test if a data integrity check is used afterwards.
+ *
+ * Usage: h5_loopback_test [-n packets] [-s payload size] [-b bit rate] [-l latency ms] [-e corrupt 1 of N bytes] [-c]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_config.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_uart_block.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_transport.h"
+
+// default as in hci_transport_h5.c
+#ifndef HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE
+#define HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE 1
+#endif
+
+#define TEST_TIMEOUT_MS   30000
+#define LINGER_MS         1000
+#define RELAY_BUFFER_SIZE 65536
+#define RELAY_FRAME_SIZE  4096
+
+#define SLIP_SOF            0xc0
+#define SLIP_ESCAPE         0xdb
+#define SLIP_ESCAPE_SOF     0xdc
+#define SLIP_ESCAPE_ESCAPE  0xdd
+
+// test config
+static uint32_t num_packets  = 1000;
+static uint16_t payload_size = 256;
+static uint32_t bit_rate     = 3000000;
+static uint32_t latency_us   = 1000;
+static uint32_t corrupt_rate = 0;
+static int      strip_config_field = 0;
+
+// endpoint state
+static const hci_transport_t * transport;
+static const char * endpoint_name;
+static uint8_t  acl_packet[HCI_ACL_HEADER_SIZE + HCI_ACL_PAYLOAD_SIZE];
+static uint32_t num_sent;
+static uint32_t num_received;
+static uint32_t start_ms;
+static uint32_t done_ms;
+static int      test_failed;
+static btstack_timer_source_t timeout_timer;
+
+static uint64_t get_time_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+// Endpoint
+
+static void endpoint_timeout_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    if (done_ms == 0){
+        printf("%s: timeout, sent %u, received %u packets\n", endpoint_name, num_sent, num_received);
+        exit(1);
+    }
+    // stayed around to acknowledge and resend packets for peer
+    uint32_t duration_ms = done_ms - start_ms;
+    double bytes = (double) num_packets * (HCI_ACL_HEADER_SIZE + payload_size);
+    printf("%s: received %u packets in %u ms, %.1f kB/s\n", endpoint_name, num_received, duration_ms, bytes / duration_ms);
+    exit(test_failed);
+}
+
+static void endpoint_check_done(void){
+    if (done_ms != 0) return;
+    if (num_received < num_packets) return;
+    if (num_sent < num_packets) return;
+    done_ms = btstack_run_loop_get_time_ms();
+    btstack_run_loop_remove_timer(&timeout_timer);
+    btstack_run_loop_set_timer(&timeout_timer, LINGER_MS);
+    btstack_run_loop_add_timer(&timeout_timer);
+}
+
+static void endpoint_send_next(void){
+    if (num_sent >= num_packets) return;
+    if (!transport->can_send_packet_now(HCI_ACL_DATA_PACKET)) return;
+    little_endian_store_16(acl_packet, 0, 0x0001);
+    little_endian_store_16(acl_packet, 2, payload_size);
+    little_endian_store_32(acl_packet, 4, num_sent);
+    memset(&acl_packet[8], (uint8_t) num_sent, payload_size - 4);
+    num_sent++;
+    transport->send_packet(HCI_ACL_DATA_PACKET, acl_packet, HCI_ACL_HEADER_SIZE + payload_size);
+    endpoint_check_done();
+}
+
+static void endpoint_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    switch (packet_type){
+        case HCI_EVENT_PACKET:
+            if (packet[0] != HCI_EVENT_TRANSPORT_PACKET_SENT) break;
+            if (start_ms == 0){
+                start_ms = btstack_run_loop_get_time_ms();
+            }
+            endpoint_send_next();
+            break;
+        case HCI_ACL_DATA_PACKET:
+            if ((size != (HCI_ACL_HEADER_SIZE + payload_size)) || (little_endian_read_32(packet, 4) != num_received)){
+                printf("%s: unexpected packet, size %u, expected nr %u\n", endpoint_name, size, num_received);
+                test_failed = 1;
+            }
+            num_received++;
+            endpoint_check_done();
+            break;
+        default:
+            break;
+    }
+}
+
+static void endpoint_run(const char * name, const char * device_name){
+    endpoint_name = name;
+
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+
+    static hci_transport_config_uart_t config = {
+        HCI_TRANSPORT_CONFIG_UART,
+        0,
+        0,
+        0,
+        NULL,
+    };
+    config.baudrate_init = bit_rate;
+    config.device_name = device_name;
+
+    transport = hci_transport_h5_instance(btstack_uart_block_posix_instance());
+    transport->init(&config);
+    transport->register_packet_handler(&endpoint_packet_handler);
+    if (transport->open() != 0){
+        printf("%s: failed to open %s\n", name, device_name);
+        exit(1);
+    }
+
+    btstack_run_loop_set_timer_handler(&timeout_timer, &endpoint_timeout_handler);
+    btstack_run_loop_set_timer(&timeout_timer, TEST_TIMEOUT_MS);
+    btstack_run_loop_add_timer(&timeout_timer);
+
+    btstack_run_loop_execute();
+}
+
+// Relay
+
+typedef struct {
+    int      in_fd;
+    int      out_fd;
+    uint8_t  data[RELAY_BUFFER_SIZE];
+    uint64_t arrival_us[RELAY_BUFFER_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint64_t wire_free_us;
+    // raw bytes of current SLIP frame, only used to strip config field
+    uint8_t  frame[RELAY_FRAME_SIZE];
+    uint16_t frame_len;
+} relay_direction_t;
+
+static relay_direction_t relay[2];
+static int relay_failed;
+
+static void relay_store(relay_direction_t * direction, uint8_t data, uint64_t arrival_us){
+    uint32_t pos = (direction->head + direction->count) % RELAY_BUFFER_SIZE;
+    direction->data[pos] = data;
+    direction->arrival_us[pos] = arrival_us;
+    direction->count++;
+}
+
+static void relay_store_slip_byte(relay_direction_t * direction, uint8_t data, uint64_t arrival_us){
+    switch (data){
+        case SLIP_SOF:
+            relay_store(direction, SLIP_ESCAPE, arrival_us);
+            relay_store(direction, SLIP_ESCAPE_SOF, arrival_us);
+            break;
+        case SLIP_ESCAPE:
+            relay_store(direction, SLIP_ESCAPE, arrival_us);
+            relay_store(direction, SLIP_ESCAPE_ESCAPE, arrival_us);
+            break;
+        default:
+            relay_store(direction, data, arrival_us);
+            break;
+    }
+}
+
+// forward complete SLIP frame, Config Response gets replaced by one without config field and data integrity check
+static void relay_process_frame(relay_direction_t * direction, uint64_t arrival_us){
+    uint8_t  packet[RELAY_FRAME_SIZE];
+    uint16_t packet_len = 0;
+    uint16_t i;
+    for (i = 1; (i + 1) < direction->frame_len; i++){
+        uint8_t data = direction->frame[i];
+        if ((data == SLIP_ESCAPE) && ((i + 2) < direction->frame_len)){
+            i++;
+            data = (direction->frame[i] == SLIP_ESCAPE_SOF) ? SLIP_SOF : SLIP_ESCAPE;
+        }
+        packet[packet_len++] = data;
+    }
+    // without config field in the Config Response, data integrity check must not be used
+    if ((packet_len >= 4) && ((packet[0] & 0x40) != 0)){
+        printf("relay: data integrity check present although config field was stripped\n");
+        relay_failed = 1;
+    }
+    uint16_t payload_len = (packet_len >= 4) ? ((packet[1] >> 4) | (packet[2] << 4)) : 0;
+    int is_config_response = (packet_len >= 7) && ((packet[1] & 0x0f) == 0x0f) && (payload_len == 3) &&
+                             (packet[4] == 0x04) && (packet[5] == 0x7b);
+    if (is_config_response == 0){
+        for (i = 0; i < direction->frame_len; i++){
+            relay_store(direction, direction->frame[i], arrival_us);
+        }
+        return;
+    }
+    uint8_t header[4];
+    header[0] = packet[0] & ~0x40;
+    header[1] = 0x0f | (2 << 4);
+    header[2] = 0;
+    header[3] = 0xff - (header[0] + header[1] + header[2]);
+    relay_store(direction, SLIP_SOF, arrival_us);
+    for (i = 0; i < 4; i++){
+        relay_store_slip_byte(direction, header[i], arrival_us);
+    }
+    relay_store_slip_byte(direction, 0x04, arrival_us);
+    relay_store_slip_byte(direction, 0x7b, arrival_us);
+    relay_store(direction, SLIP_SOF, arrival_us);
+}
+
+static void relay_filter(relay_direction_t * direction, uint8_t data, uint64_t arrival_us){
+    if (direction->frame_len == 0){
+        if (data == SLIP_SOF){
+            direction->frame[direction->frame_len++] = data;
+        } else {
+            relay_store(direction, data, arrival_us);
+        }
+        return;
+    }
+    direction->frame[direction->frame_len++] = data;
+    if (data == SLIP_SOF){
+        // SOF directly after SOF starts the frame
+        if (direction->frame_len == 2){
+            relay_store(direction, SLIP_SOF, arrival_us);
+            direction->frame_len = 1;
+            return;
+        }
+        relay_process_frame(direction, arrival_us);
+        direction->frame_len = 0;
+        return;
+    }
+    if (direction->frame_len == RELAY_FRAME_SIZE){
+        // too long for a Config Response, forward as is
+        uint16_t i;
+        for (i = 0; i < direction->frame_len; i++){
+            relay_store(direction, direction->frame[i], arrival_us);
+        }
+        direction->frame_len = 0;
+    }
+}
+
+static void relay_receive(relay_direction_t * direction){
+    uint8_t buffer[4096];
+    // leave room for a rewritten frame
+    uint32_t space = RELAY_BUFFER_SIZE - RELAY_FRAME_SIZE - direction->count;
+    ssize_t bytes_read = read(direction->in_fd, buffer, btstack_min(space, sizeof(buffer)));
+    if (bytes_read <= 0) return;
+    uint64_t now_us = get_time_us();
+    ssize_t i;
+    for (i = 0; i < bytes_read; i++){
+        uint8_t data = buffer[i];
+        if ((corrupt_rate > 0) && ((rand() % corrupt_rate) == 0)){
+            data ^= 0x5a;
+        }
+        if (strip_config_field){
+            relay_filter(direction, data, now_us);
+        } else {
+            relay_store(direction, data, now_us);
+        }
+    }
+}
+
+// forward bytes that have passed the latency at the configured bit rate (10 bit per byte)
+static void relay_forward(relay_direction_t * direction){
+    uint64_t now_us = get_time_us();
+    if (direction->wire_free_us < now_us){
+        direction->wire_free_us = now_us;
+    }
+    uint8_t buffer[4096];
+    uint32_t len = 0;
+    while ((direction->count > 0) && (len < sizeof(buffer))){
+        if ((direction->arrival_us[direction->head] + latency_us) > now_us) break;
+        if (direction->wire_free_us > (now_us + 1000)) break;
+        buffer[len++] = direction->data[direction->head];
+        direction->head = (direction->head + 1) % RELAY_BUFFER_SIZE;
+        direction->count--;
+        direction->wire_free_us += 10000000ULL / bit_rate;
+    }
+    if (len == 0) return;
+    if (write(direction->out_fd, buffer, len) != (ssize_t) len){
+        printf("relay: write failed\n");
+    }
+}
+
+static void relay_run(pid_t endpoints[2]){
+    int num_running = 2;
+    int result = 0;
+    while (num_running > 0){
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(relay[0].in_fd, &read_fds);
+        FD_SET(relay[1].in_fd, &read_fds);
+        struct timeval tv = { 0, 100 };
+        int max_fd = btstack_max(relay[0].in_fd, relay[1].in_fd);
+        if (select(max_fd + 1, &read_fds, NULL, NULL, &tv) > 0){
+            int i;
+            for (i = 0; i < 2; i++){
+                if (FD_ISSET(relay[i].in_fd, &read_fds)){
+                    relay_receive(&relay[i]);
+                }
+            }
+        }
+        relay_forward(&relay[0]);
+        relay_forward(&relay[1]);
+
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid > 0){
+            num_running--;
+            if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)){
+                result = 1;
+                // stop other endpoint
+                kill((pid == endpoints[0]) ? endpoints[1] : endpoints[0], SIGTERM);
+            }
+        }
+    }
+    if (relay_failed){
+        result = 1;
+    }
+    printf("H5 loopback, window size %u: %s\n", HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE, result ? "FAILED" : "OK");
+    exit(result);
+}
+
+static int open_pty(int * master, char * slave_name){
+    int slave;
+    if (openpty(master, &slave, slave_name, NULL, NULL) < 0) return -1;
+    // raw mode until endpoint configured it
+    struct termios toptions;
+    tcgetattr(slave, &toptions);
+    cfmakeraw(&toptions);
+    tcsetattr(slave, TCSANOW, &toptions);
+    fcntl(*master, F_SETFL, fcntl(*master, F_GETFL) | O_NONBLOCK);
+    // keep slave open to avoid EIO on master when endpoint closes it
+    return 0;
+}
+
+int main(int argc, char * argv[]){
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:b:l:e:c")) != -1){
+        switch (opt){
+            case 'n':
+                num_packets = atoi(optarg);
+                break;
+            case 's':
+                payload_size = btstack_max(4, btstack_min(atoi(optarg), HCI_ACL_PAYLOAD_SIZE));
+                break;
+            case 'b':
+                bit_rate = atoi(optarg);
+                break;
+            case 'l':
+                latency_us = atoi(optarg) * 1000;
+                break;
+            case 'e':
+                corrupt_rate = atoi(optarg);
+                break;
+            case 'c':
+                strip_config_field = 1;
+                break;
+            default:
+                printf("Usage: %s [-n packets] [-s payload size] [-b bit rate] [-l latency ms] [-e corrupt 1 of N bytes] [-c]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    printf("H5 loopback, window size %u: %u packets of %u bytes, %u bit/s, latency %u ms, corrupt 1 of %u bytes, strip config field %u\n",
+           HCI_TRANSPORT_H5_SLIDING_WINDOW_SIZE, num_packets, payload_size, bit_rate, latency_us / 1000, corrupt_rate, strip_config_field);
+
+    int master_a, master_b;
+    char slave_a[64], slave_b[64];
+    if ((open_pty(&master_a, slave_a) < 0) || (open_pty(&master_b, slave_b) < 0)){
+        printf("Could not open ptys\n");
+        return 1;
+    }
+    fflush(stdout);
+
+    pid_t endpoints[2];
+    endpoints[0] = fork();
+    if (endpoints[0] == 0){
+        endpoint_run("A", slave_a);
+    }
+    endpoints[1] = fork();
+    if (endpoints[1] == 0){
+        endpoint_run("B", slave_b);
+    }
+
+    relay[0].in_fd  = master_a;
+    relay[0].out_fd = master_b;
+    relay[1].in_fd  = master_b;
+    relay[1].out_fd = master_a;
+    relay_run(endpoints);
+    return 0;
+}
@@ -0,0 +1,28 @@
+//
+// btstack_config.h for virtual controller benchmark
+//
+
+#ifndef BTSTACK_CONFIG_H
+#define BTSTACK_CONFIG_H
+
+// Port related features
+#define HAVE_MALLOC
+#define HAVE_POSIX_TIME
+
+// BTstack features that can be enabled
+#define ENABLE_BLE
+#define ENABLE_CLASSIC
+#define ENABLE_LE_CENTRAL
+#define ENABLE_LE_PERIPHERAL
+#define ENABLE_LE_DATA_CHANNELS
+#define ENABLE_LE_DATA_LENGTH_EXTENSION
+#define ENABLE_LOG_ERROR
+#define ENABLE_RUN_LOOP_TIMER_US
+
+// BTstack configuration. buffers, sizes, ...
+#define HCI_ACL_PAYLOAD_SIZE (1021 + 4)
+#define HCI_INCOMING_PRE_BUFFER_SIZE 14
+
+#define MAX_NR_LE_DEVICE_DB_ENTRIES 4
+
+#endif
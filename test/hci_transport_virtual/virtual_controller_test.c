@@ -0,0 +1,1401 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "virtual_controller_test.c"
+
+/*
+ *  virtual_controller_test.c
+ *
+ *  Connects two BTstack instances via the virtual controller and measures L2CAP throughput and round-trip time.
+ *  Each instance runs in its own process, the controllers are linked by a SOCK_SEQPACKET socket pair.
+ *
+ *  LE mode: connect, pair with Just Works, then use an L2CAP LE Data Channel.
+ *  Classic mode: connect and use an L2CAP channel.
+ *
+ *  With -r, the central establishes the given number of connections one after the other instead and reports the
+ *  time from hci_init to working and per connection, e.g. to compare builds with and without HCI command pipelining.
+ *  With -o, a Classic and an LE connection are established at the same time. When both are up, the central reads the
+ *  RSSI of both connections at the same time for a number of rounds, so that the commands for both connections can be
+ *  outstanding together, and reports the time per round.
+ *
+ *  With -w, the central powers off and on again after the first init and reports the time of both inits, e.g. to see
+ *  the effect of the controller cache.
+ *
+ *  With -i, both instances use the CC256x chipset driver with a generated .bts init script of the given number of
+ *  vendor commands, which is memory-mapped by the driver, and the central checks that all commands were sent.
+ *
+ *  With -y, the central scans in LE mode before connecting, receives the advertising reports in batches, and
+ *  suppresses duplicates within the given time in ms. With -v, the peripheral cycles its advertising data through the
+ *  given number of values, and the central checks that every change is reported.
+ *
+ *  With -x, the peripheral additionally advertises two LE Advertising Sets, one with the given length of advertising
+ *  data, which the virtual controller reports in fragments. The central scans with LE Extended Scanning and checks the
+ *  reassembled GAP_EVENT_EXTENDED_ADVERTISING_REPORT events before connecting. The peripheral also checks that no more
+ *  advertising sets than supported by the virtual controller can be set up, and that too long advertising data is
+ *  rejected. With -g, the peripheral uses a non-resolvable private address that changes after the given time in ms
+ *  during the first half of the central's scan, and the central checks that the address of the legacy advertisement
+ *  and of both advertising sets changes. With -u, the long advertising set uses the LE Coded PHY as primary PHY and the
+ *  central scans and connects on the LE 1M and LE Coded PHYs. With -f 1, the virtual controller reports the last fragment
+ *  as truncated, with -f 2, it reports the fragments of both advertising sets in turn, which interrupts the chain of the
+ *  long advertising data. The central then checks that truncated data is reported with the correct length.
+ *
+ *  With -t, the peripheral only sets advertising data and enables advertising without setting advertising parameters,
+ *  i.e. it advertises with the default parameters of the Controller.
+ *
+ *  With -m and ENABLE_HCI_ACL_TX_SCHEDULER, the central opens two bulk and one audio L2CAP channel on a Classic
+ *  connection and one bulk channel on an LE connection. It sends the given number of packets on the bulk channels,
+ *  checks that both connections get the same share of bulk ACL packets, and that the audio channel, which requests to send
+ *  after every tenth packet, is served before any bulk channel. For this, outgoing ACL packets are observed by wrapping
+ *  send_packet of the virtual controller transport.
+ */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_config.h"
+#include "bluetooth_data_types.h"
+#include "btstack_event.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_tlv_posix.h"
+#include "btstack_util.h"
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+#include "btstack_chipset_cc256x.h"
+#endif
+#include "ble/le_device_db.h"
+#include "ble/sm.h"
+#include "gap.h"
+#include "hci.h"
+#include "hci_transport_virtual.h"
+#include "l2cap.h"
+
+#define TEST_PSM        0x1001
+#define TEST_TIMEOUT_MS 30000
+#define TEST_MTU        (HCI_ACL_PAYLOAD_SIZE - L2CAP_HEADER_SIZE)
+#define MAX_PINGS       1000
+#define SCAN_DURATION_MS 500
+#define ADVERTISING_DATA_CHANGE_MS 100
+#define MAX_EXTENDED_ADVERTISING_DATA_LEN HCI_TRANSPORT_VIRTUAL_MAX_ADVERTISING_DATA_LEN
+
+// message types
+#define MESSAGE_DATA    'D'
+#define MESSAGE_DONE    'A'
+#define MESSAGE_PING    'P'
+#define DUAL_RSSI_ROUNDS 20
+#define MESSAGE_BULK    'B'
+#define MESSAGE_AUDIO   'U'
+
+// test config
+static int      classic_mode;
+static uint32_t num_packets   = 1000;
+static uint16_t payload_size  = 1000;
+static uint32_t num_pings     = 100;
+static uint32_t num_connections;
+static int      warm_start;
+static uint32_t num_init_script_commands;
+static int      scan_before_connect;
+static uint32_t dedup_ttl_ms;
+static uint8_t  num_advertising_data_values;
+static uint16_t extended_advertising_data_len;
+static uint32_t private_address_update_ms;
+static int      coded_phy;
+static int      default_advertising_params;
+static int      acl_tx_scheduler_test;
+static int      dual_connections;
+static hci_transport_config_virtual_t virtual_config = {
+    HCI_TRANSPORT_CONFIG_VIRTUAL,
+    -1,
+    { 0 },
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+};
+
+static const bd_addr_t central_addr    = { 0x00, 0x1B, 0xDC, 0x00, 0x00, 0x01 };
+static const bd_addr_t peripheral_addr = { 0x00, 0x1B, 0xDC, 0x00, 0x00, 0x02 };
+
+static sm_key_t sm_er = { 0x45, 0x52, 0x45, 0x52, 0x45, 0x52, 0x45, 0x52, 0x45, 0x52, 0x45, 0x52, 0x45, 0x52, 0x45, 0x52 };
+static sm_key_t sm_ir = { 0x49, 0x52, 0x49, 0x52, 0x49, 0x52, 0x49, 0x52, 0x49, 0x52, 0x49, 0x52, 0x49, 0x52, 0x49, 0x52 };
+
+// endpoint state
+static const char * endpoint_name;
+static int      is_central;
+static uint16_t local_cid;
+static hci_con_handle_t con_handle;
+static uint8_t  le_receive_buffer[TEST_MTU];
+static uint8_t  send_buffer[TEST_MTU];
+static uint32_t num_sent;
+static uint32_t num_received;
+static uint32_t num_pongs;
+static uint8_t  done_pending;
+static uint8_t  pong_pending;
+static uint64_t transfer_start_us;
+static uint64_t ping_sent_us;
+static uint64_t power_on_us;
+static uint64_t connections_start_us;
+static uint32_t num_connections_done;
+static uint8_t  dual_num_disconnected;
+static uint64_t dual_connect_start_us;
+static uint64_t dual_classic_setup_us;
+static uint64_t dual_le_setup_us;
+static hci_con_handle_t dual_handles[2];
+static uint8_t  dual_num_up;
+static uint8_t  dual_num_rssi;
+static uint32_t dual_rssi_round;
+static uint64_t dual_rssi_start_us;
+static uint64_t dual_rssi_us;
+static uint64_t cold_start_us;
+static int      power_cycle_done;
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+static char     tlv_db_path[64];
+static btstack_tlv_posix_t tlv_context;
+static uint32_t num_supported_commands_read;
+#endif
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+static uint32_t num_advertising_reports;
+static uint32_t num_advertising_report_batches;
+static int      last_advertising_data_value = -1;
+static uint8_t  advertising_data[] = { 0x04, BLUETOOTH_DATA_TYPE_MANUFACTURER_SPECIFIC_DATA, 0x48, 0x00, 0x00 };
+static btstack_timer_source_t advertising_data_timer;
+#endif
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+#define EXTENDED_ADVERTISING_SID_LONG  1
+#define EXTENDED_ADVERTISING_SID_SHORT 2
+#define EXTENDED_ADVERTISING_SHORT_DATA_LEN 20
+// advertisers: legacy advertising with handle 0, advertising set with long data, advertising set with short data
+#define NUM_ADVERTISERS 3
+static le_advertising_set_t advertising_set_long;
+static le_advertising_set_t advertising_set_short;
+static le_advertising_set_t advertising_set_extra;
+static le_advertising_set_t advertising_set_rejected;
+static bd_addr_t advertiser_addresses[NUM_ADVERTISERS];
+static uint32_t  num_advertiser_addresses[NUM_ADVERTISERS];
+static uint8_t  extended_advertising_data[MAX_EXTENDED_ADVERTISING_DATA_LEN];
+static uint32_t num_extended_advertising_reports_long;
+static uint32_t num_extended_advertising_reports_short;
+static btstack_timer_source_t private_address_timer;
+#endif
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+#define SCHEDULER_PAYLOAD_SIZE   20
+#define SCHEDULER_AUDIO_INTERVAL 10
+#define SCHEDULER_NUM_BULK_CIDS  3
+// bulk channels: two on Classic connection, one on LE connection
+static uint16_t scheduler_bulk_cids[SCHEDULER_NUM_BULK_CIDS];
+static uint16_t scheduler_audio_cid;
+static uint8_t  scheduler_num_channels_opened;
+static hci_con_handle_t scheduler_classic_handle;
+static uint32_t scheduler_num_sent_classic;
+static uint32_t scheduler_num_sent_le;
+static uint8_t  scheduler_audio_pending;
+static uint8_t  scheduler_started;
+static uint32_t scheduler_num_acl_classic;
+static uint32_t scheduler_num_acl_le;
+static uint32_t scheduler_num_acl_audio;
+static hci_transport_t scheduler_transport;
+static int (*scheduler_virtual_send_packet)(uint8_t packet_type, uint8_t * packet, int size);
+static uint8_t  scheduler_done;
+static uint8_t  scheduler_num_disconnected;
+#endif
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+static char     bts_file_path[64];
+static uint32_t num_vendor_commands_completed;
+#endif
+static uint32_t round_trip_us[MAX_PINGS];
+static const uint8_t default_advertising_data[] = { 0x02, BLUETOOTH_DATA_TYPE_FLAGS, 0x06 };
+static btstack_timer_source_t timeout_timer;
+static btstack_timer_source_t connect_timer;
+static btstack_packet_callback_registration_t hci_event_callback_registration;
+static btstack_packet_callback_registration_t sm_event_callback_registration;
+
+static uint64_t get_time_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+static int compare_uint32(const void * a, const void * b){
+    uint32_t value_a = *(const uint32_t *) a;
+    uint32_t value_b = *(const uint32_t *) b;
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+static void timeout_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    printf("%s: timeout, sent %u, received %u packets, %u pongs\n", endpoint_name, num_sent, num_received, num_pongs);
+    exit(1);
+}
+
+static void channel_send(uint16_t len){
+    if (classic_mode){
+        l2cap_send(local_cid, send_buffer, len);
+    } else {
+        l2cap_le_send_data(local_cid, send_buffer, len);
+    }
+}
+
+static void channel_request_can_send_now(void){
+    if (classic_mode){
+        l2cap_request_can_send_now_event(local_cid);
+    } else {
+        l2cap_le_request_can_send_now_event(local_cid);
+    }
+}
+
+static void central_send_ping(void){
+    ping_sent_us = get_time_us();
+    channel_request_can_send_now();
+}
+
+static void central_handle_data(uint8_t * packet, uint16_t size){
+    uint64_t now_us = get_time_us();
+    switch (packet[0]){
+        case MESSAGE_DONE: {
+            uint64_t duration_us = now_us - transfer_start_us;
+            double bytes = (double) num_packets * payload_size;
+            printf("%s mode: %u packets of %u bytes in %u ms, %.1f kB/s\n", classic_mode ? "Classic" : "LE",
+                   num_packets, payload_size, (uint32_t) (duration_us / 1000), (bytes * 1000.0) / duration_us);
+            central_send_ping();
+            break;
+        }
+        case MESSAGE_PING:
+            round_trip_us[num_pongs++] = (uint32_t) (now_us - ping_sent_us);
+            if (num_pongs < num_pings){
+                central_send_ping();
+                break;
+            }
+            qsort(round_trip_us, num_pongs, sizeof(uint32_t), &compare_uint32);
+            printf("%s mode: %u pings, round trip min %u us, median %u us, max %u us\n", classic_mode ? "Classic" : "LE",
+                   num_pongs, round_trip_us[0], round_trip_us[num_pongs / 2], round_trip_us[num_pongs - 1]);
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+            hci_acl_tx_stats_t tx_stats;
+            if (hci_get_acl_tx_stats(con_handle, &tx_stats) == ERROR_CODE_SUCCESS){
+                printf("%s mode: ACL TX scheduler, max wait %u ms\n", classic_mode ? "Classic" : "LE", tx_stats.max_wait_time_ms);
+            }
+#endif
+            gap_disconnect(con_handle);
+            break;
+        default:
+            break;
+    }
+    UNUSED(size);
+}
+
+static void peripheral_handle_data(uint8_t * packet, uint16_t size){
+    switch (packet[0]){
+        case MESSAGE_DATA:
+            if ((size != payload_size) || (little_endian_read_32(packet, 1) != num_received)){
+                printf("%s: unexpected packet, size %u, expected nr %u\n", endpoint_name, size, num_received);
+                exit(1);
+            }
+            num_received++;
+            if (num_received == num_packets){
+                done_pending = 1;
+                channel_request_can_send_now();
+            }
+            break;
+        case MESSAGE_PING:
+            pong_pending = 1;
+            channel_request_can_send_now();
+            break;
+        default:
+            break;
+    }
+}
+
+static void handle_can_send_now(void){
+    if (is_central){
+        if (num_sent < num_packets){
+            send_buffer[0] = MESSAGE_DATA;
+            little_endian_store_32(send_buffer, 1, num_sent);
+            num_sent++;
+            channel_send(payload_size);
+            if (num_sent < num_packets){
+                channel_request_can_send_now();
+            }
+        } else {
+            send_buffer[0] = MESSAGE_PING;
+            channel_send(4);
+        }
+        return;
+    }
+    if (done_pending){
+        done_pending = 0;
+        send_buffer[0] = MESSAGE_DONE;
+        channel_send(4);
+    } else if (pong_pending){
+        pong_pending = 0;
+        send_buffer[0] = MESSAGE_PING;
+        channel_send(4);
+    }
+    if (done_pending || pong_pending){
+        channel_request_can_send_now();
+    }
+}
+
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+static void l2cap_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+// observe ACL packets sent to the controller
+static int scheduler_send_packet(uint8_t packet_type, uint8_t * packet, int size){
+    if ((packet_type == HCI_ACL_DATA_PACKET) && scheduler_started && !scheduler_done){
+        hci_con_handle_t handle = little_endian_read_16(packet, 0) & 0x0fff;
+        uint16_t cid = little_endian_read_16(packet, 6);
+        // skip fixed channels
+        if (cid >= 0x40){
+            // LE Data Channel PDU starts with SDU length
+            uint8_t message = packet[(handle == scheduler_classic_handle) ? 8 : 10];
+            if (message == MESSAGE_AUDIO){
+                scheduler_audio_pending = 0;
+                scheduler_num_acl_audio++;
+            } else if (scheduler_audio_pending){
+                printf("%s: bulk channel served before audio channel\n", endpoint_name);
+                exit(1);
+            } else if (handle == scheduler_classic_handle){
+                scheduler_num_acl_classic++;
+            } else {
+                scheduler_num_acl_le++;
+            }
+        }
+    }
+    return (*scheduler_virtual_send_packet)(packet_type, packet, size);
+}
+
+static void scheduler_send(uint16_t cid){
+    send_buffer[0] = (cid == scheduler_audio_cid) ? MESSAGE_AUDIO : MESSAGE_BULK;
+    if (cid == scheduler_bulk_cids[SCHEDULER_NUM_BULK_CIDS - 1]){
+        l2cap_le_send_data(cid, send_buffer, SCHEDULER_PAYLOAD_SIZE);
+    } else {
+        l2cap_send(cid, send_buffer, SCHEDULER_PAYLOAD_SIZE);
+    }
+}
+
+static void scheduler_request_can_send_now(uint16_t cid){
+    if (cid == scheduler_bulk_cids[SCHEDULER_NUM_BULK_CIDS - 1]){
+        l2cap_le_request_can_send_now_event(cid);
+    } else {
+        l2cap_request_can_send_now_event(cid);
+    }
+}
+
+static void scheduler_finish(void){
+    scheduler_done = 1;
+    // fair share of bulk ACL packets per connection, audio packets are sent with priority
+    uint32_t num_classic = scheduler_num_acl_classic;
+    uint32_t difference = (num_classic > scheduler_num_acl_le) ? (num_classic - scheduler_num_acl_le) : (scheduler_num_acl_le - num_classic);
+    printf("%s mode: ACL TX scheduler, Classic connection %u bulk + %u audio packets, LE connection %u bulk packets\n",
+           classic_mode ? "Classic" : "LE", scheduler_num_acl_classic, scheduler_num_acl_audio, scheduler_num_acl_le);
+    if (difference > (num_packets / 10)){
+        printf("%s: connections not served fairly\n", endpoint_name);
+        exit(1);
+    }
+    gap_disconnect(scheduler_classic_handle);
+    gap_disconnect(con_handle);
+}
+
+static void scheduler_handle_can_send_now(uint16_t cid){
+    if (scheduler_done) return;
+    if (cid == scheduler_audio_cid){
+        scheduler_send(cid);
+        return;
+    }
+    // LE Data Channels buffer one SDU, L2CAP_EVENT_LE_CAN_SEND_NOW is not scheduled
+    if (cid == scheduler_bulk_cids[SCHEDULER_NUM_BULK_CIDS - 1]){
+        scheduler_num_sent_le++;
+    } else {
+        scheduler_num_sent_classic++;
+    }
+    scheduler_send(cid);
+    uint32_t num_sent_bulk = scheduler_num_sent_classic + scheduler_num_sent_le;
+    if (num_sent_bulk >= num_packets){
+        // L2CAP_EVENT_CAN_SEND_NOW for other channels might be emitted while sending
+        if (!scheduler_done){
+            scheduler_finish();
+        }
+        return;
+    }
+    if ((num_sent_bulk % SCHEDULER_AUDIO_INTERVAL) == 0u){
+        // audio channel has to be served next, L2CAP_EVENT_CAN_SEND_NOW might be emitted right away
+        scheduler_audio_pending = 1;
+        l2cap_request_can_send_now_event(scheduler_audio_cid);
+    }
+    scheduler_request_can_send_now(cid);
+}
+
+// open Classic channels one after the other, then connect via LE
+static void scheduler_channel_opened(uint16_t cid){
+    bd_addr_t addr;
+    (void)memcpy(addr, peripheral_addr, 6);
+    switch (scheduler_num_channels_opened++){
+        case 0:
+            scheduler_classic_handle = con_handle;
+            scheduler_bulk_cids[0] = cid;
+            l2cap_create_channel(&l2cap_packet_handler, addr, TEST_PSM, TEST_MTU, NULL);
+            break;
+        case 1:
+            scheduler_bulk_cids[1] = cid;
+            l2cap_create_channel(&l2cap_packet_handler, addr, TEST_PSM, TEST_MTU, NULL);
+            break;
+        case 2:
+            scheduler_audio_cid = cid;
+            l2cap_set_tx_class(cid, HCI_ACL_TX_CLASS_AUDIO);
+            gap_connect(addr, BD_ADDR_TYPE_LE_PUBLIC);
+            break;
+        default: {
+            scheduler_bulk_cids[2] = cid;
+            scheduler_started = 1;
+            int i;
+            for (i = 0; i < SCHEDULER_NUM_BULK_CIDS; i++){
+                scheduler_request_can_send_now(scheduler_bulk_cids[i]);
+            }
+            break;
+        }
+    }
+}
+#endif
+
+// dual connections: read RSSI of both connections at the same time, then disconnect both
+static void dual_read_rssi(void){
+    dual_num_rssi = 0;
+    gap_read_rssi(dual_handles[0]);
+    gap_read_rssi(dual_handles[1]);
+}
+
+static void dual_connection_up(hci_con_handle_t handle){
+    dual_handles[dual_num_up++] = handle;
+    if (dual_num_up < 2u) return;
+    dual_num_up = 0;
+    dual_rssi_round = 0;
+    dual_rssi_start_us = get_time_us();
+    dual_read_rssi();
+}
+
+static void dual_handle_rssi_measurement(void){
+    dual_num_rssi++;
+    if (dual_num_rssi < 2u) return;
+    dual_rssi_round++;
+    if (dual_rssi_round < DUAL_RSSI_ROUNDS){
+        dual_read_rssi();
+        return;
+    }
+    dual_rssi_us += get_time_us() - dual_rssi_start_us;
+    gap_disconnect(dual_handles[0]);
+    gap_disconnect(dual_handles[1]);
+}
+
+static void channel_opened(uint16_t cid, hci_con_handle_t handle){
+    local_cid = cid;
+    if (!is_central) return;
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+    if (acl_tx_scheduler_test){
+        scheduler_channel_opened(cid);
+        return;
+    }
+#endif
+    if (num_connections > 0){
+        if (dual_connections){
+            dual_classic_setup_us += get_time_us() - dual_connect_start_us;
+            dual_connection_up(handle);
+            return;
+        }
+        gap_disconnect(handle);
+        return;
+    }
+    transfer_start_us = get_time_us();
+    channel_request_can_send_now();
+}
+
+static void l2cap_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type == L2CAP_DATA_PACKET){
+        if (channel != local_cid) return;
+        if (is_central){
+            central_handle_data(packet, size);
+        } else {
+            peripheral_handle_data(packet, size);
+        }
+        return;
+    }
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (hci_event_packet_get_type(packet)){
+        case L2CAP_EVENT_INCOMING_CONNECTION:
+            l2cap_accept_connection(l2cap_event_incoming_connection_get_local_cid(packet));
+            break;
+        case L2CAP_EVENT_CHANNEL_OPENED:
+            if (l2cap_event_channel_opened_get_status(packet) != ERROR_CODE_SUCCESS){
+                printf("%s: L2CAP channel failed, status 0x%02x\n", endpoint_name, l2cap_event_channel_opened_get_status(packet));
+                exit(1);
+            }
+            channel_opened(l2cap_event_channel_opened_get_local_cid(packet), l2cap_event_channel_opened_get_handle(packet));
+            break;
+        case L2CAP_EVENT_LE_INCOMING_CONNECTION:
+            l2cap_le_accept_connection(l2cap_event_le_incoming_connection_get_local_cid(packet), le_receive_buffer,
+                                       sizeof(le_receive_buffer), L2CAP_LE_AUTOMATIC_CREDITS);
+            break;
+        case L2CAP_EVENT_LE_CHANNEL_OPENED:
+            if (l2cap_event_le_channel_opened_get_status(packet) != ERROR_CODE_SUCCESS){
+                printf("%s: L2CAP LE channel failed, status 0x%02x\n", endpoint_name, l2cap_event_le_channel_opened_get_status(packet));
+                exit(1);
+            }
+            channel_opened(l2cap_event_le_channel_opened_get_local_cid(packet), l2cap_event_le_channel_opened_get_handle(packet));
+            break;
+        case L2CAP_EVENT_CAN_SEND_NOW:
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+            if (acl_tx_scheduler_test && is_central){
+                scheduler_handle_can_send_now(l2cap_event_can_send_now_get_local_cid(packet));
+                break;
+            }
+#endif
+            handle_can_send_now();
+            break;
+        case L2CAP_EVENT_LE_CAN_SEND_NOW:
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+            if (acl_tx_scheduler_test && is_central){
+                scheduler_handle_can_send_now(l2cap_event_le_can_send_now_get_local_cid(packet));
+                break;
+            }
+#endif
+            handle_can_send_now();
+            break;
+        default:
+            break;
+    }
+}
+
+static void central_connect(void){
+    bd_addr_t addr;
+    (void)memcpy(addr, peripheral_addr, 6);
+    if (dual_connections){
+        dual_connect_start_us = get_time_us();
+        l2cap_create_channel(&l2cap_packet_handler, addr, TEST_PSM, TEST_MTU, &local_cid);
+        gap_connect(addr, BD_ADDR_TYPE_LE_PUBLIC);
+    } else if (classic_mode || acl_tx_scheduler_test){
+        l2cap_create_channel(&l2cap_packet_handler, addr, TEST_PSM, TEST_MTU, &local_cid);
+    } else {
+        gap_connect(addr, BD_ADDR_TYPE_LE_PUBLIC);
+    }
+}
+
+static void connect_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    central_connect();
+}
+
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+static void advertising_reports_handler(const gap_le_advertising_report_t * reports, uint16_t num_reports){
+    uint16_t i;
+    for (i=0;i<num_reports;i++){
+        if (bd_addr_cmp(reports[i].address, peripheral_addr) != 0){
+            printf("%s: advertising report from unexpected address %s\n", endpoint_name, bd_addr_to_str(reports[i].address));
+            exit(1);
+        }
+        if ((num_advertising_data_values == 0) || (dedup_ttl_ms == 0)) continue;
+        // peripheral cycles through the values, no change may be suppressed
+        int value = reports[i].data[4];
+        if ((reports[i].data_length != sizeof(advertising_data)) ||
+            ((last_advertising_data_value >= 0) && (value != ((last_advertising_data_value + 1) % num_advertising_data_values)))){
+            printf("%s: advertising data change not reported, value %u after %d\n", endpoint_name, value, last_advertising_data_value);
+            exit(1);
+        }
+        last_advertising_data_value = value;
+    }
+    num_advertising_report_batches++;
+    num_advertising_reports += num_reports;
+}
+
+static void scan_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    gap_stop_scan();
+    printf("LE mode: scan, %u advertising reports in %u batches, dedup ttl %u ms\n", num_advertising_reports,
+           num_advertising_report_batches, dedup_ttl_ms);
+    int ok;
+    if (dedup_ttl_ms == 0){
+        ok = num_advertising_report_batches < num_advertising_reports;
+    } else if (num_advertising_data_values > 0){
+        // each value once, or every change if the cache cannot hold all values and least recently seen gets replaced
+        if (LE_ADVERTISING_REPORT_DEDUP_CACHE_SIZE >= num_advertising_data_values){
+            ok = num_advertising_reports == num_advertising_data_values;
+        } else {
+            ok = num_advertising_reports > num_advertising_data_values;
+        }
+    } else if (dedup_ttl_ms < SCAN_DURATION_MS){
+        // same advertising data reported again after ttl
+        ok = (num_advertising_reports >= 2) && (num_advertising_reports <= ((SCAN_DURATION_MS / dedup_ttl_ms) + 1));
+    } else {
+        // peripheral sends the same advertising data all the time
+        ok = num_advertising_reports == 1;
+    }
+    if (!ok){
+        printf("%s: unexpected number of advertising reports\n", endpoint_name);
+        exit(1);
+    }
+    gap_le_register_advertising_reports_handler(NULL);
+    central_connect();
+}
+
+static void central_scan(void){
+    gap_le_register_advertising_reports_handler(&advertising_reports_handler);
+    gap_le_set_advertising_reports_batch_delay(100);
+    gap_le_set_advertising_report_dedup_ttl(dedup_ttl_ms);
+    gap_set_scan_parameters(0, 0x0030, 0x0030);
+    gap_start_scan();
+    btstack_run_loop_set_timer_handler(&connect_timer, &scan_timer_handler);
+    btstack_run_loop_set_timer(&connect_timer, SCAN_DURATION_MS);
+    btstack_run_loop_add_timer(&connect_timer);
+}
+
+static void advertising_data_timer_handler(btstack_timer_source_t * ts){
+    advertising_data[4] = (advertising_data[4] + 1) % num_advertising_data_values;
+    gap_advertisements_set_data(sizeof(advertising_data), advertising_data);
+    btstack_run_loop_set_timer(ts, ADVERTISING_DATA_CHANGE_MS);
+    btstack_run_loop_add_timer(ts);
+}
+
+static void peripheral_advertising_data_start(void){
+    gap_advertisements_set_data(sizeof(advertising_data), advertising_data);
+    btstack_run_loop_set_timer_handler(&advertising_data_timer, &advertising_data_timer_handler);
+    btstack_run_loop_set_timer(&advertising_data_timer, ADVERTISING_DATA_CHANGE_MS);
+    btstack_run_loop_add_timer(&advertising_data_timer);
+}
+#endif
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+static void extended_advertising_data_init(void){
+    uint16_t i;
+    for (i=0;i<sizeof(extended_advertising_data);i++){
+        extended_advertising_data[i] = (uint8_t) (i * 7);
+    }
+}
+
+static void peripheral_extended_advertising_start(void){
+    le_extended_advertising_parameters_t params;
+    memset(&params, 0, sizeof(params));
+    params.advertising_event_properties = 0;     // non-connectable, non-scannable, extended PDUs
+    params.primary_advertising_interval_min = 0x0030;
+    params.primary_advertising_interval_max = 0x0030;
+    params.primary_advertising_channel_map = 0x07;
+    params.advertising_tx_power = 127;
+    params.primary_advertising_phy = coded_phy ? 3 : 1;
+    params.secondary_advertising_phy = 1;
+    uint8_t advertising_handle;
+    params.advertising_sid = EXTENDED_ADVERTISING_SID_LONG;
+    if (gap_extended_advertising_setup(&advertising_set_long, &params, &advertising_handle) != ERROR_CODE_SUCCESS){
+        printf("%s: advertising set setup failed\n", endpoint_name);
+        exit(1);
+    }
+    gap_extended_advertising_set_adv_data(advertising_handle, extended_advertising_data_len, extended_advertising_data);
+    gap_extended_advertising_start(advertising_handle, 0, 0);
+    params.primary_advertising_phy = 1;
+    params.advertising_sid = EXTENDED_ADVERTISING_SID_SHORT;
+    if (gap_extended_advertising_setup(&advertising_set_short, &params, &advertising_handle) != ERROR_CODE_SUCCESS){
+        printf("%s: advertising set setup failed\n", endpoint_name);
+        exit(1);
+    }
+    gap_extended_advertising_set_adv_data(advertising_handle, EXTENDED_ADVERTISING_SHORT_DATA_LEN, extended_advertising_data);
+    gap_extended_advertising_start(advertising_handle, 0, 0);
+
+    // one of the advertising sets of the virtual controller is used for handle 0
+    uint8_t status = gap_extended_advertising_setup(&advertising_set_extra, &params, &advertising_handle);
+    if (status != ERROR_CODE_SUCCESS){
+        printf("%s: setup of third advertising set failed, status 0x%02x\n", endpoint_name, status);
+        exit(1);
+    }
+    if (gap_extended_advertising_set_adv_data(advertising_handle, HCI_TRANSPORT_VIRTUAL_MAX_ADVERTISING_DATA_LEN + 1, extended_advertising_data) != ERROR_CODE_MEMORY_CAPACITY_EXCEEDED){
+        printf("%s: advertising data longer than supported by controller not rejected\n", endpoint_name);
+        exit(1);
+    }
+    gap_extended_advertising_remove(advertising_handle);
+    status = gap_extended_advertising_setup(&advertising_set_rejected, &params, &advertising_handle);
+    if (status != ERROR_CODE_LIMIT_REACHED){
+        printf("%s: setup of more advertising sets than supported by controller not rejected, status 0x%02x\n", endpoint_name, status);
+        exit(1);
+    }
+}
+
+// SM uses current address for pairing, stop address updates in the first half of the central's scan
+static void peripheral_private_address_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    gap_random_address_set_update_period(TEST_TIMEOUT_MS);
+}
+
+// with private address, all advertisers have to use the new address
+static void central_track_advertiser_address(int advertiser, bd_addr_type_t address_type, const bd_addr_t address){
+    if (private_address_update_ms == 0){
+        if (bd_addr_cmp(address, peripheral_addr) == 0) return;
+    } else if (address_type == BD_ADDR_TYPE_LE_RANDOM){
+        if (bd_addr_cmp(address, advertiser_addresses[advertiser]) == 0) return;
+        (void)memcpy(advertiser_addresses[advertiser], address, 6);
+        num_advertiser_addresses[advertiser]++;
+        return;
+    }
+    printf("%s: advertising report from unexpected address %s\n", endpoint_name, bd_addr_to_str(address));
+    exit(1);
+}
+
+// data status and length of reassembled long advertising data
+static uint16_t central_expected_extended_advertising_data_len(uint8_t * data_status){
+    const uint16_t report_len = HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORT_DATA_LEN;
+    uint16_t data_len = extended_advertising_data_len;
+    *data_status = 0;
+    if (data_len <= report_len) return data_len;
+    switch (virtual_config.extended_advertising_report_mode){
+        case HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORTS_TRUNCATED:
+            // last report without data
+            data_len = ((data_len - 1) / report_len) * report_len;
+            *data_status = 2;
+            break;
+        case HCI_TRANSPORT_VIRTUAL_EXTENDED_ADVERTISING_REPORTS_INTERLEAVED:
+            // report of short advertising set follows first report
+            *data_status = 2;
+            return report_len;
+        default:
+            break;
+    }
+    // reports that do not fit completely are discarded
+    if (data_len > LE_EXTENDED_ADVERTISING_REPORT_DATA_SIZE){
+        data_len = (LE_EXTENDED_ADVERTISING_REPORT_DATA_SIZE / report_len) * report_len;
+        *data_status = 2;
+    }
+    return data_len;
+}
+
+static void central_handle_extended_advertising_report(const uint8_t * packet, uint16_t size){
+    if (gap_event_extended_advertising_report_get_advertising_sid(packet) == 0xff) return;   // legacy advertising
+    bd_addr_t addr;
+    gap_event_extended_advertising_report_get_address(packet, addr);
+    bd_addr_type_t address_type = (bd_addr_type_t) gap_event_extended_advertising_report_get_address_type(packet);
+    uint16_t event_type  = gap_event_extended_advertising_report_get_advertising_event_type(packet);
+    uint16_t data_length = gap_event_extended_advertising_report_get_data_length(packet);
+    const uint8_t * data = gap_event_extended_advertising_report_get_data(packet);
+    uint16_t expected_length = 0;
+    uint8_t  expected_data_status = 0;
+    uint8_t  expected_primary_phy = 1;
+    uint32_t * num_reports = NULL;
+    int advertiser = 0;
+    switch (gap_event_extended_advertising_report_get_advertising_sid(packet)){
+        case EXTENDED_ADVERTISING_SID_LONG:
+            expected_length = central_expected_extended_advertising_data_len(&expected_data_status);
+            expected_primary_phy = coded_phy ? 3 : 1;
+            num_reports = &num_extended_advertising_reports_long;
+            advertiser = 1;
+            break;
+        case EXTENDED_ADVERTISING_SID_SHORT:
+            expected_length = EXTENDED_ADVERTISING_SHORT_DATA_LEN;
+            num_reports = &num_extended_advertising_reports_short;
+            advertiser = 2;
+            break;
+        default:
+            break;
+    }
+    central_track_advertiser_address(advertiser, address_type, addr);
+    // reassembled from all fragments, event length does not fit into 8 bit for long data
+    if ((num_reports == NULL) || (((event_type >> 5) & 0x03) != expected_data_status) || (packet[1] != btstack_min(size - 2, 255)) ||
+        (gap_event_extended_advertising_report_get_primary_phy(packet) != expected_primary_phy) ||
+        (data_length != expected_length) || (memcmp(data, extended_advertising_data, data_length) != 0)){
+        printf("%s: unexpected extended advertising report, sid %u, event type 0x%04x, length %u\n", endpoint_name,
+               gap_event_extended_advertising_report_get_advertising_sid(packet), event_type, data_length);
+        exit(1);
+    }
+    (*num_reports)++;
+}
+
+static void extended_scan_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    gap_stop_scan();
+    uint8_t data_status;
+    uint16_t data_len = central_expected_extended_advertising_data_len(&data_status);
+    printf("LE mode: extended scan, %u reports with %u of %u bytes, %u reports with %u bytes\n", num_extended_advertising_reports_long,
+           data_len, extended_advertising_data_len, num_extended_advertising_reports_short, EXTENDED_ADVERTISING_SHORT_DATA_LEN);
+    if ((num_extended_advertising_reports_long == 0) || (num_extended_advertising_reports_short == 0)){
+        printf("%s: extended advertising reports missing\n", endpoint_name);
+        exit(1);
+    }
+    if (private_address_update_ms > 0){
+        printf("LE mode: private address, %u legacy advertising addresses, %u and %u advertising set addresses\n",
+               num_advertiser_addresses[0], num_advertiser_addresses[1], num_advertiser_addresses[2]);
+        int i;
+        for (i = 0; i < NUM_ADVERTISERS; i++){
+            if (num_advertiser_addresses[i] < 2){
+                printf("%s: address of advertiser %u not updated\n", endpoint_name, i);
+                exit(1);
+            }
+        }
+    }
+    central_connect();
+}
+
+static void central_scan_extended(void){
+    if (coded_phy){
+        // LE 2M cannot be used for scanning
+        if (gap_set_scan_phys(0x02) != ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS){
+            printf("%s: invalid scanning PHYs not rejected\n", endpoint_name);
+            exit(1);
+        }
+        if ((gap_set_scan_phys(0x05) != ERROR_CODE_SUCCESS) || (gap_set_connection_phys(0x07) != ERROR_CODE_SUCCESS)){
+            printf("%s: setting LE 1M and LE Coded PHYs failed\n", endpoint_name);
+            exit(1);
+        }
+    }
+    gap_set_scan_parameters(0, 0x0030, 0x0030);
+    gap_start_scan();
+    btstack_run_loop_set_timer_handler(&connect_timer, &extended_scan_timer_handler);
+    btstack_run_loop_set_timer(&connect_timer, 500);
+    btstack_run_loop_add_timer(&connect_timer);
+}
+#endif
+
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+static void remove_tlv_db(void){
+    (void)unlink(tlv_db_path);
+}
+#endif
+
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+static void bts_write_action(FILE * file, uint16_t type, const uint8_t * data, uint16_t size){
+    uint8_t header[4];
+    little_endian_store_16(header, 0, type);
+    little_endian_store_16(header, 2, size);
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(data, 1, size, file);
+}
+
+// .bts file with num_init_script_commands patch commands and a baud rate change in the middle
+static int bts_file_create(void){
+    FILE * file = fopen(bts_file_path, "wb");
+    if (file == NULL) return -1;
+    uint8_t header[32];
+    memset(header, 0, sizeof(header));
+    (void)memcpy(header, "BTSB", 4);
+    fwrite(header, 1, sizeof(header), file);
+    const char remark[] = "virtual_controller_test";
+    bts_write_action(file, 6, (const uint8_t *) remark, sizeof(remark));
+    uint8_t command[4 + 250];
+    uint32_t i;
+    for (i=0;i<num_init_script_commands;i++){
+        if (i == (num_init_script_commands / 2)){
+            // HCI_VS_Update_UART_HCI_Baudrate + serial port parameters
+            const uint8_t baud_rate_command[] = { 0x01, 0x36, 0xff, 0x04, 0x00, 0x10, 0x0e, 0x00 };
+            const uint8_t serial_port_parameters[] = { 0x00, 0x10, 0x0e, 0x00, 0x01, 0x00, 0x00, 0x00 };
+            bts_write_action(file, 1, baud_rate_command, sizeof(baud_rate_command));
+            bts_write_action(file, 3, serial_port_parameters, sizeof(serial_port_parameters));
+        }
+        // HCI_VS_Write_Memory_Block-like command with sequence number
+        command[0] = 0x01;
+        little_endian_store_16(command, 1, 0xff05);
+        command[3] = 250;
+        memset(&command[4], 0, 250);
+        little_endian_store_32(command, 4, i);
+        bts_write_action(file, 1, command, sizeof(command));
+    }
+    fclose(file);
+    return 0;
+}
+
+static void remove_bts_file(void){
+    (void)unlink(bts_file_path);
+}
+#endif
+
+static void power_off_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    hci_power_control(HCI_POWER_OFF);
+}
+
+// connection mode: connect again until num_connections have been established
+static void handle_disconnection_complete(void){
+    if (dual_connections){
+        // continue after both connections are down
+        dual_num_disconnected++;
+        if (dual_num_disconnected < 2u) return;
+        dual_num_disconnected = 0;
+    }
+    num_connections_done++;
+    if (num_connections_done < num_connections){
+        // connection is freed after the Disconnection Complete event has been processed
+        if (is_central){
+            btstack_run_loop_set_timer_handler(&connect_timer, &connect_timer_handler);
+            btstack_run_loop_set_timer(&connect_timer, 0);
+            btstack_run_loop_add_timer(&connect_timer);
+        }
+        return;
+    }
+    if (is_central){
+        uint64_t duration_us = get_time_us() - connections_start_us;
+        printf("%s mode: %u connections in %u ms, %u us per connection\n", dual_connections ? "Classic and LE" : (classic_mode ? "Classic" : "LE"),
+               num_connections, (uint32_t) (duration_us / 1000), (uint32_t) (duration_us / num_connections));
+        if (dual_connections){
+            printf("Classic and LE mode: Classic connection with L2CAP channel in %u us, LE connection with pairing in %u us\n",
+                   (uint32_t) (dual_classic_setup_us / num_connections), (uint32_t) (dual_le_setup_us / num_connections));
+            printf("Classic and LE mode: Read RSSI on both connections in %u us per round\n",
+                   (uint32_t) (dual_rssi_us / (num_connections * DUAL_RSSI_ROUNDS)));
+        }
+    }
+    exit(0);
+}
+
+static void hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (hci_event_packet_get_type(packet)){
+#if defined(ENABLE_CC256X_INIT_SCRIPT_FILE) || defined(ENABLE_HCI_CONTROLLER_CACHE)
+        case HCI_EVENT_COMMAND_COMPLETE:
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+            if ((hci_event_command_complete_get_command_opcode(packet) >> 10) == OGF_VENDOR){
+                num_vendor_commands_completed++;
+            }
+#endif
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            if (hci_event_command_complete_get_command_opcode(packet) == hci_read_local_supported_commands.opcode){
+                num_supported_commands_read++;
+            }
+#endif
+            break;
+#endif
+        case BTSTACK_EVENT_STATE:
+            if (is_central && warm_start && (btstack_event_state_get_state(packet) == HCI_STATE_OFF)){
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+                num_vendor_commands_completed = 0;
+#endif
+#if defined(ENABLE_CC256X_INIT_SCRIPT_FILE) && defined(ENABLE_HCI_CONTROLLER_CACHE)
+                // updated init script invalidates the controller cache. new file, as the peripheral might still map the old one
+                if (num_init_script_commands > 0){
+                    num_init_script_commands++;
+                    (void)unlink(bts_file_path);
+                    if (bts_file_create() < 0){
+                        printf("%s: could not update %s\n", endpoint_name, bts_file_path);
+                        exit(1);
+                    }
+                }
+#endif
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+                num_supported_commands_read = 0;
+#endif
+                power_on_us = get_time_us();
+                hci_power_control(HCI_POWER_ON);
+                break;
+            }
+            if (btstack_event_state_get_state(packet) != HCI_STATE_WORKING) break;
+            if (is_central && warm_start && !power_cycle_done){
+                // power off from timer, not from within hci_init_done
+                cold_start_us = get_time_us() - power_on_us;
+                power_cycle_done = 1;
+                btstack_run_loop_set_timer_handler(&connect_timer, &power_off_timer_handler);
+                btstack_run_loop_set_timer(&connect_timer, 0);
+                btstack_run_loop_add_timer(&connect_timer);
+                break;
+            }
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+            // all commands from init script plus HCI_VS_Sleep_Mode_Configurations, without baud rate change
+            if (is_central && (num_init_script_commands > 0)){
+                printf("%s mode: init script, %u vendor commands\n", classic_mode ? "Classic" : "LE", num_vendor_commands_completed);
+                if (num_vendor_commands_completed != (num_init_script_commands + 1)){
+                    printf("%s: expected %u vendor commands\n", endpoint_name, num_init_script_commands + 1);
+                    exit(1);
+                }
+            }
+#endif
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            // controller capabilities are read again only if the init script has changed
+            if (is_central && warm_start){
+                uint32_t expected_reads = (num_init_script_commands > 0) ? 1 : 0;
+                printf("%s mode: controller cache %s\n", classic_mode ? "Classic" : "LE", (num_supported_commands_read == 0) ? "hit" : "miss");
+                if (num_supported_commands_read != expected_reads){
+                    printf("%s: expected controller cache %s\n", endpoint_name, (expected_reads == 0) ? "hit" : "miss");
+                    exit(1);
+                }
+            }
+#endif
+            if (is_central){
+                connections_start_us = get_time_us();
+                if (warm_start){
+                    printf("%s mode: hci_init to working in %u us, after power cycle %u us\n", classic_mode ? "Classic" : "LE",
+                           (uint32_t) cold_start_us, (uint32_t) (connections_start_us - power_on_us));
+                } else {
+                    printf("%s mode: hci_init to working in %u us\n", classic_mode ? "Classic" : "LE", (uint32_t) (connections_start_us - power_on_us));
+                }
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+                if (scan_before_connect && !classic_mode){
+                    central_scan();
+                    break;
+                }
+#endif
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+                if ((extended_advertising_data_len > 0) && !classic_mode){
+                    central_scan_extended();
+                    break;
+                }
+#endif
+                central_connect();
+            } else if (classic_mode){
+                gap_connectable_control(1);
+            } else {
+                if (acl_tx_scheduler_test || dual_connections){
+                    gap_connectable_control(1);
+                }
+                if (default_advertising_params){
+                    // Controller defaults, i.e. without advertising set for handle 0 configured by the application
+                    gap_advertisements_set_data(sizeof(default_advertising_data), (uint8_t *) default_advertising_data);
+                } else {
+                    bd_addr_t null_addr;
+                    memset(null_addr, 0, 6);
+                    gap_advertisements_set_params(0x0030, 0x0030, 0, 0, null_addr, 0x07, 0);
+                }
+                gap_advertisements_enable(1);
+#ifdef ENABLE_LE_ADVERTISING_REPORT_BATCHING
+                if (num_advertising_data_values > 0){
+                    peripheral_advertising_data_start();
+                }
+#endif
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+                if (extended_advertising_data_len > 0){
+                    peripheral_extended_advertising_start();
+                }
+#endif
+            }
+            break;
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+        case GAP_EVENT_EXTENDED_ADVERTISING_REPORT:
+            if (is_central){
+                central_handle_extended_advertising_report(packet, size);
+            }
+            break;
+        case GAP_EVENT_ADVERTISING_REPORT:
+            if (is_central && (extended_advertising_data_len > 0)){
+                bd_addr_t addr;
+                gap_event_advertising_report_get_address(packet, addr);
+                central_track_advertiser_address(0, (bd_addr_type_t) gap_event_advertising_report_get_address_type(packet), addr);
+            }
+            break;
+#endif
+        case HCI_EVENT_LE_META:
+            if (hci_event_le_meta_get_subevent_code(packet) != HCI_SUBEVENT_LE_CONNECTION_COMPLETE) break;
+            con_handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+            if (is_central){
+                sm_request_pairing(con_handle);
+            }
+            break;
+        case HCI_EVENT_CONNECTION_COMPLETE:
+            con_handle = hci_event_connection_complete_get_connection_handle(packet);
+            break;
+        case GAP_EVENT_RSSI_MEASUREMENT:
+            if (dual_connections && is_central){
+                dual_handle_rssi_measurement();
+            }
+            break;
+        case SM_EVENT_JUST_WORKS_REQUEST:
+            sm_just_works_confirm(sm_event_just_works_request_get_handle(packet));
+            break;
+        case SM_EVENT_PAIRING_COMPLETE:
+            if (sm_event_pairing_complete_get_status(packet) != ERROR_CODE_SUCCESS){
+                printf("%s: pairing failed, status 0x%02x\n", endpoint_name, sm_event_pairing_complete_get_status(packet));
+                exit(1);
+            }
+            if (is_central && (num_connections > 0)){
+                if (dual_connections){
+                    dual_le_setup_us += get_time_us() - dual_connect_start_us;
+                    dual_connection_up(sm_event_pairing_complete_get_handle(packet));
+                    break;
+                }
+                gap_disconnect(sm_event_pairing_complete_get_handle(packet));
+            } else if (is_central){
+                l2cap_le_create_channel(&l2cap_packet_handler, con_handle, TEST_PSM, le_receive_buffer, sizeof(le_receive_buffer),
+                                        L2CAP_LE_AUTOMATIC_CREDITS, LEVEL_2, &local_cid);
+            }
+            break;
+        case HCI_EVENT_DISCONNECTION_COMPLETE:
+            if (num_connections > 0){
+                handle_disconnection_complete();
+                break;
+            }
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+            if (acl_tx_scheduler_test && is_central){
+                if (!scheduler_done){
+                    printf("%s: disconnected, reason 0x%02x\n", endpoint_name, hci_event_disconnection_complete_get_reason(packet));
+                    exit(1);
+                }
+                scheduler_num_disconnected++;
+                if (scheduler_num_disconnected == 2){
+                    exit(0);
+                }
+                break;
+            }
+#endif
+            if (is_central && (num_pongs < num_pings)){
+                printf("%s: disconnected, reason 0x%02x\n", endpoint_name, hci_event_disconnection_complete_get_reason(packet));
+                exit(1);
+            }
+            exit(0);
+            break;
+        default:
+            break;
+    }
+}
+
+static void endpoint_run(const char * name, int central, int link_fd){
+    endpoint_name = name;
+    is_central = central;
+
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+
+    virtual_config.link_fd = link_fd;
+    (void)memcpy(virtual_config.bd_addr, central ? central_addr : peripheral_addr, 6);
+#ifdef ENABLE_HCI_ACL_TX_SCHEDULER
+    if (acl_tx_scheduler_test){
+        scheduler_transport = *hci_transport_virtual_instance();
+        scheduler_virtual_send_packet = scheduler_transport.send_packet;
+        scheduler_transport.send_packet = &scheduler_send_packet;
+        hci_init(&scheduler_transport, &virtual_config);
+    } else {
+        hci_init(hci_transport_virtual_instance(), &virtual_config);
+    }
+#else
+    hci_init(hci_transport_virtual_instance(), &virtual_config);
+#endif
+
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+    if (num_init_script_commands > 0){
+        btstack_chipset_cc256x_set_bts_files(bts_file_path, NULL);
+        hci_set_chipset(btstack_chipset_cc256x_instance());
+    }
+#endif
+
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    // fresh TLV per run, controller capabilities are stored during first init
+    snprintf(tlv_db_path, sizeof(tlv_db_path), "/tmp/virtual_controller_test_%u.tlv", (unsigned int) getpid());
+    (void)unlink(tlv_db_path);
+    const btstack_tlv_t * tlv_impl = btstack_tlv_posix_init_instance(&tlv_context, tlv_db_path);
+    hci_set_controller_cache(tlv_impl, &tlv_context);
+    atexit(&remove_tlv_db);
+#endif
+
+    hci_event_callback_registration.callback = &hci_event_handler;
+    hci_add_event_handler(&hci_event_callback_registration);
+
+    l2cap_init();
+    le_device_db_init();
+    sm_init();
+    sm_set_er(sm_er);
+    sm_set_ir(sm_ir);
+    sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+    sm_set_authentication_requirements(0);
+    sm_event_callback_registration.callback = &hci_event_handler;
+    sm_add_event_handler(&sm_event_callback_registration);
+
+    if (!central){
+        if (classic_mode || acl_tx_scheduler_test || dual_connections){
+            l2cap_register_service(&l2cap_packet_handler, TEST_PSM, TEST_MTU, LEVEL_0);
+        }
+        if (!classic_mode){
+            l2cap_le_register_service(&l2cap_packet_handler, TEST_PSM, LEVEL_2);
+        }
+    }
+
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+    extended_advertising_data_init();
+    if (!central && (private_address_update_ms > 0)){
+        gap_random_address_set_mode(GAP_RANDOM_ADDRESS_NON_RESOLVABLE);
+        gap_random_address_set_update_period(private_address_update_ms);
+        btstack_run_loop_set_timer_handler(&private_address_timer, &peripheral_private_address_timer_handler);
+        btstack_run_loop_set_timer(&private_address_timer, SCAN_DURATION_MS / 2);
+        btstack_run_loop_add_timer(&private_address_timer);
+    }
+#endif
+
+    btstack_run_loop_set_timer_handler(&timeout_timer, &timeout_handler);
+    btstack_run_loop_set_timer(&timeout_timer, TEST_TIMEOUT_MS);
+    btstack_run_loop_add_timer(&timeout_timer);
+
+    power_on_us = get_time_us();
+    hci_power_control(HCI_POWER_ON);
+    btstack_run_loop_execute();
+}
+
+int main(int argc, char * argv[]){
+    int opt;
+    while ((opt = getopt(argc, argv, "cn:s:p:l:b:e:k:a:d:q:r:owi:y:v:x:g:uf:tm")) != -1){
+        switch (opt){
+            case 'c':
+                classic_mode = 1;
+                break;
+            case 'n':
+                num_packets = atoi(optarg);
+                break;
+            case 's':
+                payload_size = btstack_max(5, btstack_min(atoi(optarg), TEST_MTU));
+                break;
+            case 'p':
+                num_pings = btstack_max(1, btstack_min(atoi(optarg), MAX_PINGS));
+                break;
+            case 'l':
+                virtual_config.latency_us = atoi(optarg);
+                break;
+            case 'b':
+                virtual_config.bit_rate = atoi(optarg);
+                break;
+            case 'e':
+                virtual_config.loss_per_mille = atoi(optarg);
+                break;
+            case 'k':
+                virtual_config.acl_buffer_count = atoi(optarg);
+                break;
+            case 'a':
+                virtual_config.acl_buffer_size = atoi(optarg);
+                break;
+            case 'd':
+                virtual_config.hci_latency_us = atoi(optarg);
+                break;
+            case 'q':
+                virtual_config.num_command_packets = atoi(optarg);
+                break;
+            case 'r':
+                num_connections = atoi(optarg);
+                break;
+            case 'o':
+                dual_connections = 1;
+                break;
+            case 'w':
+                warm_start = 1;
+                break;
+            case 'i':
+                num_init_script_commands = atoi(optarg);
+                break;
+            case 'y':
+                scan_before_connect = 1;
+                dedup_ttl_ms = atoi(optarg);
+                break;
+            case 'v':
+                num_advertising_data_values = btstack_min(atoi(optarg), 255);
+                break;
+            case 'x':
+                if (atoi(optarg) > MAX_EXTENDED_ADVERTISING_DATA_LEN){
+                    printf("Extended advertising data length larger than %u\n", MAX_EXTENDED_ADVERTISING_DATA_LEN);
+                    return 1;
+                }
+                extended_advertising_data_len = atoi(optarg);
+                break;
+            case 'f':
+                virtual_config.extended_advertising_report_mode = atoi(optarg);
+                break;
+            case 'g':
+                private_address_update_ms = atoi(optarg);
+                break;
+            case 'u':
+                coded_phy = 1;
+                break;
+            case 't':
+                default_advertising_params = 1;
+                break;
+            case 'm':
+                acl_tx_scheduler_test = 1;
+                break;
+            default:
+                printf("Usage: %s [-c Classic] [-n packets] [-s payload size] [-p pings] [-l latency us] [-b bit rate] [-e loss per mille] [-k ACL buffers] [-a ACL buffer size] [-d HCI latency us] [-q command packets] [-r connections] [-o Classic and LE connection at the same time] [-w power cycle] [-i init script commands] [-y scan with dedup ttl ms] [-v advertising data values] [-x extended advertising data length] [-g private address update ms] [-u LE Coded PHY] [-f extended advertising report mode] [-t default advertising parameters] [-m ACL TX scheduler with two connections]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    printf("%s mode: %u packets of %u bytes, latency %u us, %u bit/s, loss %u/1000, %u ACL buffers, HCI latency %u us\n",
+           classic_mode ? "Classic" : "LE", num_packets, payload_size, virtual_config.latency_us, virtual_config.bit_rate,
+           virtual_config.loss_per_mille, virtual_config.acl_buffer_count, virtual_config.hci_latency_us);
+    fflush(stdout);
+
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+    if (num_init_script_commands > 0){
+        snprintf(bts_file_path, sizeof(bts_file_path), "/tmp/virtual_controller_test_%u.bts", (unsigned int) getpid());
+        if (bts_file_create() < 0){
+            printf("Could not create %s\n", bts_file_path);
+            return 1;
+        }
+    }
+#endif
+
+    int link[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, link) < 0){
+        printf("Could not create socket pair\n");
+        return 1;
+    }
+
+    pid_t endpoints[2];
+    endpoints[0] = fork();
+    if (endpoints[0] == 0){
+        close(link[1]);
+        endpoint_run("Central", 1, link[0]);
+    }
+    endpoints[1] = fork();
+    if (endpoints[1] == 0){
+        close(link[0]);
+        endpoint_run("Peripheral", 0, link[1]);
+    }
+    close(link[0]);
+    close(link[1]);
+#ifdef ENABLE_CC256X_INIT_SCRIPT_FILE
+    // only in parent, endpoints inherit exit handlers
+    if (num_init_script_commands > 0){
+        atexit(&remove_bts_file);
+    }
+#endif
+
+    int result = 0;
+    int num_running = 2;
+    while (num_running > 0){
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) break;
+        num_running--;
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)){
+            result = 1;
+            // stop other endpoint
+            kill((pid == endpoints[0]) ? endpoints[1] : endpoints[0], SIGTERM);
+        }
+    }
+    printf("Virtual controller, %s mode: %s\n", classic_mode ? "Classic" : "LE", result ? "FAILED" : "OK");
+    return result;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "run_loop_main_thread_benchmark.c"
+
+/*
+ * run_loop_main_thread_benchmark.c
+ *
+ * Measures throughput (several threads posting as fast as possible) and latency (single thread,
+ * waits for each callback before posting the next one) of callbacks posted to the run loop:
+ * - btstack_run_loop_execute_on_main_thread with the POSIX and the epoll run loop
+ * - baseline: messages written into a pipe and read by a data source
+ * Each configuration runs in a forked child, as a run loop can only be initialized once per process.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_epoll.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+
+#define NUM_PRODUCERS             4
+#define NUM_MESSAGES_PER_PRODUCER 250000
+#define NUM_MESSAGES              (NUM_PRODUCERS * NUM_MESSAGES_PER_PRODUCER)
+#define NUM_LATENCY_MESSAGES      10000
+#define PIPE_READ_BATCH           64
+
+typedef struct {
+    btstack_context_callback_registration_t registration;
+    uint64_t post_time_ns;
+} message_t;
+
+static message_t * messages;
+static void message_received(message_t * message);
+
+static void message_callback(void * context){
+    message_received((message_t *) context);
+}
+
+static int use_pipe;
+static int pipe_fds[2];
+static btstack_data_source_t pipe_data_source;
+static btstack_timer_source_t start_timer;
+static const char * benchmark_name;
+
+static uint32_t num_received;
+static uint64_t start_time_ns;
+static int latency_phase;
+static volatile int latency_message_done;
+static uint64_t total_latency_ns;
+static uint64_t max_latency_ns;
+
+static uint64_t get_time_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void post_message(message_t * message){
+    message->registration.callback = &message_callback;
+    message->registration.context  = message;
+    message->post_time_ns = get_time_ns();
+    if (use_pipe){
+        if (write(pipe_fds[1], &message, sizeof(message)) != sizeof(message)){
+            printf("write failed\n");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        btstack_run_loop_execute_on_main_thread(&message->registration);
+    }
+}
+
+static void * latency_thread(void * arg){
+    UNUSED(arg);
+    int i;
+    for (i = 0; i < NUM_LATENCY_MESSAGES; i++){
+        latency_message_done = 0;
+        post_message(&messages[i]);
+        while (__atomic_load_n(&latency_message_done, __ATOMIC_ACQUIRE) == 0){
+        }
+    }
+    return NULL;
+}
+
+static void message_received(message_t * message){
+    uint64_t now_ns = get_time_ns();
+    num_received++;
+
+    if (latency_phase){
+        uint64_t latency_ns = now_ns - message->post_time_ns;
+        total_latency_ns += latency_ns;
+        if (latency_ns > max_latency_ns) max_latency_ns = latency_ns;
+        __atomic_store_n(&latency_message_done, 1, __ATOMIC_RELEASE);
+        if (num_received < NUM_LATENCY_MESSAGES) return;
+        printf("%-14s latency:    avg %6u ns, max %8u ns\n", benchmark_name,
+               (unsigned int) (total_latency_ns / NUM_LATENCY_MESSAGES), (unsigned int) max_latency_ns);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (num_received < NUM_MESSAGES) return;
+    uint64_t duration_ns = now_ns - start_time_ns;
+    printf("%-14s throughput: %6u k msg/s (%u threads)\n", benchmark_name,
+           (unsigned int) ((((uint64_t) NUM_MESSAGES) * 1000000ULL) / duration_ns), NUM_PRODUCERS);
+
+    // start latency measurement
+    latency_phase = 1;
+    num_received = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, &latency_thread, NULL);
+    pthread_detach(thread);
+}
+
+
+static void pipe_data_source_handler(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    UNUSED(callback_type);
+    message_t * batch[PIPE_READ_BATCH];
+    ssize_t bytes_read = read(ds->source.fd, batch, sizeof(batch));
+    if (bytes_read <= 0) return;
+    int i;
+    for (i = 0; i < (int) (bytes_read / sizeof(message_t *)); i++){
+        message_received(batch[i]);
+    }
+}
+
+static void * producer_thread(void * arg){
+    message_t * producer_messages = &messages[((intptr_t) arg) * NUM_MESSAGES_PER_PRODUCER];
+    int i;
+    for (i = 0; i < NUM_MESSAGES_PER_PRODUCER; i++){
+        post_message(&producer_messages[i]);
+    }
+    return NULL;
+}
+
+static void start_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    start_time_ns = get_time_ns();
+    intptr_t i;
+    for (i = 0; i < NUM_PRODUCERS; i++){
+        pthread_t thread;
+        pthread_create(&thread, NULL, &producer_thread, (void *) i);
+        pthread_detach(thread);
+    }
+}
+
+static void run_benchmark(const char * name, const btstack_run_loop_t * run_loop, int pipe_mode){
+    benchmark_name = name;
+    use_pipe = pipe_mode;
+    messages = calloc(NUM_MESSAGES, sizeof(message_t));
+    btstack_run_loop_init(run_loop);
+    if (use_pipe){
+        if (pipe(pipe_fds) != 0){
+            printf("pipe failed\n");
+            exit(EXIT_FAILURE);
+        }
+        fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+        btstack_run_loop_set_data_source_fd(&pipe_data_source, pipe_fds[0]);
+        btstack_run_loop_set_data_source_handler(&pipe_data_source, &pipe_data_source_handler);
+        btstack_run_loop_enable_data_source_callbacks(&pipe_data_source, DATA_SOURCE_CALLBACK_READ);
+        btstack_run_loop_add_data_source(&pipe_data_source);
+    }
+    btstack_run_loop_set_timer_handler(&start_timer, &start_timer_handler);
+    btstack_run_loop_set_timer(&start_timer, 0);
+    btstack_run_loop_add_timer(&start_timer);
+    btstack_run_loop_execute();
+}
+
+int main(int argc, const char * argv[]){
+    (void)argc;
+    (void)argv;
+    int benchmark;
+    for (benchmark = 0; benchmark < 3; benchmark++){
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0){
+            switch (benchmark){
+                case 0:
+                    run_benchmark("pipe + select", btstack_run_loop_posix_get_instance(), 1);
+                    break;
+                case 1:
+                    run_benchmark("queue + select", btstack_run_loop_posix_get_instance(), 0);
+                    break;
+                default:
+                    run_benchmark("queue + epoll", btstack_run_loop_epoll_get_instance(), 0);
+                    break;
+            }
+        }
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "run_loop_profiler_test.c"
+
+/*
+ * run_loop_profiler_test.c
+ *
+ * Checks the run loop profiler built with ENABLE_RUN_LOOP_PROFILER: first, percentiles for a known set of samples,
+ * then the histograms collected by the select based POSIX run loop and the epoll run loop for a timer and a data
+ * source handler that take a known time.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_epoll.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_run_loop_profiler.h"
+#include "btstack_util.h"
+
+#define NUM_CALLS          50
+#define TIMER_INTERVAL_MS  2
+#define TIMER_BUSY_US      500
+#define DATA_SOURCE_BUSY_US 200
+
+static btstack_data_source_t data_source;
+static btstack_timer_source_t timer;
+static btstack_timer_source_t done_timer;
+static int num_timer_calls;
+static int num_data_source_calls;
+static const char * run_loop_name;
+static int num_errors;
+
+static uint64_t get_time_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+static void busy_wait_us(uint32_t duration_us){
+    uint64_t end_us = get_time_us() + duration_us;
+    while (get_time_us() < end_us){
+    }
+}
+
+static void check(int condition, const char * what){
+    if (condition) return;
+    printf("%s: %s failed\n", run_loop_name, what);
+    num_errors++;
+}
+
+// histogram percentiles are bucket upper bounds, at most 12.5% above the exact value
+static void check_percentile(const btstack_run_loop_profiler_histogram_t * histogram, uint8_t percentile, uint32_t expected_us){
+    uint32_t value = btstack_run_loop_profiler_get_percentile(histogram, percentile);
+    if ((value >= expected_us) && (value <= (expected_us + (expected_us / 8) + 1))) return;
+    printf("%s: p%u %u us, expected %u us\n", run_loop_name, percentile, value, expected_us);
+    num_errors++;
+}
+
+static const btstack_run_loop_profiler_histogram_t * find_histogram(btstack_run_loop_profiler_type_t type, btstack_run_loop_profiler_callback_t callback){
+    uint16_t i;
+    for (i = 0; i < btstack_run_loop_profiler_get_num_histograms(); i++){
+        const btstack_run_loop_profiler_histogram_t * histogram = btstack_run_loop_profiler_get_histogram(i);
+        if ((histogram->type == type) && (histogram->callback == callback)) return histogram;
+    }
+    return NULL;
+}
+
+static void test_percentiles(void){
+    run_loop_name = "samples";
+    btstack_run_loop_profiler_reset();
+    uint32_t value;
+    for (value = 1; value <= 1000; value++){
+        btstack_run_loop_profiler_record(BTSTACK_RUN_LOOP_PROFILER_TIMER, NULL, value);
+    }
+    const btstack_run_loop_profiler_histogram_t * histogram = find_histogram(BTSTACK_RUN_LOOP_PROFILER_TIMER, NULL);
+    check(histogram != NULL, "histogram");
+    if (histogram == NULL) return;
+    check(histogram->count == 1000, "count");
+    check(histogram->max_us == 1000, "max");
+    check(histogram->total_us == 500500, "total");
+    check_percentile(histogram, 1, 10);
+    check_percentile(histogram, 50, 500);
+    check_percentile(histogram, 90, 900);
+    check_percentile(histogram, 99, 990);
+    check(btstack_run_loop_profiler_get_percentile(histogram, 100) == 1000, "p100");
+    // samples below the number of sub-buckets are exact
+    btstack_run_loop_profiler_reset();
+    btstack_run_loop_profiler_record(BTSTACK_RUN_LOOP_PROFILER_WAIT, NULL, 3);
+    histogram = find_histogram(BTSTACK_RUN_LOOP_PROFILER_WAIT, NULL);
+    check((histogram != NULL) && (btstack_run_loop_profiler_get_percentile(histogram, 50) == 3), "exact small value");
+    printf("%-8s percentiles %s\n", run_loop_name, num_errors ? "FAILED" : "OK");
+}
+
+static void check_callback_histogram(btstack_run_loop_profiler_type_t type, btstack_run_loop_profiler_callback_t callback,
+                                     uint32_t min_us, const char * name){
+    const btstack_run_loop_profiler_histogram_t * histogram = find_histogram(type, callback);
+    if (histogram == NULL){
+        printf("%s: no %s histogram\n", run_loop_name, name);
+        num_errors++;
+        return;
+    }
+    uint32_t p50 = btstack_run_loop_profiler_get_percentile(histogram, 50);
+    uint32_t p99 = btstack_run_loop_profiler_get_percentile(histogram, 99);
+    printf("%-8s %-11s count %u, p50 %5u us, p99 %5u us, max %5u us\n", run_loop_name, name, histogram->count, p50, p99, histogram->max_us);
+    check(histogram->count == NUM_CALLS, name);
+    check((p50 >= min_us) && (p50 <= p99) && (p99 <= histogram->max_us), name);
+}
+
+// called from timer, after the profiler recorded the last data source call
+static void done_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    btstack_run_loop_remove_data_source(&data_source);
+    check_callback_histogram(BTSTACK_RUN_LOOP_PROFILER_TIMER, (btstack_run_loop_profiler_callback_t) timer.process, TIMER_BUSY_US, "timer");
+    check_callback_histogram(BTSTACK_RUN_LOOP_PROFILER_TIMER_DELAY, (btstack_run_loop_profiler_callback_t) timer.process, 0, "timer delay");
+    check_callback_histogram(BTSTACK_RUN_LOOP_PROFILER_DATA_SOURCE, (btstack_run_loop_profiler_callback_t) data_source.process, DATA_SOURCE_BUSY_US, "data source");
+    // run loop waits between timer calls
+    const btstack_run_loop_profiler_histogram_t * histogram = find_histogram(BTSTACK_RUN_LOOP_PROFILER_WAIT, NULL);
+    check((histogram != NULL) && (histogram->count >= NUM_CALLS), "wait");
+    exit(num_errors ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static void data_source_handler(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    UNUSED(callback_type);
+    uint64_t value;
+    if (read(ds->source.fd, &value, sizeof(value)) != sizeof(value)){
+        printf("read failed\n");
+        exit(EXIT_FAILURE);
+    }
+    busy_wait_us(DATA_SOURCE_BUSY_US);
+    num_data_source_calls++;
+    if (num_data_source_calls == NUM_CALLS){
+        btstack_run_loop_set_timer_handler(&done_timer, &done_timer_handler);
+        btstack_run_loop_set_timer(&done_timer, 0);
+        btstack_run_loop_add_timer(&done_timer);
+    }
+}
+
+static void timer_handler(btstack_timer_source_t * ts){
+    busy_wait_us(TIMER_BUSY_US);
+    uint64_t value = 1;
+    if (write(data_source.source.fd, &value, sizeof(value)) != sizeof(value)){
+        printf("write failed\n");
+        exit(EXIT_FAILURE);
+    }
+    num_timer_calls++;
+    if (num_timer_calls == NUM_CALLS) return;
+    btstack_run_loop_set_timer(ts, TIMER_INTERVAL_MS);
+    btstack_run_loop_add_timer(ts);
+}
+
+static void test_run_loop(const char * name, const btstack_run_loop_t * run_loop){
+    run_loop_name = name;
+    btstack_run_loop_init(run_loop);
+    int fd = eventfd(0, EFD_NONBLOCK);
+    if (fd < 0){
+        printf("eventfd failed\n");
+        exit(EXIT_FAILURE);
+    }
+    btstack_run_loop_set_data_source_fd(&data_source, fd);
+    btstack_run_loop_set_data_source_handler(&data_source, &data_source_handler);
+    btstack_run_loop_enable_data_source_callbacks(&data_source, DATA_SOURCE_CALLBACK_READ);
+    btstack_run_loop_add_data_source(&data_source);
+    btstack_run_loop_set_timer_handler(&timer, &timer_handler);
+    btstack_run_loop_set_timer(&timer, TIMER_INTERVAL_MS);
+    btstack_run_loop_add_timer(&timer);
+    btstack_run_loop_execute();
+}
+
+int main(int argc, const char * argv[]){
+    (void)argc;
+    (void)argv;
+    test_percentiles();
+    int result = num_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+    int run_loop_type;
+    for (run_loop_type = 0; run_loop_type < 2; run_loop_type++){
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0){
+            if (run_loop_type == 0){
+                test_run_loop("select", btstack_run_loop_posix_get_instance());
+            } else {
+                test_run_loop("epoll", btstack_run_loop_epoll_get_instance());
+            }
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)){
+            result = EXIT_FAILURE;
+        }
+    }
+    printf("Run loop profiler: %s\n", (result == EXIT_SUCCESS) ? "OK" : "FAILED");
+    return result;
+}
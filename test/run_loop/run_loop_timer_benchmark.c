@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "run_loop_timer_benchmark.c"
+
+/*
+ * run_loop_timer_benchmark.c
+ *
+ * Stress test for the timer management in btstack_run_loop_base: re-arms 10k timers with random timeouts
+ * and processes them while time advances. Build with and without ENABLE_RUN_LOOP_TIMER_HEAP to compare
+ * the sorted list with the binary heap. Also checks that a copy of an added timer and an uninitialized
+ * timer are not considered to be added already.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_run_loop_base.h"
+#include "btstack_util.h"
+
+#define NUM_TIMERS      10000
+#define NUM_REARMS      100000
+#define MAX_TIMEOUT_MS  60000
+
+static btstack_timer_source_t timers[NUM_TIMERS];
+static btstack_timer_source_t timer_copy;
+static btstack_timer_source_t timer_garbage;
+static uint32_t last_fired_timeout;
+static uint32_t num_fired;
+static uint32_t num_errors;
+
+static uint64_t get_time_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void timer_handler(btstack_timer_source_t * ts){
+    // timers have to fire in order
+    if (btstack_time_delta(ts->timeout, last_fired_timeout) < 0){
+        num_errors++;
+    }
+    last_fired_timeout = ts->timeout;
+    num_fired++;
+}
+
+int main(int argc, const char * argv[]){
+    (void)argc;
+    (void)argv;
+
+#ifdef ENABLE_RUN_LOOP_TIMER_HEAP
+    const char * backend = "heap";
+#else
+    const char * backend = "list";
+#endif
+
+    btstack_run_loop_base_init();
+    srand(0);
+
+    // start close to wrap-around of the 32-bit ms counter
+    uint32_t now = 0xffffffffu - (MAX_TIMEOUT_MS / 2);
+
+    int i;
+    uint64_t start_ns = get_time_ns();
+    for (i = 0; i < NUM_TIMERS; i++){
+        timers[i].process = &timer_handler;
+        timers[i].timeout = now + (rand() % MAX_TIMEOUT_MS);
+        btstack_run_loop_base_add_timer(&timers[i]);
+    }
+    uint64_t add_ns = get_time_ns() - start_ns;
+
+    start_ns = get_time_ns();
+    for (i = 0; i < NUM_REARMS; i++){
+        btstack_timer_source_t * ts = &timers[rand() % NUM_TIMERS];
+        btstack_run_loop_base_remove_timer(ts);
+        ts->timeout = now + (rand() % MAX_TIMEOUT_MS);
+        btstack_run_loop_base_add_timer(ts);
+    }
+    uint64_t rearm_ns = get_time_ns() - start_ns;
+
+    // copy of added timer is a different timer
+    memcpy(&timer_copy, &timers[0], sizeof(timer_copy));
+    btstack_run_loop_base_add_timer(&timer_copy);
+    // uninitialized timer is not added
+    memset(&timer_garbage, 0x55, sizeof(timer_garbage));
+    if (btstack_run_loop_base_remove_timer(&timer_garbage)){
+        num_errors++;
+    }
+
+    start_ns = get_time_ns();
+    last_fired_timeout = now;
+    while (btstack_run_loop_base_get_time_until_timeout(now) >= 0){
+        now += 10;
+        btstack_run_loop_base_process_timers(now);
+    }
+    uint64_t process_ns = get_time_ns() - start_ns;
+
+    printf("%s: %u timers, add %u ns/op, re-arm %u ns/op, process %u ns/timer\n", backend, NUM_TIMERS,
+        (unsigned int) (add_ns / NUM_TIMERS), (unsigned int) (rearm_ns / NUM_REARMS), (unsigned int) (process_ns / NUM_TIMERS));
+
+    if ((num_fired != (NUM_TIMERS + 1)) || (num_errors != 0)){
+        printf("%s: error, %u timers fired, %u errors\n", backend, num_fired, num_errors);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
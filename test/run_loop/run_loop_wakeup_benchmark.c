@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "run_loop_wakeup_benchmark.c"
+
+/*
+ * run_loop_wakeup_benchmark.c
+ *
+ * Measures the time from signaling an eventfd until its data source handler gets called
+ * for the select based POSIX run loop and the epoll run loop with 10, 100 and 1000 data sources.
+ * Each configuration runs in a forked child, as a run loop can only be initialized once per process.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_epoll.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+
+#define MAX_DATA_SOURCES 1000
+#define NUM_WAKEUPS      20000
+
+static btstack_data_source_t data_sources[MAX_DATA_SOURCES];
+static int num_data_sources;
+static int num_wakeups;
+static uint64_t signal_time_ns;
+static uint64_t total_latency_ns;
+static uint64_t max_latency_ns;
+static uint64_t min_latency_ns;
+static const char * run_loop_name;
+static btstack_timer_source_t start_timer;
+
+static uint64_t get_time_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void signal_random_data_source(void){
+    uint64_t value = 1;
+    int index = rand() % num_data_sources;
+    signal_time_ns = get_time_ns();
+    if (write(data_sources[index].source.fd, &value, sizeof(value)) != sizeof(value)){
+        printf("write failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void data_source_handler(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    UNUSED(callback_type);
+    uint64_t latency_ns = get_time_ns() - signal_time_ns;
+    uint64_t value;
+    if (read(ds->source.fd, &value, sizeof(value)) != sizeof(value)){
+        printf("read failed\n");
+        exit(EXIT_FAILURE);
+    }
+    total_latency_ns += latency_ns;
+    if (latency_ns > max_latency_ns) max_latency_ns = latency_ns;
+    if (latency_ns < min_latency_ns) min_latency_ns = latency_ns;
+    num_wakeups++;
+    if (num_wakeups < NUM_WAKEUPS){
+        signal_random_data_source();
+        return;
+    }
+    printf("%-8s %5u sources: avg %6u ns, min %6u ns, max %8u ns\n", run_loop_name, num_data_sources,
+           (unsigned int) (total_latency_ns / num_wakeups), (unsigned int) min_latency_ns, (unsigned int) max_latency_ns);
+    exit(EXIT_SUCCESS);
+}
+
+static void start_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    signal_random_data_source();
+}
+
+static void run_benchmark(const char * name, const btstack_run_loop_t * run_loop, int count){
+    run_loop_name = name;
+    num_data_sources = count;
+    min_latency_ns = UINT64_MAX;
+    btstack_run_loop_init(run_loop);
+    int i;
+    for (i = 0; i < count; i++){
+        int fd = eventfd(0, EFD_NONBLOCK);
+        if (fd < 0){
+            printf("eventfd failed, check open file limit\n");
+            exit(EXIT_FAILURE);
+        }
+        btstack_run_loop_set_data_source_fd(&data_sources[i], fd);
+        btstack_run_loop_set_data_source_handler(&data_sources[i], &data_source_handler);
+        btstack_run_loop_enable_data_source_callbacks(&data_sources[i], DATA_SOURCE_CALLBACK_READ);
+        btstack_run_loop_add_data_source(&data_sources[i]);
+    }
+    btstack_run_loop_set_timer_handler(&start_timer, &start_timer_handler);
+    btstack_run_loop_set_timer(&start_timer, 0);
+    btstack_run_loop_add_timer(&start_timer);
+    btstack_run_loop_execute();
+}
+
+int main(int argc, const char * argv[]){
+    (void)argc;
+    (void)argv;
+    static const int data_source_counts[] = { 10, 100, 1000 };
+    unsigned int i;
+    for (i = 0; i < sizeof(data_source_counts) / sizeof(int); i++){
+        int run_loop_type;
+        for (run_loop_type = 0; run_loop_type < 2; run_loop_type++){
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0){
+                if (run_loop_type == 0){
+                    run_benchmark("select", btstack_run_loop_posix_get_instance(), data_source_counts[i]);
+                } else {
+                    run_benchmark("epoll", btstack_run_loop_epoll_get_instance(), data_source_counts[i]);
+                }
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ * btstack_slip_test.c
+ *
+ * Decodes a stream of random SLIP frames byte by byte and with btstack_slip_decoder_process_block
+ * in random chunks, verifies that both yield the original frames and reports decoder throughput.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_slip.h"
+
+#define NUM_FRAMES       5000
+#define MAX_FRAME_SIZE   1100
+#define DECODER_SIZE     1024
+#define NUM_ITERATIONS   20
+
+static uint8_t *  frames;
+static uint16_t   frame_sizes[NUM_FRAMES];
+static uint8_t *  slip_stream;
+static uint32_t   slip_stream_len;
+
+static uint8_t    decoder_buffer[DECODER_SIZE];
+static uint32_t   num_valid_frames;
+static uint32_t   next_frame;
+static uint32_t   num_frames_decoded;
+static uint32_t   num_errors;
+
+static uint64_t get_time_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void create_stream(void){
+    frames = malloc(NUM_FRAMES * MAX_FRAME_SIZE);
+    slip_stream = malloc(NUM_FRAMES * (MAX_FRAME_SIZE * 2 + 2));
+    int i;
+    for (i = 0; i < NUM_FRAMES; i++){
+        // mostly valid frames, a few too large for decoder
+        uint16_t size = 1 + (rand() % (i % 100 ? DECODER_SIZE : MAX_FRAME_SIZE));
+        uint8_t * frame = &frames[i * MAX_FRAME_SIZE];
+        int j;
+        for (j = 0; j < size; j++){
+            // roughly 1% SOF/escape bytes
+            switch (rand() % 200){
+                case 0:
+                    frame[j] = BTSTACK_SLIP_SOF;
+                    break;
+                case 1:
+                    frame[j] = 0xdb;
+                    break;
+                default:
+                    frame[j] = (uint8_t) rand();
+                    break;
+            }
+        }
+        frame_sizes[i] = size;
+        if (size <= DECODER_SIZE){
+            num_valid_frames++;
+        }
+        slip_stream[slip_stream_len++] = BTSTACK_SLIP_SOF;
+        btstack_slip_encoder_start(frame, size);
+        while (btstack_slip_encoder_has_data()){
+            slip_stream[slip_stream_len++] = btstack_slip_encoder_get_byte();
+        }
+        slip_stream[slip_stream_len++] = BTSTACK_SLIP_SOF;
+    }
+}
+
+static void handle_frame(uint16_t frame_size){
+    // skip frames that did not fit into decoder buffer
+    while ((next_frame < NUM_FRAMES) && (frame_sizes[next_frame] > DECODER_SIZE)){
+        next_frame++;
+    }
+    if ((next_frame >= NUM_FRAMES) || (frame_size != frame_sizes[next_frame])
+        || (memcmp(decoder_buffer, &frames[next_frame * MAX_FRAME_SIZE], frame_size) != 0)){
+        if (num_errors == 0){
+            printf("Frame %u mismatch: size %u\n", next_frame, frame_size);
+        }
+        num_errors++;
+    }
+    next_frame++;
+    num_frames_decoded++;
+    btstack_slip_decoder_init(decoder_buffer, sizeof(decoder_buffer));
+}
+
+static void decode_bytes(void){
+    uint32_t pos;
+    for (pos = 0; pos < slip_stream_len; pos++){
+        btstack_slip_decoder_process(slip_stream[pos]);
+        uint16_t frame_size = btstack_slip_decoder_frame_size();
+        if (frame_size){
+            handle_frame(frame_size);
+        }
+    }
+}
+
+static void decode_blocks(uint16_t max_chunk_size){
+    uint32_t pos = 0;
+    while (pos < slip_stream_len){
+        uint32_t chunk_size = 1 + (rand() % max_chunk_size);
+        if (chunk_size > (slip_stream_len - pos)){
+            chunk_size = slip_stream_len - pos;
+        }
+        const uint8_t * data = &slip_stream[pos];
+        uint16_t size = (uint16_t) chunk_size;
+        pos += chunk_size;
+        while (size > 0){
+            uint16_t bytes_processed = btstack_slip_decoder_process_block(data, size);
+            data += bytes_processed;
+            size -= bytes_processed;
+            uint16_t frame_size = btstack_slip_decoder_frame_size();
+            if (frame_size){
+                handle_frame(frame_size);
+            }
+        }
+    }
+}
+
+static int run(const char * name, uint16_t max_chunk_size){
+    uint64_t duration_ns = 0;
+    num_errors = 0;
+    int i;
+    for (i = 0; i < NUM_ITERATIONS; i++){
+        next_frame = 0;
+        num_frames_decoded = 0;
+        btstack_slip_decoder_init(decoder_buffer, sizeof(decoder_buffer));
+        uint64_t start_ns = get_time_ns();
+        if (max_chunk_size == 0){
+            decode_bytes();
+        } else {
+            decode_blocks(max_chunk_size);
+        }
+        duration_ns += get_time_ns() - start_ns;
+        if (num_frames_decoded != num_valid_frames){
+            printf("%s: received %u of %u frames\n", name, num_frames_decoded, num_valid_frames);
+            num_errors++;
+        }
+    }
+    printf("%-24s %8.1f MB/s %s\n", name, ((double) slip_stream_len * NUM_ITERATIONS) / (duration_ns / 1e3), num_errors ? "FAILED" : "OK");
+    return num_errors ? 1 : 0;
+}
+
+int main(int argc, const char * argv[]){
+    (void)argc;
+    (void)argv;
+    create_stream();
+    printf("%u frames, %u larger than decoder buffer, %u bytes SLIP encoded\n", NUM_FRAMES, NUM_FRAMES - num_valid_frames, slip_stream_len);
+
+    int errors = 0;
+    errors += run("byte by byte", 0);
+    errors += run("blocks up to 16 bytes", 16);
+    errors += run("blocks up to 1024 bytes", 1024);
+    errors += run("blocks up to 65535 bytes", 65535);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2020 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define BTSTACK_FILE__ "uart_io_uring_loopback_test.c"
+
+/*
+ * uart_io_uring_loopback_test.c
+ *
+ * Opens the slave side of a pseudo terminal with the io_uring UART driver, while the master side echoes all data.
+ * Checks blocks that wrap around the receive buffer, rejection of a block larger than the receive buffer,
+ * and streaming mode with multiple send blocks.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_uart_block.h"
+#include "btstack_util.h"
+
+#ifndef BTSTACK_UART_IO_URING_RX_BUFFER_SIZE
+#define BTSTACK_UART_IO_URING_RX_BUFFER_SIZE 4096
+#endif
+
+#define TEST_TIMEOUT_MS       5000
+#define TEST_BLOCK_SIZE       1021
+#define NUM_BLOCKS            20
+#define TEST_SMALL_BLOCK_SIZE 10
+
+static const btstack_uart_block_t * uart_driver;
+static btstack_uart_config_t uart_config;
+static btstack_data_source_t master_data_source;
+static btstack_timer_source_t timeout_timer;
+static btstack_timer_source_t step_timer;
+
+static uint8_t  tx_buffer[3 * TEST_BLOCK_SIZE];
+static uint8_t  rx_buffer[3 * TEST_BLOCK_SIZE];
+static uint8_t  rx_buffer_oversized[BTSTACK_UART_IO_URING_RX_BUFFER_SIZE + 1];
+static uint32_t num_blocks_sent;
+static uint32_t num_blocks_received;
+static uint32_t stream_len;
+static int      echo_enabled = 1;
+
+static void test_failed(const char * reason){
+    printf("io_uring loopback: %s\n", reason);
+    printf("io_uring loopback: FAILED\n");
+    exit(EXIT_FAILURE);
+}
+
+static void fill_pattern(uint8_t * buffer, uint16_t len, uint32_t seed){
+    uint16_t i;
+    for (i = 0; i < len; i++){
+        buffer[i] = (uint8_t) ((seed * 31u) + (i * 7u));
+    }
+}
+
+// master side of pseudo terminal: echo everything the driver sends
+static void master_process(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    UNUSED(callback_type);
+    uint8_t buffer[1024];
+    ssize_t len = read(ds->source.fd, buffer, sizeof(buffer));
+    if (len <= 0) return;
+    if (echo_enabled == 0) return;
+    if (write(ds->source.fd, buffer, len) != len){
+        test_failed("echo write failed");
+    }
+}
+
+static void block_sent(void){
+    num_blocks_sent++;
+}
+
+// step 3: streaming mode, three send blocks
+static void stream_received(const uint8_t * data, uint16_t size){
+    if ((stream_len + size) > sizeof(rx_buffer)){
+        test_failed("stream: too much data");
+    }
+    (void)memcpy(&rx_buffer[stream_len], data, size);
+    stream_len += size;
+    if (stream_len < sizeof(tx_buffer)) return;
+    if (memcmp(rx_buffer, tx_buffer, sizeof(tx_buffer)) != 0){
+        test_failed("stream: data mismatch");
+    }
+    printf("io_uring loopback: %u bytes in streaming mode OK\n", stream_len);
+    printf("io_uring loopback: OK\n");
+    uart_driver->close();
+    exit(EXIT_SUCCESS);
+}
+
+static void stream_start(void){
+    fill_pattern(tx_buffer, sizeof(tx_buffer), 0xff);
+    btstack_uart_block_segment_t blocks[3];
+    int i;
+    for (i = 0; i < 3; i++){
+        blocks[i].data = &tx_buffer[i * TEST_BLOCK_SIZE];
+        blocks[i].len  = TEST_BLOCK_SIZE;
+    }
+    uart_driver->set_data_received(&stream_received);
+    uart_driver->send_blocks(blocks, 3);
+}
+
+// step 2: block larger than receive buffer is rejected, smaller request afterwards gets the data
+static void small_block_received(void){
+    if (memcmp(rx_buffer, tx_buffer, TEST_SMALL_BLOCK_SIZE) != 0){
+        test_failed("small block: data mismatch");
+    }
+    printf("io_uring loopback: oversized block rejected OK\n");
+    echo_enabled = 1;
+    stream_start();
+}
+
+static void oversized_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    uart_driver->set_block_received(&small_block_received);
+    uart_driver->receive_block(rx_buffer, TEST_SMALL_BLOCK_SIZE);
+}
+
+static void oversized_block_received(void){
+    test_failed("oversized block delivered");
+}
+
+static void oversized_start(void){
+    uart_driver->set_block_received(&oversized_block_received);
+    uart_driver->receive_block(rx_buffer_oversized, sizeof(rx_buffer_oversized));
+    // send directly from master side
+    echo_enabled = 0;
+    fill_pattern(tx_buffer, TEST_SMALL_BLOCK_SIZE, 0xfe);
+    if (write(master_data_source.source.fd, tx_buffer, TEST_SMALL_BLOCK_SIZE) != TEST_SMALL_BLOCK_SIZE){
+        test_failed("master write failed");
+    }
+    btstack_run_loop_set_timer_handler(&step_timer, &oversized_timer_handler);
+    btstack_run_loop_set_timer(&step_timer, 50);
+    btstack_run_loop_add_timer(&step_timer);
+}
+
+// step 1: blocks that wrap around the receive buffer
+static void block_next(void){
+    fill_pattern(tx_buffer, TEST_BLOCK_SIZE, num_blocks_received);
+    uart_driver->receive_block(rx_buffer, TEST_BLOCK_SIZE);
+    uart_driver->send_block(tx_buffer, TEST_BLOCK_SIZE);
+}
+
+static void block_received(void){
+    if (memcmp(rx_buffer, tx_buffer, TEST_BLOCK_SIZE) != 0){
+        test_failed("block: data mismatch");
+    }
+    num_blocks_received++;
+    if (num_blocks_received < NUM_BLOCKS){
+        block_next();
+        return;
+    }
+    if (num_blocks_sent != NUM_BLOCKS){
+        test_failed("block: block_sent missing");
+    }
+    printf("io_uring loopback: %u blocks of %u bytes OK\n", num_blocks_received, TEST_BLOCK_SIZE);
+    oversized_start();
+}
+
+static void timeout_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    test_failed("timeout");
+}
+
+static int io_uring_available(void){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, 1, &params);
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+}
+
+int main(int argc, const char * argv[]){
+    (void)argc;
+    (void)argv;
+
+    if (io_uring_available() == 0){
+        printf("io_uring loopback: io_uring not available (%s), skipped\n", strerror(errno));
+        return EXIT_SUCCESS;
+    }
+
+    int master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if ((master_fd < 0) || (grantpt(master_fd) < 0) || (unlockpt(master_fd) < 0)){
+        printf("io_uring loopback: could not create pseudo terminal, skipped\n");
+        return EXIT_SUCCESS;
+    }
+
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+
+    btstack_run_loop_set_data_source_fd(&master_data_source, master_fd);
+    btstack_run_loop_set_data_source_handler(&master_data_source, &master_process);
+    btstack_run_loop_enable_data_source_callbacks(&master_data_source, DATA_SOURCE_CALLBACK_READ);
+    btstack_run_loop_add_data_source(&master_data_source);
+
+    uart_config.baudrate    = 115200;
+    uart_config.flowcontrol = 0;
+    uart_config.device_name = ptsname(master_fd);
+    uart_driver = btstack_uart_block_io_uring_instance();
+    uart_driver->init(&uart_config);
+    if (uart_driver->open() < 0){
+        test_failed("open failed");
+    }
+    uart_driver->set_block_sent(&block_sent);
+    uart_driver->set_block_received(&block_received);
+
+    btstack_run_loop_set_timer_handler(&timeout_timer, &timeout_handler);
+    btstack_run_loop_set_timer(&timeout_timer, TEST_TIMEOUT_MS);
+    btstack_run_loop_add_timer(&timeout_timer);
+
+    block_next();
+    btstack_run_loop_execute();
+    return EXIT_SUCCESS;
+}
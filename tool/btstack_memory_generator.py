@@ -107,6 +107,9 @@ hfile_header_end = """
 """
 
 cfile_header_begin = """
+#define BTSTACK_FILE__ "btstack_memory.c"
+
+
 /*
  *  btstack_memory.h
  *
@@ -195,6 +198,9 @@ list_of_structs = [
     ["hci_connection"],
     ["l2cap_service", "l2cap_channel"],
 ]
+list_of_acl_recombination_structs = [
+    ["hci_acl_recombination_buffer"],
+]
 list_of_classic_structs = [
     ["rfcomm_multiplexer", "rfcomm_service", "rfcomm_channel"],
     ["btstack_link_key_db_memory_entry"],
@@ -225,6 +231,12 @@ for struct_names in list_of_structs:
     for struct_name in struct_names:
         writeln(f, replacePlaceholder(header_template, struct_name))
     writeln(f, "")
+writeln(f, "#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL")
+for struct_names in list_of_acl_recombination_structs:
+    writeln(f, "// "+ ", ".join(struct_names))
+    for struct_name in struct_names:
+        writeln(f, replacePlaceholder(header_template, struct_name))
+writeln(f, "#endif")
 writeln(f, "#ifdef ENABLE_CLASSIC")
 for struct_names in list_of_classic_structs:
     writeln(f, "// "+ ", ".join(struct_names))
@@ -255,6 +267,12 @@ for struct_names in list_of_structs:
     for struct_name in struct_names:
         writeln(f, replacePlaceholder(code_template, struct_name))
     writeln(f, "")
+writeln(f, "#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL")
+for struct_names in list_of_acl_recombination_structs:
+    for struct_name in struct_names:
+        writeln(f, replacePlaceholder(code_template, struct_name))
+    writeln(f, "")
+writeln(f, "#endif")
 writeln(f, "#ifdef ENABLE_CLASSIC")
 for struct_names in list_of_classic_structs:
     for struct_name in struct_names:
@@ -280,6 +298,11 @@ writeln(f, "void btstack_memory_init(void){")
 for struct_names in list_of_structs:
     for struct_name in struct_names:
         writeln(f, replacePlaceholder(init_template, struct_name))
+writeln(f, "#ifdef ENABLE_HCI_ACL_RECOMBINATION_POOL")
+for struct_names in list_of_acl_recombination_structs:
+    for struct_name in struct_names:
+        writeln(f, replacePlaceholder(init_template, struct_name))
+writeln(f, "#endif")
 writeln(f, "#ifdef ENABLE_CLASSIC")
 for struct_names in list_of_classic_structs:
     for struct_name in struct_names:
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+# BlueKitchen GmbH (c) 2020
+
+# decode binary log messages in PacketLogger files written by hci_dump with ENABLE_HCI_DUMP_BINARY_LOG
+#
+# a format definition (type 0xf0) contains a 16-bit format id and the format string. it is logged before the
+# first binary log message (type 0xf1) that uses it, which contains the format id and the raw arguments.
+# integer arguments are stored little endian with 4 bytes (int) or 8 bytes (long, long long, size_t, pointer),
+# doubles with 8 bytes and strings with a length byte followed by the characters.
+#
+# without output file, all log messages are printed. otherwise, a copy of the PacketLogger file is written
+# where binary log messages are replaced by regular text log messages (type 0xfc)
+
+import re
+import struct
+import sys
+
+PKLG_TYPE_LOG_MESSAGE = 0xfc
+PKLG_TYPE_LOG_FORMAT  = 0xf0
+PKLG_TYPE_LOG_BINARY  = 0xf1
+
+conversion_re = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t)?([diuoxXcpsfFeEgG%])')
+
+def read_int(data, pos, length, signed):
+    if pos + length > len(data):
+        raise ValueError('arguments truncated')
+    return int.from_bytes(data[pos:pos+length], 'little', signed=signed), pos + length
+
+def read_arg(data, pos, length_modifier, conversion):
+    if conversion == 's':
+        if pos >= len(data):
+            raise ValueError('arguments truncated')
+        str_len = data[pos]
+        return data[pos+1:pos+1+str_len].decode('utf-8', 'replace'), pos + 1 + str_len
+    if conversion in 'fFeEgG':
+        if pos + 8 > len(data):
+            raise ValueError('arguments truncated')
+        return struct.unpack('<d', data[pos:pos+8])[0], pos + 8
+    signed = conversion in 'di'
+    if conversion == 'p' or length_modifier in ['l', 'll', 'j', 'z', 't']:
+        return read_int(data, pos, 8, signed)
+    value, pos = read_int(data, pos, 4, signed)
+    if length_modifier == 'h':
+        value = value & 0xffff
+        if signed and value >= 0x8000:
+            value -= 0x10000
+    elif length_modifier == 'hh':
+        value = value & 0xff
+        if signed and value >= 0x80:
+            value -= 0x100
+    return value, pos
+
+def format_message(format_string, data):
+    result = ''
+    last = 0
+    pos = 0
+    for match in conversion_re.finditer(format_string):
+        result += format_string[last:match.start()]
+        last = match.end()
+        (flags, width, precision, length_modifier, conversion) = match.groups()
+        if conversion == '%':
+            result += '%'
+            continue
+        if width == '*':
+            value, pos = read_int(data, pos, 4, True)
+            width = str(value)
+        if precision == '*':
+            value, pos = read_int(data, pos, 4, True)
+            precision = str(value)
+        value, pos = read_arg(data, pos, length_modifier, conversion)
+        if conversion == 'p':
+            conversion = 'x'
+            flags = flags + '#'
+        elif conversion == 'u':
+            conversion = 'd'
+        elif conversion == 'c':
+            value = chr(value & 0xff)
+        spec = '%' + (flags or '') + (width or '')
+        if precision is not None:
+            spec += '.' + precision
+        result += (spec + conversion) % value
+    return result + format_string[last:]
+
+def read_packets(data):
+    pos = 0
+    while pos + 13 <= len(data):
+        (length, ts_sec, ts_usec, packet_type) = struct.unpack('>IIIB', data[pos:pos+13])
+        if length < 9 or pos + 4 + length > len(data):
+            print("Error parsing pklg at offset %u (%x)." % (pos, pos))
+            break
+        yield (ts_sec, ts_usec, packet_type, data[pos+13:pos+4+length])
+        pos += 4 + length
+
+def main(argv):
+    if len(argv) not in [2, 3]:
+        print('Decode binary log messages in PacketLogger file')
+        print('Copyright 2020, BlueKitchen GmbH')
+        print('')
+        print('Usage: %s hci_dump.pklg [decoded.pklg]' % argv[0])
+        return 0
+
+    with open(argv[1], 'rb') as f:
+        data = f.read()
+    fout = open(argv[2], 'wb') if len(argv) == 3 else None
+
+    formats = {}
+    num_errors = 0
+    for (ts_sec, ts_usec, packet_type, packet) in read_packets(data):
+        message = None
+        if packet_type == PKLG_TYPE_LOG_FORMAT and len(packet) >= 2:
+            (format_id, ) = struct.unpack('<H', packet[0:2])
+            formats[format_id] = packet[2:].decode('utf-8', 'replace')
+            continue
+        if packet_type == PKLG_TYPE_LOG_BINARY and len(packet) >= 2:
+            (format_id, ) = struct.unpack('<H', packet[0:2])
+            if format_id in formats:
+                try:
+                    message = format_message(formats[format_id], packet[2:])
+                except (ValueError, TypeError, OverflowError) as e:
+                    message = 'Cannot decode log message with format %u: %s' % (format_id, e)
+                    num_errors += 1
+            else:
+                message = 'Unknown log message format %u' % format_id
+                num_errors += 1
+        elif packet_type == PKLG_TYPE_LOG_MESSAGE:
+            message = packet.decode('utf-8', 'replace')
+
+        if fout is None:
+            if message is not None:
+                print('[%u.%06u] LOG %s' % (ts_sec, ts_usec, message))
+            continue
+        if message is not None:
+            packet_type = PKLG_TYPE_LOG_MESSAGE
+            packet = message.encode('utf-8')
+        fout.write(struct.pack('>IIIB', 9 + len(packet), ts_sec, ts_usec, packet_type))
+        fout.write(packet)
+
+    if fout is not None:
+        fout.close()
+    return 1 if num_errors > 0 else 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
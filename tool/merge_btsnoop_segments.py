@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+# BlueKitchen GmbH (c) 2020
+
+# merge btsnoop segment files written by hci_dump with HCI_DUMP_BTSNOOP_SEGMENTS into a single btsnoop file
+#
+# segments are used as a ring, so they are ordered by the timestamp of their first record.
+# if the capture was not closed, e.g. after a crash, the records of a segment end with a zero length marker
+
+import glob
+import struct
+import sys
+
+BTSNOOP_FILE_HEADER = b'btsnoop\0'
+BTSNOOP_FILE_HDR_SIZE = 16
+BTSNOOP_HDR_SIZE = 24
+
+def read_segment(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < BTSNOOP_FILE_HDR_SIZE or data[0:8] != BTSNOOP_FILE_HEADER:
+        print("%s: not a btsnoop file" % path)
+        return None, None, []
+    (version, datalink) = struct.unpack('>II', data[8:16])
+    records = []
+    pos = BTSNOOP_FILE_HDR_SIZE
+    while pos + BTSNOOP_HDR_SIZE <= len(data):
+        (original_len, included_len, flags, drops, ts) = struct.unpack('>IIIIQ', data[pos:pos+BTSNOOP_HDR_SIZE])
+        # end marker
+        if included_len == 0:
+            break
+        end = pos + BTSNOOP_HDR_SIZE + included_len
+        if end > len(data):
+            print("%s: incomplete record at offset %u" % (path, pos))
+            break
+        records.append((ts, data[pos:end]))
+        pos = end
+    return version, datalink, records
+
+def main(argv):
+    if len(argv) != 3:
+        print('Merge btsnoop segments into single btsnoop file')
+        print('Usage: %s path output.btsnoop' % argv[0])
+        print('  path: filename passed to hci_dump_open, segments are path.0 .. path.n')
+        return 1
+
+    segments = []
+    version = 1
+    datalink = 1002
+    for path in glob.glob(argv[1] + '.[0-9]*'):
+        (segment_version, segment_datalink, records) = read_segment(path)
+        if len(records) == 0:
+            continue
+        version = segment_version
+        datalink = segment_datalink
+        segments.append(records)
+
+    # oldest segment first
+    segments.sort(key=lambda records: records[0][0])
+
+    num_records = 0
+    with open(argv[2], 'wb') as f:
+        f.write(BTSNOOP_FILE_HEADER + struct.pack('>II', version, datalink))
+        for records in segments:
+            for (ts, record) in records:
+                f.write(record)
+                num_records += 1
+    print("%u segments with %u records written to %s" % (len(segments), num_records, argv[2]))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))